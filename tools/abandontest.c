@@ -0,0 +1,377 @@
+/* Abandoned-connection test of the w8 deadlines: opens waves of connections that go
+ * silent, a third right after connecting, a third once logged in and a third in the
+ * middle of a request line, against a server started with -t in a scratch
+ * directory. After each wave it reports the server's RSS and open descriptors, then
+ * again once the idle timeout has passed, and how many of the connections the
+ * server closed. A client posting twice a second and a subscriber must stay
+ * connected throughout. RSS and descriptors are those of the server process, so
+ * with fork and prefork they leave out the children. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ACCOUNT_PREFIX "load"
+#define LIVE_POST_MS 500 /* time between the live client's posts */
+#define GRACE_MS 2500    /* time past the idle timeout for the server to close everything */
+
+int per_wave = 3000;
+int waves = 3;
+int timeout_s = 2;
+const char *engine = "epoll";
+struct sockaddr_in server_addr; /* server's address information */
+int next_account = 2;           // load0 posts, load1 subscribes
+int live = -1, subscriber = -1;
+int live_posts = 0, live_answered = 0;
+
+/**
+ * @brief Starts the server and waits until it listens. Its output is discarded
+ * after that, and its errors all along.
+ * @param dir Directory to run it in.
+ * @return Its process id, -1 on error.
+ */
+pid_t start_server(const char *dir, char *const argv[])
+{
+    int fds[2];
+    char line[256];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *output = fdopen(fds[0], "r");
+    while (output != NULL && fgets(line, sizeof(line), output) != NULL)
+    {
+        if (strncmp(line, "Server started", 14) == 0)
+        {
+            fclose(output); // the server ignores SIGPIPE, so its later output is just dropped
+            return pid;
+        }
+    }
+    fprintf(stderr, "%s did not start\n", argv[0]);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * @brief Reads the resident memory and the open descriptors of a process.
+ * @param rss_kb Set to its RSS in KB.
+ * @return Number of open descriptors, -1 on error.
+ */
+int process_usage(pid_t pid, long *rss_kb)
+{
+    char path[64], line[256];
+    struct dirent *entry;
+    int fds = 0;
+
+    *rss_kb = -1;
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+        sscanf(line, "VmRSS: %ld kB", rss_kb);
+    if (f != NULL)
+        fclose(f);
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *d = opendir(path);
+    if (d == NULL)
+        return -1;
+    while ((entry = readdir(d)) != NULL)
+        fds += entry->d_name[0] != '.';
+    closedir(d);
+    return fds;
+}
+
+/**
+ * @brief Reads from a blocking socket until a line starting with a reply code.
+ * @return 0 once it arrived, -1 on error or another reply.
+ */
+int expect(int fd, const char *code)
+{
+    char line[128];
+    size_t len = 0;
+
+    while (len < sizeof(line) - 1)
+    {
+        ssize_t n = recv(fd, line + len, 1, 0);
+        if (n <= 0)
+            return -1;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+    return strncmp(line, code, strlen(code)) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Connects to the server, logging in as the next account if asked.
+ * @return The socket, -1 on error.
+ */
+int open_conn(int log_in)
+{
+    char req[64];
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("connect() error");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (!log_in)
+        return fd;
+    int len = snprintf(req, sizeof(req), "USER " ACCOUNT_PREFIX "%d\r\n", next_account++);
+    if (expect(fd, "100") < 0 || send(fd, req, len, 0) != len || expect(fd, "110") < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Posts from the live client and checks the reply.
+ */
+void live_post()
+{
+    live_posts++;
+    if (live >= 0 && send(live, "POST still here\r\n", 17, 0) == 17 && expect(live, "120") == 0)
+        live_answered++;
+}
+
+/**
+ * @brief Waits, posting from the live client meanwhile.
+ */
+void wait_posting(int ms)
+{
+    for (; ms > 0; ms -= LIVE_POST_MS)
+    {
+        usleep((ms < LIVE_POST_MS ? ms : LIVE_POST_MS) * 1000);
+        live_post();
+    }
+}
+
+/**
+ * @brief Whether the server has closed a connection; data it sent first is read.
+ */
+int closed_by_server(int fd)
+{
+    char buf[4096];
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        ;
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [server]\n"
+            "  -c count     abandoned connections per wave (default 3000)\n"
+            "  -w waves     waves (default 3)\n"
+            "  -t seconds   the server's idle timeout, 0 for none (default 2)\n"
+            "  -e engine    server engine (default epoll)\n"
+            "The server defaults to ./server.\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the abandoned-connection test.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every check passed, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    char server[PATH_MAX], dir[] = "/tmp/abandontest.XXXXXX", path[PATH_MAX], port_arg[16], timeout_arg[16];
+    struct rlimit rl;
+    long rss_kb;
+    int opt, failures = 0;
+
+    while ((opt = getopt(argc, argv, "c:w:t:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            per_wave = atoi(optarg);
+            break;
+        case 'w':
+            waves = atoi(optarg);
+            break;
+        case 't':
+            timeout_s = atoi(optarg);
+            break;
+        case 'e':
+            engine = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 1 || per_wave <= 0 || waves <= 0 || timeout_s < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (realpath(optind < argc ? argv[optind] : "./server", server) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+    // without a timeout every wave stays open, here and in the server, which inherits the limit
+    rlim_t needed = (rlim_t)per_wave * waves + 64;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < needed)
+    {
+        rl.rlim_cur = rl.rlim_max < needed ? rl.rlim_max : needed;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // the server reads TCP_Server/account.txt under its working directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen() error");
+        return 1;
+    }
+    for (int i = 0; i < 2 + (per_wave / 3 + 1) * 2 * waves; i++)
+        fprintf(f, ACCOUNT_PREFIX "%d 1\n", i);
+    fclose(f);
+
+    srandom(time(NULL) ^ getpid());
+    int port = 20000 + random() % 20000;
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    snprintf(timeout_arg, sizeof(timeout_arg), "%d", timeout_s);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *server_argv[] = {server, "-e", (char *)engine, "-t", timeout_arg, port_arg, NULL};
+    pid_t server_pid = start_server(dir, server_argv);
+    int *fds = calloc(per_wave, sizeof(int));
+    if (server_pid < 0 || fds == NULL)
+    {
+        failures++;
+        goto out;
+    }
+
+    next_account = 0;
+    live = open_conn(1);
+    subscriber = open_conn(1);
+    next_account = 2;
+    // only the one-thread engines have SUB; the others answer 300
+    if (subscriber >= 0 && (send(subscriber, "SUB\r\n", 5, 0) != 5 || expect(subscriber, "150") < 0))
+    {
+        close(subscriber);
+        subscriber = -1;
+    }
+    int fds_before = process_usage(server_pid, &rss_kb);
+    printf("%s engine, -t %d: server RSS %.1f MB, %d fds, live client%s\n", engine, timeout_s, rss_kb / 1024.0,
+           fds_before, subscriber >= 0 ? " and subscriber" : "");
+
+    for (int w = 1; w <= waves; w++)
+    {
+        int opened = 0;
+        for (int i = 0; i < per_wave; i++)
+        {
+            fds[i] = open_conn(i % 3 != 0);
+            if (fds[i] >= 0 && i % 3 == 2 && send(fds[i], "POST the rest never co", 22, 0) != 22)
+                perror("send() error");
+            opened += fds[i] >= 0;
+        }
+        int fds_open = process_usage(server_pid, &rss_kb);
+        printf("wave %d: %d abandoned, server RSS %.1f MB, %d fds\n", w, opened, rss_kb / 1024.0, fds_open);
+        fflush(stdout);
+        wait_posting(timeout_s * 1000 + GRACE_MS);
+
+        int closed = 0;
+        for (int i = 0; i < per_wave; i++)
+        {
+            if (fds[i] < 0)
+                continue;
+            closed += closed_by_server(fds[i]);
+            if (timeout_s > 0)
+                close(fds[i]); // without a timeout they pile up across the waves
+        }
+        fds_open = process_usage(server_pid, &rss_kb);
+        printf("  after %.1f s: server RSS %.1f MB, %d fds, %d closed by the server\n",
+               (timeout_s * 1000 + GRACE_MS) / 1000.0, rss_kb / 1024.0, fds_open, closed);
+        if (timeout_s > 0 ? closed != opened : closed != 0)
+            failures++;
+    }
+
+    printf("live client: %d of %d posts answered\n", live_answered, live_posts);
+    if (live_answered != live_posts)
+        failures++;
+    if (subscriber >= 0)
+    {
+        int gone = closed_by_server(subscriber);
+        printf("subscriber: %s\n", gone ? "disconnected" : "still connected");
+        failures += gone;
+    }
+
+out:
+    if (server_pid > 0)
+    {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    printf("%s\n", failures > 0 ? "FAILED" : "ok");
+    return failures > 0 ? 2 : 0;
+}
@@ -0,0 +1,387 @@
+/* Large POST test for the w8 server: several clients stream POST {len} bodies at
+ * once, each reply's hash is checked and, with -r, the message is read back */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ACCOUNT_PREFIX "load"
+#define BUFF_SIZE (64 * 1024)
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct
+{
+    int index;       // the client logs in as load<index>
+    int fd;
+    char in[BUFF_SIZE];
+    size_t in_len;   // bytes received but not yet consumed
+    int errors;
+    long long bytes; // body bytes posted
+    double worst;    // slowest POST, in seconds
+} BigClient;
+
+int client_count = 4;
+int posts_per_client = 1;
+long long post_size = 100LL * 1024 * 1024;
+int read_back = 0;
+struct sockaddr_in server_addr; /* server's address information */
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Seconds since an arbitrary origin.
+ */
+double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Reads the wall clock, the one the server stamps messages with.
+ * @return Nanoseconds since the epoch.
+ */
+long long wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Hashes bytes with FNV-1a, as the server does for 120 replies.
+ */
+uint64_t fnv1a(uint64_t hash, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Fills a buffer with pseudo-random bytes, CRLFs included, from a xorshift
+ * state, so a body is never held whole.
+ */
+void fill_random(uint64_t *state, char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        *state ^= *state << 13;
+        *state ^= *state >> 7;
+        *state ^= *state << 17;
+        buf[i] = *state >> 24;
+    }
+}
+
+/**
+ * @brief Sends a whole buffer.
+ * @return 0 on success, -1 on error.
+ */
+int send_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("send() error");
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives more bytes after those not yet consumed.
+ * @return 0 on success, -1 if the connection closed or failed.
+ */
+int fill(BigClient *c)
+{
+    if (c->in_len == sizeof(c->in))
+        return -1;
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n < 0 && errno == EINTR)
+        return 0;
+    if (n <= 0)
+    {
+        fprintf(stderr, "Client %d: connection closed\n", c->index);
+        return -1;
+    }
+    c->in_len += n;
+    return 0;
+}
+
+/**
+ * @brief Takes the next reply line, without its CRLF.
+ * @param line Set to the line, NUL-terminated.
+ * @param size Size of line.
+ * @return 0 on success, -1 on error.
+ */
+int read_line(BigClient *c, char *line, size_t size)
+{
+    char *end;
+    while ((end = memmem(c->in, c->in_len, "\r\n", 2)) == NULL)
+        if (fill(c) < 0)
+            return -1;
+    size_t len = end - c->in;
+    snprintf(line, size, "%.*s", (int)len, c->in);
+    c->in_len -= len + 2;
+    memmove(c->in, end + 2, c->in_len);
+    return 0;
+}
+
+/**
+ * @brief Takes the next bytes of a message body and hashes them.
+ * @return 0 on success, -1 on error.
+ */
+int read_body(BigClient *c, uint64_t len, uint64_t *hash)
+{
+    while (len > 0)
+    {
+        if (c->in_len == 0 && fill(c) < 0)
+            return -1;
+        size_t n = c->in_len < len ? c->in_len : len;
+        *hash = fnv1a(*hash, c->in, n);
+        c->in_len -= n;
+        memmove(c->in, c->in + n, c->in_len);
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks that a reply line starts with the expected code.
+ * @return 0 if it does, -1 otherwise.
+ */
+int expect(BigClient *c, const char *code)
+{
+    char line[128];
+    if (read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (strncmp(line, code, strlen(code)) != 0)
+    {
+        fprintf(stderr, "Client %d: expected %s, got '%s'\n", c->index, code, line);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads back the messages posted since a time and checks that there is one,
+ * with the length and hash of the body posted.
+ * @return 0 on success, -1 on error.
+ */
+int check_read(BigClient *c, long long since, uint64_t hash)
+{
+    char line[128];
+    int count;
+    long long timestamp;
+    unsigned long len;
+
+    snprintf(line, sizeof(line), "READ " ACCOUNT_PREFIX "%d %lld\r\n", c->index, since);
+    if (send_all(c->fd, line, strlen(line)) < 0 || read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (sscanf(line, "140 %d", &count) != 1 || count != 1)
+    {
+        fprintf(stderr, "Client %d: READ answered '%s', expected one message\n", c->index, line);
+        return -1;
+    }
+    if (read_line(c, line, sizeof(line)) < 0 || sscanf(line, "%lld %lu", &timestamp, &len) != 2)
+        return -1;
+    uint64_t got = FNV_OFFSET;
+    if (read_body(c, len, &got) < 0 || read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (len != (unsigned long)post_size || got != hash || line[0] != '\0')
+    {
+        fprintf(stderr, "Client %d: READ returned %lu bytes hashing to %016llx, posted %lld hashing to %016llx\n",
+                c->index, len, (unsigned long long)got, post_size, (unsigned long long)hash);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Streams one POST {len} body and checks the hash in the reply.
+ * @return 0 on success, -1 on error.
+ */
+int post_one(BigClient *c, int post)
+{
+    char buf[BUFF_SIZE], line[128];
+    uint64_t state = 0x9e3779b97f4a7c15ull ^ ((uint64_t)c->index << 32 | post);
+    uint64_t hash = FNV_OFFSET;
+    unsigned long long got;
+    long long since = wall_ns();
+    double start = now_s();
+
+    snprintf(line, sizeof(line), "POST {%lld}\r\n", post_size);
+    if (send_all(c->fd, line, strlen(line)) < 0)
+        return -1;
+    for (long long left = post_size; left > 0;)
+    {
+        size_t n = left < (long long)sizeof(buf) ? left : (long long)sizeof(buf);
+        fill_random(&state, buf, n);
+        hash = fnv1a(hash, buf, n);
+        if (send_all(c->fd, buf, n) < 0)
+            return -1;
+        left -= n;
+    }
+    if (read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (sscanf(line, "120 %llx", &got) != 1 || got != hash)
+    {
+        fprintf(stderr, "Client %d: POST answered '%s', expected 120 %016llx\n", c->index, line, (unsigned long long)hash);
+        return -1;
+    }
+    double elapsed = now_s() - start;
+    if (elapsed > c->worst)
+        c->worst = elapsed;
+    c->bytes += post_size;
+    return read_back ? check_read(c, since, hash) : 0;
+}
+
+/**
+ * @brief Client thread: logs in, posts, and logs out.
+ */
+void *run_client(void *arg)
+{
+    BigClient *c = arg;
+    char line[64];
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("connect() error");
+        c->errors++;
+        return NULL;
+    }
+    snprintf(line, sizeof(line), "USER " ACCOUNT_PREFIX "%d\r\n", c->index);
+    if (expect(c, "100") < 0 || send_all(c->fd, line, strlen(line)) < 0 || expect(c, "110") < 0)
+    {
+        c->errors++;
+        close(c->fd);
+        return NULL;
+    }
+    for (int i = 0; i < posts_per_client; i++)
+    {
+        if (post_one(c, i) < 0)
+        {
+            c->errors++;
+            close(c->fd);
+            return NULL;
+        }
+    }
+    if (send_all(c->fd, "BYE\r\n", 5) < 0 || expect(c, "130") < 0)
+        c->errors++;
+    close(c->fd);
+    return NULL;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <server_ip> <server_port>\n"
+            "  -c clients   clients posting at once, as load0.. (default 4)\n"
+            "  -p posts     POSTs per client (default 1)\n"
+            "  -s MB        size of each POST body (default 100)\n"
+            "  -r           read each message back with READ (server run with -m, on this host)\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the large POST test.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every reply checked out, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:s:r")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            client_count = atoi(optarg);
+            break;
+        case 'p':
+            posts_per_client = atoi(optarg);
+            break;
+        case 's':
+            post_size = (long long)(atof(optarg) * 1024 * 1024);
+            break;
+        case 'r':
+            read_back = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2 || client_count <= 0 || posts_per_client <= 0 || post_size < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind + 1]));
+    server_addr.sin_addr.s_addr = inet_addr(argv[optind]);
+
+    BigClient *clients = calloc(client_count, sizeof(BigClient));
+    pthread_t *threads = malloc(client_count * sizeof(pthread_t));
+    if (clients == NULL || threads == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    double start = now_s();
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i].index = i;
+        if (pthread_create(&threads[i], NULL, run_client, &clients[i]) != 0)
+        {
+            perror("pthread_create() error");
+            return 1;
+        }
+    }
+    int errors = 0;
+    long long bytes = 0;
+    double worst = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += clients[i].errors;
+        bytes += clients[i].bytes;
+        if (clients[i].worst > worst)
+            worst = clients[i].worst;
+    }
+    double elapsed = now_s() - start;
+
+    printf("posts       %lld of %d x %.1f MB checked%s, %d errors\n", post_size > 0 ? bytes / post_size : 0,
+           client_count * posts_per_client, post_size / 1048576.0, read_back ? " and read back" : "", errors);
+    printf("throughput  %.1f MB/s posted in %.2f s, slowest POST %.2f s\n", bytes / 1048576.0 / elapsed, elapsed, worst);
+    return errors > 0 ? 2 : 0;
+}
@@ -0,0 +1,203 @@
+/* Encode/decode micro-benchmark of the w3 reply formats: a lookup result with 1, 40
+ * and 512 addresses, and a PTR result, through bin_encode_reply()/bin_decode_reply()
+ * and through format_reply() plus the text parsing a client does to get the
+ * addresses back. Prints ns per reply and the reply sizes. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "binproto.h"
+
+#define REPLY_SIZE 8193 /* the server's reply buffer */
+
+long long total_addresses = 8 * 1000 * 1000; // per format and result, spread over the iterations
+volatile long sink; // keeps the decoded results alive
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Parses a text reply back into a result, as the client reads it: '+' and
+ * space-separated addresses, '+' and a hostname for a PTR reply, or '-' for none.
+ * @return 0 on success, -1 if the reply is malformed.
+ */
+int text_decode_reply(const char *reply, int is_ptr, ResolveResult *result)
+{
+    char ip[INET_ADDRSTRLEN];
+
+    result->found = reply[0] == '+';
+    result->is_ptr = is_ptr;
+    result->addr_count = 0;
+    result->hostname[0] = '\0';
+    if (reply[0] == '-')
+        return 0;
+    if (reply[0] != '+')
+        return -1;
+    if (is_ptr)
+    {
+        snprintf(result->hostname, sizeof(result->hostname), "%s", reply + 1);
+        return 0;
+    }
+    for (const char *p = reply + 1; *p && result->addr_count < MAX_ADDRESSES;)
+    {
+        size_t len = strcspn(p, " ");
+        if (len >= sizeof(ip))
+            return -1;
+        memcpy(ip, p, len);
+        ip[len] = '\0';
+        if (inet_pton(AF_INET, ip, &result->addrs[result->addr_count++]) != 1)
+            return -1;
+        p += len;
+        p += strspn(p, " ");
+    }
+    return 0;
+}
+
+/**
+ * @brief Whether a decoded reply holds the same answer as the result.
+ */
+int same_result(const ResolveResult *decoded, const ResolveResult *result)
+{
+    if (result->is_ptr)
+        return decoded->found && strcmp(decoded->hostname, result->hostname) == 0;
+    return decoded->found && decoded->addr_count == result->addr_count &&
+           memcmp(decoded->addrs, result->addrs, result->addr_count * sizeof(struct in_addr)) == 0;
+}
+
+/**
+ * @brief Times both formats on one result and checks they decode it intact.
+ */
+void bench(const char *label, const ResolveResult *result)
+{
+    static uint8_t bin_reply[BIN_MAX_REPLY];
+    static char text_reply[REPLY_SIZE];
+    ResolveResult *decoded = malloc(sizeof(ResolveResult));
+    int count = result->is_ptr ? 1 : result->addr_count;
+    long iterations = total_addresses / count;
+    uint16_t id;
+    uint8_t status;
+    int bin_len = 0;
+
+    if (decoded == NULL)
+    {
+        perror("malloc() error");
+        exit(1);
+    }
+
+    long long start = now_ns();
+    uint8_t qtype = result->is_ptr ? BIN_QTYPE_PTR : BIN_QTYPE_A;
+    for (long i = 0; i < iterations; i++)
+        bin_len = bin_encode_reply(bin_reply, sizeof(bin_reply), qtype, i, BIN_STATUS_OK, result);
+    long long bin_encode = now_ns() - start;
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+    {
+        bin_decode_reply(bin_reply, bin_len, &id, &status, decoded);
+        sink += decoded->addr_count;
+    }
+    long long bin_decode = now_ns() - start;
+    int bin_ok = same_result(decoded, result);
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+        format_reply(result, text_reply);
+    long long text_encode = now_ns() - start;
+    start = now_ns();
+    for (long i = 0; i < iterations; i++)
+    {
+        text_decode_reply(text_reply, result->is_ptr, decoded);
+        sink += decoded->addr_count;
+    }
+    long long text_decode = now_ns() - start;
+    int text_ok = same_result(decoded, result);
+
+    if (!bin_ok || !text_ok)
+        fprintf(stderr, "%s: the %s reply does not decode to the result\n", label, bin_ok ? "text" : "binary");
+
+    printf("%-14s text %5zu B  enc %8.1f  dec %8.1f ns   binary %5d B  enc %6.1f  dec %6.1f ns   %5.1fx\n", label,
+           strlen(text_reply), (double)text_encode / iterations, (double)text_decode / iterations, bin_len,
+           (double)bin_encode / iterations, (double)bin_decode / iterations,
+           (double)(text_encode + text_decode) / (bin_encode + bin_decode));
+    free(decoded);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n addresses] [address_count...]\n"
+            "  -n addresses addresses encoded and decoded per format and result, in millions (default 8)\n"
+            "The address counts default to 1, 40 and %d; a PTR result is timed too.\n",
+            prog, MAX_ADDRESSES);
+}
+
+/**
+ * @brief Main function of the reply format benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    static const int default_counts[] = {1, 40, MAX_ADDRESSES};
+    ResolveResult *result = calloc(1, sizeof(ResolveResult));
+    char label[32];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            total_addresses = atoll(optarg) * 1000 * 1000;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (total_addresses <= 0 || result == NULL)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // addresses of every length, 10.0.0.1 to 10.255.255.255
+    srandom(1);
+    for (int i = 0; i < MAX_ADDRESSES; i++)
+        result->addrs[i].s_addr = htonl(10u << 24 | (random() % (1 << (8 * (i % 3 + 1)))) | 1);
+    result->found = 1;
+    int count_args = argc - optind;
+    for (int i = 0; i < (count_args > 0 ? count_args : 3); i++)
+    {
+        int count = count_args > 0 ? atoi(argv[optind + i]) : default_counts[i];
+        if (count < 1 || count > MAX_ADDRESSES)
+        {
+            fprintf(stderr, "Address count %d out of range\n", count);
+            return 1;
+        }
+        result->addr_count = count;
+        snprintf(label, sizeof(label), "%d address%s", count, count > 1 ? "es" : "");
+        bench(label, result);
+    }
+    result->is_ptr = 1;
+    result->addr_count = 0;
+    snprintf(result->hostname, sizeof(result->hostname), "host-192-0-2-7.example.com");
+    bench("PTR", result);
+    free(result);
+    return 0;
+}
@@ -0,0 +1,224 @@
+/* Accept/close churn benchmark of the w6/w7 session allocator: keeps a number of
+ * sessions live and replaces a random one at a time, through session_open() and
+ * session_close() and through a malloc()/free() of the session and its line buffer
+ * per connection, as before the slab allocator. Each round then scans the live
+ * sessions the way the w7 select loop does, to show what packing them is worth.
+ * For the whole accept/close path over TCP, run loadgen -k -p 0 against a server. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "session.h"
+#include "bufpool.h"
+
+#define FAKE_FD 1000000 /* marks a live session without a socket; cleared before session_close() */
+
+int live_count = 1000;
+long churn = 2000000;
+int scan_every = 1000; // replacements between scans
+volatile size_t sink;  // keeps the scanned fields alive
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Starts a session like accept() would: a slot, its buffer, a first line.
+ */
+Session *slab_open(const struct sockaddr_in *peer)
+{
+    Session *session = session_open(-1, peer);
+    if (session == NULL)
+    {
+        fprintf(stderr, "session_open() failed\n");
+        exit(1);
+    }
+    session->fd = FAKE_FD + session->index;
+    session->buf_len = 7;
+    memcpy(session->buf, "USER a\r", 7);
+    return session;
+}
+
+/**
+ * @brief Ends a session from slab_open().
+ */
+void slab_close(Session *session)
+{
+    session->fd = -1; // nothing to close
+    session_close(session);
+}
+
+/**
+ * @brief Starts a session with its own allocations, as before the slab allocator.
+ */
+Session *malloc_open(const struct sockaddr_in *peer)
+{
+    Session *session = malloc(sizeof(Session));
+    if (session == NULL || (session->buf = malloc(POOL_MIN_SIZE)) == NULL)
+    {
+        perror("malloc() error");
+        exit(1);
+    }
+    session->fd = FAKE_FD;
+    session->buf_cap = POOL_MIN_SIZE;
+    session->peer = *peer;
+    session->is_logged_in = false;
+    session->account_index = -1;
+    session->discarding = false;
+    session->buf_len = 7;
+    memcpy(session->buf, "USER a\r", 7);
+    return session;
+}
+
+/**
+ * @brief Ends a session from malloc_open().
+ */
+void malloc_close(Session *session)
+{
+    free(session->buf);
+    free(session);
+}
+
+/**
+ * @brief Scans every slot for live sessions with pending input, as the w7 loop does.
+ */
+size_t scan_slots()
+{
+    size_t pending = 0;
+    for (int i = 0; i < session_slots(); i++)
+    {
+        const Session *session = session_at(i);
+        if (session->fd >= 0)
+            pending += session->buf_len + session->is_logged_in;
+    }
+    return pending;
+}
+
+/**
+ * @brief Scans sessions through a table of pointers, as with one allocation each.
+ */
+size_t scan_table(Session **live)
+{
+    size_t pending = 0;
+    for (int i = 0; i < live_count; i++)
+        pending += live[i]->buf_len + live[i]->is_logged_in;
+    return pending;
+}
+
+/**
+ * @brief Runs the churn with one allocator and prints its costs.
+ * @param slab 1 for session_open()/session_close(), 0 for malloc()/free().
+ */
+void bench(int slab, Session **live)
+{
+    struct sockaddr_in peer;
+    long long churn_ns = 0, scan_ns = 0;
+    long scans = 0;
+
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    srandom(1);
+    for (int i = 0; i < live_count; i++)
+        live[i] = slab ? slab_open(&peer) : malloc_open(&peer);
+
+    for (long done = 0; done < churn; done += scan_every)
+    {
+        long long start = now_ns();
+        for (int i = 0; i < scan_every; i++)
+        {
+            int victim = random() % live_count;
+            if (slab)
+            {
+                slab_close(live[victim]);
+                live[victim] = slab_open(&peer);
+            }
+            else
+            {
+                malloc_close(live[victim]);
+                live[victim] = malloc_open(&peer);
+            }
+        }
+        long long middle = now_ns();
+        sink += slab ? scan_slots() : scan_table(live);
+        scan_ns += now_ns() - middle;
+        churn_ns += middle - start;
+        scans++;
+    }
+
+    for (int i = 0; i < live_count; i++)
+        slab ? slab_close(live[i]) : malloc_close(live[i]);
+    printf("%-14s accept+close %6.1f ns   scan %6.2f ns/session\n", slab ? "slab" : "malloc/free",
+           (double)churn_ns / churn, (double)scan_ns / scans / live_count);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -l sessions  live sessions (default 1000, at most %d)\n"
+            "  -n count     sessions replaced (default 2000000)\n"
+            "  -s count     sessions replaced between scans (default 1000)\n",
+            prog, SESSIONS_PER_SLAB * MAX_SLABS);
+}
+
+/**
+ * @brief Main function of the churn benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'l':
+            live_count = atoi(optarg);
+            break;
+        case 'n':
+            churn = atol(optarg);
+            break;
+        case 's':
+            scan_every = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || live_count <= 0 || live_count > SESSIONS_PER_SLAB * MAX_SLABS || churn <= 0 ||
+        scan_every <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    Session **live = malloc(live_count * sizeof(Session *));
+    if (live == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+
+    printf("%d live sessions, %ld replaced, scanned every %d\n", live_count, churn, scan_every);
+    bench(0, live);
+    bench(1, live);
+    free(live);
+    return 0;
+}
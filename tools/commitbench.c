@@ -0,0 +1,325 @@
+/* Group-commit benchmark of the w8 message store: durable POSTs/s and latency
+ * against the number of concurrent posters, with group commits and with one sync per
+ * POST (-n). For each engine, mode and client count it starts the server with a
+ * fresh log in a scratch directory, which holds its account file too, and drives
+ * it with loadgen. The sync cost depends on the filesystem of the log (-t). */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_CLIENT_COUNTS 32
+#define POSTS_PER_LOGIN 1000 /* POSTs between USER and BYE, so nearly every request is one */
+
+char server[PATH_MAX], loadgen[PATH_MAX];
+const char *engines = "thread,epoll";
+const char *parent = "/tmp";
+int seconds = 4;
+char message[128];
+int client_counts[MAX_CLIENT_COUNTS] = {1, 10, 100, 1000};
+int client_count_number = 4;
+
+typedef struct
+{
+    double posts_per_s; // durable POSTs, answered 120, per second
+    double p50_ms;
+    double p99_ms;
+    long long errors;
+} Result;
+
+/**
+ * @brief Starts a program and reads its output until a line starting with ready_line,
+ * then stops reading it.
+ * @param dir Directory to run it in, NULL for the current one.
+ * @param quiet 1 to discard its errors too: the server reports every connection
+ * loadgen leaves mid-request when it stops.
+ * @param out Set to the rest of its output when ready_line is NULL, which makes the
+ * call return at once; NULL to discard the output.
+ * @return Its process id, -1 on error.
+ */
+pid_t start(const char *dir, const char *ready_line, FILE **out, int quiet, char *const argv[])
+{
+    int fds[2];
+    char line[256];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        if (quiet)
+            dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (dir != NULL && chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        perror("execv() error");
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *output = fdopen(fds[0], "r");
+    if (output != NULL && ready_line == NULL && out != NULL)
+    {
+        *out = output;
+        return pid;
+    }
+    while (output != NULL && fgets(line, sizeof(line), output) != NULL)
+    {
+        if (strncmp(line, ready_line, strlen(ready_line)) == 0)
+        {
+            fclose(output); // the server ignores SIGPIPE, so its later output is just dropped
+            return pid;
+        }
+    }
+    fprintf(stderr, "%s did not start\n", argv[0]);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * @brief Runs a program to its end with its output discarded.
+ * @return 0 if it succeeded, -1 otherwise.
+ */
+int run(char *const argv[])
+{
+    int status;
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror("execv() error");
+        _exit(127);
+    }
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Deletes the files of a directory and the directory.
+ */
+void remove_dir(const char *dir)
+{
+    char path[PATH_MAX + 256];
+    struct dirent *entry;
+    DIR *d = opendir(dir);
+
+    while (d != NULL && (entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d != NULL)
+        closedir(d);
+    rmdir(dir);
+}
+
+/**
+ * @brief Runs one configuration: a server with an empty log and loadgen against it.
+ * @param dir Scratch directory holding TCP_Server/account.txt.
+ * @param group 1 for group commits, 0 for one sync per POST.
+ * @return 0 on success, -1 on error.
+ */
+int bench(const char *dir, const char *engine, int group, int clients, int port, Result *result)
+{
+    char log_dir[PATH_MAX + 8], port_arg[16], clients_arg[16], posts_arg[16], seconds_arg[16], line[256];
+    long long count, answered = 0;
+    double elapsed = 0;
+    int ok = 0;
+    FILE *out = NULL;
+
+    snprintf(log_dir, sizeof(log_dir), "%s/msgs", dir);
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    snprintf(clients_arg, sizeof(clients_arg), "%d", clients);
+    snprintf(posts_arg, sizeof(posts_arg), "%d", POSTS_PER_LOGIN);
+    snprintf(seconds_arg, sizeof(seconds_arg), "%d", seconds);
+    char *server_argv[] = {server, "-e", (char *)engine, "-m", log_dir, group ? port_arg : "-n",
+                           group ? NULL : port_arg, NULL};
+    char *loadgen_argv[] = {loadgen, "-c", clients_arg, "-p", posts_arg, "-d", seconds_arg, "-m", message,
+                            "127.0.0.1", port_arg, NULL};
+
+    memset(result, 0, sizeof(*result));
+    pid_t server_pid = start(dir, "Server started", NULL, 1, server_argv);
+    if (server_pid < 0)
+        return -1;
+    pid_t loadgen_pid = start(NULL, NULL, &out, 0, loadgen_argv);
+    while (loadgen_pid > 0 && fgets(line, sizeof(line), out) != NULL)
+    {
+        if (sscanf(line, "requests %lld answered in %lf s, %*f req/s, %lld errors", &answered, &elapsed,
+                   &result->errors) == 3)
+            ok++;
+        sscanf(line, "latency p50 %lf ms p99 %lf ms", &result->p50_ms, &result->p99_ms);
+        // replies 110:12 120:34567 130:11
+        char *posts = strstr(line, " 120:");
+        if (strncmp(line, "replies", 7) == 0 && posts != NULL && sscanf(posts + 5, "%lld", &count) == 1 &&
+            elapsed > 0)
+            result->posts_per_s = count / elapsed;
+    }
+    if (out != NULL)
+        fclose(out);
+    if (loadgen_pid > 0)
+        waitpid(loadgen_pid, NULL, 0);
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+    remove_dir(log_dir);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [client_count...]\n"
+            "  -e engines   comma-separated server engines (default %s)\n"
+            "  -d seconds   duration of each run (default %d)\n"
+            "  -s bytes     POST body size (default 100)\n"
+            "  -t dir       directory to put the log under (default %s)\n"
+            "  -S server    server program (default ./server)\n"
+            "  -L loadgen   load generator (default ./loadgen)\n"
+            "The client counts default to 1, 10, 100 and 1000.\n",
+            prog, engines, seconds, parent);
+}
+
+/**
+ * @brief Main function of the group-commit benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 on success, 2 if a run failed.
+ */
+int main(int argc, char *argv[])
+{
+    const char *server_arg = "./server", *loadgen_arg = "./loadgen";
+    char dir[PATH_MAX], path[PATH_MAX + 32], count_arg[16];
+    int opt, body_size = 100, failures = 0;
+
+    while ((opt = getopt(argc, argv, "e:d:s:t:S:L:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+            engines = optarg;
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 's':
+            body_size = atoi(optarg);
+            break;
+        case 't':
+            parent = optarg;
+            break;
+        case 'S':
+            server_arg = optarg;
+            break;
+        case 'L':
+            loadgen_arg = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > MAX_CLIENT_COUNTS || seconds <= 0 || body_size <= 0 || body_size >= (int)sizeof(message))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (optind < argc)
+        client_count_number = 0;
+    int max_clients = 0;
+    for (int i = optind; i < argc; i++)
+        client_counts[client_count_number++] = atoi(argv[i]);
+    for (int i = 0; i < client_count_number; i++)
+    {
+        if (client_counts[i] <= 0)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        if (client_counts[i] > max_clients)
+            max_clients = client_counts[i];
+    }
+    memset(message, 'm', body_size);
+    if (realpath(server_arg, server) == NULL || realpath(loadgen_arg, loadgen) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+
+    // the server reads TCP_Server/account.txt under its working directory
+    snprintf(dir, sizeof(dir), "%s/commitbench.XXXXXX", parent);
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    snprintf(count_arg, sizeof(count_arg), "%d", max_clients);
+    char *generate_argv[] = {loadgen, "-g", count_arg, path, NULL};
+    if (run(generate_argv) < 0)
+    {
+        fprintf(stderr, "%s could not write the accounts\n", loadgen);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    srandom(time(NULL) ^ getpid());
+    int port = 20000 + random() % 20000;
+    printf("%d-byte POSTs, %d s per run, log under %s\n", body_size, seconds, parent);
+    printf("%-10s %-6s %7s %12s %10s %10s\n", "engine", "sync", "clients", "POSTs/s", "p50 ms", "p99 ms");
+    for (char *list = strdupa(engines), *engine; (engine = strsep(&list, ",")) != NULL;)
+    {
+        for (int group = 1; group >= 0; group--)
+        {
+            for (int i = 0; i < client_count_number; i++)
+            {
+                Result result;
+                if (bench(dir, engine, group, client_counts[i], port++, &result) < 0)
+                {
+                    fprintf(stderr, "%s with %d clients failed\n", engine, client_counts[i]);
+                    failures++;
+                    continue;
+                }
+                printf("%-10s %-6s %7d %12.0f %10.2f %10.2f%s\n", engine, group ? "group" : "each", client_counts[i],
+                       result.posts_per_s, result.p50_ms, result.p99_ms, result.errors > 0 ? "  (errors)" : "");
+                fflush(stdout);
+            }
+        }
+    }
+
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    return failures > 0 ? 2 : 0;
+}
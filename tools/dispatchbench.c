@@ -0,0 +1,189 @@
+/* Dispatch micro-benchmark for w8 verbs: looks commands up in the perfect-hash
+ * table of command.c and in a strncmp() chain like the one it replaced, with 3
+ * and with 30 registered verbs */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "command.h"
+
+#define LINE_COUNT 1024 /* distinct request lines cycled through */
+
+static const char *verbs[] = {"USER", "POST", "BYE", "READ", "SUB", "UNSUB", "LIST", "STAT", "PING", "QUIT",
+                              "HELP", "NOOP", "RETR", "STOR", "DELE", "RSET", "TOP", "UIDL", "APOP", "AUTH",
+                              "CAPA", "PASS", "LOGIN", "NICK", "JOIN", "PART", "KICK", "MODE", "NAMES", "WHO"};
+
+#define VERB_COUNT ((int)(sizeof(verbs) / sizeof(verbs[0])))
+
+long long lookups = 50000000;
+long long dispatched; // commands handled, checked against lookups
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Handler registered for every verb.
+ */
+void count_command(Client *client, const Command *cmd)
+{
+    (void)client;
+    (void)cmd;
+    dispatched++;
+}
+
+/**
+ * @brief Dispatches through the table of command.c, as handle_client_request() does.
+ * @return Nanoseconds per lookup.
+ */
+double bench_table(char lines[][16])
+{
+    Command cmd;
+    long long start = now_ns();
+    for (long long i = 0; i < lookups; i++)
+    {
+        const char *line = lines[i % LINE_COUNT];
+        split_command(line, strlen(line), &cmd);
+        CommandHandler handler = find_command(&cmd.verb);
+        if (handler != NULL)
+            handler(NULL, &cmd);
+    }
+    return (double)(now_ns() - start) / lookups;
+}
+
+/**
+ * @brief Dispatches through a chain of strncmp() calls, one per verb, as w8 did
+ * before the table; verbs are matched by prefix like the old chain.
+ * @return Nanoseconds per lookup.
+ */
+double bench_chain(char lines[][16], int verb_count)
+{
+    static CommandHandler handlers[VERB_COUNT];
+    static size_t lengths[VERB_COUNT];
+    Command cmd;
+
+    for (int v = 0; v < verb_count; v++)
+    {
+        handlers[v] = count_command;
+        lengths[v] = strlen(verbs[v]);
+    }
+    long long start = now_ns();
+    for (long long i = 0; i < lookups; i++)
+    {
+        const char *line = lines[i % LINE_COUNT];
+        split_command(line, strlen(line), &cmd);
+        for (int v = 0; v < verb_count; v++)
+        {
+            if (strncmp(line, verbs[v], lengths[v]) == 0)
+            {
+                handlers[v](NULL, &cmd);
+                break;
+            }
+        }
+    }
+    return (double)(now_ns() - start) / lookups;
+}
+
+/**
+ * @brief Registers the first verbs and times both dispatchers on lines that cycle
+ * over them in a shuffled order.
+ * @return 0 on success, -1 on error.
+ */
+int bench(int verb_count)
+{
+    static char lines[LINE_COUNT][16];
+    static int registered = 0;
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    for (; registered < verb_count; registered++)
+        if (register_command(verbs[registered], count_command) < 0)
+            return -1;
+    for (int i = 0; i < LINE_COUNT; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        snprintf(lines[i], sizeof(lines[i]), "%s arg", verbs[state % verb_count]);
+    }
+
+    dispatched = 0;
+    double table_ns = bench_table(lines);
+    double chain_ns = bench_chain(lines, verb_count);
+    if (dispatched != 2 * lookups)
+    {
+        fprintf(stderr, "%d verbs: dispatched %lld of %lld commands\n", verb_count, dispatched, 2 * lookups);
+        return -1;
+    }
+    printf("%2d verbs  table %6.1f ns   strncmp chain %6.1f ns\n", verb_count, table_ns, chain_ns);
+    return 0;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-n lookups] [verb_count...]\n"
+            "  -n lookups   lookups per run (default 50000000)\n"
+            "Runs with 3 and 30 verbs unless counts (1-%d, increasing) are given.\n",
+            prog, VERB_COUNT);
+}
+
+/**
+ * @brief Main function of the dispatch benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            lookups = atoll(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (lookups <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%lld lookups per run, ns per line split and dispatched\n", lookups);
+    if (optind == argc)
+        return bench(3) < 0 || bench(30) < 0 ? 2 : 0;
+    for (int i = optind, last = 0; i < argc; i++)
+    {
+        int count = atoi(argv[i]);
+        if (count <= last || count > VERB_COUNT) // registered verbs cannot be removed
+        {
+            fprintf(stderr, "Verb count %s out of range\n", argv[i]);
+            return 1;
+        }
+        if (bench(count) < 0)
+            return 2;
+        last = count;
+    }
+    return 0;
+}
@@ -0,0 +1,262 @@
+/* Test of the w3 DNS client (dnsclient.c) against the fake upstream of fakedns.c,
+ * which it starts itself: answers, PTR, NXDOMAIN, replies matched by transaction ID
+ * and question, out-of-order replies, EDNS0, retransmission, timeouts, and names
+ * answered from the hosts file without a query */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "dnsclient.h"
+
+#define MAX_CASES 16
+
+typedef struct
+{
+    const char *name;
+    int is_ptr;
+    int done;
+    long long elapsed; // ms from the query to its callback
+    ResolveResult result;
+} Case;
+
+Case cases[MAX_CASES];
+int case_count = 0;
+int failures = 0;
+long long start;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Milliseconds since an arbitrary origin.
+ */
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief The address fakedns gives a plain name: 10.x.y.z from an FNV-1a hash of
+ * the lower-case name.
+ */
+uint32_t name_address(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (uint8_t)(*name >= 'A' && *name <= 'Z' ? *name + 32 : *name);
+        hash *= 16777619u;
+    }
+    return htonl(10u << 24 | (hash & 0xffffff));
+}
+
+/**
+ * @brief Prints the outcome of a check and counts failures.
+ */
+void check(int ok, const char *what, const char *detail)
+{
+    printf("%s %s%s%s\n", ok ? "ok  " : "FAIL", what, ok ? "" : ": ", ok ? "" : detail);
+    failures += !ok;
+}
+
+/**
+ * @brief DNS client callback: records the result of a case.
+ */
+void on_result(void *ctx, const ResolveResult *result)
+{
+    Case *c = ctx;
+    c->result = *result;
+    c->elapsed = now_ms() - start;
+    c->done = 1;
+}
+
+/**
+ * @brief Adds a case and sends its query.
+ * @return The case.
+ */
+Case *query(const char *name, int is_ptr)
+{
+    Case *c = &cases[case_count++];
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->is_ptr = is_ptr;
+    if (dns_query(name, is_ptr, on_result, c) < 0)
+    {
+        check(0, name, "dns_query() failed");
+        c->done = 1;
+    }
+    return c;
+}
+
+/**
+ * @brief Runs the client's event loop until every case is done.
+ * @param sock The socket from dns_open().
+ */
+void run(int sock)
+{
+    struct pollfd pfd = {sock, POLLIN, 0};
+    for (int i = 0; i < case_count;)
+    {
+        if (cases[i].done)
+        {
+            i++;
+            continue;
+        }
+        if (poll(&pfd, 1, dns_next_timeout()) > 0 && (pfd.revents & POLLIN))
+            dns_process_replies();
+        dns_expire();
+    }
+}
+
+/**
+ * @brief Whether a result holds exactly one address.
+ */
+int has_address(const Case *c, uint32_t addr)
+{
+    return c->result.found && c->result.addr_count == 1 && c->result.addrs[0].s_addr == addr;
+}
+
+/**
+ * @brief Reads the fake server's query counter through the client.
+ * @return The number of queries it received since the last reset.
+ */
+long queries_seen(int sock)
+{
+    case_count = 0;
+    Case *c = query("count.fake", 0);
+    run(sock);
+    return c->result.found ? (long)ntohl(c->result.addrs[0].s_addr) : -1;
+}
+
+/**
+ * @brief Starts fakedns on a port and waits until it is listening.
+ * @return Its process id, -1 on error.
+ */
+pid_t start_fake(const char *path, const char *port)
+{
+    int fds[2];
+    char line[128];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(path, path, port, (char *)NULL);
+        perror("execl() error");
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *out = fdopen(fds[0], "r");
+    // the pipe stays open, so the fake can go on writing to it
+    int ready = out != NULL && fgets(line, sizeof(line), out) != NULL && strncmp(line, "Fake DNS", 8) == 0;
+    if (!ready)
+    {
+        fprintf(stderr, "%s did not start\n", path);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Main function of the DNS client test.
+ * @param argc Argument count.
+ * @param argv [path of fakedns] [port]
+ * @return Exit status: 0 if every check passed, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    const char *fake = argc > 1 ? argv[1] : "./fakedns";
+    char port[16], upstream[32], detail[256];
+    ResolveResult hosts;
+
+    srandom(time(NULL) ^ getpid());
+    snprintf(port, sizeof(port), "%d", argc > 2 ? atoi(argv[2]) : 20000 + (int)(random() % 20000));
+    snprintf(upstream, sizeof(upstream), "127.0.0.1:%s", port);
+    signal(SIGPIPE, SIG_IGN);
+    pid_t pid = start_fake(fake, port);
+    if (pid < 0)
+        return 2;
+    int sock = dns_open(upstream);
+    if (sock < 0)
+    {
+        fprintf(stderr, "dns_open(%s) failed\n", upstream);
+        kill(pid, SIGTERM);
+        return 2;
+    }
+
+    // every query of the batch is in flight at once
+    start = now_ms();
+    Case *plain = query("www.example.test", 0);
+    Case *delayed = query("delay300.example.test", 0);
+    Case *wrong_id = query("wrongid.example.test", 0);
+    Case *nx = query("nx.example.test", 0);
+    Case *ptr = query("192.0.2.7", 1);
+    Case *many = query("many200.example.test", 0);
+    Case *dropped = query("drop1.example.test", 0);
+    Case *never = query("never.example.test", 0);
+    run(sock);
+
+    check(has_address(plain, name_address(plain->name)) && plain->elapsed < 300, "A answer", "wrong or late address");
+    snprintf(detail, sizeof(detail), "answered after %lld ms", delayed->elapsed);
+    check(has_address(delayed, name_address(delayed->name)) && delayed->elapsed >= 300 &&
+              delayed->elapsed < DNS_TIMEOUT_MS,
+          "reply arriving after later queries' replies", detail);
+    check(has_address(wrong_id, name_address(wrong_id->name)),
+          "replies with another ID or question ignored", "took a bogus reply");
+    check(!nx->result.found && nx->elapsed < DNS_TIMEOUT_MS, "NXDOMAIN", "not reported at once");
+    check(ptr->result.found && strcmp(ptr->result.hostname, "host-192-0-2-7.fake") == 0, "PTR answer",
+          ptr->result.hostname);
+    snprintf(detail, sizeof(detail), "%d addresses", many->result.addr_count);
+    check(many->result.found && many->result.addr_count == 200, "200 A records through EDNS0", detail);
+    snprintf(detail, sizeof(detail), "found %d after %lld ms", dropped->result.found, dropped->elapsed);
+    check(has_address(dropped, name_address(dropped->name)) && dropped->elapsed >= DNS_TIMEOUT_MS &&
+              dropped->elapsed < 2 * DNS_TIMEOUT_MS,
+          "lost query retransmitted", detail);
+    snprintf(detail, sizeof(detail), "found %d after %lld ms", never->result.found, never->elapsed);
+    check(!never->result.found && never->elapsed >= DNS_TRIES * DNS_TIMEOUT_MS, "unanswered query times out",
+          detail);
+    // one transmission each, two for drop1, DNS_TRIES for never
+    long seen = queries_seen(sock);
+    snprintf(detail, sizeof(detail), "%ld queries", seen);
+    check(seen == 6 + 2 + DNS_TRIES, "transmissions counted by the upstream", detail);
+
+    if (dns_hosts_lookup("localhost", 0, &hosts) || dns_hosts_lookup("127.0.0.1", 1, &hosts))
+    {
+        check(dns_hosts_lookup("localhost", 0, &hosts) && hosts.addrs[0].s_addr == htonl(INADDR_LOOPBACK),
+              "hosts file name", "localhost is not 127.0.0.1");
+        check(dns_hosts_lookup("127.0.0.1", 1, &hosts) && hosts.hostname[0] != '\0', "hosts file address",
+              "127.0.0.1 has no name");
+    }
+    else
+    {
+        printf("skip hosts file checks: " HOSTS_FILE " has no localhost\n");
+    }
+    check(!dns_hosts_lookup("www.example.test", 0, &hosts), "name missing from the hosts file", "found");
+    check(queries_seen(sock) == seen, "hosts file lookups send no query", "a query was sent");
+
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    printf("%d failure(s)\n", failures);
+    return failures > 0 ? 2 : 0;
+}
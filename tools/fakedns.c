@@ -0,0 +1,363 @@
+/* Fake upstream DNS server for testing the w3 DNS client. It answers A and PTR
+ * queries over UDP on 127.0.0.1, and the first label of the name picks how:
+ *   nx...        NXDOMAIN
+ *   never...     no reply at all, every transmission is dropped
+ *   drop<N>...   the first N transmissions of a transaction ID are dropped
+ *   delay<MS>... the reply is sent MS milliseconds later
+ *   wrongid...   a reply with another ID and one with another question go first
+ *   many<N>...   N A records; without an EDNS0 payload size big enough for them
+ *                the reply is truncated to a bare header with TC set
+ *   anything else gets one A record, 10.x.y.z from an FNV-1a hash of the name
+ * PTR queries get host-a-b-c-d.fake. "count.fake" is answered with the number of
+ * queries received so far as an address, and "reset.fake" sets it back to 0. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_OPT 41
+#define CLASSIC_PAYLOAD 512 /* UDP reply size allowed without EDNS0 */
+#define MAX_PACKET 65535
+#define MAX_DELAYED 1024
+
+typedef struct
+{
+    long long due; // monotonic ms
+    struct sockaddr_in to;
+    int len;
+    uint8_t packet[4096];
+} DelayedReply;
+
+int sock;
+int verbose = 0;
+unsigned long queries = 0;       // queries received, count.fake and reset.fake aside
+uint8_t transmissions[65536];    // times each transaction ID was received, for drop<N>
+DelayedReply delayed[MAX_DELAYED];
+int delayed_count = 0;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Milliseconds since an arbitrary origin.
+ */
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief The address a plain name resolves to: 10.x.y.z from an FNV-1a hash of the
+ * lower-case name. dnstest computes the same.
+ */
+uint32_t name_address(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (uint8_t)(*name >= 'A' && *name <= 'Z' ? *name + 32 : *name);
+        hash *= 16777619u;
+    }
+    return htonl(10u << 24 | (hash & 0xffffff));
+}
+
+/**
+ * @brief Reads the uncompressed question name of a query as a dotted string.
+ * @return Position right after the name, -1 if it is malformed.
+ */
+int read_qname(const uint8_t *msg, int len, char *out, int size)
+{
+    int pos = DNS_HEADER_SIZE, out_len = 0;
+    while (pos < len && msg[pos] != 0)
+    {
+        int label_len = msg[pos];
+        if ((label_len & 0xc0) || pos + 1 + label_len >= len || out_len + label_len + 2 > size)
+            return -1;
+        if (out_len > 0)
+            out[out_len++] = '.';
+        memcpy(out + out_len, msg + pos + 1, label_len);
+        out_len += label_len;
+        pos += 1 + label_len;
+    }
+    if (pos >= len)
+        return -1;
+    out[out_len] = '\0';
+    return pos + 1;
+}
+
+/**
+ * @brief Finds the UDP payload size of the query's EDNS0 OPT record.
+ * @param pos Position right after the question.
+ * @return The payload size, 0 without an OPT record.
+ */
+int edns_payload(const uint8_t *msg, int len, int pos)
+{
+    int arcount = msg[10] << 8 | msg[11];
+    // the client sends no answer or authority records, and the OPT owner is the root
+    for (int i = 0; i < arcount && pos + 11 <= len; i++)
+    {
+        int type = msg[pos + 1] << 8 | msg[pos + 2];
+        int rdlength = msg[pos + 9] << 8 | msg[pos + 10];
+        if (msg[pos] == 0 && type == DNS_TYPE_OPT)
+            return msg[pos + 3] << 8 | msg[pos + 4];
+        pos += 11 + rdlength;
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends a resource record pointing back at the question name.
+ * @return The new length.
+ */
+int add_record(uint8_t *reply, int len, uint16_t type, const void *data, int data_len)
+{
+    uint8_t *p = reply + len;
+    p[0] = 0xc0;
+    p[1] = DNS_HEADER_SIZE; // the question name
+    p[2] = type >> 8;
+    p[3] = type & 0xff;
+    p[4] = 0;
+    p[5] = 1; // IN
+    p[6] = p[7] = p[8] = 0;
+    p[9] = 60; // TTL
+    p[10] = data_len >> 8;
+    p[11] = data_len & 0xff;
+    memcpy(p + 12, data, data_len);
+    reply[7]++; // ANCOUNT
+    if (reply[7] == 0)
+        reply[6]++;
+    return len + 12 + data_len;
+}
+
+/**
+ * @brief Sends a reply now, or later when it is delayed.
+ */
+void send_reply(const struct sockaddr_in *to, const uint8_t *reply, int len, int delay_ms)
+{
+    if (delay_ms > 0 && delayed_count < MAX_DELAYED && len <= (int)sizeof(delayed[0].packet))
+    {
+        DelayedReply *d = &delayed[delayed_count++];
+        d->due = now_ms() + delay_ms;
+        d->to = *to;
+        d->len = len;
+        memcpy(d->packet, reply, len);
+        return;
+    }
+    if (sendto(sock, reply, len, 0, (const struct sockaddr *)to, sizeof(*to)) < 0)
+        perror("sendto() error");
+}
+
+/**
+ * @brief Sends the delayed replies that are due.
+ * @return Milliseconds until the next one is, -1 if none is waiting.
+ */
+int send_due()
+{
+    long long now = now_ms(), next = -1;
+    for (int i = 0; i < delayed_count;)
+    {
+        if (delayed[i].due <= now)
+        {
+            send_reply(&delayed[i].to, delayed[i].packet, delayed[i].len, 0);
+            delayed[i] = delayed[--delayed_count];
+            continue;
+        }
+        if (next < 0 || delayed[i].due - now < next)
+            next = delayed[i].due - now;
+        i++;
+    }
+    return (int)next;
+}
+
+/**
+ * @brief Answers one query as its name asks.
+ */
+void answer(const uint8_t *msg, int len, const struct sockaddr_in *from)
+{
+    static uint8_t reply[MAX_PACKET];
+    char name[256];
+    int count = 0, delay = 0;
+
+    if (len < DNS_HEADER_SIZE || (msg[2] & 0x80))
+        return;
+    int end = read_qname(msg, len, name, sizeof(name));
+    if (end < 0 || end + 4 > len)
+        return;
+    uint16_t id = msg[0] << 8 | msg[1];
+    uint16_t qtype = msg[end] << 8 | msg[end + 1];
+    int payload = edns_payload(msg, len, end + 4);
+    int special = strcasecmp(name, "count.fake") == 0 || strcasecmp(name, "reset.fake") == 0;
+    if (!special)
+        queries++;
+    transmissions[id]++;
+    if (verbose)
+        printf("query id=%u %s type=%u edns=%d transmission=%u\n", id, name, qtype, payload, transmissions[id]);
+    fflush(stdout);
+
+    if (strncasecmp(name, "never", 5) == 0)
+        return;
+    if (sscanf(name, "drop%d", &count) == 1 && transmissions[id] <= count)
+        return;
+    sscanf(name, "delay%d", &delay);
+
+    // header and question echoed, recursion available, no authority or additional records
+    int pos = end + 4;
+    memcpy(reply, msg, pos);
+    reply[2] = 0x81;
+    reply[3] = 0x80;
+    reply[6] = reply[7] = reply[8] = reply[9] = reply[10] = reply[11] = 0;
+
+    if (strncasecmp(name, "nx", 2) == 0)
+    {
+        reply[3] = 0x83;
+    }
+    else if (qtype == DNS_TYPE_PTR)
+    {
+        unsigned a, b, c, d;
+        uint8_t host[64];
+        if (sscanf(name, "%u.%u.%u.%u.in-addr.arpa", &d, &c, &b, &a) == 4)
+        {
+            int n = snprintf((char *)host + 1, sizeof(host) - 1, "host-%u-%u-%u-%u", a, b, c, d);
+            host[0] = n;
+            memcpy(host + 1 + n, "\4fake", 6);
+            pos = add_record(reply, pos, DNS_TYPE_PTR, host, n + 7);
+        }
+        else
+        {
+            reply[3] = 0x83;
+        }
+    }
+    else if (strcasecmp(name, "count.fake") == 0 || strcasecmp(name, "reset.fake") == 0)
+    {
+        if (strcasecmp(name, "reset.fake") == 0)
+            queries = 0;
+        uint32_t addr = htonl(queries);
+        pos = add_record(reply, pos, DNS_TYPE_A, &addr, 4);
+    }
+    else if (sscanf(name, "many%d", &count) == 1)
+    {
+        int needed = pos + count * 16;
+        if (needed > (payload > CLASSIC_PAYLOAD ? payload : CLASSIC_PAYLOAD))
+        {
+            reply[2] |= 0x02; // TC: the answers do not fit
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                uint32_t addr = htonl(10u << 24 | 200u << 16 | i);
+                pos = add_record(reply, pos, DNS_TYPE_A, &addr, 4);
+            }
+        }
+    }
+    else
+    {
+        uint32_t addr = name_address(name);
+        if (strncasecmp(name, "wrongid", 7) == 0)
+        {
+            // a stale reply for another transaction, then one for another question
+            uint32_t wrong = htonl(10u << 24 | 66u << 16 | 66u << 8 | 66u);
+            int wrong_len = add_record(reply, pos, DNS_TYPE_A, &wrong, 4);
+            reply[1] ^= 1;
+            send_reply(from, reply, wrong_len, delay);
+            reply[1] ^= 1;
+            reply[DNS_HEADER_SIZE + 1] ^= 0x20; // flips the case of the first letter
+            send_reply(from, reply, wrong_len, delay);
+            reply[DNS_HEADER_SIZE + 1] ^= 0x20;
+            reply[6] = reply[7] = 0;
+        }
+        pos = add_record(reply, pos, DNS_TYPE_A, &addr, 4);
+    }
+    send_reply(from, reply, pos, delay);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-v] <port>\n"
+            "  -v           print every query received\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the fake DNS server.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    static uint8_t msg[MAX_PACKET];
+    struct sockaddr_in addr, from;
+    socklen_t from_len;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+    {
+        perror("socket() error");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(argv[optind]));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind() error");
+        return 1;
+    }
+    printf("Fake DNS server on 127.0.0.1:%s\n", argv[optind]);
+    fflush(stdout);
+
+    struct pollfd pfd = {sock, POLLIN, 0};
+    while (1)
+    {
+        if (poll(&pfd, 1, send_due()) < 0 && errno != EINTR)
+        {
+            perror("poll() error");
+            return 1;
+        }
+        if (pfd.revents & POLLIN)
+        {
+            from_len = sizeof(from);
+            ssize_t len = recvfrom(sock, msg, sizeof(msg), 0, (struct sockaddr *)&from, &from_len);
+            if (len >= 0)
+                answer(msg, len, &from);
+        }
+    }
+}
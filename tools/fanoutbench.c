@@ -0,0 +1,453 @@
+/* Fan-out benchmark of SUB in the w8 server: one poster and N subscribers. It starts
+ * the server in a scratch directory with an account file of its own, logs the
+ * subscribers in and sends SUB, then posts one message at a time and waits until
+ * every subscriber has it. Reports the delivery latency of each copy, the time until
+ * all copies are delivered, and the server's CPU per post from /proc. The
+ * subscribers are read by this process, which shares the machine with the server. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ACCOUNT_PREFIX "load"
+#define POST_TIMEOUT_MS 30000 /* time every subscriber has to get a post */
+#define MAX_EVENTS 256
+#define MAX_BODY 4000
+
+typedef struct
+{
+    int fd;
+    size_t got; // bytes of the current broadcast received
+} Subscriber;
+
+Subscriber *subs;
+int sub_count = 1000;
+int posts = 100;
+int body_size = 64;
+const char *engine = "epoll";
+int store = 0;
+struct sockaddr_in server_addr; /* server's address information */
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Starts the server and waits until it listens. Its output is discarded
+ * after that, and its errors all along.
+ * @param dir Directory to run it in.
+ * @return Its process id, -1 on error.
+ */
+pid_t start_server(const char *dir, char *const argv[])
+{
+    int fds[2];
+    char line[256];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *output = fdopen(fds[0], "r");
+    while (output != NULL && fgets(line, sizeof(line), output) != NULL)
+    {
+        if (strncmp(line, "Server started", 14) == 0)
+        {
+            fclose(output); // the server ignores SIGPIPE, so its later output is just dropped
+            return pid;
+        }
+    }
+    fprintf(stderr, "%s did not start\n", argv[0]);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * @brief Reads the CPU time a process has used, summed over its threads.
+ * @return Nanoseconds on a CPU, -1 on error.
+ */
+long long process_cpu_ns(pid_t pid)
+{
+    char path[PATH_MAX];
+    unsigned long long runtime;
+    long long total = 0;
+    struct dirent *entry;
+
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+    DIR *d = opendir(path);
+    if (d == NULL)
+        return -1;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        // the first field of schedstat is the time on a CPU in ns, finer than stat's ticks
+        snprintf(path, sizeof(path), "/proc/%d/task/%s/schedstat", (int)pid, entry->d_name);
+        FILE *f = fopen(path, "r");
+        if (f != NULL && fscanf(f, "%llu", &runtime) == 1)
+            total += runtime;
+        if (f != NULL)
+            fclose(f);
+    }
+    closedir(d);
+    return total;
+}
+
+/**
+ * @brief Reads from a blocking socket until a line starting with a reply code.
+ * @return 0 once it arrived, -1 on error or another reply.
+ */
+int expect(int fd, const char *code)
+{
+    char line[128];
+    size_t len = 0;
+
+    while (len < sizeof(line) - 1)
+    {
+        ssize_t n = recv(fd, line + len, 1, 0);
+        if (n <= 0)
+            return -1;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+    if (strncmp(line, code, strlen(code)) != 0)
+    {
+        fprintf(stderr, "Expected %s, got '%s'\n", code, line);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Connects and logs in as an account, subscribing if asked.
+ * @return The socket, -1 on error.
+ */
+int log_in(int account, int subscribe)
+{
+    char req[64];
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("connect() error");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int len = snprintf(req, sizeof(req), "USER " ACCOUNT_PREFIX "%d\r\n", account);
+    if (expect(fd, "100") < 0 || send(fd, req, len, 0) != len || expect(fd, "110") < 0 ||
+        (subscribe && (send(fd, "SUB\r\n", 5, 0) != 5 || expect(fd, "150") < 0)))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Orders latencies for qsort().
+ */
+int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Posts one message and reads its broadcast from every subscriber.
+ * @param latencies Filled with each subscriber's delivery latency, in ns.
+ * @param all Set to the time until the last subscriber had it, in ns.
+ * @return Number of subscribers that did not get it intact.
+ */
+int post_once(int epfd, int poster, int seq, long long *latencies, long long *all)
+{
+    static char body[MAX_BODY + 1], expected[MAX_BODY + 64], post[MAX_BODY + 16], buf[65536];
+    struct epoll_event events[MAX_EVENTS];
+    int waiting = sub_count, bad = 0;
+    char number[16];
+
+    int number_len = snprintf(number, sizeof(number), "%08d", seq);
+    memset(body, 'x', body_size); // the post number, padded to the body size
+    memcpy(body, number, number_len < body_size ? number_len : body_size);
+    body[body_size] = '\0';
+    size_t expected_len =
+        snprintf(expected, sizeof(expected), "170 " ACCOUNT_PREFIX "0 %d\r\n%s\r\n", body_size, body);
+    int post_len = snprintf(post, sizeof(post), "POST %s\r\n", body);
+    for (int i = 0; i < sub_count; i++)
+        subs[i].got = 0;
+
+    long long start = now_ns();
+    if (send(poster, post, post_len, 0) != post_len || expect(poster, "120") < 0)
+        return sub_count;
+    while (waiting > 0)
+    {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, POST_TIMEOUT_MS);
+        if (n <= 0)
+            break;
+        long long now = now_ns();
+        for (int e = 0; e < n; e++)
+        {
+            Subscriber *s = &subs[events[e].data.u32];
+            ssize_t len;
+            while ((len = recv(s->fd, buf, sizeof(buf), 0)) > 0)
+            {
+                if (s->got + len > expected_len || memcmp(buf, expected + s->got, len) != 0)
+                {
+                    fprintf(stderr, "Subscriber %d got '%.*s'\n", (int)(s - subs), (int)len, buf);
+                    bad++;
+                    s->got = expected_len + 1; // no longer waited for
+                    waiting--;
+                    break;
+                }
+                s->got += len;
+                if (s->got == expected_len)
+                {
+                    latencies[s - subs] = now - start;
+                    waiting--;
+                }
+            }
+        }
+    }
+    *all = now_ns() - start;
+    for (int i = 0; i < sub_count; i++)
+    {
+        if (subs[i].got < expected_len)
+        {
+            latencies[i] = POST_TIMEOUT_MS * 1000000LL;
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/**
+ * @brief Deletes the files of a directory and the directory.
+ */
+void remove_dir(const char *dir)
+{
+    char path[PATH_MAX + 256];
+    struct dirent *entry;
+    DIR *d = opendir(dir);
+
+    while (d != NULL && (entry = readdir(d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    if (d != NULL)
+        closedir(d);
+    rmdir(dir);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [server]\n"
+            "  -c subs      subscribers (default 1000)\n"
+            "  -n posts     messages posted, one at a time (default 100)\n"
+            "  -b bytes     message size (default 64, at most %d)\n"
+            "  -e engine    select, epoll or uring (default epoll)\n"
+            "  -m           store the posts in a log, so broadcasts wait until they are durable\n"
+            "The server defaults to ./server.\n",
+            prog, MAX_BODY);
+}
+
+/**
+ * @brief Main function of the fan-out benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every subscriber got every post, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    char server[PATH_MAX], dir[] = "/tmp/fanoutbench.XXXXXX", path[PATH_MAX], port_arg[16];
+    struct rlimit rl;
+    int opt, bad = 0;
+
+    while ((opt = getopt(argc, argv, "c:n:b:e:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            sub_count = atoi(optarg);
+            break;
+        case 'n':
+            posts = atoi(optarg);
+            break;
+        case 'b':
+            body_size = atoi(optarg);
+            break;
+        case 'e':
+            engine = optarg;
+            break;
+        case 'm':
+            store = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 1 || sub_count <= 0 || posts <= 0 || body_size <= 0 || body_size > MAX_BODY)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (realpath(optind < argc ? argv[optind] : "./server", server) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+    // the server inherits the limit, and needs a descriptor per subscriber too
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)sub_count + 64)
+    {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)sub_count + 64 ? rl.rlim_max : (rlim_t)sub_count + 64;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // the server reads TCP_Server/account.txt under its working directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen() error");
+        return 1;
+    }
+    for (int i = 0; i <= sub_count; i++)
+        fprintf(f, ACCOUNT_PREFIX "%d 1\n", i);
+    fclose(f);
+
+    srandom(time(NULL) ^ getpid());
+    int port = 20000 + random() % 20000;
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *server_argv[] = {server, "-e", (char *)engine, "-t", "0", store ? "-m" : port_arg,
+                           store ? "msgs" : NULL, port_arg, NULL};
+    pid_t server_pid = start_server(dir, server_argv);
+    subs = calloc(sub_count, sizeof(Subscriber));
+    long long *latencies = calloc((size_t)sub_count * posts, sizeof(long long));
+    long long *all = calloc(posts, sizeof(long long));
+    int epfd = epoll_create1(0);
+    int poster = -1;
+
+    if (server_pid < 0 || subs == NULL || latencies == NULL || all == NULL || epfd < 0)
+    {
+        bad++;
+        goto out;
+    }
+    for (int i = 0; i < sub_count; i++)
+    {
+        if ((subs[i].fd = log_in(i + 1, 1)) < 0)
+        {
+            fprintf(stderr, "Subscriber %d could not subscribe\n", i);
+            bad++;
+            goto out;
+        }
+        struct epoll_event ev = {EPOLLIN, {.u32 = i}};
+        fcntl(subs[i].fd, F_SETFL, O_NONBLOCK);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, subs[i].fd, &ev);
+    }
+    if ((poster = log_in(0, 0)) < 0)
+    {
+        bad++;
+        goto out;
+    }
+
+    long long cpu_start = process_cpu_ns(server_pid);
+    for (int p = 0; p < posts; p++)
+        bad += post_once(epfd, poster, p, latencies + (size_t)p * sub_count, &all[p]);
+    long long cpu = process_cpu_ns(server_pid) - cpu_start;
+
+    size_t total = (size_t)sub_count * posts;
+    qsort(latencies, total, sizeof(long long), compare_ll);
+    qsort(all, posts, sizeof(long long), compare_ll);
+    printf("%d subscribers, %d posts of %d bytes, %s engine%s, %d missing or wrong\n", sub_count, posts, body_size,
+           engine, store ? " with the store" : "", bad);
+    printf("delivery      p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n", latencies[total / 2] / 1e6,
+           latencies[(size_t)(total * 0.99)] / 1e6, latencies[total - 1] / 1e6);
+    printf("all delivered p50 %8.2f ms  max %8.2f ms\n", all[posts / 2] / 1e6, all[posts - 1] / 1e6);
+    printf("server CPU    %8.3f ms per post, %6.2f us per delivery\n", cpu / 1e6 / posts, cpu / 1e3 / total);
+
+out:
+    if (poster >= 0)
+        close(poster);
+    for (int i = 0; subs != NULL && i < sub_count; i++)
+        if (subs[i].fd > 0)
+            close(subs[i].fd);
+    if (server_pid > 0)
+    {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    snprintf(path, sizeof(path), "%s/msgs", dir);
+    remove_dir(path);
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    return bad > 0 ? 2 : 0;
+}
@@ -0,0 +1,392 @@
+/* Thundering-herd test of the w3 server's lookup coalescing. It starts fakedns and
+ * the server, resolving through it, in a scratch directory; then each round N
+ * clients ask for the same name at once, and the name is answered slowly so all of
+ * them arrive while its lookup is pending. Every client must get the right reply,
+ * and the upstream must see one query per round. Reply latency is reported. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dnsclient.h"
+
+#define REPLY_SIZE 8193
+#define REPLY_TIMEOUT_MS 5000
+
+int client_count = 200;
+int rounds = 20;
+int delay_ms = 200;
+int dns_sock;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief The address fakedns gives a plain name: 10.x.y.z from an FNV-1a hash of
+ * the lower-case name.
+ */
+uint32_t name_address(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (uint8_t)(*name >= 'A' && *name <= 'Z' ? *name + 32 : *name);
+        hash *= 16777619u;
+    }
+    return htonl(10u << 24 | (hash & 0xffffff));
+}
+
+/**
+ * @brief Starts a program with its output discarded, or piped back when ready_line
+ * is given, in which case the call waits for that line.
+ * @param dir Directory to run it in, NULL for the current one.
+ * @return Its process id, -1 on error.
+ */
+pid_t start(const char *dir, const char *ready_line, char *const argv[])
+{
+    int fds[2];
+    char line[128];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        if (ready_line == NULL)
+            dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        else
+            dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (dir != NULL && chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        perror("execv() error");
+        _exit(127);
+    }
+    close(fds[1]);
+    if (ready_line == NULL)
+    {
+        close(fds[0]);
+        return pid;
+    }
+    // the pipe stays open, so the program can go on writing to it
+    FILE *out = fdopen(fds[0], "r");
+    if (out == NULL || fgets(line, sizeof(line), out) == NULL || strncmp(line, ready_line, strlen(ready_line)) != 0)
+    {
+        fprintf(stderr, "%s did not start\n", argv[0]);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Connects a UDP socket to the server.
+ * @return The socket, -1 on error.
+ */
+int open_client(int port)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("socket() error");
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Sends a query until the server answers it, for when it has just started.
+ * @return 0 once it answers, -1 if it never does.
+ */
+int wait_for_server(int fd)
+{
+    char reply[REPLY_SIZE];
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    for (int i = 0; i < 100; i++)
+    {
+        // until the server is bound, send() or recv() fail at once with ECONNREFUSED
+        if (send(fd, "nx.ready.test", 13, 0) >= 0 && poll(&pfd, 1, 50) > 0 && recv(fd, reply, sizeof(reply), 0) > 0)
+            return 0;
+        usleep(50000);
+    }
+    return -1;
+}
+
+/**
+ * @brief DNS client callback: stores the address of the answer.
+ */
+void on_count(void *ctx, const ResolveResult *result)
+{
+    *(long *)ctx = result->found ? (long)ntohl(result->addrs[0].s_addr) : -2;
+}
+
+/**
+ * @brief Asks fakedns a special name: count.fake for the queries it received since
+ * the last reset.fake.
+ * @return The count, -1 on error.
+ */
+long ask_fake(const char *name)
+{
+    struct pollfd pfd = {dns_sock, POLLIN, 0};
+    long value = -1;
+
+    if (dns_query(name, 0, on_count, &value) < 0)
+        return -1;
+    while (value == -1)
+    {
+        if (poll(&pfd, 1, dns_next_timeout()) > 0)
+            dns_process_replies();
+        dns_expire();
+    }
+    return value < 0 ? -1 : value;
+}
+
+/**
+ * @brief Orders latencies for qsort().
+ */
+int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Runs one round: every client sends the same query back to back, then the
+ * replies are collected and checked.
+ * @param latencies Filled with each client's reply latency, in ns.
+ * @return Number of wrong or missing replies.
+ */
+int run_round(int *fds, int round, long long *latencies)
+{
+    char name[128], expected[64], reply[REPLY_SIZE];
+    struct in_addr addr;
+    struct pollfd *pfds = calloc(client_count, sizeof(struct pollfd));
+    long long *sent = calloc(client_count, sizeof(long long));
+    int errors = 0, waiting = client_count;
+
+    if (pfds == NULL || sent == NULL)
+    {
+        perror("calloc() error");
+        exit(2);
+    }
+    snprintf(name, sizeof(name), "delay%d.r%d.herd.test", delay_ms, round);
+    addr.s_addr = name_address(name);
+    snprintf(expected, sizeof(expected), "+%s", inet_ntoa(addr));
+
+    for (int i = 0; i < client_count; i++)
+    {
+        sent[i] = now_ns();
+        if (send(fds[i], name, strlen(name), 0) < 0)
+            perror("send() error");
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    long long deadline = now_ns() + REPLY_TIMEOUT_MS * 1000000LL;
+    while (waiting > 0 && now_ns() < deadline)
+    {
+        if (poll(pfds, client_count, REPLY_TIMEOUT_MS) <= 0)
+            break;
+        for (int i = 0; i < client_count; i++)
+        {
+            if (!(pfds[i].revents & POLLIN))
+                continue;
+            ssize_t len = recv(fds[i], reply, sizeof(reply) - 1, 0);
+            latencies[i] = now_ns() - sent[i];
+            pfds[i].fd = -1; // one reply per client
+            waiting--;
+            reply[len > 0 ? len : 0] = '\0';
+            if (strcmp(reply, expected) != 0)
+            {
+                fprintf(stderr, "Round %d client %d: got '%s', expected '%s'\n", round, i, reply, expected);
+                errors++;
+            }
+        }
+    }
+    for (int i = 0; i < client_count; i++)
+    {
+        if (pfds[i].fd >= 0)
+        {
+            latencies[i] = REPLY_TIMEOUT_MS * 1000000LL;
+            errors++;
+        }
+    }
+    if (waiting > 0)
+        fprintf(stderr, "Round %d: %d clients got no reply\n", round, waiting);
+    free(pfds);
+    free(sent);
+    return errors;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [server [fakedns]]\n"
+            "  -n clients   clients asking for the same name at once (default 200); past about\n"
+            "               250 the server's default UDP receive buffer drops the extra queries\n"
+            "  -r rounds    rounds, each for a new name (default 20)\n"
+            "  -d ms        time fakedns takes to answer (default 200)\n"
+            "The programs default to ./server and ./fakedns.\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the herd test.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every check passed, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    char server[PATH_MAX], fake[PATH_MAX], dir[] = "/tmp/herdtest.XXXXXX", path[PATH_MAX];
+    char port[16], dns_port[16], upstream[32];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            client_count = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'd':
+            delay_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 2 || client_count <= 0 || rounds <= 0 || delay_ms < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (realpath(optind < argc ? argv[optind] : "./server", server) == NULL ||
+        realpath(optind + 1 < argc ? argv[optind + 1] : "./fakedns", fake) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+    // the server logs to UDP_Server/ under its working directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/UDP_Server", dir);
+    if (mkdir(path, 0755) < 0)
+    {
+        perror("mkdir() error");
+        return 1;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    int base = 20000 + random() % 20000;
+    snprintf(port, sizeof(port), "%d", base);
+    snprintf(dns_port, sizeof(dns_port), "%d", base + 1);
+    snprintf(upstream, sizeof(upstream), "127.0.0.1:%d", base + 1);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *fake_argv[] = {fake, dns_port, NULL};
+    char *server_argv[] = {server, port, upstream, NULL};
+    pid_t fake_pid = start(NULL, "Fake DNS", fake_argv);
+    pid_t server_pid = fake_pid < 0 ? -1 : start(dir, NULL, server_argv);
+    int *fds = calloc(client_count, sizeof(int));
+    long long *latencies = calloc((size_t)client_count * rounds, sizeof(long long));
+    int errors = 0;
+
+    if (server_pid < 0 || fds == NULL || latencies == NULL || (dns_sock = dns_open(upstream)) < 0)
+    {
+        errors++;
+        goto out;
+    }
+    for (int i = 0; i < client_count; i++)
+    {
+        if ((fds[i] = open_client(base)) < 0)
+        {
+            errors++;
+            goto out;
+        }
+    }
+    if (wait_for_server(fds[0]) < 0)
+    {
+        fprintf(stderr, "The server does not answer\n");
+        errors++;
+        goto out;
+    }
+    ask_fake("reset.fake");
+
+    long long start_ns = now_ns();
+    for (int r = 0; r < rounds; r++)
+        errors += run_round(fds, r, latencies + (size_t)r * client_count);
+    double elapsed = (now_ns() - start_ns) / 1e9;
+    long upstream_queries = ask_fake("count.fake");
+
+    size_t total = (size_t)client_count * rounds;
+    qsort(latencies, total, sizeof(long long), compare_ll);
+    printf("queries     %zu from %d clients in %d rounds, %.2f s, %d bad or missing replies\n", total, client_count,
+           rounds, elapsed, errors);
+    printf("upstream    %ld lookups for %d names (%d expected)\n", upstream_queries, rounds, rounds);
+    printf("latency     p50 %.1f ms  p99 %.1f ms  max %.1f ms  (upstream answers in %d ms)\n",
+           latencies[total / 2] / 1e6, latencies[(size_t)(total * 0.99)] / 1e6, latencies[total - 1] / 1e6, delay_ms);
+    if (upstream_queries != rounds)
+        errors++;
+
+out:
+    if (server_pid > 0)
+        kill(server_pid, SIGTERM);
+    if (fake_pid > 0)
+        kill(fake_pid, SIGTERM);
+    while (wait(NULL) > 0)
+        ;
+    snprintf(path, sizeof(path), "%s/UDP_Server/log_20225839.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/UDP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    printf("%s\n", errors > 0 ? "FAILED" : "ok");
+    return errors > 0 ? 2 : 0;
+}
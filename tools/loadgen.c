@@ -0,0 +1,589 @@
+/* Load generator for the USER/POST/BYE login protocol (w5, w6, w7 servers) */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MAX_EVENTS 256
+#define CONNECT_BATCH 16  /* connects in flight at once, the servers listen with a backlog of 20 */
+#define ACCOUNT_PREFIX "load"
+#define REQ_SIZE 128
+
+#define CONNECTED_CODE 100
+#define LOGIN_CODE 110
+#define POST_CODE 120
+#define LOGOUT_CODE 130
+
+typedef enum
+{
+    CONN_CONNECTING, // connect() in progress or waiting for the 100 greeting
+    CONN_IDLE,       // ready to send the next request
+    CONN_WAITING,    // request sent, waiting for its reply
+    CONN_DEAD
+} ConnState;
+
+typedef struct
+{
+    int fd;
+    ConnState state;
+    int account;        // index of the account this connection logs in as
+    int greeted;        // 1 once the 100 greeting has arrived
+    int step;           // 0 = USER, 1..posts = POST, posts + 1 = BYE
+    int expected;       // reply code the request in flight should get
+    long long start_ns; // when the request in flight was due (open loop) or sent (closed loop)
+    int code_len;       // digits of the reply code received so far
+    int code;
+} Conn;
+
+Conn *conns;
+int conn_count = 100;
+int account_count = 0; // 0: one account per connection
+int posts_per_login = 8;
+long long total_requests = 100000;
+double duration = 0;   // seconds, 0: run until total_requests are answered
+double rate = 0;       // requests per second, 0: closed loop
+int reconnect = 0;     // close and reopen the connection after each BYE
+char post_body[REQ_SIZE] = "hello";
+struct sockaddr_in server_addr; /* server's address information */
+int epfd;
+
+long long *latencies; // ns, one per answered request
+long long latency_cap = 0;
+Conn **idle;          // connections ready for a request, used as a stack
+int idle_count = 0;
+long long answered = 0, issued = 0, lost = 0, errors = 0, connect_errors = 0;
+long long reply_counts[1000];
+int connected = 0, connecting = 0, next_to_connect = 0, opened = 0;
+long long t0;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Writes an account file with count active accounts named load0, load1...
+ * to load into a server instead of its own TCP_Server/account.txt.
+ * @param count Number of accounts.
+ * @param filename Path of the file to write.
+ * @return 0 on success, -1 on error.
+ */
+int generate_accounts(int count, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        perror("fopen() error");
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+        fprintf(f, ACCOUNT_PREFIX "%d 1\n", i);
+    if (fclose(f) != 0)
+    {
+        perror("fclose() error");
+        return -1;
+    }
+    printf("Wrote %d accounts to %s\n", count, filename);
+    return 0;
+}
+
+/**
+ * @brief Starts a non-blocking connect for a connection slot.
+ * @param c The connection.
+ */
+void start_connect(Conn *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+    {
+        perror("socket() error");
+        c->state = CONN_DEAD;
+        connect_errors++;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c->state = CONN_CONNECTING;
+    c->greeted = 0;
+    c->step = 0;
+    c->code = 0;
+    c->code_len = 0;
+    connecting++;
+    if (connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        perror("connect() error");
+        close(c->fd);
+        c->state = CONN_DEAD;
+        connecting--;
+        connect_errors++;
+        return;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = c};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+/**
+ * @brief Keeps up to CONNECT_BATCH connects in flight until every slot has been opened.
+ */
+void ramp_up()
+{
+    while (connecting < CONNECT_BATCH && next_to_connect < conn_count)
+        start_connect(&conns[next_to_connect++]);
+}
+
+/**
+ * @brief Closes a connection for good, dropping the request it had in flight.
+ * @param c The connection.
+ */
+void kill_conn(Conn *c)
+{
+    if (c->state == CONN_CONNECTING)
+        connecting--;
+    else
+        connected--;
+    if (c->state == CONN_WAITING)
+    {
+        lost++;
+        errors++;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->state = CONN_DEAD;
+}
+
+/**
+ * @brief Sends the next request of the connection's USER, POST..., BYE script.
+ * @param c An idle connection.
+ * @param start_ns Time the request counts from.
+ */
+void send_request(Conn *c, long long start_ns)
+{
+    char req[REQ_SIZE + 16];
+    int len;
+
+    if (c->step == 0)
+    {
+        len = snprintf(req, sizeof(req), "USER " ACCOUNT_PREFIX "%d\r\n", c->account);
+        c->expected = LOGIN_CODE;
+    }
+    else if (c->step <= posts_per_login)
+    {
+        len = snprintf(req, sizeof(req), "POST %s\r\n", post_body);
+        c->expected = POST_CODE;
+    }
+    else
+    {
+        len = snprintf(req, sizeof(req), "BYE\r\n");
+        c->expected = LOGOUT_CODE;
+    }
+
+    c->start_ns = start_ns;
+    c->state = CONN_WAITING;
+    issued++;
+    if (send(c->fd, req, len, MSG_NOSIGNAL) != len)
+    {
+        perror("send() error");
+        kill_conn(c);
+    }
+}
+
+/**
+ * @brief Records a reply code: the greeting makes the connection ready, any
+ * other code completes the request in flight.
+ * @param c The connection.
+ * @param code The three-digit reply code.
+ */
+void handle_reply(Conn *c, int code)
+{
+    reply_counts[code]++;
+
+    if (c->state == CONN_CONNECTING)
+    {
+        if (code != CONNECTED_CODE)
+            errors++;
+        connecting--;
+        connected++;
+        opened++;
+        c->state = CONN_IDLE;
+        idle[idle_count++] = c;
+        return;
+    }
+    if (c->state != CONN_WAITING)
+    {
+        errors++; // a reply nobody asked for
+        return;
+    }
+
+    if (answered == latency_cap)
+    {
+        latency_cap = latency_cap ? latency_cap * 2 : 65536;
+        latencies = realloc(latencies, latency_cap * sizeof(long long));
+        if (latencies == NULL)
+        {
+            perror("realloc() error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    latencies[answered++] = now_ns() - c->start_ns;
+    if (code != c->expected)
+        errors++;
+    c->state = CONN_IDLE;
+    if (++c->step > posts_per_login + 1)
+    {
+        c->step = 0;
+        if (reconnect)
+        {
+            kill_conn(c);
+            start_connect(c);
+            return;
+        }
+    }
+    idle[idle_count++] = c;
+}
+
+/**
+ * @brief Reads what the server sent and parses it as three-digit reply codes.
+ * The w5 server sends bare codes, w6 and w7 end them with CRLF, so any
+ * non-digit byte is skipped.
+ * @param c The connection.
+ */
+void receive_replies(Conn *c)
+{
+    char buf[4096];
+    int fd = c->fd;
+
+    while (c->state != CONN_DEAD && c->fd == fd) // reopened after a BYE otherwise
+    {
+        ssize_t bytes = recv(c->fd, buf, sizeof(buf), 0);
+        if (bytes < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            kill_conn(c);
+            return;
+        }
+        if (bytes == 0)
+        {
+            kill_conn(c);
+            return;
+        }
+        for (ssize_t i = 0; i < bytes && c->state != CONN_DEAD && c->fd == fd; i++)
+        {
+            if (buf[i] < '0' || buf[i] > '9')
+                continue;
+            c->code = c->code * 10 + (buf[i] - '0');
+            if (++c->code_len == 3)
+            {
+                handle_reply(c, c->code);
+                c->code = 0;
+                c->code_len = 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Handles readiness of one connection.
+ * @param c The connection.
+ * @param events The epoll events reported.
+ */
+void handle_event(Conn *c, unsigned int events)
+{
+    if (c->state == CONN_CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+        {
+            kill_conn(c);
+            connect_errors++;
+            return;
+        }
+        if (!c->greeted)
+        {
+            c->greeted = 1;
+            struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        receive_replies(c);
+}
+
+/**
+ * @brief Sends requests on idle connections. In closed loop every idle connection
+ * sends right away. In open loop request k is due at t0 + k / rate whether or not a
+ * connection is free, and its latency counts from that time, so a stalled server is
+ * charged for the requests it kept waiting.
+ * @param now Current time.
+ * @param limit Number of requests to issue in total.
+ */
+void issue_requests(long long now, long long limit)
+{
+    while (idle_count > 0 && issued < limit)
+    {
+        long long start = now;
+        if (rate > 0)
+        {
+            start = t0 + (long long)(issued * 1e9 / rate);
+            if (start > now)
+                return;
+        }
+        Conn *c = idle[--idle_count];
+        if (c->state == CONN_IDLE) // closed by the server while idle otherwise
+            send_request(c, start);
+    }
+}
+
+/**
+ * @brief Compares two latencies for qsort().
+ */
+int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns a percentile of the sorted latencies.
+ * @param p Percentile, between 0 and 100.
+ * @return The latency in milliseconds.
+ */
+double percentile(double p)
+{
+    if (answered == 0)
+        return 0;
+    long long k = (long long)(p / 100 * answered);
+    if (k >= answered)
+        k = answered - 1;
+    return latencies[k] / 1e6;
+}
+
+/**
+ * @brief Prints throughput, latency percentiles and the reply codes seen.
+ * @param elapsed Run time in seconds.
+ */
+void print_report(double elapsed)
+{
+    qsort(latencies, answered, sizeof(long long), compare_ll);
+
+    printf("connections %d opened, %lld failed to connect\n", opened, connect_errors);
+    printf("requests    %lld answered in %.2f s, %.0f req/s, %lld errors\n",
+           answered, elapsed, elapsed > 0 ? answered / elapsed : 0, errors);
+    printf("latency     p50 %.3f ms  p99 %.3f ms  p999 %.3f ms  max %.3f ms\n",
+           percentile(50), percentile(99), percentile(99.9), answered ? latencies[answered - 1] / 1e6 : 0);
+    printf("replies    ");
+    for (int code = 0; code < 1000; code++)
+        if (reply_counts[code] > 0)
+            printf(" %03d:%lld", code, reply_counts[code]);
+    printf("\n");
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <server_ip> <server_port>\n"
+            "       %s -g <count> <account_file>\n"
+            "  -c conns     concurrent connections (default 100)\n"
+            "  -a accounts  accounts to log in as, load0..; default one per connection\n"
+            "  -p posts     POST requests between USER and BYE (default 8)\n"
+            "  -n requests  requests to send (default 100000)\n"
+            "  -d seconds   stop after this long instead\n"
+            "  -r rate      open loop at this many requests/s (default closed loop)\n"
+            "  -m message   body of the POST requests\n"
+            "  -k           reconnect after each BYE\n"
+            "  -g count     write an account file with count accounts and exit\n",
+            prog, prog);
+}
+
+/**
+ * @brief Main function of the load generator.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    int opt, generate = 0;
+
+    while ((opt = getopt(argc, argv, "c:a:p:n:d:r:m:kg:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            conn_count = atoi(optarg);
+            break;
+        case 'a':
+            account_count = atoi(optarg);
+            break;
+        case 'p':
+            posts_per_login = atoi(optarg);
+            break;
+        case 'n':
+            total_requests = atoll(optarg);
+            break;
+        case 'd':
+            duration = atof(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'm':
+            snprintf(post_body, sizeof(post_body), "%s", optarg);
+            break;
+        case 'k':
+            reconnect = 1;
+            break;
+        case 'g':
+            generate = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (generate > 0)
+    {
+        if (argc - optind != 1)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return generate_accounts(generate, argv[optind]) == 0 ? 0 : 1;
+    }
+    if (argc - optind != 2 || conn_count <= 0 || posts_per_login < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (account_count <= 0)
+        account_count = conn_count;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind + 1]));
+    server_addr.sin_addr.s_addr = inet_addr(argv[optind]);
+
+    // Thousands of sockets need more than the default 1024 descriptors
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)conn_count + 16)
+    {
+        rl.rlim_cur = rl.rlim_max < (rlim_t)conn_count + 16 ? rl.rlim_max : (rlim_t)conn_count + 16;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    long long limit = duration > 0 ? __LONG_LONG_MAX__ : total_requests;
+    conns = calloc(conn_count, sizeof(Conn));
+    idle = malloc(conn_count * sizeof(Conn *));
+    if (conns == NULL || idle == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    for (int i = 0; i < conn_count; i++)
+    {
+        conns[i].account = i % account_count;
+        conns[i].state = CONN_DEAD;
+    }
+
+    if ((epfd = epoll_create1(0)) < 0)
+    {
+        perror("epoll_create1() error");
+        return 1;
+    }
+
+    // Open every connection and wait for its greeting before the clock starts
+    ramp_up();
+    while (connecting > 0 || next_to_connect < conn_count)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 5000);
+        if (n == 0)
+            break; // the server stopped answering, run with what is open
+        for (int i = 0; i < n; i++)
+            handle_event(events[i].data.ptr, events[i].events);
+        ramp_up();
+    }
+    if (connected == 0)
+    {
+        fprintf(stderr, "No connection could be opened\n");
+        return 1;
+    }
+
+    // Open loop wakes up on a timer at each due time; epoll_wait() only has millisecond
+    // resolution, and the delay would be charged to the server
+    int timerfd = -1;
+    if (rate > 0)
+    {
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timerfd < 0)
+        {
+            perror("timerfd_create() error");
+            return 1;
+        }
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &ev);
+    }
+
+    t0 = now_ns();
+    long long stop = duration > 0 ? t0 + (long long)(duration * 1e9) : 0;
+    while (1)
+    {
+        long long now = now_ns();
+        if (stop != 0 && now >= stop)
+            break;
+        issue_requests(now, limit);
+        if (issued >= limit && answered + lost >= issued)
+            break;
+        if (connected == 0 && connecting == 0)
+            break;
+
+        if (rate > 0 && issued < limit && idle_count > 0)
+        {
+            long long due = t0 + (long long)(issued * 1e9 / rate);
+            struct itimerspec its = {.it_value = {due / 1000000000LL, due % 1000000000LL}};
+            timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+        struct epoll_event events[MAX_EVENTS];
+        int n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                unsigned long long expirations;
+                read(timerfd, &expirations, sizeof(expirations));
+                continue;
+            }
+            handle_event(events[i].data.ptr, events[i].events);
+        }
+    }
+
+    print_report((now_ns() - t0) / 1e9);
+    return errors > 0 ? 2 : 0;
+}
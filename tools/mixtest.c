@@ -0,0 +1,496 @@
+/* Mixed-protocol test of the w3 server: binary (0x01-framed) and text queries are
+ * interleaved on one socket, against fakedns started like in herdtest. Binary
+ * replies are matched by request id and text replies by content, since a slow
+ * name makes them come back out of order; a binary reply must carry the same answer
+ * as the text one. Malformed binary queries get BIN_STATUS_BAD_REQUEST, and a text
+ * and a binary query for the same name share one upstream lookup. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "binproto.h"
+#include "dnsclient.h"
+
+#define REPLY_SIZE 8193
+#define REPLY_TIMEOUT_MS 5000
+#define STRAY_WAIT_MS 200 /* time left for replies nobody should get */
+#define NOT_FOUND_MSG "-Information not found"
+
+typedef struct
+{
+    const char *name;
+    int binary;
+    uint8_t qtype;        // binary queries only
+    uint16_t id;          // binary queries only
+    const uint8_t *raw;   // malformed binary query sent as is, NULL to encode one
+    int raw_len;
+    uint8_t status;       // expected BIN_STATUS_* of a binary reply
+    char expected[REPLY_SIZE]; // expected text reply, or the text form of the binary one
+    int answered;
+} Request;
+
+int dns_sock;
+int failures = 0;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Milliseconds since an arbitrary origin.
+ */
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief The address fakedns gives a plain name: 10.x.y.z from an FNV-1a hash of
+ * the lower-case name.
+ */
+uint32_t name_address(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash ^= (uint8_t)(*name >= 'A' && *name <= 'Z' ? *name + 32 : *name);
+        hash *= 16777619u;
+    }
+    return htonl(10u << 24 | (hash & 0xffffff));
+}
+
+/**
+ * @brief Prints the outcome of a check and counts failures.
+ */
+void check(int ok, const char *what, const char *detail)
+{
+    printf("%s %s%s%s\n", ok ? "ok  " : "FAIL", what, ok ? "" : ": ", ok ? "" : detail);
+    failures += !ok;
+}
+
+/**
+ * @brief Starts a program with its output discarded, or piped back when ready_line
+ * is given, in which case the call waits for that line.
+ * @param dir Directory to run it in, NULL for the current one.
+ * @return Its process id, -1 on error.
+ */
+pid_t start(const char *dir, const char *ready_line, char *const argv[])
+{
+    int fds[2];
+    char line[128];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        if (ready_line == NULL)
+            dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+        else
+            dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (dir != NULL && chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        perror("execv() error");
+        _exit(127);
+    }
+    close(fds[1]);
+    if (ready_line == NULL)
+    {
+        close(fds[0]);
+        return pid;
+    }
+    // the pipe stays open, so the program can go on writing to it
+    FILE *out = fdopen(fds[0], "r");
+    if (out == NULL || fgets(line, sizeof(line), out) == NULL || strncmp(line, ready_line, strlen(ready_line)) != 0)
+    {
+        fprintf(stderr, "%s did not start\n", argv[0]);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+/**
+ * @brief Connects a UDP socket to the server.
+ * @return The socket, -1 on error.
+ */
+int open_client(int port)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("socket() error");
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Sends a query until the server answers it, for when it has just started.
+ * @return 0 once it answers, -1 if it never does.
+ */
+int wait_for_server(int fd)
+{
+    char reply[REPLY_SIZE];
+    struct pollfd pfd = {fd, POLLIN, 0};
+
+    for (int i = 0; i < 100; i++)
+    {
+        // until the server is bound, send() or recv() fail at once with ECONNREFUSED
+        if (send(fd, "nx.ready.test", 13, 0) >= 0 && poll(&pfd, 1, 50) > 0 && recv(fd, reply, sizeof(reply), 0) > 0)
+            return 0;
+        usleep(50000);
+    }
+    return -1;
+}
+
+/**
+ * @brief DNS client callback: stores the address of the answer.
+ */
+void on_count(void *ctx, const ResolveResult *result)
+{
+    *(long *)ctx = result->found ? (long)ntohl(result->addrs[0].s_addr) : -2;
+}
+
+/**
+ * @brief Asks fakedns a special name: count.fake for the queries it received since
+ * the last reset.fake.
+ * @return The count, -1 on error.
+ */
+long ask_fake(const char *name)
+{
+    struct pollfd pfd = {dns_sock, POLLIN, 0};
+    long value = -1;
+
+    if (dns_query(name, 0, on_count, &value) < 0)
+        return -1;
+    while (value == -1)
+    {
+        if (poll(&pfd, 1, dns_next_timeout()) > 0)
+            dns_process_replies();
+        dns_expire();
+    }
+    return value < 0 ? -1 : value;
+}
+
+/**
+ * @brief Fills in a text query.
+ * @param expected Its whole reply.
+ */
+void text_request(Request *r, const char *name, const char *expected)
+{
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    snprintf(r->expected, sizeof(r->expected), "%s", expected);
+}
+
+/**
+ * @brief Fills in a binary query.
+ * @param expected The text form of its answer, as format_reply() writes it.
+ */
+void binary_request(Request *r, const char *name, uint8_t qtype, uint16_t id, uint8_t status, const char *expected)
+{
+    text_request(r, name, expected);
+    r->binary = 1;
+    r->qtype = qtype;
+    r->id = id;
+    r->status = status;
+}
+
+/**
+ * @brief Takes a reply: a binary one for the query with its request id, a text one
+ * for the first unanswered text query expecting it.
+ * @return The query, NULL if no query expects the reply.
+ */
+Request *match_reply(Request *requests, int count, const uint8_t *reply, int len)
+{
+    char text[REPLY_SIZE], detail[REPLY_SIZE + 64], label[300];
+    ResolveResult *result = malloc(sizeof(ResolveResult));
+    uint16_t id;
+    uint8_t status;
+    Request *r = NULL;
+
+    if (result == NULL)
+    {
+        perror("malloc() error");
+        exit(2);
+    }
+    if (is_binary_message(reply, len))
+    {
+        if (bin_decode_reply(reply, len, &id, &status, result) < 0)
+        {
+            check(0, "binary reply", "malformed");
+            free(result);
+            return NULL;
+        }
+        for (int i = 0; i < count && r == NULL; i++)
+            if (requests[i].binary && !requests[i].answered && requests[i].id == id)
+                r = &requests[i];
+        format_reply(result, text);
+        snprintf(detail, sizeof(detail), "status %u, %s", status, text);
+        if (r != NULL)
+        {
+            snprintf(label, sizeof(label), "binary %s", r->name);
+            check(status == r->status && strcmp(text, r->expected) == 0, label, detail);
+        }
+        else
+            check(0, "binary reply for no query", detail);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "%.*s", len, (const char *)reply);
+        for (int i = 0; i < count && r == NULL; i++)
+            if (!requests[i].binary && !requests[i].answered && strcmp(requests[i].expected, text) == 0)
+                r = &requests[i];
+        if (r != NULL)
+        {
+            snprintf(label, sizeof(label), "text   %s", r->name);
+            check(1, label, "");
+        }
+        else
+            check(0, "text reply for no query", text);
+    }
+    free(result);
+    if (r != NULL)
+        r->answered = 1;
+    return r;
+}
+
+/**
+ * @brief Sends every query back to back, binary and text interleaved, then matches
+ * the replies as they come and waits a little for any extra one.
+ * @param in_order Set to whether the replies came in the order of the queries.
+ */
+void run_batch(int fd, Request *requests, int count, int *in_order)
+{
+    uint8_t packet[REPLY_SIZE];
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int waiting = 0, last = -1;
+
+    *in_order = 1;
+    for (int i = 0; i < count; i++)
+    {
+        Request *r = &requests[i];
+        int len;
+        if (!r->binary)
+            len = snprintf((char *)packet, sizeof(packet), "%s", r->name);
+        else if (r->raw != NULL)
+            memcpy(packet, r->raw, len = r->raw_len);
+        else
+            len = bin_encode_query(packet, sizeof(packet), r->qtype, r->id, r->name);
+        if (len < 0 || send(fd, packet, len, 0) < 0)
+        {
+            check(0, r->name, "not sent");
+            r->answered = 1;
+            continue;
+        }
+        waiting += !r->answered;
+    }
+
+    long long deadline = now_ms() + REPLY_TIMEOUT_MS;
+    while (waiting > 0 && now_ms() < deadline && poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0)
+    {
+        ssize_t len = recv(fd, packet, sizeof(packet) - 1, 0);
+        if (len < 0)
+        {
+            perror("recv() error");
+            break;
+        }
+        Request *r = match_reply(requests, count, packet, len);
+        if (r == NULL)
+            continue;
+        waiting--;
+        if (r - requests < last)
+            *in_order = 0;
+        last = r - requests;
+    }
+    for (int i = 0; i < count; i++)
+        if (!requests[i].answered)
+            check(0, requests[i].name, "no reply");
+    while (poll(&pfd, 1, STRAY_WAIT_MS) > 0)
+    {
+        ssize_t len = recv(fd, packet, sizeof(packet) - 1, 0);
+        if (len < 0)
+            break;
+        match_reply(requests, count, packet, len);
+    }
+}
+
+/**
+ * @brief Builds the expected text of a reply with one address.
+ */
+const char *address_reply(const char *name, char *buf, size_t size)
+{
+    struct in_addr addr = {name_address(name)};
+    snprintf(buf, size, "+%s", inet_ntoa(addr));
+    return buf;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [server [fakedns]]\n"
+            "The programs default to ./server and ./fakedns.\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the mixed-protocol test.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every check passed, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    char server[PATH_MAX], fake[PATH_MAX], dir[] = "/tmp/mixtest.XXXXXX", path[PATH_MAX];
+    char port[16], dns_port[16], upstream[32], one[32], two[32], pair[32], many[REPLY_SIZE];
+    static Request requests[16];
+    int in_order;
+
+    if (argc > 3)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (realpath(argc > 1 ? argv[1] : "./server", server) == NULL ||
+        realpath(argc > 2 ? argv[2] : "./fakedns", fake) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+    // the server logs to UDP_Server/ under its working directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(path, sizeof(path), "%s/UDP_Server", dir);
+    if (mkdir(path, 0755) < 0)
+    {
+        perror("mkdir() error");
+        return 1;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    int base = 20000 + random() % 20000;
+    snprintf(port, sizeof(port), "%d", base);
+    snprintf(dns_port, sizeof(dns_port), "%d", base + 1);
+    snprintf(upstream, sizeof(upstream), "127.0.0.1:%d", base + 1);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *fake_argv[] = {fake, dns_port, NULL};
+    char *server_argv[] = {server, port, upstream, NULL};
+    pid_t fake_pid = start(NULL, "Fake DNS", fake_argv);
+    pid_t server_pid = fake_pid < 0 ? -1 : start(dir, NULL, server_argv);
+    int fd = -1;
+
+    if (server_pid < 0 || (dns_sock = dns_open(upstream)) < 0 || (fd = open_client(base)) < 0)
+    {
+        failures++;
+        goto out;
+    }
+    if (wait_for_server(fd) < 0)
+    {
+        fprintf(stderr, "The server does not answer\n");
+        failures++;
+        goto out;
+    }
+
+    // 40 records from fakedns: 10.200.0.0 to 10.200.0.39
+    int many_len = snprintf(many, sizeof(many), "+");
+    for (int i = 0; i < 40; i++)
+        many_len += snprintf(many + many_len, sizeof(many) - many_len, "%s10.200.0.%d", i > 0 ? " " : "", i);
+    // the query type is unknown, and the name is shorter than its length byte says
+    static const uint8_t bad_qtype[] = {BIN_VERSION, 9, 0x12, 0x34, 3, 'a', '.', 'b'};
+    static const uint8_t bad_length[] = {BIN_VERSION, BIN_QTYPE_A, 0xab, 0xcd, 40, 'a', '.', 'b'};
+    static const uint8_t too_short[] = {BIN_VERSION, BIN_QTYPE_A};
+
+    // the slow name is asked first, so later replies overtake it
+    Request *r = requests;
+    text_request(r++, "delay150.one.mix.test", address_reply("delay150.one.mix.test", one, sizeof(one)));
+    binary_request(r++, "delay150.one.mix.test", BIN_QTYPE_A, 0x0101, BIN_STATUS_OK, one);
+    binary_request(r++, "two.mix.test", BIN_QTYPE_A, 0xffff, BIN_STATUS_OK, address_reply("two.mix.test", two, sizeof(two)));
+    text_request(r++, "two.mix.test", two);
+    binary_request(r++, "many40.mix.test", BIN_QTYPE_A, 0x0000, BIN_STATUS_OK, many);
+    text_request(r++, "many40.mix.test", many);
+    binary_request(r++, "192.0.2.7", BIN_QTYPE_PTR, 0x0200, BIN_STATUS_OK, "+host-192-0-2-7.fake");
+    text_request(r++, "192.0.2.7", "+host-192-0-2-7.fake");
+    binary_request(r++, "nx.mix.test", BIN_QTYPE_A, 0x0300, BIN_STATUS_NOT_FOUND, NOT_FOUND_MSG);
+    text_request(r++, "nx.mix.test", NOT_FOUND_MSG);
+    binary_request(r, "unknown query type", 9, 0x1234, BIN_STATUS_BAD_REQUEST, NOT_FOUND_MSG);
+    r->raw = bad_qtype;
+    r++->raw_len = sizeof(bad_qtype);
+    binary_request(r, "name shorter than its length", BIN_QTYPE_A, 0xabcd, BIN_STATUS_BAD_REQUEST, NOT_FOUND_MSG);
+    r->raw = bad_length;
+    r++->raw_len = sizeof(bad_length);
+    binary_request(r++, "192.0.2.8", BIN_QTYPE_A, 0x0400, BIN_STATUS_NOT_FOUND, NOT_FOUND_MSG);
+    text_request(r++, "no_dot", NOT_FOUND_MSG);
+    // too short to carry a request id, so it gets no reply
+    binary_request(r, "query without a request id", BIN_QTYPE_A, 0, 0, "");
+    r->raw = too_short;
+    r->raw_len = sizeof(too_short);
+    r++->answered = 1;
+
+    printf("%d queries, binary and text interleaved on one socket\n", (int)(r - requests));
+    run_batch(fd, requests, r - requests, &in_order);
+    check(!in_order, "replies overtaking the slow one", "they came in query order");
+
+    // a text and two binary waiters of one lookup, each binary one with its own id
+    ask_fake("reset.fake");
+    r = requests;
+    binary_request(r++, "delay200.pair.mix.test", BIN_QTYPE_A, 0x0500, BIN_STATUS_OK,
+                   address_reply("delay200.pair.mix.test", pair, sizeof(pair)));
+    text_request(r++, "delay200.pair.mix.test", pair);
+    binary_request(r++, "delay200.pair.mix.test", BIN_QTYPE_A, 0x0501, BIN_STATUS_OK, pair);
+    run_batch(fd, requests, r - requests, &in_order);
+    long seen = ask_fake("count.fake");
+    snprintf(path, sizeof(path), "%ld upstream queries", seen);
+    check(seen == 1, "text and binary queries share a lookup", path);
+
+out:
+    if (server_pid > 0)
+        kill(server_pid, SIGTERM);
+    if (fake_pid > 0)
+        kill(fake_pid, SIGTERM);
+    while (wait(NULL) > 0)
+        ;
+    snprintf(path, sizeof(path), "%s/UDP_Server/log_20225839.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/UDP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    printf("%d failure(s)\n", failures);
+    return failures > 0 ? 2 : 0;
+}
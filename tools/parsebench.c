@@ -0,0 +1,236 @@
+/* Parser micro-benchmark for w8 request framing: streams lines of 1, 64 and 4096
+ * bytes in TCP-sized segments through find_line_end() and split_command(), and
+ * through the strstr/strncmp/sscanf path of w5-w7 for comparison */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "tokenizer.h"
+
+#define SEGMENT_SIZE 1448 /* bytes delivered per recv(), one Ethernet MSS */
+#define MAX_LINE 65536
+
+size_t stream_size = 32 * 1024 * 1024;
+size_t segment_size = SEGMENT_SIZE;
+volatile size_t sink; // keeps the parsed slices alive
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Builds a stream of CRLF-terminated lines of one length: "POST " and
+ * filler, or filler alone for lines shorter than a verb.
+ * @param line_len Length of each line, without its CRLF.
+ * @param lines Set to the number of lines.
+ * @param size Set to the size of the stream.
+ * @return The stream, stream_size bytes rounded down to whole lines; NULL on error.
+ */
+char *build_stream(size_t line_len, size_t *lines, size_t *size)
+{
+    *lines = stream_size / (line_len + 2);
+    *size = *lines * (line_len + 2);
+    char *stream = malloc(*size);
+    if (stream == NULL)
+    {
+        perror("malloc() error");
+        return NULL;
+    }
+    for (size_t i = 0; i < *lines; i++)
+    {
+        char *line = stream + i * (line_len + 2);
+        memset(line, 'x', line_len);
+        if (line_len > 5)
+            memcpy(line, "POST ", 5);
+        memcpy(line + line_len, "\r\n", 2);
+    }
+    return stream;
+}
+
+/**
+ * @brief Frames a stream the way w8's client_received() does: only the bytes that
+ * arrived since the last search are searched, and each line is split into slices.
+ * @return Number of lines parsed.
+ */
+size_t parse_new(const char *stream, size_t size, char *in)
+{
+    size_t in_len = 0, searched = 0, lines = 0, total = 0;
+
+    for (size_t pos = 0; pos < size; pos += segment_size)
+    {
+        size_t n = size - pos < segment_size ? size - pos : segment_size;
+        memcpy(in + in_len, stream + pos, n); // the recv()
+        in_len += n;
+
+        const char *start = in, *end;
+        while ((end = find_line_end(start, searched, in + in_len - start)) != NULL)
+        {
+            Command cmd;
+            split_command(start, end - start, &cmd);
+            total += cmd.verb.len + cmd.argument.len;
+            lines++;
+            start = end + 2;
+            searched = 0;
+        }
+        in_len -= start - in;
+        searched = in_len;
+        memmove(in, start, in_len);
+    }
+    sink = total;
+    return lines;
+}
+
+/**
+ * @brief Frames a stream the way w5-w7 do: the NUL-terminated message is searched
+ * from its start with strstr() after every recv(), each line is copied out and
+ * NUL-terminated, the verb is found with a strncmp() chain and the argument is
+ * extracted with sscanf().
+ * @return Number of lines parsed.
+ */
+size_t parse_old(const char *stream, size_t size, char *mess)
+{
+    static char line[MAX_LINE], argument[MAX_LINE];
+    size_t mess_len = 0, lines = 0, total = 0;
+
+    mess[0] = '\0';
+    for (size_t pos = 0; pos < size; pos += segment_size)
+    {
+        size_t n = size - pos < segment_size ? size - pos : segment_size;
+        memcpy(mess + mess_len, stream + pos, n); // the recv() and strcat()
+        mess_len += n;
+        mess[mess_len] = '\0';
+
+        char *start = mess, *end;
+        while ((end = strstr(start, "\r\n")) != NULL)
+        {
+            size_t len = end - start;
+            memcpy(line, start, len);
+            line[len] = '\0';
+            if (strncmp(line, "USER", 4) == 0 || strncmp(line, "POST", 4) == 0)
+                total += sscanf(line + 5, "%s", argument) == 1 ? strlen(argument) : 0;
+            else if (strncmp(line, "BYE", 3) == 0)
+                total++;
+            total += len;
+            lines++;
+            start = end + 2;
+        }
+        mess_len -= start - mess;
+        memmove(mess, start, mess_len + 1);
+    }
+    sink = total;
+    return lines;
+}
+
+/**
+ * @brief Times both parsers on lines of one length and prints the result.
+ * @return 0 on success, -1 on error.
+ */
+int bench(size_t line_len, char *buf)
+{
+    size_t lines, size;
+    char *stream = build_stream(line_len, &lines, &size);
+    if (stream == NULL)
+        return -1;
+
+    long long t0 = now_ns();
+    size_t old_lines = parse_old(stream, size, buf);
+    long long t1 = now_ns();
+    size_t new_lines = parse_new(stream, size, buf);
+    long long t2 = now_ns();
+    free(stream);
+    if (old_lines != lines || new_lines != lines)
+    {
+        fprintf(stderr, "%zu-byte lines: parsed %zu and %zu of %zu lines\n", line_len, old_lines, new_lines, lines);
+        return -1;
+    }
+
+    double old_ns = (double)(t1 - t0) / lines, new_ns = (double)(t2 - t1) / lines;
+    printf("%5zu-byte lines  old %9.1f ns/line %6.2f GB/s   new %8.1f ns/line %6.2f GB/s   %5.1fx\n", line_len, old_ns,
+           size / (double)(t1 - t0), new_ns, size / (double)(t2 - t1), old_ns / new_ns);
+    return 0;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [line_length...]\n"
+            "  -s MB        bytes of lines per run (default 32)\n"
+            "  -m bytes     bytes delivered per simulated recv() (default %d)\n"
+            "Lines are 1, 64 and 4096 bytes long unless lengths are given.\n",
+            prog, SEGMENT_SIZE);
+}
+
+/**
+ * @brief Main function of the parser benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    static const size_t default_lengths[] = {1, 64, 4096};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            stream_size = (size_t)(atof(optarg) * 1024 * 1024);
+            break;
+        case 'm':
+            segment_size = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (segment_size == 0 || stream_size == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // holds a partial line of up to MAX_LINE bytes and the next segment
+    char *buf = malloc(MAX_LINE + segment_size + 1);
+    if (buf == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    printf("%zu MB of lines in %zu-byte segments\n", stream_size >> 20, segment_size);
+    if (optind == argc)
+    {
+        for (size_t i = 0; i < sizeof(default_lengths) / sizeof(default_lengths[0]); i++)
+            if (bench(default_lengths[i], buf) < 0)
+                return 2;
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        size_t len = strtoul(argv[i], NULL, 10);
+        if (len == 0 || len + 2 > MAX_LINE)
+        {
+            fprintf(stderr, "Line length %s out of range\n", argv[i]);
+            return 1;
+        }
+        if (bench(len, buf) < 0)
+            return 2;
+    }
+    free(buf);
+    return 0;
+}
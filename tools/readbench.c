@@ -0,0 +1,392 @@
+/* READ latency benchmark for the w8 server (run with -m): times the first page of
+ * a user's messages, a page from the middle of them and a query past the end, and
+ * the first page on a connection of its own, where a server building its index per
+ * process would pay for it. -f posts the user's messages first. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define BUFF_SIZE (256 * 1024)
+#define POST_BATCH 1000 /* POSTs sent before their replies are read */
+
+typedef struct
+{
+    int fd;
+    char in[BUFF_SIZE];
+    size_t in_len; // bytes received but not yet consumed
+} Conn;
+
+int iterations = 2000;
+long long fill_posts = 0;
+const char *user;
+struct sockaddr_in server_addr; /* server's address information */
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads the wall clock, the one the server stamps messages with.
+ * @return Nanoseconds since the epoch.
+ */
+long long wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Sends a whole buffer.
+ * @return 0 on success, -1 on error.
+ */
+int send_all(Conn *c, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(c->fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            perror("send() error");
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Receives more bytes after those not yet consumed.
+ * @return 0 on success, -1 if the connection closed or failed.
+ */
+int receive_more(Conn *c)
+{
+    if (c->in_len == sizeof(c->in))
+        return -1;
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n < 0 && errno == EINTR)
+        return 0;
+    if (n <= 0)
+    {
+        fprintf(stderr, "Connection closed\n");
+        return -1;
+    }
+    c->in_len += n;
+    return 0;
+}
+
+/**
+ * @brief Takes the next line, without its CRLF.
+ * @param line Set to the line, NUL-terminated; a longer line is cut.
+ * @param size Size of line.
+ * @return 0 on success, -1 on error.
+ */
+int read_line(Conn *c, char *line, size_t size)
+{
+    char *end;
+    while ((end = memmem(c->in, c->in_len, "\r\n", 2)) == NULL)
+        if (receive_more(c) < 0)
+            return -1;
+    size_t len = end - c->in;
+    snprintf(line, size, "%.*s", (int)len, c->in);
+    c->in_len -= len + 2;
+    memmove(c->in, end + 2, c->in_len);
+    return 0;
+}
+
+/**
+ * @brief Checks that the next line starts with a reply code.
+ * @return 0 if it does, -1 otherwise.
+ */
+int expect(Conn *c, const char *code)
+{
+    char line[128];
+    if (read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (strncmp(line, code, strlen(code)) != 0)
+    {
+        fprintf(stderr, "Expected %s, got '%s'\n", code, line);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Connects and logs in as the user.
+ * @return 0 on success, -1 on error.
+ */
+int open_conn(Conn *c)
+{
+    char line[128];
+    int one = 1;
+
+    c->in_len = 0;
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("connect() error");
+        if (c->fd >= 0)
+            close(c->fd);
+        return -1;
+    }
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    snprintf(line, sizeof(line), "USER %s\r\n", user);
+    if (expect(c, "100") < 0 || send_all(c, line, strlen(line)) < 0 || expect(c, "110") < 0)
+    {
+        close(c->fd);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Logs out and closes a connection.
+ */
+void close_conn(Conn *c)
+{
+    if (send_all(c, "BYE\r\n", 5) == 0)
+        expect(c, "130");
+    close(c->fd);
+}
+
+/**
+ * @brief Sends a READ and takes its whole reply.
+ * @param since Timestamp to read after, -1 for none.
+ * @param last Set to the timestamp of the last message returned, if any.
+ * @return Number of messages returned, -1 on error.
+ */
+int read_page(Conn *c, long long since, long long *last)
+{
+    char line[128];
+    int count;
+    long long timestamp;
+    unsigned long len;
+
+    if (since < 0)
+        snprintf(line, sizeof(line), "READ %s\r\n", user);
+    else
+        snprintf(line, sizeof(line), "READ %s %lld\r\n", user, since);
+    if (send_all(c, line, strlen(line)) < 0 || read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    if (sscanf(line, "140 %d", &count) != 1)
+    {
+        fprintf(stderr, "READ answered '%s'\n", line);
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (read_line(c, line, sizeof(line)) < 0 || sscanf(line, "%lld %lu", &timestamp, &len) != 2)
+            return -1;
+        // the body and its CRLF
+        for (len += 2; len > 0;)
+        {
+            if (c->in_len == 0 && receive_more(c) < 0)
+                return -1;
+            size_t n = c->in_len < len ? c->in_len : len;
+            c->in_len -= n;
+            memmove(c->in, c->in + n, c->in_len);
+            len -= n;
+        }
+        *last = timestamp;
+    }
+    return count;
+}
+
+/**
+ * @brief Posts fill_posts messages as the user, POST_BATCH at a time.
+ * @param middle Set to the wall clock once half of them are answered.
+ * @return 0 on success, -1 on error.
+ */
+int fill(Conn *c, long long *middle)
+{
+    static char batch[POST_BATCH * 32];
+    long long posted = 0;
+
+    *middle = -1;
+    while (posted < fill_posts)
+    {
+        int n = fill_posts - posted < POST_BATCH ? fill_posts - posted : POST_BATCH;
+        size_t len = 0;
+        for (int i = 0; i < n; i++)
+            len += snprintf(batch + len, sizeof(batch) - len, "POST message %lld\r\n", posted + i);
+        if (send_all(c, batch, len) < 0)
+            return -1;
+        for (int i = 0; i < n; i++)
+            if (expect(c, "120") < 0)
+                return -1;
+        posted += n;
+        if (*middle < 0 && posted >= fill_posts / 2)
+            *middle = wall_ns();
+    }
+    return 0;
+}
+
+/**
+ * @brief Orders latencies for qsort().
+ */
+int compare_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Prints the median and 99th percentile of latencies, in us.
+ */
+void report(const char *label, long long *latencies, int count, int messages)
+{
+    qsort(latencies, count, sizeof(long long), compare_ll);
+    printf("%-16s %4d msgs   p50 %8.1f us   p99 %8.1f us\n", label, messages, latencies[count / 2] / 1000.0,
+           latencies[(int)(count * 0.99)] / 1000.0);
+}
+
+/**
+ * @brief Times READs with the same since on one connection.
+ * @return 0 on success, -1 on error.
+ */
+int bench_page(Conn *c, const char *label, long long since, long long *latencies)
+{
+    long long last;
+    int messages = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        long long start = now_ns();
+        if ((messages = read_page(c, since, &last)) < 0)
+            return -1;
+        latencies[i] = now_ns() - start;
+    }
+    report(label, latencies, iterations, messages);
+    return 0;
+}
+
+/**
+ * @brief Times the first READ of each of a series of connections.
+ * @return 0 on success, -1 on error.
+ */
+int bench_new_conn(long long *latencies, int count)
+{
+    Conn *c = malloc(sizeof(Conn));
+    long long last;
+    int messages = 0;
+
+    if (c == NULL)
+    {
+        perror("malloc() error");
+        return -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (open_conn(c) < 0)
+        {
+            free(c);
+            return -1;
+        }
+        long long start = now_ns();
+        messages = read_page(c, -1, &last);
+        latencies[i] = now_ns() - start;
+        close_conn(c);
+        if (messages < 0)
+        {
+            free(c);
+            return -1;
+        }
+    }
+    free(c);
+    report("new connection", latencies, count, messages);
+    return 0;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <server_ip> <server_port> <user>\n"
+            "  -n count     READs timed per query (default 2000, a tenth of that on new connections)\n"
+            "  -f posts     post that many messages as the user first\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the READ benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 on success, 2 if a request failed.
+ */
+int main(int argc, char *argv[])
+{
+    int opt;
+    long long first = -1, last = -1, middle = -1;
+
+    while ((opt = getopt(argc, argv, "n:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'f':
+            fill_posts = atoll(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 3 || iterations < 10 || fill_posts < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[optind + 1]));
+    server_addr.sin_addr.s_addr = inet_addr(argv[optind]);
+    user = argv[optind + 2];
+
+    Conn *c = malloc(sizeof(Conn));
+    long long *latencies = malloc(iterations * sizeof(long long));
+    if (c == NULL || latencies == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    if (open_conn(c) < 0 || (fill_posts > 0 && fill(c, &middle) < 0))
+        return 2;
+    if (read_page(c, -1, &first) < 0)
+        return 2;
+    if (middle < 0)
+        middle = first >= 0 ? first + (wall_ns() - first) / 2 : 0;
+    last = wall_ns();
+
+    if (bench_page(c, "first page", -1, latencies) < 0 || bench_page(c, "middle page", middle, latencies) < 0 ||
+        bench_page(c, "past the end", last, latencies) < 0)
+        return 2;
+    close_conn(c);
+    if (bench_new_conn(latencies, iterations / 10) < 0)
+        return 2;
+    free(latencies);
+    free(c);
+    return 0;
+}
@@ -0,0 +1,696 @@
+/* Slow-client attack simulator for the w8 request limits. Against a server started
+ * with -t in a scratch directory, it first checks that each kind of slow or
+ * oversized request gets its reply code in time: a request line sent a byte a
+ * second, a body at 100 B/s and a silent client are cut off with 302 or 303 once the
+ * deadline passed, a line over the limit and a huge POST length get 301 at once,
+ * while a body that takes longer than the deadline at an honest rate is stored.
+ * Then it measures legitimate traffic from loadgen alone and again while attackers
+ * hold connections open with a partial line, one byte a second, reconnecting each
+ * time the server drops them. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define ACCOUNT_PREFIX "load"
+#define TICK_MS 100            /* how often the checks send their next bytes */
+#define DRIP_MS 1000           /* time between an attacker's bytes */
+#define LATE_MS 1500           /* time past a deadline allowed for the disconnection */
+#define LONG_LINE (70 * 1024)  /* over the server's longest line */
+#define HONEST_RATE 2000       /* bytes per second of the upload that must get through */
+
+int timeout_s = 5;
+int attacker_count = 3000;
+int seconds = 10;
+int clients = 50;
+const char *engine = "epoll";
+struct sockaddr_in server_addr; /* server's address information */
+int next_account = 0;
+
+typedef struct
+{
+    const char *name;
+    const char *request; // sent at once, after logging in if log_in
+    int log_in;
+    int filler;     // bytes sent at once after the request
+    int rate;       // bytes per second sent after that
+    long long body; // bytes to send at rate, -1 for no end
+    const char *code;
+    int immediate; // the reply is due at once rather than at the deadline
+    int fd;
+    long long start_ms;
+    long long sent;
+    long long reply_ms;
+    char reply[64];
+    int closed;
+} Check;
+
+typedef struct
+{
+    double req_per_s;
+    double p99_ms;
+    long long errors;
+} Result;
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Milliseconds since an arbitrary origin.
+ */
+long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Starts the server and waits until it listens. Its output is discarded
+ * after that, and its errors all along.
+ * @param dir Directory to run it in.
+ * @return Its process id, -1 on error.
+ */
+pid_t start_server(const char *dir, char *const argv[])
+{
+    int fds[2];
+    char line[256];
+
+    if (pipe(fds) < 0)
+    {
+        perror("pipe() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork() error");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(open("/dev/null", O_WRONLY), STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (chdir(dir) < 0)
+            perror("chdir() error");
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(fds[1]);
+    FILE *output = fdopen(fds[0], "r");
+    while (output != NULL && fgets(line, sizeof(line), output) != NULL)
+    {
+        if (strncmp(line, "Server started", 14) == 0)
+        {
+            fclose(output); // the server ignores SIGPIPE, so its later output is just dropped
+            return pid;
+        }
+    }
+    fprintf(stderr, "%s did not start\n", argv[0]);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+/**
+ * @brief Starts loadgen against the server with its output going to a file.
+ * @return Its process id, -1 on error.
+ */
+pid_t start_loadgen(const char *loadgen, const char *out_path)
+{
+    char clients_arg[16], seconds_arg[16], port_arg[16];
+
+    snprintf(clients_arg, sizeof(clients_arg), "%d", clients);
+    snprintf(seconds_arg, sizeof(seconds_arg), "%d", seconds);
+    snprintf(port_arg, sizeof(port_arg), "%d", ntohs(server_addr.sin_port));
+    char *argv[] = {(char *)loadgen, "-c", clients_arg, "-p", "8", "-d", seconds_arg, "127.0.0.1", port_arg, NULL};
+    int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        perror("open() error");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+        perror("fork() error");
+    if (pid == 0)
+    {
+        dup2(out, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror("execv() error");
+        _exit(127);
+    }
+    close(out);
+    return pid;
+}
+
+/**
+ * @brief Reads the results from the output of a finished loadgen.
+ * @return 0 on success, -1 if it did not report any.
+ */
+int read_loadgen(const char *out_path, Result *result)
+{
+    char line[256];
+    double elapsed;
+    long long answered;
+    int ok = 0;
+    FILE *f = fopen(out_path, "r");
+
+    memset(result, 0, sizeof(*result));
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "requests %lld answered in %lf s, %lf req/s, %lld errors", &answered, &elapsed,
+                   &result->req_per_s, &result->errors) == 4)
+            ok = 1;
+        sscanf(line, "latency p50 %*f ms p99 %lf ms", &result->p99_ms);
+    }
+    if (f != NULL)
+        fclose(f);
+    unlink(out_path);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Counts the open descriptors of a process.
+ * @return Their number, -1 on error.
+ */
+int process_fds(pid_t pid)
+{
+    char path[64];
+    struct dirent *entry;
+    int fds = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *d = opendir(path);
+    if (d == NULL)
+        return -1;
+    while ((entry = readdir(d)) != NULL)
+        fds += entry->d_name[0] != '.';
+    closedir(d);
+    return fds;
+}
+
+/**
+ * @brief Reads from a blocking socket until a line starting with a reply code.
+ * @return 0 once it arrived, -1 on error or another reply.
+ */
+int expect(int fd, const char *code)
+{
+    char line[128];
+    size_t len = 0;
+
+    while (len < sizeof(line) - 1)
+    {
+        ssize_t n = recv(fd, line + len, 1, 0);
+        if (n <= 0)
+            return -1;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+    return strncmp(line, code, strlen(code)) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Connects to the server, logging in as the next account if asked. The 100
+ * greeting is read either way.
+ * @return The socket, -1 on error.
+ */
+int open_conn(int log_in)
+{
+    char req[64];
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        perror("connect() error");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (expect(fd, "100") < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (!log_in)
+        return fd;
+    int len = snprintf(req, sizeof(req), "USER " ACCOUNT_PREFIX "%d\r\n", next_account++);
+    if (send(fd, req, len, 0) != len || expect(fd, "110") < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Sends bytes of filler without blocking; the server may already have closed.
+ * @return Bytes sent.
+ */
+long long send_filler(int fd, long long len)
+{
+    static char filler[4096];
+    long long sent = 0;
+
+    if (filler[0] == '\0')
+        memset(filler, 'x', sizeof(filler));
+    while (sent < len)
+    {
+        ssize_t n = send(fd, filler, len - sent < (long long)sizeof(filler) ? len - sent : sizeof(filler),
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    return sent;
+}
+
+/**
+ * @brief Reads what a check's connection received: its reply line and the close.
+ */
+void check_receive(Check *check)
+{
+    char buf[4096];
+    ssize_t n;
+
+    while ((n = recv(check->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        size_t len = strlen(check->reply);
+        for (ssize_t i = 0; i < n && len < sizeof(check->reply) - 1 && strchr(check->reply, '\n') == NULL; i++)
+        {
+            check->reply[len++] = buf[i];
+            check->reply[len] = '\0';
+            if (buf[i] == '\n')
+                check->reply_ms = now_ms();
+        }
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        check->closed = 1;
+}
+
+/**
+ * @brief Runs every check at once: each must get its reply within its window, and
+ * be disconnected unless the reply is 120.
+ * @return Number of checks that failed.
+ */
+int run_checks()
+{
+    char huge_post[64], honest_post[64];
+    long long honest_len = (long long)HONEST_RATE * (timeout_s + 3);
+    snprintf(huge_post, sizeof(huge_post), "POST {2000000000}\r\n");
+    snprintf(honest_post, sizeof(honest_post), "POST {%lld}\r\n", honest_len);
+    Check checks[] = {
+        {"silent client", "", 0, 0, 0, 0, "303", 0},
+        {"request line at 1 B/s", "USER lo", 0, 0, 1, -1, "302", 0},
+        {"POST body at 100 B/s", "POST {100000}\r\n", 1, 0, 100, 100000, "302", 0},
+        {"70 KB request line", "POST ", 1, LONG_LINE, 0, 0, "301", 1},
+        {"POST {2000000000}", huge_post, 1, 0, 0, 0, "301", 1},
+        {"POST body at 2 KB/s", honest_post, 1, 0, HONEST_RATE, honest_len, "120", 0},
+    };
+    int count = sizeof(checks) / sizeof(checks[0]), failures = 0;
+    struct pollfd pfds[sizeof(checks) / sizeof(checks[0])];
+
+    for (int i = 0; i < count; i++)
+    {
+        Check *check = &checks[i];
+        check->fd = open_conn(check->log_in);
+        check->start_ms = now_ms();
+        check->reply_ms = -1;
+        if (check->fd < 0)
+            continue;
+        size_t len = strlen(check->request);
+        if (len > 0 && send(check->fd, check->request, len, MSG_NOSIGNAL) != (ssize_t)len)
+            perror("send() error");
+        send_filler(check->fd, check->filler);
+    }
+
+    long long started = now_ms(), end = started + (timeout_s + 5) * 1000LL;
+    for (long long now = started, tick = started; now < end; now = now_ms())
+    {
+        int pending = 0;
+        for (int i = 0; i < count; i++)
+        {
+            Check *check = &checks[i];
+            int done = check->fd < 0 || check->closed || (check->reply_ms >= 0 && strcmp(check->code, "120") == 0);
+            pfds[i].fd = done ? -1 : check->fd;
+            pfds[i].events = POLLIN;
+            pending += !done;
+        }
+        if (pending == 0)
+            break;
+        if (poll(pfds, count, tick + TICK_MS > now ? tick + TICK_MS - now : 0) < 0 && errno != EINTR)
+        {
+            perror("poll() error");
+            break;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (pfds[i].fd >= 0 && pfds[i].revents != 0)
+                check_receive(&checks[i]);
+        }
+        now = now_ms();
+        if (now < tick + TICK_MS)
+            continue;
+        tick = now;
+        for (int i = 0; i < count; i++)
+        {
+            Check *check = &checks[i];
+            if (pfds[i].fd < 0 || check->rate == 0 || check->reply_ms >= 0)
+                continue;
+            long long due = (now - check->start_ms) * check->rate / 1000 - check->sent;
+            if (check->body >= 0 && due > check->body - check->sent)
+                due = check->body - check->sent;
+            if (due > 0)
+                check->sent += send_filler(check->fd, due);
+        }
+    }
+
+    printf("checks, -t %d:\n", timeout_s);
+    for (int i = 0; i < count; i++)
+    {
+        Check *check = &checks[i];
+        double elapsed = check->reply_ms >= 0 ? (check->reply_ms - check->start_ms) / 1000.0 : -1;
+        int is_120 = strcmp(check->code, "120") == 0;
+        int ok = check->fd >= 0 && strncmp(check->reply, check->code, 3) == 0 && (is_120 || check->closed);
+        if (ok && check->immediate)
+            ok = elapsed < 1;
+        else if (ok && is_120)
+            ok = check->sent == check->body && elapsed > timeout_s;
+        else if (ok)
+            ok = elapsed >= timeout_s - 0.1 && elapsed <= timeout_s + LATE_MS / 1000.0;
+        char *end_of_code = strchr(check->reply, '\r');
+        if (end_of_code != NULL)
+            *end_of_code = '\0';
+        printf("  %-4s %-24s %s after %.2f s (%s %s)\n", ok ? "ok" : "FAIL", check->name,
+               check->reply[0] != '\0' ? check->reply : "no reply", elapsed, check->immediate ? "at once:" : "expected",
+               check->code);
+        failures += !ok;
+        if (check->fd >= 0)
+            close(check->fd);
+    }
+    return failures;
+}
+
+/**
+ * @brief Opens an attacker's connection: the greeting is left unread and a request
+ * line is started, to be continued a byte at a time.
+ * @return The socket, -1 on error.
+ */
+int attacker_connect(int epfd, int index)
+{
+    struct epoll_event ev;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    send(fd, "USER l", 6, MSG_NOSIGNAL);
+    ev.events = EPOLLIN;
+    ev.data.u32 = index;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    return fd;
+}
+
+/**
+ * @brief Runs the attackers until loadgen exits: each drips a byte a second into a
+ * request line and reconnects whenever the server drops it.
+ * @return 0 if the server kept the attackers in check, 1 otherwise.
+ */
+int attack(pid_t server_pid, const char *loadgen, const char *out_path, Result *result)
+{
+    struct epoll_event events[256];
+    int *fds = malloc(attacker_count * sizeof(int));
+    long long *since = malloc(attacker_count * sizeof(long long));
+    long long cut = 0, codes[4] = {0}, held_ms = 0, first_cut_ms = -1, connect_errors = 0;
+    int epfd = epoll_create1(0), status;
+
+    if (fds == NULL || since == NULL || epfd < 0)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    long long started = now_ms();
+    for (int i = 0; i < attacker_count; i++)
+    {
+        fds[i] = attacker_connect(epfd, i);
+        since[i] = now_ms();
+        connect_errors += fds[i] < 0;
+    }
+    printf("%d attackers connected in %.2f s\n", attacker_count, (now_ms() - started) / 1000.0);
+    fflush(stdout);
+
+    struct rusage usage_before, usage_after;
+    getrusage(RUSAGE_SELF, &usage_before);
+    pid_t loadgen_pid = start_loadgen(loadgen, out_path);
+    started = now_ms();
+    long long tick = started;
+    while (loadgen_pid > 0 && waitpid(loadgen_pid, &status, WNOHANG) == 0)
+    {
+        long long now = now_ms();
+        int n = epoll_wait(epfd, events, 256, tick + DRIP_MS > now ? tick + DRIP_MS - now : 0);
+        for (int e = 0; e < n; e++)
+        {
+            int i = events[e].data.u32;
+            char buf[256];
+            ssize_t len;
+            int code = -1;
+            while ((len = recv(fds[i], buf, sizeof(buf) - 1, 0)) > 0)
+            {
+                buf[len] = '\0';
+                char *reply = strstr(buf, "30"); // after the 100 greeting
+                if (reply != NULL && reply[2] >= '1' && reply[2] <= '3')
+                    code = reply[2] - '0';
+            }
+            if (len < 0 && errno == EAGAIN)
+                continue;
+            now = now_ms();
+            cut++;
+            codes[code > 0 ? code : 0]++;
+            held_ms += now - since[i];
+            if (first_cut_ms < 0)
+                first_cut_ms = now - started;
+            close(fds[i]);
+            fds[i] = attacker_connect(epfd, i);
+            since[i] = now;
+            connect_errors += fds[i] < 0;
+        }
+        now = now_ms();
+        if (now < tick + DRIP_MS)
+            continue;
+        tick = now;
+        for (int i = 0; i < attacker_count; i++)
+        {
+            if (fds[i] < 0 && (fds[i] = attacker_connect(epfd, i)) >= 0)
+                since[i] = now;
+            else if (fds[i] >= 0)
+                send(fds[i], "x", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+
+    long long now = now_ms(), longest_ms = 0;
+    getrusage(RUSAGE_SELF, &usage_after);
+    double cpu_s = usage_after.ru_utime.tv_sec - usage_before.ru_utime.tv_sec + usage_after.ru_stime.tv_sec -
+                   usage_before.ru_stime.tv_sec +
+                   (usage_after.ru_utime.tv_usec - usage_before.ru_utime.tv_usec + usage_after.ru_stime.tv_usec -
+                    usage_before.ru_stime.tv_usec) / 1e6;
+    for (int i = 0; i < attacker_count; i++)
+    {
+        if (fds[i] >= 0 && now - since[i] > longest_ms)
+            longest_ms = now - since[i];
+    }
+    int server_fds = process_fds(server_pid);
+    for (int i = 0; i < attacker_count; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    close(epfd);
+    free(fds);
+    free(since);
+
+    int failed = loadgen_pid < 0 || read_loadgen(out_path, result) < 0;
+    printf("attackers: %lld cut off (302: %lld, 303: %lld, other: %lld), first after %.1f s, held %.1f s on "
+           "average; longest held at the end %.1f s, server fds %d, %lld failed connects; the attackers used %.0f%% of a CPU\n",
+           cut, codes[2], codes[3], codes[0] + codes[1], first_cut_ms / 1000.0,
+           cut > 0 ? held_ms / 1000.0 / cut : 0, longest_ms / 1000.0, server_fds, connect_errors,
+           now > started ? 100 * cpu_s * 1000 / (now - started) : 0);
+    if (timeout_s > 0 && (cut == 0 || longest_ms > timeout_s * 1000LL + LATE_MS + DRIP_MS))
+        failed = 1;
+    return failed;
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [server [loadgen]]\n"
+            "  -t seconds   the server's idle timeout, 0 for none (default 5)\n"
+            "  -a count     attackers (default 3000)\n"
+            "  -d seconds   duration of each loadgen run (default 10)\n"
+            "  -c conns     loadgen connections (default 50)\n"
+            "  -e engine    server engine (default epoll)\n"
+            "The server and loadgen default to ./server and ./loadgen.\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the slow-client attack simulator.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status: 0 if every check passed, 2 otherwise.
+ */
+int main(int argc, char *argv[])
+{
+    char server[PATH_MAX], loadgen[PATH_MAX], dir[] = "/tmp/slowattack.XXXXXX", path[PATH_MAX],
+                                              out_path[PATH_MAX], port_arg[16], timeout_arg[16];
+    struct rlimit rl;
+    Result alone, attacked;
+    int opt, failures = 0;
+
+    while ((opt = getopt(argc, argv, "t:a:d:c:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            timeout_s = atoi(optarg);
+            break;
+        case 'a':
+            attacker_count = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'e':
+            engine = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 2 || timeout_s < 0 || attacker_count <= 0 || seconds <= 0 || clients <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (realpath(optind < argc ? argv[optind] : "./server", server) == NULL ||
+        realpath(optind + 1 < argc ? argv[optind + 1] : "./loadgen", loadgen) == NULL)
+    {
+        perror("realpath() error");
+        return 1;
+    }
+    // the attackers are all connected at once, here and in the server, which inherits the limit
+    rlim_t needed = (rlim_t)attacker_count + clients + 64;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < needed)
+    {
+        rl.rlim_cur = rl.rlim_max < needed ? rl.rlim_max : needed;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // the server reads TCP_Server/account.txt under its working directory
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp() error");
+        return 1;
+    }
+    snprintf(out_path, sizeof(out_path), "%s/loadgen.out", dir);
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/TCP_Server/account.txt", dir);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen() error");
+        return 1;
+    }
+    for (int i = 0; i < clients + 8; i++)
+        fprintf(f, ACCOUNT_PREFIX "%d 1\n", i);
+    fclose(f);
+
+    srandom(time(NULL) ^ getpid());
+    int port = 20000 + random() % 20000;
+    snprintf(port_arg, sizeof(port_arg), "%d", port);
+    snprintf(timeout_arg, sizeof(timeout_arg), "%d", timeout_s);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    signal(SIGPIPE, SIG_IGN);
+
+    char *server_argv[] = {server, "-e", (char *)engine, "-t", timeout_arg, port_arg, NULL};
+    pid_t server_pid = start_server(dir, server_argv);
+    if (server_pid < 0)
+    {
+        failures++;
+        goto out;
+    }
+
+    // loadgen logs in as load0.., so the checks take the accounts after its own
+    next_account = clients;
+    if (timeout_s > 0)
+        failures += run_checks();
+    fflush(stdout);
+
+    pid_t loadgen_pid = start_loadgen(loadgen, out_path);
+    if (loadgen_pid < 0 || waitpid(loadgen_pid, NULL, 0) != loadgen_pid || read_loadgen(out_path, &alone) < 0)
+    {
+        fprintf(stderr, "loadgen failed\n");
+        failures++;
+        goto out;
+    }
+    printf("%d legit clients alone:     %8.0f req/s, p99 %.2f ms, %lld errors\n", clients, alone.req_per_s,
+           alone.p99_ms, alone.errors);
+    fflush(stdout);
+    failures += alone.errors > 0;
+
+    failures += attack(server_pid, loadgen, out_path, &attacked);
+    printf("%d legit clients attacked:  %8.0f req/s (%.0f%% of alone), p99 %.2f ms, %lld errors\n", clients,
+           attacked.req_per_s, alone.req_per_s > 0 ? 100 * attacked.req_per_s / alone.req_per_s : 0,
+           attacked.p99_ms, attacked.errors);
+    failures += attacked.errors > 0;
+
+out:
+    if (server_pid > 0)
+    {
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, NULL, 0);
+    }
+    unlink(out_path);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/TCP_Server", dir);
+    rmdir(path);
+    rmdir(dir);
+    printf("%s\n", failures > 0 ? "FAILED" : "ok");
+    return failures > 0 ? 2 : 0;
+}
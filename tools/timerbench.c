@@ -0,0 +1,175 @@
+/* Timer overhead micro-benchmark for the w8 timing wheel: with N client deadlines
+ * armed, times what the engines do per request (clock read, deadline check, re-arm),
+ * a cancel plus arm, the poll timeout and expiry check when nothing is due, and the
+ * cost of each timer that expires, moving down the levels included. The wheel runs
+ * on simulated time, so the runs do not depend on the machine's clock. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "timerwheel.h"
+
+#define IDLE_MS (300 * 1000) /* the server's default idle timeout */
+
+int timer_count = 100000;
+long operations = 10000000;
+volatile long sink; // keeps the results alive
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Nanoseconds since an arbitrary origin.
+ */
+long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Prints one measurement.
+ */
+void report(const char *label, long long ns, long count)
+{
+    printf("%-36s %8.1f ns\n", label, (double)ns / count);
+}
+
+/**
+ * @brief Prints the command line usage.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-t timers] [-n operations]\n"
+            "  -t timers    client deadlines armed (default 100000)\n"
+            "  -n count     operations timed per measurement (default 10000000)\n",
+            prog);
+}
+
+/**
+ * @brief Main function of the timer benchmark.
+ * @param argc Argument count.
+ * @param argv Command line arguments, see usage().
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    static TimerWheel wheel;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            timer_count = atoi(optarg);
+            break;
+        case 'n':
+            operations = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc || timer_count <= 0 || operations <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    int order_len = operations < 1000000 ? operations : 1000000; // random timers, used in turn
+    Timer *timers = calloc(timer_count, sizeof(Timer));
+    int *order = malloc(order_len * sizeof(int));
+    if (timers == NULL || order == NULL)
+    {
+        perror("malloc() error");
+        return 1;
+    }
+    srandom(1);
+    for (int i = 0; i < order_len; i++)
+        order[i] = random() % timer_count;
+
+    // deadlines spread over the idle timeout, as when clients last spoke at different times
+    int64_t now = 1000000;
+    wheel_init(&wheel, now);
+    for (int i = 0; i < timer_count; i++)
+        timer_arm(&wheel, &timers[i], now + 1000 + random() % IDLE_MS);
+    printf("%d timers armed, %zu bytes per timer, %zu bytes per wheel\n", timer_count, sizeof(Timer),
+           sizeof(TimerWheel));
+
+    long long start = now_ns();
+    for (long i = 0; i < operations; i++)
+        sink += clock_ms();
+    report("clock_ms()", now_ns() - start, operations);
+
+    // a request of a client whose deadline does not come closer: the check alone
+    start = now_ns();
+    for (long i = 0; i < operations; i++)
+    {
+        Timer *timer = &timers[order[i % order_len]];
+        int64_t deadline = now + IDLE_MS;
+        if (!timer_armed(timer) || deadline < timer->when)
+            timer_arm(&wheel, timer, deadline);
+    }
+    report("deadline check, no move", now_ns() - start, operations);
+
+    start = now_ns();
+    for (long i = 0; i < operations; i++)
+        timer_arm(&wheel, &timers[order[i % order_len]], now + 1000 + (i & 0xffff) * 4);
+    report("re-arm", now_ns() - start, operations);
+
+    start = now_ns();
+    for (long i = 0; i < operations; i++)
+    {
+        Timer *timer = &timers[order[i % order_len]];
+        timer_cancel(&wheel, timer);
+        timer_arm(&wheel, timer, now + 1000 + (i & 0xffff) * 4);
+    }
+    report("cancel + arm", now_ns() - start, operations);
+
+    // every timer well in the future, the clock moving 1 ms per loop turn
+    for (int i = 0; i < timer_count; i++)
+        timer_arm(&wheel, &timers[i], now + 2 * IDLE_MS + random() % IDLE_MS);
+    long turns = operations < 2 * IDLE_MS ? operations : 2 * IDLE_MS;
+    start = now_ns();
+    for (long i = 0; i < turns; i++)
+    {
+        sink += wheel_timeout(&wheel, now + i);
+        if (wheel_expire(&wheel, now + i) != NULL)
+        {
+            fprintf(stderr, "A timer expired early\n");
+            return 1;
+        }
+    }
+    report("timeout + expiry check, none due", now_ns() - start, turns);
+    now += turns;
+
+    // every deadline passes: each timer moves down the levels, then expires; the
+    // clock jumps to the next time with work, as an engine sleeping in poll does
+    for (int i = 0; i < timer_count; i++)
+        timer_arm(&wheel, &timers[i], now + 1000 + random() % IDLE_MS);
+    long expired = 0;
+    int timeout;
+    start = now_ns();
+    while ((timeout = wheel_timeout(&wheel, now)) >= 0)
+    {
+        now += timeout > 0 ? timeout : 1;
+        while (wheel_expire(&wheel, now) != NULL)
+            expired++;
+    }
+    long long expire_ns = now_ns() - start;
+    if (expired != timer_count)
+    {
+        fprintf(stderr, "%ld of %d timers expired\n", expired, timer_count);
+        return 1;
+    }
+    report("per expired timer", expire_ns, expired);
+
+    free(order);
+    free(timers);
+    return 0;
+}
@@ -9,6 +9,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "binproto.h"
+
 #define BUFF_SIZE 8193
 #define NOT_FOUND_MSG "Information not found"
 
@@ -17,6 +19,8 @@ char buff[BUFF_SIZE];
 struct sockaddr_in server_addr;
 int sent_bytes, received_bytes;
 socklen_t sin_size = sizeof(struct sockaddr);
+int binary_mode = 0;      /* 1 to use the binary wire format */
+uint16_t next_request_id; /* request id of the next binary query */
 
 /**
  * @brief Setup UDP socket and server address structure
@@ -80,13 +84,67 @@ void process_reply()
   }
 }
 
+/**
+ * @brief Process a binary reply from the server and print the result
+ * @param len Length of the reply
+ * @param request_id Request id of the query, replies with another id are ignored
+ * @return 1 if the reply matched the query, 0 otherwise
+ */
+int process_binary_reply(int len, uint16_t request_id)
+{
+  ResolveResult result;
+  uint16_t id;
+  uint8_t status;
+
+  if (bin_decode_reply((uint8_t *)buff, len, &id, &status, &result) < 0)
+  {
+    puts("Invalid response from server");
+    return 1;
+  }
+  if (id != request_id)
+    return 0; // late reply to an earlier query
+
+  if (!result.found)
+    puts(NOT_FOUND_MSG);
+  else if (result.is_ptr)
+    printf("%s\n", result.hostname);
+  else
+  {
+    char ip[INET_ADDRSTRLEN];
+    for (int i = 0; i < result.addr_count; i++)
+    {
+      inet_ntop(AF_INET, &result.addrs[i], ip, sizeof(ip));
+      printf("%s\n", ip);
+    }
+  }
+  return 1;
+}
+
 /**
  * @brief Communicate with the server: send request and receive reply
  */
 void communicate()
 {
   // Step 3: Communicate with server
-  sent_bytes = sendto(client_sock, buff, strlen(buff), 0, (struct sockaddr *)&server_addr, sin_size);
+  int len = strlen(buff);
+  uint16_t request_id = next_request_id++;
+
+  if (binary_mode)
+  {
+    struct in_addr addr;
+    char name[256];
+    strncpy(name, buff, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    uint8_t qtype = inet_pton(AF_INET, name, &addr) == 1 ? BIN_QTYPE_PTR : BIN_QTYPE_A;
+    len = bin_encode_query((uint8_t *)buff, BUFF_SIZE, qtype, request_id, name);
+    if (len < 0)
+    {
+      puts(NOT_FOUND_MSG);
+      return;
+    }
+  }
+
+  sent_bytes = sendto(client_sock, buff, len, 0, (struct sockaddr *)&server_addr, sin_size);
 
   if (sent_bytes < 0)
   {
@@ -94,32 +152,37 @@ void communicate()
   }
   else
   {
-    received_bytes = recvfrom(client_sock, buff, BUFF_SIZE - 1, 0, (struct sockaddr *)&server_addr, &sin_size);
-
-    if (received_bytes < 0)
-    {
-      perror("recvfrom() error: ");
-    }
-    else
+    do
     {
+      received_bytes = recvfrom(client_sock, buff, BUFF_SIZE - 1, 0, (struct sockaddr *)&server_addr, &sin_size);
+
+      if (received_bytes < 0)
+      {
+        perror("recvfrom() error: ");
+        return;
+      }
       buff[received_bytes] = '\0';
+    } while (binary_mode && !process_binary_reply(received_bytes, request_id));
+
+    if (!binary_mode)
       process_reply(buff);
-    }
   }
 }
 
 /**
  * @brief Main function
  * @param argc Number of command line arguments
- * @param argv Command line arguments: <program> <server_ip> <server_port>
+ * @param argv Command line arguments: <program> <server_ip> <server_port> [-b]
+ * -b selects the binary wire format
  * @return Exit status
  */
 int main(int argc, char *argv[])
 {
-  if (argc != 3)
+  if (argc != 3 && !(argc == 4 && strcmp(argv[3], "-b") == 0))
   {
     return 1;
   }
+  binary_mode = argc == 4;
 
   setup_socket(argv[1], argv[2]);
 
@@ -0,0 +1,209 @@
+#include "binproto.h"
+
+/**
+ * This function checks if a datagram uses the binary wire format
+ * @param buf The received datagram
+ * @param len Length of the datagram
+ * @return 1 if the first byte selects the binary format, 0 for a text query
+ */
+int is_binary_message(const uint8_t *buf, int len)
+{
+    return len > 0 && buf[0] == BIN_VERSION;
+}
+
+/**
+ * This function encodes a binary query
+ * @param buf Buffer to store the query
+ * @param size Size of the buffer
+ * @param qtype BIN_QTYPE_A or BIN_QTYPE_PTR
+ * @param id Request id echoed back in the reply
+ * @param name Domain name, or dotted IPv4 address for PTR queries
+ * @return Length of the query, -1 if it does not fit or the address is invalid
+ */
+int bin_encode_query(uint8_t *buf, int size, uint8_t qtype, uint16_t id, const char *name)
+{
+    int name_len;
+
+    if (size < BIN_QUERY_HEADER)
+        return -1;
+
+    buf[0] = BIN_VERSION;
+    buf[1] = qtype;
+    buf[2] = id >> 8;
+    buf[3] = id & 0xff;
+
+    if (qtype == BIN_QTYPE_PTR)
+    {
+        if (size < BIN_QUERY_HEADER + 4 || inet_pton(AF_INET, name, buf + BIN_QUERY_HEADER) != 1)
+            return -1;
+        name_len = 4;
+    }
+    else
+    {
+        name_len = strlen(name);
+        if (name_len > 255 || BIN_QUERY_HEADER + name_len > size)
+            return -1;
+        memcpy(buf + BIN_QUERY_HEADER, name, name_len);
+    }
+
+    buf[4] = name_len;
+    return BIN_QUERY_HEADER + name_len;
+}
+
+/**
+ * This function decodes a binary query
+ * @param buf The received datagram
+ * @param len Length of the datagram
+ * @param query Structure to store the decoded query
+ * @return 0 on success, -1 if the query is malformed
+ */
+int bin_decode_query(const uint8_t *buf, int len, BinQuery *query)
+{
+    int name_len;
+
+    if (len < BIN_QUERY_HEADER || buf[0] != BIN_VERSION)
+        return -1;
+
+    query->qtype = buf[1];
+    query->id = (buf[2] << 8) | buf[3];
+    name_len = buf[4];
+    if (BIN_QUERY_HEADER + name_len > len)
+        return -1;
+
+    if (query->qtype == BIN_QTYPE_PTR)
+    {
+        if (name_len != 4)
+            return -1;
+        inet_ntop(AF_INET, buf + BIN_QUERY_HEADER, query->name, sizeof(query->name));
+    }
+    else if (query->qtype == BIN_QTYPE_A)
+    {
+        memcpy(query->name, buf + BIN_QUERY_HEADER, name_len);
+        query->name[name_len] = '\0';
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * This function encodes a binary reply
+ * @param buf Buffer to store the reply
+ * @param size Size of the buffer
+ * @param qtype Query type of the request
+ * @param id Request id of the request
+ * @param status BIN_STATUS_* code, used when result is NULL or not found
+ * @param result The lookup result, may be NULL
+ * @return Length of the reply, -1 if the buffer is too small
+ */
+int bin_encode_reply(uint8_t *buf, int size, uint8_t qtype, uint16_t id, uint8_t status, const ResolveResult *result)
+{
+    int len = BIN_REPLY_HEADER;
+    int count = 0;
+
+    if (size < BIN_REPLY_HEADER)
+        return -1;
+
+    if (result != NULL && result->found)
+    {
+        status = BIN_STATUS_OK;
+        if (result->is_ptr)
+        {
+            int host_len = strlen(result->hostname);
+            if (host_len > 255)
+                host_len = 255;
+            if (len + 1 + host_len > size)
+                return -1;
+            buf[len++] = host_len;
+            memcpy(buf + len, result->hostname, host_len);
+            len += host_len;
+            count = 1;
+        }
+        else
+        {
+            count = result->addr_count;
+            if (len + count * 4 > size)
+                count = (size - len) / 4;
+            for (int i = 0; i < count; i++)
+            {
+                memcpy(buf + len, &result->addrs[i].s_addr, 4);
+                len += 4;
+            }
+        }
+    }
+    else if (result != NULL)
+    {
+        status = BIN_STATUS_NOT_FOUND;
+    }
+
+    buf[0] = BIN_VERSION;
+    buf[1] = qtype;
+    bin_set_reply_id(buf, id);
+    buf[4] = status;
+    buf[5] = count >> 8;
+    buf[6] = count & 0xff;
+    return len;
+}
+
+/**
+ * This function decodes a binary reply
+ * @param buf The received datagram
+ * @param len Length of the datagram
+ * @param id Request id of the reply
+ * @param status BIN_STATUS_* code of the reply
+ * @param result Structure to store the addresses or the hostname
+ * @return 0 on success, -1 if the reply is malformed
+ */
+int bin_decode_reply(const uint8_t *buf, int len, uint16_t *id, uint8_t *status, ResolveResult *result)
+{
+    int count, pos = BIN_REPLY_HEADER;
+
+    if (len < BIN_REPLY_HEADER || buf[0] != BIN_VERSION)
+        return -1;
+
+    *id = (buf[2] << 8) | buf[3];
+    *status = buf[4];
+    count = (buf[5] << 8) | buf[6];
+
+    result->found = *status == BIN_STATUS_OK;
+    result->is_ptr = buf[1] == BIN_QTYPE_PTR;
+    result->addr_count = 0;
+    result->hostname[0] = '\0';
+    if (!result->found)
+        return 0;
+
+    if (result->is_ptr)
+    {
+        int host_len;
+        if (pos + 1 > len)
+            return -1;
+        host_len = buf[pos++];
+        if (pos + host_len > len)
+            return -1;
+        memcpy(result->hostname, buf + pos, host_len);
+        result->hostname[host_len] = '\0';
+    }
+    else
+    {
+        if (count > MAX_ADDRESSES || pos + count * 4 > len)
+            return -1;
+        for (int i = 0; i < count; i++, pos += 4)
+            memcpy(&result->addrs[i].s_addr, buf + pos, 4);
+        result->addr_count = count;
+    }
+    return 0;
+}
+
+/**
+ * This function rewrites the request id of an encoded reply, so one encoded
+ * reply can be sent to every client waiting on the same lookup
+ * @param buf The encoded reply
+ * @param id Request id of the client
+ */
+void bin_set_reply_id(uint8_t *buf, uint16_t id)
+{
+    buf[2] = id >> 8;
+    buf[3] = id & 0xff;
+}
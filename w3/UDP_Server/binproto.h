@@ -0,0 +1,43 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+
+#include <stdint.h>
+
+#include "resolver.h"
+
+/*
+ * Compact binary wire format. A datagram whose first byte is BIN_VERSION is a
+ * binary message; any other first byte is a plain text query.
+ *
+ * Query: version(1) | qtype(1) | request id(2) | length(1) | name
+ *        (for BIN_QTYPE_PTR the "name" is the 4-byte address)
+ * Reply: version(1) | qtype(1) | request id(2) | status(1) | count(2) | payload
+ *        A:   count packed 4-byte addresses
+ *        PTR: length(1) | hostname (count is 1)
+ * Multi-byte integers and addresses are in network byte order.
+ */
+#define BIN_VERSION 0x01
+#define BIN_QTYPE_A 1
+#define BIN_QTYPE_PTR 2
+#define BIN_STATUS_OK 0
+#define BIN_STATUS_NOT_FOUND 1
+#define BIN_STATUS_BAD_REQUEST 2
+#define BIN_QUERY_HEADER 5
+#define BIN_REPLY_HEADER 7
+#define BIN_MAX_REPLY (BIN_REPLY_HEADER + MAX_ADDRESSES * 4)
+
+typedef struct
+{
+    uint8_t qtype;
+    uint16_t id;
+    char name[256]; // domain name, or dotted address for PTR queries
+} BinQuery;
+
+int is_binary_message(const uint8_t *buf, int len);
+int bin_encode_query(uint8_t *buf, int size, uint8_t qtype, uint16_t id, const char *name);
+int bin_decode_query(const uint8_t *buf, int len, BinQuery *query);
+int bin_encode_reply(uint8_t *buf, int size, uint8_t qtype, uint16_t id, uint8_t status, const ResolveResult *result);
+int bin_decode_reply(const uint8_t *buf, int len, uint16_t *id, uint8_t *status, ResolveResult *result);
+void bin_set_reply_id(uint8_t *buf, uint16_t id);
+
+#endif
@@ -0,0 +1,556 @@
+#include "dnsclient.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_A 1
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_OPT 41
+#define DNS_CLASS_IN 1
+
+typedef struct DnsQuery
+{
+    uint16_t id;
+    int is_ptr;
+    uint8_t packet[DNS_MAX_QUERY]; // query as sent, retransmitted unchanged
+    int packet_len;
+    int question_len; // length of the question section, compared with the answer
+    int tries;
+    long long deadline; // monotonic ms when the query times out
+    dns_callback callback;
+    void *ctx;
+    struct DnsQuery *prev, *next; // timeout queue, ordered by deadline
+} DnsQuery;
+
+typedef struct
+{
+    struct in_addr addr;
+    char name[256];
+} HostEntry;
+
+static int dns_sock = -1;
+static DnsQuery *pending[65536]; // pending queries indexed by id
+static DnsQuery *queue_head, *queue_tail;
+static int pending_count = 0;
+static uint16_t next_id;
+static HostEntry *hosts; // one entry per name or alias in HOSTS_FILE, in file order
+static int host_count, host_capacity;
+static struct timespec hosts_mtime; // of the loaded HOSTS_FILE, reloaded when it changes
+
+/**
+ * This function returns the current monotonic time
+ * @return Time in milliseconds
+ */
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * This function appends a query to the tail of the timeout queue. Every query
+ * waits DNS_TIMEOUT_MS, so the queue stays ordered by deadline.
+ * @param q The query
+ */
+static void queue_push(DnsQuery *q)
+{
+    q->deadline = now_ms() + DNS_TIMEOUT_MS;
+    q->next = NULL;
+    q->prev = queue_tail;
+    if (queue_tail)
+        queue_tail->next = q;
+    else
+        queue_head = q;
+    queue_tail = q;
+}
+
+/**
+ * This function removes a query from the timeout queue
+ * @param q The query
+ */
+static void queue_remove(DnsQuery *q)
+{
+    if (q->prev)
+        q->prev->next = q->next;
+    else
+        queue_head = q->next;
+    if (q->next)
+        q->next->prev = q->prev;
+    else
+        queue_tail = q->prev;
+}
+
+/**
+ * This function finds the first nameserver listed in /etc/resolv.conf
+ * @param upstream Buffer to store the nameserver address
+ * @param size Size of the buffer
+ * @return 1 if a nameserver was found, 0 otherwise
+ */
+static int read_resolv_conf(char *upstream, int size)
+{
+    char line[256], addr[INET_ADDRSTRLEN];
+    struct in_addr tmp;
+    FILE *f = fopen(RESOLV_CONF, "r");
+    if (!f)
+        return 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "nameserver %15s", addr) == 1 && inet_pton(AF_INET, addr, &tmp) == 1)
+        {
+            snprintf(upstream, size, "%s", addr);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * This function (re)loads the IPv4 entries of HOSTS_FILE when it changed since the
+ * last load, so names that getaddrinfo() found there still resolve
+ */
+static void load_hosts()
+{
+    char line[1024], *save, *token;
+    struct in_addr addr;
+    struct stat st;
+
+    if (stat(HOSTS_FILE, &st) < 0)
+    {
+        host_count = 0;
+        return;
+    }
+    if (st.st_mtim.tv_sec == hosts_mtime.tv_sec && st.st_mtim.tv_nsec == hosts_mtime.tv_nsec)
+        return;
+    FILE *f = fopen(HOSTS_FILE, "r");
+    if (!f)
+        return;
+    hosts_mtime = st.st_mtim;
+    host_count = 0;
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+        token = strtok_r(line, " \t\r\n", &save);
+        if (token == NULL || inet_pton(AF_INET, token, &addr) != 1)
+            continue; // blank, comment or IPv6 line
+        while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            if (host_count == host_capacity)
+            {
+                int capacity = host_capacity ? host_capacity * 2 : 16;
+                HostEntry *bigger = realloc(hosts, capacity * sizeof(HostEntry));
+                if (bigger == NULL)
+                {
+                    perror("realloc() error: ");
+                    fclose(f);
+                    return;
+                }
+                hosts = bigger;
+                host_capacity = capacity;
+            }
+            hosts[host_count].addr = addr;
+            snprintf(hosts[host_count].name, sizeof(hosts[host_count].name), "%s", token);
+            host_count++;
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * This function answers a lookup from HOSTS_FILE, which is consulted before the
+ * upstream server as the "files" source of NSS is: every address of a name, or the
+ * first name of an address
+ * @param name Domain name, or dotted IPv4 address for PTR lookups
+ * @param is_ptr 1 for an address -> hostname lookup
+ * @param result Structure to store the addresses or the hostname
+ * @return 1 if the hosts file has the name or address, 0 otherwise
+ */
+int dns_hosts_lookup(const char *name, int is_ptr, ResolveResult *result)
+{
+    struct in_addr addr;
+
+    load_hosts();
+    memset(result, 0, sizeof(*result));
+    result->is_ptr = is_ptr;
+    if (is_ptr && inet_pton(AF_INET, name, &addr) != 1)
+        return 0;
+
+    for (int i = 0; i < host_count; i++)
+    {
+        if (is_ptr && hosts[i].addr.s_addr == addr.s_addr)
+        {
+            snprintf(result->hostname, sizeof(result->hostname), "%s", hosts[i].name);
+            result->found = 1;
+            break;
+        }
+        if (!is_ptr && strcasecmp(hosts[i].name, name) == 0 && result->addr_count < MAX_ADDRESSES)
+        {
+            int seen = 0;
+            for (int j = 0; j < result->addr_count; j++)
+                seen |= result->addrs[j].s_addr == hosts[i].addr.s_addr;
+            if (!seen)
+                result->addrs[result->addr_count++] = hosts[i].addr;
+        }
+    }
+    if (!is_ptr)
+        result->found = result->addr_count > 0;
+    return result->found;
+}
+
+/**
+ * This function opens the non-blocking socket used to talk to the upstream server
+ * @param upstream "ip" or "ip:port" of the upstream server, NULL to use /etc/resolv.conf
+ * @return The socket descriptor, -1 if no upstream server is usable
+ */
+int dns_open(const char *upstream)
+{
+    char host[64];
+    char *colon;
+    int port = DNS_PORT;
+    struct sockaddr_in addr;
+
+    if (upstream)
+        snprintf(host, sizeof(host), "%s", upstream);
+    else if (!read_resolv_conf(host, sizeof(host)))
+        return -1;
+
+    if ((colon = strchr(host, ':')) != NULL)
+    {
+        *colon = '\0';
+        port = atoi(colon + 1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        return -1;
+
+    if ((dns_sock = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
+    {
+        perror("socket() error: ");
+        return -1;
+    }
+    // connect() so that only datagrams from the upstream reach this socket
+    if (connect(dns_sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror("connect() error: ");
+        close(dns_sock);
+        dns_sock = -1;
+        return -1;
+    }
+    fcntl(dns_sock, F_SETFL, fcntl(dns_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    srandom(time(NULL) ^ getpid());
+    next_id = random();
+    load_hosts();
+    printf("Resolving through DNS server %s:%d\n", host, port);
+    return dns_sock;
+}
+
+/**
+ * This function encodes a domain name as DNS labels
+ * @param name The domain name
+ * @param buf Buffer to store the labels
+ * @param size Size of the buffer
+ * @return Length of the encoded name, -1 if it is invalid
+ */
+static int encode_name(const char *name, uint8_t *buf, int size)
+{
+    int pos = 0;
+    while (*name)
+    {
+        const char *dot = strchr(name, '.');
+        int label_len = dot ? dot - name : (int)strlen(name);
+        if (label_len == 0 || label_len > 63 || pos + 1 + label_len + 1 > size)
+            return -1;
+        buf[pos++] = label_len;
+        memcpy(buf + pos, name, label_len);
+        pos += label_len;
+        name += label_len;
+        if (*name == '.')
+            name++;
+    }
+    buf[pos++] = 0;
+    return pos;
+}
+
+/**
+ * This function reads a (possibly compressed) domain name from a DNS message
+ * @param msg The DNS message
+ * @param len Length of the message
+ * @param pos Position of the name
+ * @param out Buffer to store the dotted name, may be NULL
+ * @param out_size Size of the buffer
+ * @return Position right after the name, -1 if the name is malformed
+ */
+static int read_name(const uint8_t *msg, int len, int pos, char *out, int out_size)
+{
+    int end = -1, out_len = 0, hops = 0;
+
+    while (1)
+    {
+        if (pos >= len)
+            return -1;
+        uint8_t label_len = msg[pos];
+        if ((label_len & 0xc0) == 0xc0) // compression pointer
+        {
+            if (pos + 1 >= len || ++hops > 16)
+                return -1;
+            if (end < 0)
+                end = pos + 2;
+            pos = ((label_len & 0x3f) << 8) | msg[pos + 1];
+            continue;
+        }
+        if (label_len == 0)
+            break;
+        if (pos + 1 + label_len > len)
+            return -1;
+        if (out)
+        {
+            if (out_len + label_len + 2 > out_size)
+                return -1;
+            if (out_len > 0)
+                out[out_len++] = '.';
+            memcpy(out + out_len, msg + pos + 1, label_len);
+            out_len += label_len;
+        }
+        pos += 1 + label_len;
+    }
+    if (out)
+        out[out_len] = '\0';
+    return end >= 0 ? end : pos + 1;
+}
+
+/**
+ * This function sends (or resends) a query to the upstream server
+ * @param q The query
+ */
+static void transmit(DnsQuery *q)
+{
+    q->tries++;
+    if (send(dns_sock, q->packet, q->packet_len, 0) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("send() error: ");
+    queue_push(q); // a failed send is retried at the deadline
+}
+
+/**
+ * This function completes a query and releases it
+ * @param q The query
+ * @param result The lookup result
+ */
+static void finish(DnsQuery *q, const ResolveResult *result)
+{
+    queue_remove(q);
+    pending[q->id] = NULL;
+    pending_count--;
+    q->callback(q->ctx, result);
+    free(q);
+}
+
+/**
+ * This function starts an asynchronous A or PTR lookup. The callback runs from
+ * dns_process_replies() or dns_expire() once the answer arrives or the query times out.
+ * @param name Domain name, or dotted IPv4 address for PTR lookups
+ * @param is_ptr 1 for an address -> hostname lookup
+ * @param callback Function called with the result
+ * @param ctx Argument passed to the callback
+ * @return 0 if the query was sent, -1 otherwise
+ */
+int dns_query(const char *name, int is_ptr, dns_callback callback, void *ctx)
+{
+    char qname[256];
+    DnsQuery *q;
+    int pos, n;
+
+    if (dns_sock < 0 || pending_count >= 65536)
+        return -1;
+
+    if (is_ptr)
+    {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, name, &addr) != 1)
+            return -1;
+        uint8_t *b = (uint8_t *)&addr.s_addr;
+        snprintf(qname, sizeof(qname), "%d.%d.%d.%d.in-addr.arpa", b[3], b[2], b[1], b[0]);
+    }
+    else
+    {
+        snprintf(qname, sizeof(qname), "%s", name);
+    }
+
+    q = calloc(1, sizeof(DnsQuery));
+    if (q == NULL)
+        return -1;
+
+    while (pending[next_id] != NULL) // ids are matched with a direct table lookup
+        next_id += 7919;
+    q->id = next_id;
+    next_id = random();
+
+    // header: id, RD flag, one question, one additional (EDNS0 OPT) record
+    uint8_t *p = q->packet;
+    memset(p, 0, DNS_HEADER_SIZE);
+    p[0] = q->id >> 8;
+    p[1] = q->id & 0xff;
+    p[2] = 0x01;
+    p[5] = 1;
+    p[11] = 1;
+    pos = DNS_HEADER_SIZE;
+
+    if ((n = encode_name(qname, p + pos, DNS_MAX_QUERY - pos - 15)) < 0)
+    {
+        free(q);
+        return -1;
+    }
+    pos += n;
+    uint16_t qtype = is_ptr ? DNS_TYPE_PTR : DNS_TYPE_A;
+    p[pos++] = qtype >> 8;
+    p[pos++] = qtype & 0xff;
+    p[pos++] = 0;
+    p[pos++] = DNS_CLASS_IN;
+    q->question_len = pos - DNS_HEADER_SIZE;
+
+    // OPT record advertising a large UDP payload so many A records fit one reply
+    p[pos++] = 0;
+    p[pos++] = 0;
+    p[pos++] = DNS_TYPE_OPT;
+    p[pos++] = DNS_MAX_PACKET >> 8;
+    p[pos++] = DNS_MAX_PACKET & 0xff;
+    memset(p + pos, 0, 6);
+    pos += 6;
+    q->packet_len = pos;
+
+    q->is_ptr = is_ptr;
+    q->callback = callback;
+    q->ctx = ctx;
+    pending[q->id] = q;
+    pending_count++;
+    transmit(q);
+    return 0;
+}
+
+/**
+ * This function parses the answer section of a reply
+ * @param q The query the reply belongs to
+ * @param msg The reply
+ * @param len Length of the reply
+ * @param result Structure to store the addresses or the hostname
+ */
+static void parse_answers(const DnsQuery *q, const uint8_t *msg, int len, ResolveResult *result)
+{
+    int ancount = (msg[6] << 8) | msg[7];
+    int pos = DNS_HEADER_SIZE + q->question_len;
+
+    for (int i = 0; i < ancount; i++)
+    {
+        if ((pos = read_name(msg, len, pos, NULL, 0)) < 0 || pos + 10 > len)
+            return;
+        uint16_t type = (msg[pos] << 8) | msg[pos + 1];
+        uint16_t rdlength = (msg[pos + 8] << 8) | msg[pos + 9];
+        pos += 10;
+        if (pos + rdlength > len)
+            return;
+
+        if (!q->is_ptr && type == DNS_TYPE_A && rdlength == 4 && result->addr_count < MAX_ADDRESSES)
+        {
+            memcpy(&result->addrs[result->addr_count++].s_addr, msg + pos, 4);
+        }
+        else if (q->is_ptr && type == DNS_TYPE_PTR && !result->found)
+        {
+            if (read_name(msg, len, pos, result->hostname, sizeof(result->hostname)) > 0)
+                result->found = 1;
+        }
+        pos += rdlength;
+    }
+    if (!q->is_ptr)
+        result->found = result->addr_count > 0;
+}
+
+/**
+ * This function reads every reply waiting on the socket and completes the matching queries
+ */
+void dns_process_replies()
+{
+    uint8_t msg[DNS_MAX_PACKET];
+    ResolveResult result;
+    ssize_t len;
+
+    while ((len = recv(dns_sock, msg, sizeof(msg), 0)) >= 0)
+    {
+        if (len < DNS_HEADER_SIZE || !(msg[2] & 0x80)) // not a response
+            continue;
+
+        DnsQuery *q = pending[(msg[0] << 8) | msg[1]];
+        // the question must be echoed back unchanged, otherwise the reply is stale or spoofed
+        if (q == NULL || len < DNS_HEADER_SIZE + q->question_len ||
+            memcmp(msg + DNS_HEADER_SIZE, q->packet + DNS_HEADER_SIZE, q->question_len) != 0)
+            continue;
+
+        memset(&result, 0, sizeof(result));
+        result.is_ptr = q->is_ptr;
+        if ((msg[3] & 0x0f) == 0) // RCODE NOERROR
+            parse_answers(q, msg, len, &result);
+        finish(q, &result);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        perror("recv() error: ");
+}
+
+/**
+ * This function retransmits queries whose deadline has passed, and fails the
+ * ones that were already sent DNS_TRIES times
+ */
+void dns_expire()
+{
+    long long now = now_ms();
+    ResolveResult result;
+
+    while (queue_head != NULL && queue_head->deadline <= now)
+    {
+        DnsQuery *q = queue_head;
+        if (q->tries >= DNS_TRIES)
+        {
+            memset(&result, 0, sizeof(result));
+            result.is_ptr = q->is_ptr;
+            finish(q, &result);
+        }
+        else
+        {
+            queue_remove(q);
+            transmit(q);
+        }
+    }
+}
+
+/**
+ * This function computes how long the event loop may wait before dns_expire() has work
+ * @return Timeout in milliseconds, -1 if no query is pending
+ */
+int dns_next_timeout()
+{
+    if (queue_head == NULL)
+        return -1;
+    long long wait = queue_head->deadline - now_ms();
+    return wait > 0 ? (int)wait : 0;
+}
+
+/**
+ * This function returns the number of queries waiting for an answer
+ * @return Number of pending queries
+ */
+int dns_pending_count()
+{
+    return pending_count;
+}
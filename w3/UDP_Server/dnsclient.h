@@ -0,0 +1,26 @@
+#ifndef DNSCLIENT_H
+#define DNSCLIENT_H
+
+#include <stdint.h>
+
+#include "resolver.h"
+
+#define DNS_PORT 53
+#define DNS_TIMEOUT_MS 2000 /* time to wait for an answer before retransmitting */
+#define DNS_TRIES 3         /* transmissions of a query before giving up */
+#define DNS_MAX_PACKET 4096 /* EDNS0 payload size advertised to the upstream */
+#define DNS_MAX_QUERY 300
+#define RESOLV_CONF "/etc/resolv.conf"
+#define HOSTS_FILE "/etc/hosts"
+
+typedef void (*dns_callback)(void *ctx, const ResolveResult *result);
+
+int dns_open(const char *upstream);
+int dns_hosts_lookup(const char *name, int is_ptr, ResolveResult *result);
+int dns_query(const char *name, int is_ptr, dns_callback callback, void *ctx);
+void dns_process_replies();
+void dns_expire();
+int dns_next_timeout();
+int dns_pending_count();
+
+#endif
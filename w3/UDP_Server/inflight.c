@@ -0,0 +1,148 @@
+#include "inflight.h"
+
+static Lookup *table[INFLIGHT_BUCKETS];
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long backend_lookups = 0;
+static unsigned long coalesced_queries = 0;
+
+/**
+ * This function computes the bucket index of a key (FNV-1a hash)
+ * @param key The normalized query
+ * @return Bucket index in the table
+ */
+static unsigned int bucket_of(const char *key)
+{
+    unsigned int h = 2166136261u;
+    for (; *key; key++)
+    {
+        h ^= (unsigned char)*key;
+        h *= 16777619u;
+    }
+    return h % INFLIGHT_BUCKETS;
+}
+
+/**
+ * This function appends a client to the waiter list of a lookup
+ * @param lookup The pending lookup
+ * @param waiter The client to reply to
+ * @return 1 on success, 0 if out of memory
+ */
+static int add_waiter(Lookup *lookup, const Waiter *waiter)
+{
+    if (lookup->waiter_count == lookup->waiter_capacity)
+    {
+        int capacity = lookup->waiter_capacity ? lookup->waiter_capacity * 2 : 4;
+        Waiter *waiters = realloc(lookup->waiters, capacity * sizeof(Waiter));
+        if (waiters == NULL)
+            return 0;
+        lookup->waiters = waiters;
+        lookup->waiter_capacity = capacity;
+    }
+    lookup->waiters[lookup->waiter_count++] = *waiter;
+    return 1;
+}
+
+/**
+ * This function builds the coalescing key of a query. Domain names are
+ * case-insensitive, so "Example.COM" and "example.com" share one lookup.
+ * @param query The query received from the client
+ * @param key Buffer to store the normalized key
+ */
+void normalize_query(const char *query, char key[MAX_QUERY_LENGTH])
+{
+    int i;
+    for (i = 0; query[i] && i < MAX_QUERY_LENGTH - 1; i++)
+        key[i] = tolower((unsigned char)query[i]);
+    key[i] = '\0';
+}
+
+/**
+ * This function attaches a client to the pending lookup of a key, creating it if
+ * no lookup for the key is in flight
+ * @param key The normalized query
+ * @param waiter The client to reply to
+ * @param is_new Set to 1 if the caller must start the backend lookup, 0 otherwise
+ * @return The pending lookup, NULL if out of memory
+ */
+Lookup *inflight_attach(const char *key, const Waiter *waiter, int *is_new)
+{
+    unsigned int b = bucket_of(key);
+    Lookup *lookup;
+
+    pthread_mutex_lock(&table_mutex);
+    for (lookup = table[b]; lookup != NULL; lookup = lookup->next)
+    {
+        if (strcmp(lookup->query, key) == 0)
+        {
+            if (!add_waiter(lookup, waiter))
+                lookup = NULL;
+            else
+                coalesced_queries++;
+            pthread_mutex_unlock(&table_mutex);
+            *is_new = 0;
+            return lookup;
+        }
+    }
+
+    lookup = calloc(1, sizeof(Lookup));
+    if (lookup == NULL || !add_waiter(lookup, waiter))
+    {
+        free(lookup);
+        pthread_mutex_unlock(&table_mutex);
+        *is_new = 0;
+        return NULL;
+    }
+    strncpy(lookup->query, key, MAX_QUERY_LENGTH - 1);
+    lookup->next = table[b];
+    table[b] = lookup;
+    backend_lookups++;
+    pthread_mutex_unlock(&table_mutex);
+
+    *is_new = 1;
+    return lookup;
+}
+
+/**
+ * This function removes a completed lookup from the table. Once it returns no
+ * client can attach to the lookup anymore, so its waiters may be read without the lock.
+ * @param lookup The completed lookup
+ */
+void inflight_finish(Lookup *lookup)
+{
+    Lookup **p;
+
+    pthread_mutex_lock(&table_mutex);
+    for (p = &table[bucket_of(lookup->query)]; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == lookup)
+        {
+            *p = lookup->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table_mutex);
+}
+
+/**
+ * This function releases a lookup removed by inflight_finish()
+ * @param lookup The lookup to release
+ */
+void inflight_free(Lookup *lookup)
+{
+    free(lookup->waiters);
+    free(lookup);
+}
+
+/**
+ * This function reports how many backend lookups were started and how many
+ * queries were answered by joining a lookup already in flight
+ * @param lookups Number of backend lookups
+ * @param coalesced Number of coalesced queries
+ */
+void inflight_stats(unsigned long *lookups, unsigned long *coalesced)
+{
+    pthread_mutex_lock(&table_mutex);
+    *lookups = backend_lookups;
+    *coalesced = coalesced_queries;
+    pthread_mutex_unlock(&table_mutex);
+}
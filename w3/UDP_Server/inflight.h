@@ -0,0 +1,37 @@
+#ifndef INFLIGHT_H
+#define INFLIGHT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define INFLIGHT_BUCKETS 1024
+#define MAX_QUERY_LENGTH 256
+
+typedef struct
+{
+    struct sockaddr_in addr; // client waiting for the result
+    int binary;              // 1 if the client asked in the binary format
+    uint8_t qtype;           // binary query type
+    uint16_t request_id;     // binary request id
+} Waiter;
+
+typedef struct Lookup
+{
+    char query[MAX_QUERY_LENGTH]; // normalized key (lower case)
+    Waiter *waiters;
+    int waiter_count;
+    int waiter_capacity;
+    struct Lookup *next; // next lookup in the same bucket
+} Lookup;
+
+void normalize_query(const char *query, char key[MAX_QUERY_LENGTH]);
+Lookup *inflight_attach(const char *key, const Waiter *waiter, int *is_new);
+void inflight_finish(Lookup *lookup);
+void inflight_free(Lookup *lookup);
+void inflight_stats(unsigned long *lookups, unsigned long *coalesced);
+
+#endif
@@ -60,78 +60,126 @@ int is_valid_domain(const char *domain)
 }
 
 /**
- * This function resolves the given IPv4 address to its corresponding hostname
- * and prints the result
+ * This function resolves the given IPv4 address to its corresponding hostname.
+ * Uses getnameinfo() because gethostbyaddr() returns a static hostent and
+ * cannot be called from several lookup threads at once.
  * @param ip The IPv4 address to resolve
- * @param reply_data Buffer to store the resolved hostname or "Not found information" if resolution fails
+ * @param result Structure to store the resolved hostname
+ * @return 1 if the address was resolved, 0 otherwise
  */
-void resolve_ip(const char *ip, char reply_data[BUFFER_SIZE])
+int lookup_ip(const char *ip, ResolveResult *result)
 {
     struct sockaddr_in addr;
-    struct hostent *ret;
+
+    memset(result, 0, sizeof(*result));
+    result->is_ptr = 1;
+
+    memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     inet_pton(AF_INET, ip, &addr.sin_addr);
 
-    ret = gethostbyaddr(&addr.sin_addr, 4, AF_INET);
-    if (ret == NULL){
-        strncpy(reply_data, NOT_FOUND_MSG, BUFFER_SIZE-1);
-        reply_data[BUFFER_SIZE-1] = '\0';
-    }
-    else
-    {
-        reply_data[0] = '+';
-        strcat(reply_data, ret->h_name);
-    }
+    if (getnameinfo((struct sockaddr *)&addr, sizeof(addr), result->hostname, sizeof(result->hostname), NULL, 0, NI_NAMEREQD) != 0)
+        return 0;
+
+    result->found = 1;
+    return 1;
 }
 
 /**
  * This function resolves the given domain name to its corresponding IPv4 addresses
- * and prints the results
  * @param domain The domain name to resolve
- * @param reply_data Buffer to store the resolved IPv4 addresses or "Not found information" if resolution fails
+ * @param result Structure to store the resolved addresses
+ * @return 1 if at least one address was found, 0 otherwise
  */
-void resolve_domain(const char *domain, char reply_data[])
+int lookup_domain(const char *domain, ResolveResult *result)
 {
-    struct addrinfo *result, *p, hints;
-    int error;
-    char ipStr[INET_ADDRSTRLEN];
-    size_t total_len = 0;
+    struct addrinfo *res, *p, hints;
+
+    memset(result, 0, sizeof(*result));
 
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
-    error = getaddrinfo(domain, NULL, &hints, &result);
-    if (error != 0)
+    if (getaddrinfo(domain, NULL, &hints, &res) != 0)
+        return 0;
+
+    for (p = res; p != NULL && result->addr_count < MAX_ADDRESSES; p = p->ai_next)
+    {
+        struct sockaddr_in *addr = (struct sockaddr_in *)p->ai_addr;
+        result->addrs[result->addr_count++] = addr->sin_addr;
+    }
+
+    freeaddrinfo(res);
+
+    result->found = result->addr_count > 0;
+    return result->found;
+}
+
+/**
+ * This function formats a lookup result as a text reply:
+ * "+ip ip ..." for a domain, "+hostname" for an address
+ * @param result The lookup result
+ * @param reply_data Buffer to store the reply or "Not found information" if resolution failed
+ */
+void format_reply(const ResolveResult *result, char reply_data[])
+{
+    char ipStr[INET_ADDRSTRLEN];
+    size_t total_len;
+
+    if (!result->found)
     {
         strncpy(reply_data, NOT_FOUND_MSG, BUFFER_SIZE - 1);
         reply_data[BUFFER_SIZE - 1] = '\0';
         return;
     }
 
+    if (result->is_ptr)
+    {
+        snprintf(reply_data, BUFFER_SIZE, "+%s", result->hostname);
+        return;
+    }
+
     reply_data[0] = '+';
     reply_data[1] = '\0';
     total_len = 1;
-    for (p = result; p != NULL; p = p->ai_next)
+    for (int i = 0; i < result->addr_count; i++)
     {
-        struct sockaddr_in *addr = (struct sockaddr_in *)p->ai_addr;
-        inet_ntop(AF_INET, &addr->sin_addr, ipStr, sizeof(ipStr));
+        inet_ntop(AF_INET, &result->addrs[i], ipStr, sizeof(ipStr));
 
         size_t ip_len = strlen(ipStr);
         if (total_len + ip_len + 2 >= BUFFER_SIZE)
             break;
 
         if (total_len > 1)
-        {
             reply_data[total_len++] = ' ';
-            reply_data[total_len] = '\0';
-        }
 
-        strcat(reply_data, ipStr);
+        memcpy(reply_data + total_len, ipStr, ip_len + 1);
         total_len += ip_len;
     }
+}
 
-    freeaddrinfo(result);
+/**
+ * This function resolves the given IPv4 address to its corresponding hostname
+ * and prints the result
+ * @param ip The IPv4 address to resolve
+ * @param reply_data Buffer to store the resolved hostname or "Not found information" if resolution fails
+ */
+void resolve_ip(const char *ip, char reply_data[])
+{
+    ResolveResult result;
+    lookup_ip(ip, &result);
+    format_reply(&result, reply_data);
+}
 
-    if (total_len == 0)
-        strncpy(reply_data, NOT_FOUND_MSG, BUFFER_SIZE - 1);
+/**
+ * This function resolves the given domain name to its corresponding IPv4 addresses
+ * and prints the results
+ * @param domain The domain name to resolve
+ * @param reply_data Buffer to store the resolved IPv4 addresses or "Not found information" if resolution fails
+ */
+void resolve_domain(const char *domain, char reply_data[])
+{
+    ResolveResult result;
+    lookup_domain(domain, &result);
+    format_reply(&result, reply_data);
 }
@@ -10,9 +10,23 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+#define MAX_ADDRESSES 512
+
+typedef struct
+{
+    int found;                          // 1 if the lookup succeeded
+    int is_ptr;                         // 1 for address -> hostname lookups
+    int addr_count;                     // number of addresses in addrs
+    struct in_addr addrs[MAX_ADDRESSES]; // resolved IPv4 addresses (domain lookups)
+    char hostname[NI_MAXHOST];          // resolved hostname (address lookups)
+} ResolveResult;
+
 int is_valid_ipv4(const char *ip);
 int is_valid_domain(const char *domain);
-void resolve_ip(const char *domain, char reply_data[]);
+int lookup_ip(const char *ip, ResolveResult *result);
+int lookup_domain(const char *domain, ResolveResult *result);
+void format_reply(const ResolveResult *result, char reply_data[]);
+void resolve_ip(const char *ip, char reply_data[]);
 void resolve_domain(const char *domain, char reply_data[]);
 
 #endif
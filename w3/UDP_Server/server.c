@@ -2,13 +2,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
 #include <time.h>
 
 #include "resolver.h"
+#include "inflight.h"
+#include "binproto.h"
+#include "dnsclient.h"
 
 #define FILE_LOG "UDP_Server/log_20225839.txt"
 #define BUFFER_SIZE 8193
@@ -16,11 +22,12 @@
 
 int server_sock;
 char recv_data[BUFFER_SIZE];
-char reply_data[BUFFER_SIZE];
-int bytes_sent, bytes_received;
+int bytes_received;
 struct sockaddr_in server_addr, client_addr; /* server and client address */
 char client_ip_str[INET_ADDRSTRLEN];
-int sin_size = sizeof(struct sockaddr_in);
+socklen_t sin_size = sizeof(struct sockaddr_in);
+pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+int dns_sock = -1; /* upstream DNS socket, -1 when lookups use getaddrinfo threads */
 
 /**
  * @brief Setup UDP socket and server address structure
@@ -49,98 +56,303 @@ void setup_socket(char *port)
 };
 
 /**
- * @brief Writes server activities to the log file.
+ * @brief Writes server activities to the log file. Lookup threads log their own
+ * replies, so appends are serialized with a mutex.
+ * @param request The query received from the client
+ * @param reply The reply sent to the client
  * @return New log in the log file.
  */
-void write_log()
+void write_log(const char *request, const char *reply)
 {
   time_t now;
-  struct tm *t;
+  struct tm t;
   char buffer[100];
 
   time(&now);
-  t = localtime(&now);
+  localtime_r(&now, &t);
 
-  strftime(buffer, sizeof(buffer), "[%d/%m/%Y %H:%M:%S]", t);
+  strftime(buffer, sizeof(buffer), "[%d/%m/%Y %H:%M:%S]", &t);
 
+  pthread_mutex_lock(&log_mutex);
   FILE *f = fopen(FILE_LOG, "a");
   if (!f)
   {
     printf("cant open file %s\n", FILE_LOG);
+    pthread_mutex_unlock(&log_mutex);
     return;
   }
 
-  fprintf(f, "%s$%s$%s\n", buffer, recv_data, reply_data);
+  fprintf(f, "%s$%s$%s\n", buffer, request, reply);
   fclose(f);
+  pthread_mutex_unlock(&log_mutex);
 }
 
 /**
- * @brief Receive message from client, process it and send reply
+ * @brief Send a reply to one client
+ * @param addr Address of the client
+ * @param reply The reply message
+ * @param len Length of the reply
  */
-void communicate()
+void send_reply(const struct sockaddr_in *addr, const void *reply, int len)
 {
-  bytes_received = recvfrom(server_sock, recv_data, BUFFER_SIZE - 1, 0, (struct sockaddr *)&client_addr, &sin_size);
-  if (bytes_received < 0)
+  int bytes_sent = sendto(server_sock, reply, len, 0,
+                          (const struct sockaddr *)addr, sizeof(struct sockaddr_in));
+  if (bytes_sent < 0)
   {
-    perror("recvfrom() error: ");
-    return;
+    perror("sendto() error: ");
   }
+}
+
+/**
+ * @brief Check whether a query can be resolved
+ * @param query The query received from the client
+ * @return 1 if the query is an IPv4 address or a domain name, 0 otherwise
+ */
+int is_valid_query(const char *query)
+{
+  if (is_valid_ipv4(query))
+    return 1;
+  return !(strspn(query, "0123456789.") == strlen(query)) && is_valid_domain(query);
+}
+
+/**
+ * @brief Resolve a valid query with the backend resolver
+ * @param query The query (IPv4 address or domain name)
+ * @param result Structure to store the lookup result
+ */
+void resolve_query(const char *query, ResolveResult *result)
+{
+  if (is_valid_ipv4(query))
+    lookup_ip(query, result);
   else
+    lookup_domain(query, result);
+}
+
+/**
+ * @brief Reply to every client attached to a completed lookup.
+ * The text reply and the binary reply are each built at most once; binary
+ * clients only get their request id patched in.
+ * @param lookup The completed lookup
+ * @param result The lookup result
+ */
+void complete_lookup(Lookup *lookup, const ResolveResult *result)
+{
+  char reply[BUFFER_SIZE];
+  uint8_t bin_reply[BIN_MAX_REPLY];
+  int bin_len = -1;
+  unsigned long lookups, coalesced;
+
+  format_reply(result, reply);
+
+  inflight_finish(lookup);
+  for (int i = 0; i < lookup->waiter_count; i++)
   {
-    recv_data[bytes_received] = '\0';
-    if (inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip_str, INET_ADDRSTRLEN) == NULL)
+    Waiter *w = &lookup->waiters[i];
+    if (w->binary)
     {
-      perror("inet_ntop() error: ");
+      if (bin_len < 0)
+        bin_len = bin_encode_reply(bin_reply, sizeof(bin_reply), w->qtype, w->request_id, BIN_STATUS_NOT_FOUND, result);
+      bin_set_reply_id(bin_reply, w->request_id);
+      send_reply(&w->addr, bin_reply, bin_len);
     }
     else
     {
-      printf("Received from client [%s:%d]: %s [%d bytes]\n", client_ip_str, ntohs(client_addr.sin_port), recv_data, bytes_received);
+      send_reply(&w->addr, reply, strlen(reply));
     }
+    write_log(lookup->query, reply);
+  }
 
-    if (is_valid_ipv4(recv_data))
-    {
-      resolve_ip(recv_data, reply_data);
-    }
-    else if (!(strspn(recv_data, "0123456789.") == strlen(recv_data)) && is_valid_domain(recv_data))
-    {
-      resolve_domain(recv_data, reply_data);
-    }
-    else
-    {
-      strncpy(reply_data, NOT_FOUND_MSG, BUFFER_SIZE - 1);
-    }
+  inflight_stats(&lookups, &coalesced);
+  printf("Reply to %d client(s) for %s: %s [lookups: %lu, coalesced: %lu]\n",
+         lookup->waiter_count, lookup->query, reply, lookups, coalesced);
+  inflight_free(lookup);
+}
+
+/**
+ * @brief Resolve a pending lookup with the blocking resolver, in its own thread
+ * @param arg The pending lookup
+ */
+void *lookup_worker(void *arg)
+{
+  Lookup *lookup = (Lookup *)arg;
+  ResolveResult result;
+
+  resolve_query(lookup->query, &result);
+  complete_lookup(lookup, &result);
+  return NULL;
+}
+
+/**
+ * @brief Called by the DNS client when the answer of a lookup arrives or times out
+ * @param ctx The pending lookup
+ * @param result The lookup result
+ */
+void on_dns_result(void *ctx, const ResolveResult *result)
+{
+  complete_lookup((Lookup *)ctx, result);
+}
+
+/**
+ * @brief Start the backend lookup of a new pending lookup
+ * @param lookup The pending lookup
+ */
+void start_lookup(Lookup *lookup)
+{
+  if (dns_sock >= 0)
+  {
+    ResolveResult result;
+    // names in /etc/hosts are answered at once, like getaddrinfo() does
+    if (dns_hosts_lookup(lookup->query, is_valid_ipv4(lookup->query), &result) ||
+        dns_query(lookup->query, is_valid_ipv4(lookup->query), on_dns_result, lookup) < 0)
+      complete_lookup(lookup, &result);
+    return;
+  }
 
-    printf("Reply to client: ");
-    puts(reply_data);
-    bytes_sent = sendto(server_sock, reply_data, strlen(reply_data), 0,
-                        (struct sockaddr *)&client_addr, sin_size);
-    if (bytes_sent < 0)
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, lookup_worker, lookup) != 0)
+  {
+    perror("pthread_create() error: ");
+    lookup_worker(lookup); // resolve in the receive loop instead
+    return;
+  }
+  pthread_detach(tid);
+}
+
+/**
+ * @brief Reply "not found" to a query that is not worth a lookup
+ * @param waiter The client to reply to
+ * @param query The query received from the client
+ * @param status Binary status code (not found or bad request)
+ */
+void reply_not_found(const Waiter *waiter, const char *query, uint8_t status)
+{
+  if (waiter->binary)
+  {
+    uint8_t bin_reply[BIN_REPLY_HEADER];
+    int len = bin_encode_reply(bin_reply, sizeof(bin_reply), waiter->qtype, waiter->request_id, status, NULL);
+    send_reply(&waiter->addr, bin_reply, len);
+  }
+  else
+  {
+    send_reply(&waiter->addr, NOT_FOUND_MSG, strlen(NOT_FOUND_MSG));
+  }
+  printf("Reply to client: ");
+  puts(NOT_FOUND_MSG);
+  write_log(query, NOT_FOUND_MSG);
+}
+
+/**
+ * @brief Receive message from client, then reply at once or attach the client to a lookup
+ */
+void communicate()
+{
+  sin_size = sizeof(struct sockaddr_in);
+  bytes_received = recvfrom(server_sock, recv_data, BUFFER_SIZE - 1, 0, (struct sockaddr *)&client_addr, &sin_size);
+  if (bytes_received < 0)
+  {
+    perror("recvfrom() error: ");
+    return;
+  }
+
+  Waiter waiter;
+  const char *query = recv_data;
+  BinQuery bin_query;
+
+  memset(&waiter, 0, sizeof(waiter));
+  waiter.addr = client_addr;
+  recv_data[bytes_received] = '\0';
+
+  // the first byte selects the wire format
+  if (is_binary_message((uint8_t *)recv_data, bytes_received))
+  {
+    waiter.binary = 1;
+    if (bin_decode_query((uint8_t *)recv_data, bytes_received, &bin_query) < 0)
     {
-      perror("sendto() error: ");
+      if (bytes_received >= 4)
+      {
+        waiter.qtype = recv_data[1];
+        waiter.request_id = ((uint8_t)recv_data[2] << 8) | (uint8_t)recv_data[3];
+        reply_not_found(&waiter, "<malformed binary query>", BIN_STATUS_BAD_REQUEST);
+      }
+      return;
     }
+    waiter.qtype = bin_query.qtype;
+    waiter.request_id = bin_query.id;
+    query = bin_query.name;
+  }
+
+  if (inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip_str, INET_ADDRSTRLEN) == NULL)
+  {
+    perror("inet_ntop() error: ");
   }
+  else
+  {
+    printf("Received from client [%s:%d]: %s [%d bytes%s]\n", client_ip_str, ntohs(client_addr.sin_port), query, bytes_received, waiter.binary ? ", binary" : "");
+  }
+
+  if (!is_valid_query(query) || (waiter.binary && (waiter.qtype == BIN_QTYPE_PTR) != is_valid_ipv4(query)))
+  {
+    reply_not_found(&waiter, query, BIN_STATUS_NOT_FOUND);
+    return;
+  }
+
+  // concurrent queries for the same name share one backend lookup
+  char key[MAX_QUERY_LENGTH];
+  int is_new;
+  normalize_query(query, key);
+  Lookup *lookup = inflight_attach(key, &waiter, &is_new);
+  if (lookup == NULL)
+  {
+    reply_not_found(&waiter, query, BIN_STATUS_NOT_FOUND);
+    return;
+  }
+  if (is_new)
+    start_lookup(lookup);
 }
 
 /**
  * @brief Main function
  * @param argc Number of command line arguments
- * @param argv Command line arguments: <program> <server_port>
+ * @param argv Command line arguments: <program> <server_port> [dns_server[:port]]
+ * Lookups go to the given DNS server (or the one in /etc/resolv.conf) from the
+ * event loop; without a usable DNS server they fall back to getaddrinfo threads.
  * @return Exit status
  */
 int main(int argc, char *argv[])
 {
-  if (argc != 2)
+  if (argc != 2 && argc != 3)
   {
     return 1;
   }
 
   setup_socket(argv[1]);
+  dns_sock = dns_open(argc == 3 ? argv[2] : NULL);
+  if (dns_sock < 0)
+    printf("No DNS server available, resolving with getaddrinfo()\n");
+
+  struct pollfd fds[2];
+  fds[0].fd = server_sock;
+  fds[0].events = POLLIN;
+  fds[1].fd = dns_sock;
+  fds[1].events = POLLIN;
 
   while (1)
   {
-    communicate();
-    write_log();
-    memset(&(reply_data), 0, sizeof(reply_data));
+    if (poll(fds, dns_sock >= 0 ? 2 : 1, dns_sock >= 0 ? dns_next_timeout() : -1) < 0)
+    {
+      perror("poll() error: ");
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN)
+      communicate();
+
+    if (dns_sock >= 0)
+    {
+      if (fds[1].revents & POLLIN)
+        dns_process_replies();
+      dns_expire();
+    }
   }
 
   close(server_sock);
@@ -9,9 +9,22 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "crc32c.h"
+#include "xxhash64.h"
+#include "cdc.h"
 
 #define BUFF_SIZE 4096
 #define CHUNK_SIZE 65536 // 64KB
+#define MAX_RESUME_ATTEMPTS 5 /* RSUM attempts before a resumable upload gives up */
+#define MAX_STREAMS 64        /* connections of a parallel upload */
 
 int client_sock;
 char buff[BUFF_SIZE + 1];
@@ -19,6 +32,20 @@ struct sockaddr_in server_addr; /* server's address information */
 int msg_len, sent_bytes, received_bytes;
 char filepath[BUFF_SIZE];
 unsigned long filesize;
+int resume_mode = 0; /* 1 to upload with RSUM (resumable, checksummed chunks) */
+int streams = 1;     /* connections used to upload one file (UPLR ranges when > 1) */
+int digest_mode = 0; /* 1 to send the file's XXH64 in the UPLD header */
+int dedup_mode = 0;  /* 1 to upload with CHNK: only chunks the server lacks are sent */
+int deflate_mode = 0; /* 1 to send UPLD bodies as a zlib stream */
+
+typedef struct
+{
+    int fd;               // the opened file, shared by every stream
+    char *filename;
+    unsigned long offset; // range sent by this stream
+    unsigned long length;
+    char reply[BUFF_SIZE + 1]; // final reply of the server
+} StreamJob;
 
 /**
  * @brief Handles and displays the server's response message. Eliminates the status code prefix.
@@ -41,31 +68,79 @@ void handle_server_response()
 }
 
 /**
- * @brief Sets up the client socket and connects to the server.
- * @param ip The server's IP address.
- * @param port The server's port number.
+ * @brief Sends part of a file with sendfile(), so the bytes go from the page cache
+ * to the socket without passing through user space. Falls back to read()+send()
+ * through a CHUNK_SIZE buffer when sendfile() is not supported.
+ * @param sock The connected socket.
+ * @param fd The opened file.
+ * @param offset Position of the first byte to send.
+ * @param length Number of bytes to send.
+ * @return Number of bytes sent.
  */
-void setup_socket(char *ip, char *port)
+unsigned long send_file_body(int sock, int fd, off_t offset, unsigned long length)
+{
+    unsigned long total_sent = 0;
+
+    while (total_sent < length)
+    {
+        ssize_t sent_bytes = sendfile(sock, fd, &offset, length - total_sent);
+        if (sent_bytes < 0 && (errno == EINVAL || errno == ENOSYS))
+            break; // not supported for this file, copy the rest
+        if (sent_bytes <= 0)
+        {
+            if (sent_bytes < 0 && errno == EINTR)
+                continue;
+            if (sent_bytes < 0)
+                perror("sendfile() error");
+            return total_sent;
+        }
+        total_sent += sent_bytes;
+    }
+
+    char send_data[CHUNK_SIZE];
+    while (total_sent < length)
+    {
+        size_t to_read = length - total_sent < sizeof(send_data) ? length - total_sent : sizeof(send_data);
+        ssize_t bytes_read = pread(fd, send_data, to_read, offset);
+        if (bytes_read <= 0)
+            break; // hết file hoặc lỗi
+        offset += bytes_read;
+
+        size_t sent = 0;
+        while (sent < (size_t)bytes_read)
+        {
+            ssize_t sent_bytes = send(sock, send_data + sent, bytes_read - sent, 0); // ko dung  strlen(buff) tai vi file nhi phan, buff se chi doc den /0, dung bytes_read - sent de gui chinh xac so byte con lai
+            if (sent_bytes < 0)
+            {
+                perror("send() error");
+                return total_sent;
+            }
+            sent += sent_bytes;
+            total_sent += sent_bytes;
+        }
+    }
+    return total_sent;
+}
+
+/**
+ * @brief Connects to the server and reads the welcome message.
+ * @return 0 on success, -1 on error.
+ */
+int connect_server()
 {
     // Step 1: Construct socket
-    int client_port = atoi(port);
     if ((client_sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
     {
         perror("socket() error");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
-    // Step 2: Specify server address
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(client_port);
-    server_addr.sin_addr.s_addr = inet_addr(ip);
-
     // Step 3: Request to connect server
     if (connect(client_sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) < 0)
     {
         perror("connect() error");
-        exit(EXIT_FAILURE);
+        close(client_sock);
+        return -1;
     }
 
     received_bytes = recv(client_sock, buff, BUFF_SIZE, 0);
@@ -81,6 +156,538 @@ void setup_socket(char *ip, char *port)
     {
         handle_server_response();
     }
+    return 0;
+}
+
+/**
+ * @brief Sets up the client socket and connects to the server.
+ * @param ip The server's IP address.
+ * @param port The server's port number.
+ */
+void setup_socket(char *ip, char *port)
+{
+    // Step 2: Specify server address
+    int client_port = atoi(port);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(client_port);
+    server_addr.sin_addr.s_addr = inet_addr(ip);
+
+    if (connect_server() < 0)
+        exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Sends a whole buffer.
+ * @return 0 on success, -1 on error.
+ */
+int send_all(const char *data, size_t len, int flags)
+{
+    while (len > 0)
+    {
+        ssize_t sent_bytes = send(client_sock, data, len, flags);
+        if (sent_bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("send() error");
+            return -1;
+        }
+        data += sent_bytes;
+        len -= sent_bytes;
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends a file from an offset as resumable chunks: each chunk is preceded
+ * by its CRC32C as 4 big-endian bytes, so the server can verify it alone.
+ * @param fd The opened file.
+ * @param offset Position to resume from, on a chunk boundary.
+ * @param chunk_size Chunk size announced by the server.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int send_chunks(int fd, unsigned long offset, unsigned long chunk_size)
+{
+    char *chunk = malloc(chunk_size);
+    if (chunk == NULL)
+        return -1;
+
+    while (offset < filesize)
+    {
+        unsigned long len = filesize - offset < chunk_size ? filesize - offset : chunk_size;
+        if (pread(fd, chunk, len, offset) != (ssize_t)len)
+        {
+            perror("pread() error");
+            free(chunk);
+            return -1;
+        }
+
+        uint32_t crc = crc32c(0, chunk, len);
+        uint8_t header[4] = {crc >> 24, crc >> 16, crc >> 8, crc};
+        if (send_all((char *)header, 4, MSG_MORE) < 0 || send_all(chunk, len, 0) < 0)
+        {
+            free(chunk);
+            return -1;
+        }
+        offset += len;
+    }
+    free(chunk);
+    return 0;
+}
+
+/**
+ * @brief Uploads a file with RSUM. The server answers with the number of verified
+ * bytes it already holds, and only the rest is sent. A chunk that fails its
+ * checksum, or a broken connection, leads to a new RSUM that resumes from the
+ * verified prefix instead of byte 0.
+ * @param fd The opened file.
+ * @param filename Name of the file on the server.
+ */
+void upload_resumable(int fd, char *filename)
+{
+    unsigned long offset, chunk_size;
+
+    for (int attempt = 0; attempt < MAX_RESUME_ATTEMPTS; attempt++)
+    {
+        if (attempt > 0 && client_sock < 0)
+        {
+            sleep(1);
+            if (connect_server() < 0)
+            {
+                client_sock = -1;
+                continue;
+            }
+        }
+
+        if (snprintf(buff, sizeof(buff), "RSUM %s %lu", filename, filesize) >= (int)sizeof(buff))
+        {
+            printf("File name too long: %s\n", filename);
+            return;
+        }
+        if (send_all(buff, strlen(buff), 0) < 0 || (received_bytes = recv(client_sock, buff, BUFF_SIZE, 0)) <= 0)
+        {
+            close(client_sock);
+            client_sock = -1;
+            continue;
+        }
+        buff[received_bytes] = '\0';
+        if (sscanf(buff, "+OK Resume from %lu chunk %lu", &offset, &chunk_size) != 2)
+        {
+            printf("Server error: %s\n", buff);
+            return;
+        }
+        printf("Sending '%s' from byte %lu of %lu\n", filename, offset, filesize);
+
+        if (send_chunks(fd, offset, chunk_size) < 0 || (received_bytes = recv(client_sock, buff, BUFF_SIZE, 0)) <= 0)
+        {
+            printf("Connection lost, resuming...\n");
+            close(client_sock);
+            client_sock = -1;
+            continue;
+        }
+        handle_server_response();
+        if (strncmp(buff, "-ERR Chunk checksum", 19) != 0)
+            return; // uploaded, or an error resuming cannot fix
+    }
+    printf("Upload of '%s' failed after %d attempts\n", filename, MAX_RESUME_ATTEMPTS);
+    if (client_sock < 0 && connect_server() < 0)
+        exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Receives one reply on a stream's own connection.
+ * @return Length of the reply, <= 0 on error.
+ */
+int recv_reply(int sock, char *reply)
+{
+    int n = recv(sock, reply, BUFF_SIZE, 0);
+    reply[n > 0 ? n : 0] = '\0';
+    return n;
+}
+
+/**
+ * @brief Uploads one range of a file over its own connection with UPLR.
+ * @param arg The StreamJob describing the range.
+ */
+void *upload_range(void *arg)
+{
+    StreamJob *job = (StreamJob *)arg;
+    char header[BUFF_SIZE];
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    strcpy(job->reply, "-ERR Connection failed");
+    if (sock < 0 || connect(sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) < 0 ||
+        recv_reply(sock, job->reply) <= 0)
+    {
+        perror("connect() error");
+        if (sock >= 0)
+            close(sock);
+        return NULL;
+    }
+
+    snprintf(header, sizeof(header), "UPLR %s %lu %lu %lu", job->filename, filesize, job->offset, job->length);
+    if (send(sock, header, strlen(header), 0) < 0 || recv_reply(sock, job->reply) <= 0 || job->reply[0] != '+')
+    {
+        close(sock);
+        return NULL;
+    }
+
+    if (send_file_body(sock, job->fd, job->offset, job->length) == job->length)
+        recv_reply(sock, job->reply);
+    else
+        strcpy(job->reply, "-ERR Range not sent");
+    close(sock);
+    return NULL;
+}
+
+/**
+ * @brief Uploads a file over several connections at once: the file is split into
+ * one range per stream and the server writes each range at its offset, committing
+ * the file when the last range arrives.
+ * @param fd The opened file.
+ * @param filename Name of the file on the server.
+ */
+void upload_parallel(int fd, char *filename)
+{
+    StreamJob jobs[MAX_STREAMS];
+    pthread_t tids[MAX_STREAMS];
+    unsigned long range = filesize / streams;
+    int n = filesize < (unsigned long)streams ? 1 : streams;
+
+    printf("Sending '%s' over %d streams...\n", filename, n);
+    for (int i = 0; i < n; i++)
+    {
+        jobs[i].fd = fd;
+        jobs[i].filename = filename;
+        jobs[i].offset = i * range;
+        jobs[i].length = i == n - 1 ? filesize - jobs[i].offset : range;
+        if (pthread_create(&tids[i], NULL, upload_range, &jobs[i]) != 0)
+        {
+            perror("pthread_create() error");
+            n = i;
+            break;
+        }
+    }
+
+    int success = 0;
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join(tids[i], NULL);
+        if (strncmp(jobs[i].reply, "-ERR", 4) == 0)
+            printf("Stream %d (bytes %lu-%lu): %s\n", i, jobs[i].offset, jobs[i].offset + jobs[i].length, jobs[i].reply);
+        else if (strcmp(jobs[i].reply, "+OK Successful upload") == 0)
+            success = 1;
+    }
+    printf("Server response: %s\n", success ? " Successful upload" : " Upload incomplete");
+}
+
+/**
+ * @brief Splits a file into content-defined chunks and hashes each one.
+ * @param fd The opened file.
+ * @param chunks Set to the chunk list, to free by the caller.
+ * @param offsets Set to each chunk's offset in the file, to free by the caller.
+ * @return Number of chunks, -1 on error.
+ */
+int chunk_file(int fd, ChunkRef **chunks, unsigned long **offsets)
+{
+    int count = 0, capacity = 0;
+    *chunks = NULL;
+    *offsets = NULL;
+
+    uint8_t *data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap() error");
+        return -1;
+    }
+
+    for (unsigned long pos = 0; pos < filesize;)
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            ChunkRef *c = realloc(*chunks, capacity * sizeof(ChunkRef));
+            unsigned long *o = realloc(*offsets, capacity * sizeof(unsigned long));
+            if (c != NULL)
+                *chunks = c;
+            if (o != NULL)
+                *offsets = o;
+            if (c == NULL || o == NULL)
+            {
+                munmap(data, filesize);
+                return -1;
+            }
+        }
+        size_t len = cdc_cut(data + pos, filesize - pos);
+        chunk_hash(data + pos, len, (*chunks)[count].hash);
+        (*chunks)[count].length = len;
+        (*offsets)[count] = pos;
+        count++;
+        pos += len;
+    }
+    munmap(data, filesize);
+    return count;
+}
+
+/**
+ * @brief Receives a reply line ending in '\n' into buff; binary data may follow it
+ * in the same recv().
+ * @return Bytes received in buff (the line is terminated in place of its '\n'),
+ * -1 on error or on a reply without a line.
+ */
+int recv_line()
+{
+    int len = 0;
+    char *nl = NULL;
+
+    while (nl == NULL)
+    {
+        int n = recv(client_sock, buff + len, BUFF_SIZE - len, 0);
+        if (n <= 0)
+            return -1;
+        len += n;
+        buff[len] = '\0';
+        nl = memchr(buff, '\n', len);
+        if (nl == NULL && (buff[0] == '-' || len == BUFF_SIZE))
+            return -1;
+    }
+    *nl = '\0';
+    return len;
+}
+
+/**
+ * @brief Receives the "+OK Need <k> <bytes>\n" reply and the bitmap that follows it.
+ * @param need Buffer for the bitmap.
+ * @param bitmap_size Expected bitmap length.
+ * @param needed Set to the number of chunks to send.
+ * @return 0 on success, -1 on error (the reply is left in buff).
+ */
+int recv_need(uint8_t *need, int bitmap_size, int *needed)
+{
+    int len = recv_line(), size;
+    if (len < 0 || sscanf(buff, "+OK Need %d %d", needed, &size) != 2 || size != bitmap_size)
+        return -1;
+
+    int have = len - (strlen(buff) + 1);
+    memcpy(need, buff + strlen(buff) + 1, have);
+    while (have < bitmap_size)
+    {
+        int n = recv(client_sock, need + have, bitmap_size - have, 0);
+        if (n <= 0)
+            return -1;
+        have += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Downloads a stored file with "RETR <name> [offset [length]]" into a file of
+ * the same name in the current directory. The bytes of a ranged request are written
+ * at their offset, so an interrupted download can be continued.
+ * @param command The RETR command typed by the user.
+ * @return 0 on success, -1 if the connection was lost.
+ */
+int download_file(char *command)
+{
+    char name[256];
+    unsigned long offset = 0, length;
+
+    if (sscanf(command, "RETR %255s %lu", name, &offset) < 1)
+    {
+        printf("Usage: RETR <name> [offset [length]]\n");
+        return 0;
+    }
+    if (send_all(command, strlen(command), 0) < 0)
+        return -1;
+
+    int len = recv_line();
+    if (len < 0 || sscanf(buff, "+OK Sending %lu", &length) != 1)
+    {
+        if (len < 0 && buff[0] != '-')
+            return -1;
+        printf("Server error: %s\n", buff);
+        return 0;
+    }
+
+    int fd = open(name, O_WRONLY | O_CREAT | (offset == 0 ? O_TRUNC : 0), 0644);
+    if (fd < 0)
+        perror("open() error"); // still consume the body to keep the connection usable
+
+    int line_len = strlen(buff) + 1;
+    unsigned long received = len - line_len;
+    if (received > length)
+        received = length;
+    if (fd >= 0 && pwrite(fd, buff + line_len, received, offset) < 0)
+        perror("write() error");
+
+    static char data[CHUNK_SIZE];
+    while (received < length)
+    {
+        unsigned long remaining = length - received;
+        int n = recv(client_sock, data, remaining < sizeof(data) ? remaining : sizeof(data), 0);
+        if (n <= 0)
+        {
+            perror("recv() error");
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        if (fd >= 0 && pwrite(fd, data, n, offset + received) < 0)
+            perror("write() error");
+        received += n;
+    }
+    if (fd >= 0)
+        close(fd);
+    printf("Downloaded '%s' (%lu bytes from offset %lu)\n", name, length, offset);
+    return 0;
+}
+
+/**
+ * @brief Uploads a file to the server's content-addressed store: sends the list of
+ * chunk hashes, then only the chunks the server asks for.
+ * @param fd The opened file.
+ * @param filename Name of the file on the server.
+ */
+void upload_dedup(int fd, char *filename)
+{
+    ChunkRef *chunks;
+    unsigned long *offsets;
+    int count = chunk_file(fd, &chunks, &offsets);
+    if (count < 0)
+    {
+        printf("Cannot chunk '%s'\n", filename);
+        return;
+    }
+
+    int bitmap_size = (count + 7) / 8;
+    char *list = malloc((size_t)count * MANIFEST_ENTRY_SIZE + 1);
+    uint8_t *need = calloc(bitmap_size + 1, 1);
+    if (list == NULL || need == NULL)
+        goto out;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t length = htonl(chunks[i].length);
+        memcpy(list + (size_t)i * MANIFEST_ENTRY_SIZE, chunks[i].hash, CHUNK_HASH_SIZE);
+        memcpy(list + (size_t)i * MANIFEST_ENTRY_SIZE + CHUNK_HASH_SIZE, &length, 4);
+    }
+
+    if (snprintf(buff, sizeof(buff), "CHNK %s %lu %d", filename, filesize, count) >= (int)sizeof(buff))
+    {
+        printf("File name too long: %s\n", filename);
+        goto out;
+    }
+    if (send_all(buff, strlen(buff), 0) < 0 || (received_bytes = recv(client_sock, buff, BUFF_SIZE, 0)) <= 0)
+    {
+        perror("recv() error");
+        goto out;
+    }
+    buff[received_bytes] = '\0';
+    if (buff[0] != '+')
+    {
+        printf("Server error: %s\n", buff);
+        goto out;
+    }
+
+    int needed;
+    if (send_all(list, (size_t)count * MANIFEST_ENTRY_SIZE, 0) < 0 || recv_need(need, bitmap_size, &needed) < 0)
+    {
+        printf("Server error: %s\n", buff);
+        goto out;
+    }
+    printf("Sending %d of %d chunks of '%s'...\n", needed, count, filename);
+
+    for (int i = 0; i < count; i++)
+    {
+        if ((need[i / 8] & (1 << (i % 8))) && send_file_body(client_sock, fd, offsets[i], chunks[i].length) != chunks[i].length)
+            goto out;
+    }
+    if ((received_bytes = recv(client_sock, buff, BUFF_SIZE, 0)) > 0)
+        handle_server_response();
+
+out:
+    free(list);
+    free(need);
+    free(chunks);
+    free(offsets);
+}
+
+/**
+ * @brief Sends a file as one zlib stream, compressed on the fly at the fastest level:
+ * the point is fewer bytes on the wire, not the smallest output.
+ * @param fd The opened file.
+ * @param wire_bytes Set to the number of compressed bytes sent.
+ * @return Number of file bytes sent, which is filesize on success.
+ */
+unsigned long send_deflated(int fd, unsigned long *wire_bytes)
+{
+    static char in[CHUNK_SIZE], out[CHUNK_SIZE];
+    unsigned long total = 0;
+    z_stream z;
+    int flush;
+
+    *wire_bytes = 0;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit(&z, Z_BEST_SPEED) != Z_OK)
+        return 0;
+
+    do
+    {
+        ssize_t n = pread(fd, in, sizeof(in), total);
+        if (n < 0)
+        {
+            perror("read() error");
+            break;
+        }
+        total += n;
+        flush = total >= filesize || n == 0 ? Z_FINISH : Z_NO_FLUSH;
+        z.next_in = (Bytef *)in;
+        z.avail_in = n;
+        do
+        {
+            z.next_out = (Bytef *)out;
+            z.avail_out = sizeof(out);
+            deflate(&z, flush);
+            size_t have = sizeof(out) - z.avail_out;
+            if (have > 0 && send_all(out, have, 0) < 0)
+            {
+                deflateEnd(&z);
+                return 0;
+            }
+            *wire_bytes += have;
+        } while (z.avail_out == 0);
+    } while (flush != Z_FINISH);
+
+    deflateEnd(&z);
+    return total;
+}
+
+/**
+ * @brief Computes the XXH64 of a whole file, for the digest of the UPLD header.
+ * @param fd The opened file.
+ * @param hash Set to the file's hash.
+ * @return 0 on success, -1 on read error.
+ */
+int hash_file(int fd, uint64_t *hash)
+{
+    char data[CHUNK_SIZE];
+    Xxh64State state;
+    off_t offset = 0;
+    ssize_t n;
+
+    xxh64_reset(&state, 0);
+    while ((n = pread(fd, data, sizeof(data), offset)) > 0)
+    {
+        xxh64_update(&state, data, n);
+        offset += n;
+    }
+    if (n < 0)
+    {
+        perror("read() error");
+        return -1;
+    }
+    *hash = xxh64_digest(&state);
+    return 0;
 }
 
 /**
@@ -93,7 +700,7 @@ void communicate()
     // Step 4: Communicate with server
     while (1)
     {
-        printf("\nEnter file's name: ");
+        printf("\nEnter file's name (or RETR <name> [offset [length]]): ");
         if (fgets(buff, BUFF_SIZE, stdin) == NULL)
         {
             break;
@@ -107,6 +714,13 @@ void communicate()
             break;
         }
 
+        if (strncmp(buff, "RETR ", 5) == 0)
+        {
+            if (download_file(buff) < 0)
+                break;
+            continue;
+        }
+
         // set filepath
         strcpy(filepath, buff);
 
@@ -117,32 +731,70 @@ void communicate()
         else
             filename = filepath;
 
+        // open file to read
+        int fd = open(filepath, O_RDONLY);
+        if (fd < 0)
+        {
+            perror("open() error");
+            continue;
+        }
+
         // get filesize
         struct stat file_stat;
-        if (stat(filepath, &file_stat) < 0) // check file info
+        if (fstat(fd, &file_stat) < 0) // check file info
         {
-            perror("stat() error");
+            perror("fstat() error");
+            close(fd);
             continue;
         }
         filesize = file_stat.st_size; // get file's size (bytes)
 
-        // open file to read
-        FILE *fp = fopen(filepath, "rb");
-        if (fp == NULL)
+        if (resume_mode)
         {
-            perror("fopen() error");
+            upload_resumable(fd, filename);
+            close(fd);
+            continue;
+        }
+        if (dedup_mode && filesize > 0) // an empty file has no chunks, UPLD sends it
+        {
+            upload_dedup(fd, filename);
+            close(fd);
+            continue;
+        }
+        if (streams > 1)
+        {
+            upload_parallel(fd, filename);
+            close(fd);
             continue;
         }
 
         // send request to server
-        sprintf(buff, "UPLD %s %lu", filename, filesize);
+        uint64_t hash;
+        if (digest_mode && hash_file(fd, &hash) < 0)
+        {
+            close(fd);
+            continue;
+        }
+        int len;
+        if (digest_mode)
+            len = snprintf(buff, sizeof(buff), "UPLD %s %lu xxh64:%016llx", filename, filesize, (unsigned long long)hash);
+        else
+            len = snprintf(buff, sizeof(buff), "UPLD %s %lu", filename, filesize);
+        if (len + sizeof(" deflate") > sizeof(buff))
+        {
+            printf("File name too long: %s\n", filename);
+            close(fd);
+            continue;
+        }
+        if (deflate_mode)
+            strcat(buff, " deflate");
         send(client_sock, buff, strlen(buff), 0);
 
         received_bytes = recv(client_sock, buff, sizeof(buff) - 1, 0);
         if (received_bytes <= 0)
         {
             perror("recv() error (please send)");
-            fclose(fp);
+            close(fd);
             break;
         }
 
@@ -150,41 +802,30 @@ void communicate()
         if (buff[0] == '-')
         {
             printf("Server error: %s", buff);
-            fclose(fp);
+            close(fd);
             continue;
         }
         else if (buff[0] == '+')
         {
             handle_server_response();
             puts("Start sending file...");
-            size_t total_sent = 0;
-            char send_data[CHUNK_SIZE];
-            while (1)
+            if (deflate_mode)
+            {
+                unsigned long wire_bytes;
+                unsigned long total_sent = send_deflated(fd, &wire_bytes);
+                printf("File '%s' sent (%lu/%lu bytes, %lu compressed)\n", filename, total_sent, filesize, wire_bytes);
+            }
+            else
             {
-                size_t bytes_read = fread(send_data, 1, sizeof(send_data), fp);
-                if (bytes_read == 0)
-                    break; // hết file hoặc lỗi
-
-                size_t sent = 0;
-                while (sent < bytes_read)
-                {
-                    ssize_t sent_bytes = send(client_sock, send_data + sent, bytes_read - sent, 0); // ko dung  strlen(buff) tai vi file nhi phan, buff se chi doc den /0, dung bytes_read - sent de gui chinh xac so byte con lai
-                    if (sent_bytes < 0)
-                    {
-                        perror("send() error");
-                        break;
-                    }
-                    sent += sent_bytes;
-                    total_sent += sent_bytes;
-                }
+                unsigned long total_sent = send_file_body(client_sock, fd, 0, filesize);
+                printf("File '%s' sent (%lu/%lu bytes)\n", filename, total_sent, filesize);
             }
-            printf("File '%s' sent (%lu/%lu bytes)\n", filename, total_sent, filesize);
-            fclose(fp);
+            close(fd);
         }
         else
         {
             printf("Unexpected server response: %s", buff);
-            fclose(fp);
+            close(fd);
             continue;
         }
 
@@ -205,17 +846,42 @@ void communicate()
 /**
  * @brief Main function to start the TCP client.
  * @param argc Argument count.
- * @param argv Command line arguments: <program> <server_ip> <server_port>
+ * @param argv Command line arguments: <program> <server_ip> <server_port> [-r] [-p streams] [-x] [-d] [-z]
+ * -r uploads with RSUM: resumable, CRC32C-checked chunks.
+ * -p uploads each file as ranges over several parallel connections.
+ * -x sends the file's XXH64 so the server verifies the upload.
+ * -d uploads with CHNK, sending only the chunks a -d server does not have yet.
+ * -z compresses UPLD bodies with deflate; the server stores the original bytes.
  * @return Exit status.
  */
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    int opt;
+    while ((opt = getopt(argc, argv, "rp:xdz")) != -1)
+    {
+        if (opt == 'r')
+            resume_mode = 1;
+        else if (opt == 'z')
+            deflate_mode = 1;
+        else if (opt == 'd')
+            dedup_mode = 1;
+        else if (opt == 'x')
+            digest_mode = 1;
+        else if (opt == 'p')
+        {
+            streams = atoi(optarg);
+            if (streams < 1 || streams > MAX_STREAMS)
+                return 1;
+        }
+        else
+            return 1;
+    }
+    if (argc - optind != 2)
     {
         return 1;
     }
 
-    setup_socket(argv[1], argv[2]);
+    setup_socket(argv[optind], argv[optind + 1]);
 
     communicate();
 
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <openssl/sha.h>
+
+#include "cdc.h"
+
+static uint64_t gear[256];
+static int gear_ready = 0;
+
+/**
+ * @brief Fills the gear table with fixed pseudo-random values (splitmix64), so the
+ * client and any later version cut the same content at the same places.
+ */
+static void build_gear()
+{
+    uint64_t x = 0x5EED;
+    for (int i = 0; i < 256; i++)
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+    gear_ready = 1;
+}
+
+/**
+ * @brief Finds the end of the next content-defined chunk with a gear rolling hash.
+ * A cut depends only on the bytes just before it, so an insertion early in a file
+ * shifts the following chunk boundaries with the content and the chunks after the
+ * edit keep their hashes.
+ * @param data The remaining bytes of the file.
+ * @param len Number of remaining bytes.
+ * @return Length of the next chunk.
+ */
+size_t cdc_cut(const uint8_t *data, size_t len)
+{
+    const uint64_t mask = ((1ULL << CDC_AVG_BITS) - 1) << (64 - CDC_AVG_BITS); // top bits mix the most bytes
+    uint64_t h = 0;
+
+    if (!gear_ready)
+        build_gear();
+    if (len <= CDC_MIN_SIZE)
+        return len;
+    if (len > CDC_MAX_SIZE)
+        len = CDC_MAX_SIZE;
+
+    for (size_t i = CDC_MIN_SIZE; i < len; i++)
+    {
+        h = (h << 1) + gear[data[i]];
+        if ((h & mask) == 0)
+            return i + 1;
+    }
+    return len;
+}
+
+/**
+ * @brief Computes the identity of a chunk: its SHA-256.
+ */
+void chunk_hash(const void *data, size_t len, uint8_t hash[CHUNK_HASH_SIZE])
+{
+    SHA256(data, len, hash);
+}
+
+/**
+ * @brief Formats a chunk hash as lowercase hex, the chunk's file name in the store.
+ */
+void hash_to_hex(const uint8_t hash[CHUNK_HASH_SIZE], char hex[2 * CHUNK_HASH_SIZE + 1])
+{
+    for (int i = 0; i < CHUNK_HASH_SIZE; i++)
+        sprintf(hex + 2 * i, "%02x", hash[i]);
+}
@@ -0,0 +1,23 @@
+#ifndef CDC_H
+#define CDC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CDC_MIN_SIZE (16 * 1024)  /* no cut before this many bytes */
+#define CDC_AVG_BITS 16           /* cut where the top 16 bits of the gear hash are 0: ~64KB chunks */
+#define CDC_MAX_SIZE (256 * 1024) /* forced cut */
+#define CHUNK_HASH_SIZE 32        /* SHA-256 */
+#define MANIFEST_ENTRY_SIZE (CHUNK_HASH_SIZE + 4) /* hash + 4-byte big-endian length */
+
+typedef struct
+{
+    uint8_t hash[CHUNK_HASH_SIZE];
+    uint32_t length;
+} ChunkRef;
+
+size_t cdc_cut(const uint8_t *data, size_t len);
+void chunk_hash(const void *data, size_t len, uint8_t hash[CHUNK_HASH_SIZE]);
+void hash_to_hex(const uint8_t hash[CHUNK_HASH_SIZE], char hex[2 * CHUNK_HASH_SIZE + 1]);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "chunkstore.h"
+
+/**
+ * @brief Builds the path of a chunk: <dir>/.chunks/<sha256 hex>.
+ */
+static void chunk_path(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE], char *path, size_t size)
+{
+    char hex[2 * CHUNK_HASH_SIZE + 1];
+    hash_to_hex(hash, hex);
+    snprintf(path, size, "%s/.chunks/%s", dir, hex);
+}
+
+/**
+ * @brief Builds the path of the chunk list of a deduplicated file: <dir>/.manifests/<name>.
+ * Only CHNK uploads write there, so what a client uploads is never taken for one.
+ * @return 0 on success, -1 if the path does not fit.
+ */
+static int manifest_path(const char *dir, const char *name, char *path, size_t size)
+{
+    return snprintf(path, size, "%s/.manifests/%s", dir, name) < (int)size ? 0 : -1;
+}
+
+/**
+ * @brief Creates the chunk and chunk list directories of a content-addressed store.
+ * @param dir The upload directory.
+ * @return 0 on success, -1 on error.
+ */
+int store_init(const char *dir)
+{
+    char path[600];
+    snprintf(path, sizeof(path), "%s/.chunks", dir);
+    if (mkdir(path, 0777) == -1 && errno != EEXIST)
+    {
+        perror("mkdir(chunks) error");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/.manifests", dir);
+    if (mkdir(path, 0777) == -1 && errno != EEXIST)
+    {
+        perror("mkdir(manifests) error");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells whether the store already holds a chunk.
+ * @return 1 if it does, 0 otherwise.
+ */
+int store_has_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE])
+{
+    char path[700];
+    chunk_path(dir, hash, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Stores a chunk under its hash. The chunk is written to a temporary file and
+ * renamed, so a chunk file is either complete or absent.
+ * @return 0 on success, -1 on error.
+ */
+int store_put_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE], const char *data, size_t len)
+{
+    char path[700], tmp[720];
+
+    chunk_path(dir, hash, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("open() error");
+        return -1;
+    }
+    if (write(fd, data, len) != (ssize_t)len)
+    {
+        perror("write() error");
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0)
+    {
+        perror("rename() error");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the stored form of a deduplicated file: a "DEDUP1 <size> <count>"
+ * line, then one "<sha256 hex> <length>" line per chunk. A plain file uploaded
+ * earlier under the same name is removed.
+ * @param dir The upload directory.
+ * @param name Name of the file.
+ * @param upload The received chunk list.
+ * @param filesize Size of the original file.
+ * @return 0 on success, -1 on error.
+ */
+int store_write_manifest(const char *dir, const char *name, const DedupUpload *upload, unsigned long filesize)
+{
+    char path[600], hex[2 * CHUNK_HASH_SIZE + 1];
+    if (manifest_path(dir, name, path, sizeof(path)) < 0)
+        return -1;
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+    {
+        perror("fopen() error");
+        return -1;
+    }
+
+    fprintf(f, "%s %lu %d\n", MANIFEST_MAGIC, filesize, upload->count);
+    for (int i = 0; i < upload->count; i++)
+    {
+        hash_to_hex(upload->chunks[i].hash, hex);
+        fprintf(f, "%s %u\n", hex, upload->chunks[i].length);
+    }
+    if (fclose(f) != 0)
+    {
+        perror("fclose() error");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    unlink(path);
+    return 0;
+}
+
+/**
+ * @brief Forgets the chunk list stored for a name, when plain bytes are uploaded under it.
+ */
+void store_drop_manifest(const char *dir, const char *name)
+{
+    char path[600];
+    if (manifest_path(dir, name, path, sizeof(path)) == 0)
+        unlink(path);
+}
+
+/**
+ * @brief Loads the chunk list of a file stored by store_write_manifest().
+ * @param dir The upload directory.
+ * @param name Name of the file.
+ * @param filesize Set to the size of the original file.
+ * @return The chunk list, NULL if the file was not stored as one.
+ */
+DedupUpload *store_read_manifest(const char *dir, const char *name, unsigned long *filesize)
+{
+    char path[600], magic[8], hex[2 * CHUNK_HASH_SIZE + 1];
+    int count;
+    if (manifest_path(dir, name, path, sizeof(path)) < 0)
+        return NULL;
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return NULL;
+
+    DedupUpload *upload = NULL;
+    if (fscanf(f, "%7s %lu %d", magic, filesize, &count) != 3 || strcmp(magic, MANIFEST_MAGIC) != 0 || count < 0 ||
+        count > MAX_MANIFEST_CHUNKS || (upload = calloc(1, sizeof(DedupUpload))) == NULL ||
+        (upload->chunks = calloc(count + 1, sizeof(ChunkRef))) == NULL)
+        goto fail;
+
+    for (upload->count = 0; upload->count < count; upload->count++)
+    {
+        ChunkRef *chunk = &upload->chunks[upload->count];
+        if (fscanf(f, "%64s %u", hex, &chunk->length) != 2 || strlen(hex) != 2 * CHUNK_HASH_SIZE)
+            goto fail;
+        for (int i = 0; i < CHUNK_HASH_SIZE; i++)
+            sscanf(hex + 2 * i, "%2hhx", &chunk->hash[i]);
+    }
+    fclose(f);
+    return upload;
+
+fail:
+    fclose(f);
+    dedup_free(upload);
+    return NULL;
+}
+
+/**
+ * @brief Opens a stored chunk for reading.
+ * @return The file descriptor, -1 if the chunk is missing.
+ */
+int store_open_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE])
+{
+    char path[700];
+    chunk_path(dir, hash, path, sizeof(path));
+    return open(path, O_RDONLY);
+}
+
+/**
+ * @brief Frees a deduplicated upload.
+ */
+void dedup_free(DedupUpload *upload)
+{
+    if (upload == NULL)
+        return;
+    free(upload->chunks);
+    free(upload->need);
+    free(upload->reply);
+    free(upload->buf);
+    free(upload);
+}
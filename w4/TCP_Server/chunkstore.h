@@ -0,0 +1,34 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "cdc.h"
+
+#define MANIFEST_MAGIC "DEDUP1" /* first word of a stored chunk list */
+#define MAX_MANIFEST_CHUNKS (1 << 20)
+
+typedef struct
+{
+    ChunkRef *chunks;       // chunk list of the file, in order
+    int count;
+    int capacity;           // entries allocated in chunks, grown as the list arrives
+    unsigned long list_pos; // bytes of the chunk list received so far
+    uint8_t *need;          // bitmap: chunks the store does not have yet
+    int needed;
+    char *reply;            // "+OK Need" reply still being sent, NULL otherwise
+    int reply_len;
+    int reply_sent;
+    int current;            // chunk being received
+    char *buf;              // bytes of the current chunk received so far
+    unsigned long buf_pos;
+} DedupUpload;
+
+int store_init(const char *dir);
+int store_has_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE]);
+int store_put_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE], const char *data, size_t len);
+int store_write_manifest(const char *dir, const char *name, const DedupUpload *upload, unsigned long filesize);
+void store_drop_manifest(const char *dir, const char *name);
+DedupUpload *store_read_manifest(const char *dir, const char *name, unsigned long *filesize);
+int store_open_chunk(const char *dir, const uint8_t hash[CHUNK_HASH_SIZE]);
+void dedup_free(DedupUpload *upload);
+
+#endif
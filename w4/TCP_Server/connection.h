@@ -0,0 +1,87 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "rangeupload.h"
+#include "xxhash64.h"
+#include "chunkstore.h"
+
+#define BUFF_SIZE 4096   /* Buffer size */
+#define CHUNK_SIZE 65536 // 64KB
+#define RECV_BUFFER_SIZE (256 * 1024) /* copy-path buffer when splice() is unavailable */
+#define PIPE_SIZE (1024 * 1024)       /* splice() pipe capacity per connection */
+#define RESUME_CHUNK_SIZE (1024 * 1024) /* bytes covered by one checksum in resumable uploads */
+#define WRITEBACK_WINDOW (8 * 1024 * 1024) /* body bytes handed to the disk at a time with -w */
+#define WELCOME_MSG "+OK Welcome to file server"
+#define OK_SEND_FILE_MSG "+OK Please send file"
+#define OK_SUCCESS_MSG "+OK Successful upload"
+#define ERR_INVALID_FILE_MSG "-ERR Invalid file info format"
+#define ERR_FILE_INCOMPLETE_MSG "-ERR File transfer incomplete"
+#define OK_RESUME_MSG "+OK Resume from"
+#define ERR_CHECKSUM_MSG "-ERR Chunk checksum mismatch, resume from"
+#define OK_RANGE_STORED_MSG "+OK Range stored"
+#define ERR_INVALID_RANGE_MSG "-ERR Invalid range"
+#define ERR_DIGEST_MSG "-ERR Checksum mismatch"
+#define OK_SEND_LIST_MSG "+OK Send chunk list"
+#define OK_NEED_MSG "+OK Need"
+#define ERR_DEDUP_DISABLED_MSG "-ERR Dedup store disabled"
+#define ERR_INVALID_LIST_MSG "-ERR Invalid chunk list"
+#define ERR_CHUNK_HASH_MSG "-ERR Chunk hash mismatch"
+#define OK_SENDING_MSG "+OK Sending"
+#define ERR_NOT_FOUND_MSG "-ERR File not found"
+
+typedef enum
+{
+    STATE_HEADER, // waiting for an UPLD, RSUM, UPLR, CHNK or RETR header
+    STATE_BODY,   // receiving the file body
+    STATE_REPLY,  // sending the chunk request of a CHNK upload, on writable events
+    STATE_SEND    // sending a RETR download, on writable events
+} ConnState;
+
+typedef struct
+{
+    int sockfd; // -1 if the slot is free
+    ConnState state;
+    char client_ip[INET_ADDRSTRLEN];
+    int client_port;
+    char header[BUFF_SIZE]; // last request header, for the log
+    char filename[256];
+    char filepath[512];
+    unsigned long filesize;       // body length: the whole file, or the range for UPLR
+    unsigned long total_received; // body bytes written to the file
+    unsigned long flushed;        // body bytes already handed to write-back (-w)
+    unsigned long range_offset;   // file offset of the first body byte (UPLR), 0 otherwise
+    RangedUpload *ranged;         // multi-stream upload this range belongs to (UPLR), NULL otherwise
+    int file_fd;                  // file being written in STATE_BODY, -1 otherwise
+    int use_splice;               // 0 once splice() turned out to be unsupported
+    int pipe_fds[2];              // socket -> file splice() pipe, -1 until first used
+    unsigned long pipe_pending;   // bytes sitting in the pipe, not yet in the file
+    int resumable;                // 1 for RSUM uploads: CRC32C-framed chunks into <name>.<size>.part
+    char partpath[600];           // partial file of a resumable upload
+    unsigned long verified;       // bytes of the partial file whose chunks passed the checksum
+    char *frame;                  // current chunk frame: 4-byte CRC32C + up to RESUME_CHUNK_SIZE bytes
+    unsigned long frame_pos;      // bytes of the current frame received so far
+    int hashing;                  // 1 when the UPLD header carried an xxh64 digest
+    Xxh64State hash;              // XXH64 of the body bytes received so far
+    uint64_t expected_hash;       // digest sent by the client
+    z_stream *inflater;           // "deflate" uploads: zlib stream of the body, NULL otherwise
+    DedupUpload *dedup;           // chunk list of a CHNK upload or of a deduplicated download, NULL otherwise
+    off_t send_offset;            // RETR: position in the file, or in the current chunk
+    unsigned long send_remaining; // RETR: bytes still to send
+} Connection;
+
+extern char fullpath[512];
+extern int dedup_store; /* 1 when CHNK uploads go to the content-addressed store */
+extern int stream_writeback; /* 1 to preallocate uploads and keep them out of the page cache */
+
+void write_log(Connection *conn, char *input, char *result);
+void send_msg(Connection *conn, char *msg);
+void close_connection(Connection *conn);
+void watch_writable(Connection *conn, int on);
+
+#endif
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#include "download.h"
+
+/**
+ * @brief Rejects names that would leave the upload directory or reach the chunk store.
+ * @return 1 if the name is a plain file name.
+ */
+int valid_name(const char *name)
+{
+    return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL;
+}
+
+/**
+ * @brief Releases the file, or the chunk list, of a finished or refused download.
+ */
+static void close_download(Connection *conn)
+{
+    if (conn->file_fd >= 0)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    dedup_free(conn->dedup);
+    conn->dedup = NULL;
+}
+
+/**
+ * @brief Replies to a RETR that cannot be served.
+ */
+static void refuse(Connection *conn, char *msg)
+{
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+}
+
+/**
+ * @brief Positions a download of a deduplicated file: finds the chunk holding the
+ * first requested byte. The chunk files are opened one after the other while sending.
+ * @param conn The connection, with dedup holding the file's chunk list.
+ * @param offset First byte to send.
+ */
+static void seek_chunks(Connection *conn, unsigned long offset)
+{
+    DedupUpload *d = conn->dedup;
+
+    d->current = 0;
+    while (d->current < d->count && offset >= d->chunks[d->current].length)
+    {
+        offset -= d->chunks[d->current].length;
+        d->current++;
+    }
+    conn->send_offset = offset;
+}
+
+/**
+ * @brief Handles "RETR <name> [offset [length]]": opens a stored file and starts
+ * sending it. The reply is "+OK Sending <length>\n" followed by exactly that many
+ * bytes; the rest is sent from handle_send() as the socket becomes writable.
+ * @param conn The connection, with the command in conn->header.
+ */
+void handle_retr(Connection *conn)
+{
+    unsigned long offset = 0, length = ULONG_MAX, size;
+    struct stat st;
+    char msg[128];
+
+    if (sscanf(conn->header, "RETR %255s %lu %lu", conn->filename, &offset, &length) < 1 || !valid_name(conn->filename))
+    {
+        refuse(conn, ERR_INVALID_FILE_MSG);
+        return;
+    }
+    printf("Client %s:%d: %s\n", conn->client_ip, conn->client_port, conn->header);
+    if (snprintf(conn->filepath, sizeof(conn->filepath), "%s/%s", fullpath, conn->filename) >= (int)sizeof(conn->filepath))
+    {
+        refuse(conn, ERR_INVALID_FILE_MSG);
+        return;
+    }
+
+    // a file uploaded with CHNK is stored as its chunk list, kept apart from the uploads
+    conn->dedup = dedup_store ? store_read_manifest(fullpath, conn->filename, &size) : NULL;
+    if (conn->dedup == NULL)
+    {
+        conn->file_fd = open(conn->filepath, O_RDONLY);
+        if (conn->file_fd < 0 || fstat(conn->file_fd, &st) < 0 || !S_ISREG(st.st_mode))
+        {
+            close_download(conn);
+            refuse(conn, ERR_NOT_FOUND_MSG);
+            return;
+        }
+        size = st.st_size;
+    }
+
+    if (offset > size)
+    {
+        close_download(conn);
+        refuse(conn, ERR_INVALID_RANGE_MSG);
+        return;
+    }
+    if (length > size - offset)
+        length = size - offset;
+
+    conn->send_remaining = length;
+    if (conn->dedup != NULL)
+        seek_chunks(conn, offset);
+    else
+        conn->send_offset = offset;
+
+    snprintf(msg, sizeof(msg), "%s %lu\n", OK_SENDING_MSG, length);
+    send_msg(conn, msg);
+    msg[strlen(msg) - 1] = '\0';
+    write_log(conn, conn->header, msg);
+
+    conn->state = STATE_SEND;
+    watch_writable(conn, 1);
+    handle_send(conn);
+}
+
+/**
+ * @brief Sends as much of a download as the socket accepts, with sendfile() from the
+ * stored file, or from each chunk file in turn for a deduplicated file. Returns on
+ * EAGAIN, so one slow reader never holds up the others.
+ * @param conn The connection, in STATE_SEND.
+ */
+void handle_send(Connection *conn)
+{
+    DedupUpload *d = conn->dedup;
+
+    while (conn->send_remaining > 0)
+    {
+        unsigned long available = conn->send_remaining;
+        if (d != NULL)
+        {
+            if (conn->file_fd < 0 && (conn->file_fd = store_open_chunk(fullpath, d->chunks[d->current].hash)) < 0)
+            {
+                printf("Chunk %d of '%s' is missing from the store\n", d->current, conn->filename);
+                close_connection(conn);
+                return;
+            }
+            if (d->chunks[d->current].length - conn->send_offset < available)
+                available = d->chunks[d->current].length - conn->send_offset;
+        }
+
+        ssize_t n = sendfile(conn->sockfd, conn->file_fd, &conn->send_offset, available);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return; // wait until the socket is writable
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n < 0)
+                perror("sendfile() error");
+            close_connection(conn);
+            return;
+        }
+        conn->send_remaining -= n;
+
+        if (d != NULL && conn->send_offset == (off_t)d->chunks[d->current].length)
+        {
+            close(conn->file_fd);
+            conn->file_fd = -1;
+            conn->send_offset = 0;
+            d->current++;
+        }
+    }
+
+    printf("File '%s' sent to %s:%d\n", conn->filename, conn->client_ip, conn->client_port);
+    close_download(conn);
+    watch_writable(conn, 0);
+    conn->state = STATE_HEADER;
+}
@@ -0,0 +1,10 @@
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include "connection.h"
+
+int valid_name(const char *name);
+void handle_retr(Connection *conn);
+void handle_send(Connection *conn);
+
+#endif
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "rangeupload.h"
+
+static RangedUpload *uploads = NULL; /* multi-stream uploads in progress */
+
+/**
+ * @brief Finds the upload of a file, or starts one: the partial file is opened
+ * and preallocated to its full size, so ranges arriving out of order are written
+ * in place without growing the file.
+ * @return The upload, NULL on error.
+ */
+static RangedUpload *find_or_create(const char *filepath, unsigned long filesize)
+{
+    RangedUpload *u;
+    for (u = uploads; u != NULL; u = u->next)
+        if (strcmp(u->filepath, filepath) == 0 && u->filesize == filesize)
+            return u;
+
+    u = calloc(1, sizeof(RangedUpload));
+    if (u == NULL)
+        return NULL;
+    snprintf(u->filepath, sizeof(u->filepath), "%s", filepath);
+    snprintf(u->partpath, sizeof(u->partpath), "%s.%lu.ranges", filepath, filesize);
+    u->filesize = filesize;
+
+    u->fd = open(u->partpath, O_WRONLY | O_CREAT, 0644);
+    if (u->fd < 0)
+    {
+        perror("open() error");
+        free(u);
+        return NULL;
+    }
+    if (filesize > 0 && fallocate(u->fd, 0, 0, filesize) < 0 && ftruncate(u->fd, filesize) < 0)
+    {
+        perror("fallocate() error");
+        close(u->fd);
+        free(u);
+        return NULL;
+    }
+
+    u->next = uploads;
+    uploads = u;
+    return u;
+}
+
+/**
+ * @brief Releases an upload once no connection uses it and no range is recorded.
+ * An upload with completed ranges is kept, since a fast stream may finish before
+ * the others have sent their header.
+ */
+static void release(RangedUpload *u)
+{
+    RangedUpload **p;
+
+    if (--u->refs > 0 || u->range_count > 0)
+        return;
+    for (p = &uploads; *p != NULL; p = &(*p)->next)
+    {
+        if (*p == u)
+        {
+            *p = u->next;
+            break;
+        }
+    }
+    close(u->fd);
+    free(u->ranges);
+    free(u);
+}
+
+/**
+ * @brief Registers a range of a multi-stream upload.
+ * @param filepath Final path of the file.
+ * @param filesize Size of the whole file.
+ * @param offset First byte of the range.
+ * @param length Length of the range.
+ * @param err Set to RANGE_INVALID or RANGE_ERROR when NULL is returned.
+ * @return The upload the range belongs to; its fd accepts pwrite() at the range's offsets.
+ */
+RangedUpload *range_begin(const char *filepath, unsigned long filesize, unsigned long offset, unsigned long length, int *err)
+{
+    if (offset > filesize || length > filesize - offset)
+    {
+        *err = RANGE_INVALID;
+        return NULL;
+    }
+
+    RangedUpload *u = find_or_create(filepath, filesize);
+    if (u == NULL)
+    {
+        *err = RANGE_ERROR;
+        return NULL;
+    }
+
+    for (int i = 0; i < u->range_count; i++)
+    {
+        Range *r = &u->ranges[i];
+        if (offset < r->offset + r->length && r->offset < offset + length)
+        {
+            *err = RANGE_INVALID;
+            if (u->refs == 0)
+            {
+                u->refs = 1;
+                release(u);
+            }
+            return NULL;
+        }
+    }
+
+    Range *ranges = realloc(u->ranges, (u->range_count + 1) * sizeof(Range));
+    if (ranges == NULL)
+    {
+        *err = RANGE_ERROR;
+        return NULL;
+    }
+    u->ranges = ranges;
+    u->ranges[u->range_count].offset = offset;
+    u->ranges[u->range_count].length = length;
+    u->ranges[u->range_count].done = 0;
+    u->range_count++;
+    u->refs++;
+    *err = RANGE_OK;
+    return u;
+}
+
+/**
+ * @brief Marks a range as received. When every byte of the file has arrived the
+ * partial file is renamed to its final name.
+ * @param upload The upload.
+ * @param offset First byte of the range.
+ * @return 1 if the file was committed, 0 if other ranges are still missing, -1 on error.
+ */
+int range_complete(RangedUpload *upload, unsigned long offset)
+{
+    int committed = 0;
+
+    for (int i = 0; i < upload->range_count; i++)
+    {
+        if (upload->ranges[i].offset == offset && !upload->ranges[i].done)
+        {
+            upload->ranges[i].done = 1;
+            upload->bytes_done += upload->ranges[i].length;
+            break;
+        }
+    }
+
+    if (upload->bytes_done == upload->filesize)
+    {
+        committed = 1;
+        if (rename(upload->partpath, upload->filepath) < 0)
+        {
+            perror("rename() error");
+            committed = -1;
+        }
+        upload->range_count = 0; // a new upload of the same name starts from scratch
+        upload->bytes_done = 0;
+    }
+    release(upload);
+    return committed;
+}
+
+/**
+ * @brief Forgets a range whose connection failed, so the client can send it again.
+ * @param upload The upload.
+ * @param offset First byte of the range.
+ */
+void range_abort(RangedUpload *upload, unsigned long offset)
+{
+    for (int i = 0; i < upload->range_count; i++)
+    {
+        if (upload->ranges[i].offset == offset && !upload->ranges[i].done)
+        {
+            upload->ranges[i] = upload->ranges[--upload->range_count];
+            break;
+        }
+    }
+    release(upload);
+}
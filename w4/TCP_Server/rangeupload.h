@@ -0,0 +1,32 @@
+#ifndef RANGEUPLOAD_H
+#define RANGEUPLOAD_H
+
+#define RANGE_OK 0
+#define RANGE_INVALID -1 /* range outside the file or overlapping another range */
+#define RANGE_ERROR -2   /* the partial file cannot be opened */
+
+typedef struct
+{
+    unsigned long offset;
+    unsigned long length;
+    int done; // 1 once every byte of the range is in the file
+} Range;
+
+typedef struct RangedUpload
+{
+    char filepath[512];  // final path, committed by rename()
+    char partpath[600];  // preallocated file the ranges are written into
+    unsigned long filesize;
+    unsigned long bytes_done; // bytes of completed ranges
+    int fd;
+    int refs; // connections currently uploading a range
+    Range *ranges;
+    int range_count;
+    struct RangedUpload *next;
+} RangedUpload;
+
+RangedUpload *range_begin(const char *filepath, unsigned long filesize, unsigned long offset, unsigned long length, int *err);
+int range_complete(RangedUpload *upload, unsigned long offset);
+void range_abort(RangedUpload *upload, unsigned long offset);
+
+#endif
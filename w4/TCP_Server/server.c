@@ -3,45 +3,44 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <time.h>
 
+#include "connection.h"
+#include "upload.h"
+#include "download.h"
+#include "writeback.h"
+
 #define FILE_LOG "TCP_Server/log_20225839.txt"
 #define BASE_DIR "TCP_Server"
-#define BACKLOG 2        /* Number of allowed connections */
-#define BUFF_SIZE 4096   /* Buffer size */
-#define CHUNK_SIZE 65536 // 64KB
-#define WELCOME_MSG "+OK Welcome to file server"
-#define OK_SEND_FILE_MSG "+OK Please send file"
-#define OK_SUCCESS_MSG "+OK Successful upload"
-#define ERR_INVALID_FILE_MSG "-ERR Invalid file info format"
-#define ERR_FILE_INCOMPLETE_MSG "-ERR File transfer incomplete"
-
-int listen_sock, conn_sock; /* file descriptors */
-char recv_data[BUFF_SIZE];
-char client_ip[INET_ADDRSTRLEN];
-int bytes_sent, received_bytes;
-socklen_t sin_size;
+#define BACKLOG 256 /* Number of allowed connections */
+
+int listen_sock; /* file descriptors */
 struct sockaddr_in server_addr; /* server's address information */
-struct sockaddr_in client_addr; /* client's address information */
-int client_port;
+Connection conns[FD_SETSIZE];   /* per-connection state, indexed by socket */
+fd_set allset;
+fd_set wallset; /* connections sending a download */
+int maxfd;
 
 char fullpath[512];
 char directory_name[256];
-char filename[256];
-unsigned long filesize;
-char buffer[BUFF_SIZE];
+int dedup_store = 0;
+int stream_writeback = 0;
 
 /**
  * @brief Writes server activities to the log file.
+ * @param conn The connection the activity belongs to.
  * @return New log in the log file.
  */
-void write_log(char *input, char *result)
+void write_log(Connection *conn, char *input, char *result)
 {
     time_t now;
     struct tm *t;
@@ -61,13 +60,79 @@ void write_log(char *input, char *result)
 
     if (input == NULL)
     {
-        fprintf(f, "%s$%s:%d$%s\n", buffer, client_ip, client_port, result);
+        fprintf(f, "%s$%s:%d$%s\n", buffer, conn->client_ip, conn->client_port, result);
     }
     else
-        fprintf(f, "%s$%s:%d$%s$%s\n", buffer, client_ip, client_port, input, result);
+        fprintf(f, "%s$%s:%d$%s$%s\n", buffer, conn->client_ip, conn->client_port, input, result);
     fclose(f);
 }
 
+/**
+ * @brief Sends a status message to a client.
+ * @param conn The connection.
+ * @param msg The message.
+ */
+void send_msg(Connection *conn, char *msg)
+{
+    if (send(conn->sockfd, msg, strlen(msg), 0) < 0)
+        perror("send() error");
+}
+
+/**
+ * @brief Closes a connection and frees its slot.
+ * @param conn The connection.
+ */
+void close_connection(Connection *conn)
+{
+    if (conn->ranged != NULL)
+    {
+        range_abort(conn->ranged, conn->range_offset); // the file descriptor belongs to the upload
+        conn->ranged = NULL;
+        conn->file_fd = -1;
+    }
+    if (conn->file_fd >= 0)
+    {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+    }
+    if (conn->pipe_fds[0] >= 0)
+    {
+        close(conn->pipe_fds[0]);
+        close(conn->pipe_fds[1]);
+        conn->pipe_fds[0] = conn->pipe_fds[1] = -1;
+    }
+    free(conn->frame);
+    conn->frame = NULL;
+    dedup_free(conn->dedup);
+    conn->dedup = NULL;
+    free_inflater(conn);
+    FD_CLR(conn->sockfd, &allset);
+    FD_CLR(conn->sockfd, &wallset);
+    close(conn->sockfd);
+    conn->sockfd = -1;
+}
+
+/**
+ * @brief Switches a connection between waiting for requests and sending a download
+ * or a long reply. While sending, the connection is watched for writability only,
+ * so a pipelined request waits until the send is done.
+ * @param conn The connection.
+ * @param on 1 to watch for writability, 0 to watch for requests again.
+ */
+void watch_writable(Connection *conn, int on)
+{
+    if (on)
+    {
+        FD_CLR(conn->sockfd, &allset);
+        FD_SET(conn->sockfd, &wallset);
+    }
+    else
+    {
+        FD_CLR(conn->sockfd, &wallset);
+        FD_SET(conn->sockfd, &allset);
+    }
+}
+
 /**
  * @brief Sets up the server socket.
  * @param port The port number to bind the server socket to.
@@ -110,112 +175,111 @@ void setup_socket(char *port)
         if (errno != EEXIST) // if error is not EEXIST exit
         {
             perror("mkdir(fullpath) error");
-            close(conn_sock);
             exit(EXIT_FAILURE);
         }
     }
 }
 
 /**
- * @brief Communicates with the client to receive files.
- * @param filename The name of the file to be received.
- * @param filesize The size of the file to be received.
- * @return file received successfully or not in the selected folder.
+ * @brief Accepts a new client and sends the welcome message.
  */
-void communicate()
+void accept_client()
 {
-    // Step 4: Communicate with client
-    while (1)
+    struct sockaddr_in client_addr; /* client's address information */
+    socklen_t sin_size = sizeof(struct sockaddr_in);
+    int conn_sock = accept(listen_sock, (struct sockaddr *)&client_addr, &sin_size);
+    if (conn_sock == -1)
     {
-        // accept request
-        sin_size = sizeof(struct sockaddr_in);
-        if ((conn_sock = accept(listen_sock, (struct sockaddr *)&client_addr, &sin_size)) == -1)
-        {
-            perror("accept() error");
-            continue;
-        }
+        perror("accept() error");
+        return;
+    }
+    if (conn_sock >= FD_SETSIZE)
+    {
+        printf("Too many clients\n");
+        close(conn_sock);
+        return;
+    }
 
-        if (inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN) == NULL)
-        {
-            perror("inet_ntop() error");
-            close(conn_sock);
-            continue;
-        }
+    Connection *conn = &conns[conn_sock];
+    memset(conn, 0, sizeof(*conn));
+    conn->sockfd = conn_sock;
+    conn->state = STATE_HEADER;
+    conn->file_fd = -1;
+    conn->use_splice = 1;
+    conn->pipe_fds[0] = conn->pipe_fds[1] = -1;
+    if (inet_ntop(AF_INET, &client_addr.sin_addr, conn->client_ip, INET_ADDRSTRLEN) == NULL)
+    {
+        perror("inet_ntop() error");
+        close(conn_sock);
+        conn->sockfd = -1;
+        return;
+    }
+    conn->client_port = ntohs(client_addr.sin_port);
 
-        // send welcome message
-        client_port = ntohs(client_addr.sin_port);
-        printf("You got a connection from %s:%d\n", client_ip, client_port);
-        bytes_sent = send(conn_sock, WELCOME_MSG, strlen(WELCOME_MSG), 0);
-        if (bytes_sent < 0)
-            perror("send() error");
-        write_log(NULL, WELCOME_MSG);
+    // a slow client must not block the others
+    fcntl(conn_sock, F_SETFL, fcntl(conn_sock, F_GETFL, 0) | O_NONBLOCK);
+    FD_SET(conn_sock, &allset);
+    if (conn_sock > maxfd)
+        maxfd = conn_sock;
 
-        while (1)
-        {
+    // send welcome message
+    printf("You got a connection from %s:%d\n", conn->client_ip, conn->client_port);
+    send_msg(conn, WELCOME_MSG);
+    write_log(conn, NULL, WELCOME_MSG);
+}
 
-            // receives file name and file data from client
-            char recv_data[CHUNK_SIZE];
+/**
+ * @brief Communicates with all clients to receive files. Each connection runs its
+ * own header/body state machine, so many uploads progress at the same time.
+ */
+void communicate()
+{
+    fd_set readfds, writefds;
 
-            received_bytes = recv(conn_sock, recv_data, sizeof(recv_data), 0);
-            if (received_bytes <= 0)
-            {
-                printf("Client %s:%d disconnected\n", client_ip, client_port);
-                close(conn_sock);
-                break;
-            }
-            recv_data[received_bytes] = '\0';
+    for (int i = 0; i < FD_SETSIZE; i++)
+        conns[i].sockfd = -1;
+    FD_ZERO(&allset);
+    FD_ZERO(&wallset);
+    FD_SET(listen_sock, &allset);
+    maxfd = listen_sock;
 
-            if (sscanf(recv_data, "UPLD %s %lu", filename, &filesize) != 2)
-            {
-                send(conn_sock, ERR_INVALID_FILE_MSG, strlen(ERR_INVALID_FILE_MSG), 0);
-                close(conn_sock);
-                write_log(recv_data, ERR_INVALID_FILE_MSG);
+    // Step 4: Communicate with clients
+    while (1)
+    {
+        readfds = allset;
+        writefds = wallset;
+        if (select(maxfd + 1, &readfds, &writefds, NULL, NULL) < 0)
+        {
+            if (errno == EINTR)
                 continue;
-            }
-            else
-            {
-                printf("Client %s:%d: %s\n", client_ip, client_port, recv_data);
-                send(conn_sock, OK_SEND_FILE_MSG, strlen(OK_SEND_FILE_MSG), 0);
-                write_log(recv_data, OK_SEND_FILE_MSG);
-            }
+            perror("select() error");
+            exit(EXIT_FAILURE);
+        }
 
-            // write file to disk
-            char filepath[512];
-            snprintf(filepath, sizeof(filepath), "%s/%s", fullpath, filename);
-            FILE *fp = fopen(filepath, "wb"); // w = write, b = binary
-            if (fp == NULL)
-            {
-                perror("fopen() error");
-                close(conn_sock);
-                continue;
-            }
+        if (FD_ISSET(listen_sock, &readfds))
+            accept_client();
 
-            unsigned long total_received = 0;
-            while (total_received < filesize)
-            {
-                received_bytes = recv(conn_sock, buffer, sizeof(buffer), 0);
-                if (received_bytes <= 0)
-                {
-                    break;
-                }
-                fwrite(buffer, 1, received_bytes, fp);
-                total_received += received_bytes;
-            }
-            fclose(fp);
+        for (int fd = 0; fd <= maxfd; fd++)
+        {
+            Connection *conn = &conns[fd];
+            if (fd == listen_sock || conn->sockfd < 0)
+                continue;
 
-            if (total_received == filesize)
+            if (conn->state == STATE_SEND || conn->state == STATE_REPLY)
             {
-                send(conn_sock, OK_SUCCESS_MSG, strlen(OK_SUCCESS_MSG), 0);
-                printf("File '%s' uploaded successfully (%lu bytes) in '%s'\n", filename, filesize, filepath);
-                write_log(recv_data, OK_SUCCESS_MSG);
+                if (!FD_ISSET(fd, &writefds))
+                    continue;
+                if (conn->state == STATE_SEND)
+                    handle_send(conn);
+                else
+                    send_reply(conn);
             }
+            else if (!FD_ISSET(fd, &readfds))
+                continue;
+            else if (conn->state == STATE_HEADER)
+                handle_header(conn);
             else
-            {
-                send(conn_sock, ERR_FILE_INCOMPLETE_MSG, strlen(ERR_FILE_INCOMPLETE_MSG), 0);
-                printf("%s", ERR_FILE_INCOMPLETE_MSG);
-                write_log(recv_data, ERR_FILE_INCOMPLETE_MSG);
-                close(conn_sock);
-            }
+                handle_body(conn);
         }
     }
 }
@@ -223,19 +287,35 @@ void communicate()
 /**
  * @brief Main function to start the TCP server.
  * @param argc Argument count.
- * @param argv Command line arguments: <program> <server_port> <directory_name>
+ * @param argv Command line arguments: <program> [-d] [-w] <server_port> <directory_name>
+ * -d stores CHNK uploads as chunk lists in a content-addressed store.
+ * -w preallocates uploads and streams them to disk without filling the page cache.
  * @return Exit status.
  */
 int main(int argc, char *argv[])
 {
-    if (argc != 3)
+    int opt;
+    while ((opt = getopt(argc, argv, "dw")) != -1)
+    {
+        if (opt == 'd')
+            dedup_store = 1;
+        else if (opt == 'w')
+            stream_writeback = 1;
+        else
+            return 1;
+    }
+    if (argc - optind != 2)
     {
         return 1;
     }
 
-    strcpy(directory_name, argv[2]);
+    strcpy(directory_name, argv[optind + 1]);
 
-    setup_socket(argv[1]);
+    setup_socket(argv[optind]);
+    if (dedup_store && store_init(fullpath) < 0)
+        exit(EXIT_FAILURE);
+    if (stream_writeback && writeback_start() < 0)
+        exit(EXIT_FAILURE);
 
     communicate();
 
@@ -0,0 +1,965 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "upload.h"
+#include "download.h"
+#include "crc32c.h"
+#include "writeback.h"
+
+#define RECV_AGAIN 0       /* socket drained, wait for the next readable event */
+#define RECV_DONE 1        /* the whole body is in the file */
+#define RECV_CLOSED 2      /* peer closed or an error occurred before the end */
+#define RECV_UNSUPPORTED 3 /* splice() cannot be used, switch to the copy path */
+
+static char copy_buffer[RECV_BUFFER_SIZE]; /* shared: the event loop is single-threaded */
+static char inflate_buffer[RECV_BUFFER_SIZE]; /* inflated bytes of a deflate body */
+
+/**
+ * @brief Opens the partial file of a resumable upload and tells the client where to
+ * resume. Only whole chunks that passed their checksum are ever written, so the
+ * verified prefix is the partial file's size rounded down to a chunk boundary.
+ * The size is part of the partial file's name, so a different file uploaded under
+ * the same name starts over.
+ * @param conn The connection.
+ * @return 0 on success, -1 on error.
+ */
+static int open_resumable(Connection *conn)
+{
+    struct stat st;
+    char msg[128];
+
+    snprintf(conn->partpath, sizeof(conn->partpath), "%s.%lu.part", conn->filepath, conn->filesize);
+    conn->file_fd = open(conn->partpath, O_WRONLY | O_CREAT, 0644);
+    if (conn->file_fd < 0 || fstat(conn->file_fd, &st) < 0)
+    {
+        perror("open() error");
+        return -1;
+    }
+
+    conn->verified = (unsigned long)st.st_size - (unsigned long)st.st_size % RESUME_CHUNK_SIZE;
+    if ((unsigned long)st.st_size >= conn->filesize)
+        conn->verified = conn->filesize;
+    if (ftruncate(conn->file_fd, conn->verified) < 0)
+    {
+        perror("ftruncate() error");
+        return -1;
+    }
+
+    conn->frame = malloc(4 + RESUME_CHUNK_SIZE);
+    if (conn->frame == NULL)
+        return -1;
+    conn->frame_pos = 0;
+    conn->total_received = conn->verified;
+
+    snprintf(msg, sizeof(msg), "%s %lu chunk %d", OK_RESUME_MSG, conn->verified, RESUME_CHUNK_SIZE);
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+    return 0;
+}
+
+/**
+ * @brief Joins the multi-stream upload a UPLR range belongs to. The ranges of one
+ * file arrive over several connections and share one preallocated file.
+ * @param conn The connection.
+ * @param whole_size Size of the whole file.
+ * @return 0 on success, -1 if the connection was closed.
+ */
+static int open_range(Connection *conn, unsigned long whole_size)
+{
+    int err;
+
+    conn->ranged = range_begin(conn->filepath, whole_size, conn->range_offset, conn->filesize, &err);
+    if (conn->ranged == NULL)
+    {
+        if (err == RANGE_INVALID)
+        {
+            send_msg(conn, ERR_INVALID_RANGE_MSG);
+            write_log(conn, conn->header, ERR_INVALID_RANGE_MSG);
+        }
+        close_connection(conn);
+        return -1;
+    }
+    conn->file_fd = conn->ranged->fd;
+    return 0;
+}
+
+/**
+ * @brief Starts a CHNK upload into the content-addressed store. The body is the
+ * file's chunk list, then the chunks the store is missing. Empty files have no
+ * chunks and are uploaded with UPLD.
+ * @param conn The connection.
+ * @param count Number of chunks in the file.
+ * @return 0 on success, -1 if the connection was closed.
+ */
+static int open_dedup(Connection *conn, int count)
+{
+    char *msg = !dedup_store ? ERR_DEDUP_DISABLED_MSG : ERR_INVALID_LIST_MSG;
+
+    // every chunk but the last has at least CDC_MIN_SIZE bytes; the list itself is
+    // stored as it arrives, so a header alone cannot make the server allocate much
+    if (dedup_store && count > 0 && count <= MAX_MANIFEST_CHUNKS && conn->filesize > 0 &&
+        (unsigned long)count <= conn->filesize / CDC_MIN_SIZE + 1)
+    {
+        conn->dedup = calloc(1, sizeof(DedupUpload));
+        if (conn->dedup != NULL)
+        {
+            conn->dedup->count = count;
+            conn->dedup->buf = malloc(CDC_MAX_SIZE);
+            if (conn->dedup->buf != NULL)
+                return 0;
+        }
+        msg = ERR_FILE_INCOMPLETE_MSG;
+    }
+
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+    close_connection(conn);
+    return -1;
+}
+
+/**
+ * @brief Parses the options that may follow the size in an UPLD header:
+ * "xxh64:<16 hex digits>" starts hashing the body against that digest, and
+ * "deflate" means the body is a zlib stream that is inflated while it is written.
+ * @param conn The connection.
+ * @param options The rest of the header after the size.
+ * @return 0 on success, -1 if the connection was closed.
+ */
+static int parse_options(Connection *conn, const char *options)
+{
+    char copy[BUFF_SIZE], *save, *word;
+    int valid = 1;
+
+    snprintf(copy, sizeof(copy), "%s", options);
+    for (word = strtok_r(copy, " \r\n", &save); word != NULL && valid; word = strtok_r(NULL, " \r\n", &save))
+    {
+        char *end = NULL;
+        if (strncmp(word, "xxh64:", 6) == 0 && strlen(word + 6) == 16)
+        {
+            conn->expected_hash = strtoull(word + 6, &end, 16);
+            valid = *end == '\0';
+            conn->hashing = 1;
+            xxh64_reset(&conn->hash, 0);
+        }
+        else if (strcmp(word, "deflate") == 0 && conn->inflater == NULL)
+        {
+            conn->inflater = calloc(1, sizeof(z_stream));
+            valid = conn->inflater != NULL && inflateInit(conn->inflater) == Z_OK;
+        }
+        else
+            valid = 0;
+    }
+    if (!valid)
+    {
+        send_msg(conn, ERR_INVALID_FILE_MSG);
+        write_log(conn, conn->header, ERR_INVALID_FILE_MSG);
+        close_connection(conn);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the "UPLD <name> <size> [xxh64:<hex>] [deflate]", "RSUM <name> <size>" or
+ * "UPLR <name> <size> <offset> <length>" header of a connection and opens the destination file.
+ * "RETR" requests are handed to handle_retr().
+ * @param conn The connection, in STATE_HEADER.
+ */
+void handle_header(Connection *conn)
+{
+    int received_bytes = recv(conn->sockfd, conn->header, sizeof(conn->header) - 1, 0);
+    if (received_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (received_bytes <= 0)
+    {
+        printf("Client %s:%d disconnected\n", conn->client_ip, conn->client_port);
+        close_connection(conn);
+        return;
+    }
+    conn->header[received_bytes] = '\0';
+
+    if (strncmp(conn->header, "RETR ", 5) == 0)
+    {
+        handle_retr(conn);
+        return;
+    }
+
+    unsigned long whole_size = 0;
+    int count = 0, options, ranged = 0, chunked = 0;
+    conn->resumable = 0;
+    conn->hashing = 0;
+    conn->range_offset = 0;
+    if (sscanf(conn->header, "RSUM %255s %lu", conn->filename, &conn->filesize) == 2)
+        conn->resumable = 1;
+    else if (sscanf(conn->header, "UPLR %255s %lu %lu %lu", conn->filename, &whole_size, &conn->range_offset, &conn->filesize) == 4)
+        ranged = 1;
+    else if (sscanf(conn->header, "CHNK %255s %lu %d", conn->filename, &conn->filesize, &count) == 3)
+        chunked = 1;
+    else if (sscanf(conn->header, "UPLD %255s %lu%n", conn->filename, &conn->filesize, &options) != 2)
+        conn->filename[0] = '\0'; // refused below
+    else if (parse_options(conn, conn->header + options) < 0)
+        return;
+
+    // the name must stay in the upload directory, out of the store's own directories
+    if (!valid_name(conn->filename) ||
+        snprintf(conn->filepath, sizeof(conn->filepath), "%s/%s", fullpath, conn->filename) >= (int)sizeof(conn->filepath))
+    {
+        send_msg(conn, ERR_INVALID_FILE_MSG);
+        write_log(conn, conn->header, ERR_INVALID_FILE_MSG);
+        close_connection(conn);
+        return;
+    }
+    printf("Client %s:%d: %s\n", conn->client_ip, conn->client_port, conn->header);
+    if (ranged && open_range(conn, whole_size) < 0)
+        return;
+    if (chunked && open_dedup(conn, count) < 0)
+        return;
+    if (!chunked && dedup_store)
+        store_drop_manifest(fullpath, conn->filename); // the name now holds plain bytes
+    conn->total_received = 0;
+
+    if (conn->ranged != NULL)
+    {
+        send_msg(conn, OK_SEND_FILE_MSG);
+        write_log(conn, conn->header, OK_SEND_FILE_MSG);
+    }
+    else if (conn->dedup != NULL)
+    {
+        send_msg(conn, OK_SEND_LIST_MSG);
+        write_log(conn, conn->header, OK_SEND_LIST_MSG);
+        conn->state = STATE_BODY;
+        return;
+    }
+    else if (conn->resumable)
+    {
+        if (open_resumable(conn) < 0)
+        {
+            close_connection(conn);
+            return;
+        }
+    }
+    else
+    {
+        // write file to disk
+        conn->file_fd = open(conn->filepath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (conn->file_fd < 0)
+        {
+            perror("open() error");
+            close_connection(conn);
+            return;
+        }
+        // reserve the blocks up front so the file is laid out contiguously; the size
+        // still grows with the data, so an interrupted upload shows its real length
+        if (stream_writeback && conn->filesize > 0 && fallocate(conn->file_fd, FALLOC_FL_KEEP_SIZE, 0, conn->filesize) < 0 &&
+            errno != EOPNOTSUPP)
+            perror("fallocate() error");
+        send_msg(conn, OK_SEND_FILE_MSG);
+        write_log(conn, conn->header, OK_SEND_FILE_MSG);
+    }
+
+    conn->flushed = conn->total_received;
+    conn->state = STATE_BODY;
+    if (conn->total_received == conn->filesize)
+        handle_body(conn);
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor at an offset.
+ * @return 0 on success, -1 on error.
+ */
+static int write_all(int fd, const char *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("write() error");
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Moves the bytes sitting in the splice() pipe into the file. If the file
+ * system cannot splice, the pipe is drained with read()/write() instead.
+ * @return RECV_AGAIN on success, RECV_UNSUPPORTED or RECV_CLOSED on failure.
+ */
+static int drain_pipe(Connection *conn)
+{
+    while (conn->pipe_pending > 0)
+    {
+        loff_t offset = conn->range_offset + conn->total_received;
+        ssize_t n = splice(conn->pipe_fds[0], NULL, conn->file_fd, &offset, conn->pipe_pending, SPLICE_F_MOVE);
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            while (conn->pipe_pending > 0)
+            {
+                n = read(conn->pipe_fds[0], copy_buffer, conn->pipe_pending < sizeof(copy_buffer) ? conn->pipe_pending : sizeof(copy_buffer));
+                if (n <= 0 || write_all(conn->file_fd, copy_buffer, n, conn->range_offset + conn->total_received) < 0)
+                    return RECV_CLOSED;
+                conn->pipe_pending -= n;
+                conn->total_received += n;
+            }
+            return RECV_UNSUPPORTED;
+        }
+        if (n <= 0)
+        {
+            perror("splice() error");
+            return RECV_CLOSED;
+        }
+        conn->pipe_pending -= n;
+        conn->total_received += n;
+    }
+    return RECV_AGAIN;
+}
+
+/**
+ * @brief Zero-copy body receive: socket -> pipe -> file with splice(), so the
+ * bytes never pass through a user-space buffer. Never reads past the body.
+ * @return One of the RECV_* codes.
+ */
+static int receive_splice(Connection *conn)
+{
+    if (conn->pipe_fds[0] < 0)
+    {
+        if (pipe2(conn->pipe_fds, O_NONBLOCK) < 0)
+        {
+            conn->pipe_fds[0] = conn->pipe_fds[1] = -1;
+            return RECV_UNSUPPORTED;
+        }
+        fcntl(conn->pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE); // best effort, the default is 64KB
+    }
+
+    while (conn->total_received + conn->pipe_pending < conn->filesize)
+    {
+        unsigned long remaining = conn->filesize - conn->total_received - conn->pipe_pending;
+        ssize_t n = splice(conn->sockfd, NULL, conn->pipe_fds[1], NULL, remaining < PIPE_SIZE ? remaining : PIPE_SIZE,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            return conn->pipe_pending > 0 ? drain_pipe(conn) : RECV_UNSUPPORTED;
+        if (n <= 0)
+        {
+            drain_pipe(conn);
+            return RECV_CLOSED;
+        }
+        conn->pipe_pending += n;
+
+        int status = drain_pipe(conn);
+        if (status != RECV_AGAIN)
+            return status;
+    }
+
+    return conn->total_received == conn->filesize ? RECV_DONE : RECV_AGAIN;
+}
+
+/**
+ * @brief Copy body receive: recv() into a large buffer, then write() to the file.
+ * When the client sent a digest the bytes are hashed while they are still in the
+ * buffer, so the file is never read back.
+ * @return One of the RECV_* codes.
+ */
+static int receive_copy(Connection *conn)
+{
+    while (conn->total_received < conn->filesize)
+    {
+        unsigned long remaining = conn->filesize - conn->total_received;
+        ssize_t n = recv(conn->sockfd, copy_buffer, remaining < sizeof(copy_buffer) ? remaining : sizeof(copy_buffer), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return RECV_AGAIN;
+        if (n <= 0 || write_all(conn->file_fd, copy_buffer, n, conn->range_offset + conn->total_received) < 0)
+            return RECV_CLOSED;
+        if (conn->hashing)
+            xxh64_update(&conn->hash, copy_buffer, n);
+        conn->total_received += n;
+    }
+    return RECV_DONE;
+}
+
+/**
+ * @brief Compressed receive: the body is a zlib stream of unknown length, inflated as
+ * it arrives. The inflated bytes are written and hashed like a plain body, so the
+ * stored file is the original. The body ends with the zlib stream, which must hold
+ * exactly the size announced in the header.
+ * @return One of the RECV_* codes.
+ */
+static int receive_inflate(Connection *conn)
+{
+    z_stream *z = conn->inflater;
+
+    while (1)
+    {
+        ssize_t n = recv(conn->sockfd, copy_buffer, sizeof(copy_buffer), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return RECV_AGAIN;
+        if (n <= 0)
+            return RECV_CLOSED;
+
+        z->next_in = (Bytef *)copy_buffer;
+        z->avail_in = n;
+        while (z->avail_in > 0)
+        {
+            z->next_out = (Bytef *)inflate_buffer;
+            z->avail_out = sizeof(inflate_buffer);
+            int ret = inflate(z, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END)
+            {
+                printf("Compressed body of '%s' is corrupt\n", conn->filename);
+                return RECV_CLOSED;
+            }
+
+            size_t produced = sizeof(inflate_buffer) - z->avail_out;
+            if (produced > conn->filesize - conn->total_received ||
+                write_all(conn->file_fd, inflate_buffer, produced, conn->total_received) < 0)
+                return RECV_CLOSED;
+            if (conn->hashing)
+                xxh64_update(&conn->hash, inflate_buffer, produced);
+            conn->total_received += produced;
+
+            if (ret == Z_STREAM_END)
+                return z->avail_in == 0 && conn->total_received == conn->filesize ? RECV_DONE : RECV_CLOSED;
+        }
+    }
+}
+
+/**
+ * @brief Resumable receive: each chunk arrives as a 4-byte big-endian CRC32C followed
+ * by the chunk bytes. A chunk is written at its offset only if its checksum matches
+ * and every chunk before it did; after a bad chunk the rest of the body is consumed
+ * but discarded, so the client can resume from the verified prefix.
+ * @return One of the RECV_* codes.
+ */
+static int receive_chunks(Connection *conn)
+{
+    while (conn->total_received < conn->filesize)
+    {
+        unsigned long remaining = conn->filesize - conn->total_received;
+        unsigned long chunk_len = remaining < RESUME_CHUNK_SIZE ? remaining : RESUME_CHUNK_SIZE;
+        unsigned long frame_len = 4 + chunk_len;
+
+        ssize_t n = recv(conn->sockfd, conn->frame + conn->frame_pos, frame_len - conn->frame_pos, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return RECV_AGAIN;
+        if (n <= 0)
+            return RECV_CLOSED;
+        conn->frame_pos += n;
+        if (conn->frame_pos < frame_len)
+            continue;
+
+        uint8_t *h = (uint8_t *)conn->frame;
+        uint32_t expected = ((uint32_t)h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+        if (conn->verified == conn->total_received && crc32c(0, conn->frame + 4, chunk_len) == expected)
+        {
+            if (pwrite(conn->file_fd, conn->frame + 4, chunk_len, conn->total_received) != (ssize_t)chunk_len)
+            {
+                perror("pwrite() error");
+                return RECV_CLOSED;
+            }
+            conn->verified += chunk_len;
+        }
+        else if (conn->verified == conn->total_received)
+        {
+            printf("Chunk at offset %lu of '%s' failed its checksum\n", conn->total_received, conn->filename);
+        }
+        conn->total_received += chunk_len;
+        conn->frame_pos = 0;
+    }
+    return RECV_DONE;
+}
+
+/**
+ * @brief Completes a resumable upload: renames the partial file once every chunk
+ * is verified, otherwise asks the client to resume from the verified prefix.
+ * @param conn The connection.
+ */
+static void finish_resumable(Connection *conn)
+{
+    char msg[128];
+
+    free(conn->frame);
+    conn->frame = NULL;
+
+    if (conn->verified == conn->filesize)
+    {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+        if (rename(conn->partpath, conn->filepath) < 0)
+        {
+            perror("rename() error");
+            close_connection(conn);
+            return;
+        }
+        send_msg(conn, OK_SUCCESS_MSG);
+        printf("File '%s' uploaded successfully (%lu bytes) in '%s'\n", conn->filename, conn->filesize, conn->filepath);
+        write_log(conn, conn->header, OK_SUCCESS_MSG);
+    }
+    else
+    {
+        close(conn->file_fd);
+        conn->file_fd = -1;
+        snprintf(msg, sizeof(msg), "%s %lu", ERR_CHECKSUM_MSG, conn->verified);
+        send_msg(conn, msg);
+        printf("%s\n", msg);
+        write_log(conn, conn->header, msg);
+    }
+    conn->state = STATE_HEADER;
+}
+
+/**
+ * @brief Completes one range of a multi-stream upload. The connection that delivers
+ * the last missing range commits the file and gets the success reply.
+ * @param conn The connection.
+ */
+static void finish_range(Connection *conn)
+{
+    if (conn->total_received != conn->filesize)
+    {
+        send_msg(conn, ERR_FILE_INCOMPLETE_MSG);
+        write_log(conn, conn->header, ERR_FILE_INCOMPLETE_MSG);
+        close_connection(conn); // aborts the range
+        return;
+    }
+
+    RangedUpload *upload = conn->ranged;
+    conn->ranged = NULL;
+    conn->file_fd = -1;
+    int committed = range_complete(upload, conn->range_offset);
+    char *msg = committed == 1 ? OK_SUCCESS_MSG : committed == 0 ? OK_RANGE_STORED_MSG : ERR_FILE_INCOMPLETE_MSG;
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+    if (committed == 1)
+        printf("File '%s' uploaded successfully over several streams\n", conn->filename);
+    conn->state = STATE_HEADER;
+}
+
+/**
+ * @brief Orders chunk indexes by hash, to find the chunks a file repeats.
+ */
+static const ChunkRef *sort_chunks;
+
+static int compare_chunks(const void *a, const void *b)
+{
+    int i = *(const int *)a, j = *(const int *)b;
+    int c = memcmp(sort_chunks[i].hash, sort_chunks[j].hash, CHUNK_HASH_SIZE);
+    return c != 0 ? c : i - j;
+}
+
+/**
+ * @brief Moves the complete entries of the chunk list received so far from dedup->buf
+ * to the chunk array, growing it as needed; a partial entry stays at the start of
+ * the buffer.
+ * @param conn The connection.
+ * @param buffered Bytes of the list in dedup->buf.
+ * @return Bytes left in dedup->buf, -1 if out of memory.
+ */
+static int take_entries(Connection *conn, int buffered)
+{
+    DedupUpload *d = conn->dedup;
+    int first = (d->list_pos - buffered) / MANIFEST_ENTRY_SIZE;
+    int complete = buffered / MANIFEST_ENTRY_SIZE;
+
+    if (first + complete > d->capacity)
+    {
+        int capacity = d->capacity == 0 ? 1024 : d->capacity * 2;
+        if (capacity < first + complete)
+            capacity = first + complete;
+        if (capacity > d->count)
+            capacity = d->count;
+        ChunkRef *chunks = realloc(d->chunks, capacity * sizeof(ChunkRef));
+        if (chunks == NULL)
+            return -1;
+        d->chunks = chunks;
+        d->capacity = capacity;
+    }
+    for (int k = 0; k < complete; k++)
+    {
+        const uint8_t *e = (const uint8_t *)d->buf + (size_t)k * MANIFEST_ENTRY_SIZE;
+        uint32_t length;
+        memcpy(d->chunks[first + k].hash, e, CHUNK_HASH_SIZE);
+        memcpy(&length, e + CHUNK_HASH_SIZE, 4);
+        d->chunks[first + k].length = ntohl(length);
+    }
+    buffered -= complete * MANIFEST_ENTRY_SIZE;
+    memmove(d->buf, d->buf + complete * MANIFEST_ENTRY_SIZE, buffered);
+    return buffered;
+}
+
+/**
+ * @brief Checks the received chunk list and marks the chunks the store lacks. A chunk
+ * that appears several times in the file is requested once, at its first position.
+ * @param conn The connection, with the whole list in dedup->chunks.
+ * @return 0 on success, -1 if the list is malformed.
+ */
+static int parse_chunk_list(Connection *conn)
+{
+    DedupUpload *d = conn->dedup;
+    unsigned long total = 0;
+
+    for (int i = 0; i < d->count; i++)
+    {
+        if (d->chunks[i].length == 0 || d->chunks[i].length > CDC_MAX_SIZE)
+            return -1;
+        total += d->chunks[i].length;
+    }
+    if (total != conn->filesize)
+        return -1;
+
+    d->need = calloc(d->count / 8 + 1, 1);
+    if (d->need == NULL)
+        return -1;
+
+    int *order = malloc(d->count * sizeof(int) + 1);
+    if (order == NULL)
+        return -1;
+    for (int i = 0; i < d->count; i++)
+        order[i] = i;
+    sort_chunks = d->chunks;
+    qsort(order, d->count, sizeof(int), compare_chunks);
+
+    for (int k = 0; k < d->count; k++)
+    {
+        int i = order[k];
+        if (k > 0 && memcmp(d->chunks[order[k - 1]].hash, d->chunks[i].hash, CHUNK_HASH_SIZE) == 0)
+            continue; // a repeat of the chunk just before it in hash order
+        if (!store_has_chunk(fullpath, d->chunks[i].hash))
+        {
+            d->need[i / 8] |= 1 << (i % 8);
+            d->needed++;
+        }
+    }
+    free(order);
+    return 0;
+}
+
+/**
+ * @brief Moves to the next chunk the client has to send.
+ */
+static void next_needed(DedupUpload *d)
+{
+    d->current++;
+    while (d->current < d->count && !(d->need[d->current / 8] & (1 << (d->current % 8))))
+        d->current++;
+    d->buf_pos = 0;
+}
+
+/**
+ * @brief Queues the reply telling the client which chunks to send: "+OK Need <k>
+ * <bytes>\n" followed by a bitmap of <bytes> bytes, bit i (LSB first) set when chunk
+ * i is missing. The bitmap can take 128 KB, so it is sent by send_reply() on
+ * writable events rather than waited out.
+ * @return 0 on success, -1 if out of memory.
+ */
+static int send_need(Connection *conn)
+{
+    DedupUpload *d = conn->dedup;
+    int bitmap_size = (d->count + 7) / 8;
+    char line[64];
+    int line_len = snprintf(line, sizeof(line), "%s %d %d\n", OK_NEED_MSG, d->needed, bitmap_size);
+
+    d->reply = malloc(line_len + bitmap_size);
+    if (d->reply == NULL)
+        return -1;
+    memcpy(d->reply, line, line_len);
+    memcpy(d->reply + line_len, d->need, bitmap_size);
+    d->reply_len = line_len + bitmap_size;
+    d->reply_sent = 0;
+    line[line_len - 1] = '\0';
+    write_log(conn, conn->header, line);
+
+    conn->state = STATE_REPLY;
+    watch_writable(conn, 1);
+    return 0;
+}
+
+/**
+ * @brief Sends as much of the queued chunk request as the socket accepts. Once it is
+ * all out, the connection goes back to receiving the upload.
+ * @param conn The connection, in STATE_REPLY.
+ */
+void send_reply(Connection *conn)
+{
+    DedupUpload *d = conn->dedup;
+
+    while (d->reply_sent < d->reply_len)
+    {
+        ssize_t n = send(conn->sockfd, d->reply + d->reply_sent, d->reply_len - d->reply_sent, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return; // wait until the socket is writable
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            close_connection(conn);
+            return;
+        }
+        d->reply_sent += n;
+    }
+
+    free(d->reply);
+    d->reply = NULL;
+    watch_writable(conn, 0);
+    conn->state = STATE_BODY;
+    handle_body(conn); // nothing may be needed, or the first chunks already wait
+}
+
+/**
+ * @brief Deduplicated receive: first the chunk list (count entries of a SHA-256 and
+ * a 4-byte big-endian length), then the bytes of each missing chunk in file order.
+ * Every chunk is checked against its hash before it enters the store.
+ * @return One of the RECV_* codes.
+ */
+static int receive_dedup(Connection *conn)
+{
+    DedupUpload *d = conn->dedup;
+    unsigned long list_size = (unsigned long)d->count * MANIFEST_ENTRY_SIZE;
+
+    while (d->list_pos < list_size)
+    {
+        // d->buf_pos counts the bytes of a partial entry left in the buffer
+        unsigned long room = CDC_MAX_SIZE - d->buf_pos;
+        if (room > list_size - d->list_pos)
+            room = list_size - d->list_pos;
+        ssize_t n = recv(conn->sockfd, d->buf + d->buf_pos, room, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return RECV_AGAIN;
+        if (n <= 0)
+            return RECV_CLOSED;
+        d->list_pos += n;
+        int left = take_entries(conn, d->buf_pos + n);
+        if (left < 0)
+            return RECV_CLOSED;
+        d->buf_pos = left;
+        if (d->list_pos < list_size)
+            continue;
+
+        if (parse_chunk_list(conn) < 0)
+        {
+            send_msg(conn, ERR_INVALID_LIST_MSG);
+            write_log(conn, conn->header, ERR_INVALID_LIST_MSG);
+            return RECV_CLOSED;
+        }
+        if (send_need(conn) < 0)
+            return RECV_CLOSED;
+        d->current = -1;
+        next_needed(d);
+        return RECV_AGAIN; // the chunks follow once the reply is sent
+    }
+    while (d->current < d->count)
+    {
+        ChunkRef *chunk = &d->chunks[d->current];
+        ssize_t n = recv(conn->sockfd, d->buf + d->buf_pos, chunk->length - d->buf_pos, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return RECV_AGAIN;
+        if (n <= 0)
+            return RECV_CLOSED;
+        d->buf_pos += n;
+        conn->total_received += n;
+        if (d->buf_pos < chunk->length)
+            continue;
+
+        uint8_t hash[CHUNK_HASH_SIZE];
+        chunk_hash(d->buf, chunk->length, hash);
+        if (memcmp(hash, chunk->hash, CHUNK_HASH_SIZE) != 0)
+        {
+            send_msg(conn, ERR_CHUNK_HASH_MSG);
+            write_log(conn, conn->header, ERR_CHUNK_HASH_MSG);
+            return RECV_CLOSED;
+        }
+        if (store_put_chunk(fullpath, chunk->hash, d->buf, chunk->length) < 0)
+            return RECV_CLOSED;
+        next_needed(d);
+    }
+    return RECV_DONE;
+}
+
+/**
+ * @brief Completes a CHNK upload: the file is stored as its chunk list.
+ * @param conn The connection.
+ */
+static void finish_dedup(Connection *conn)
+{
+    char msg[128];
+
+    if (store_write_manifest(fullpath, conn->filename, conn->dedup, conn->filesize) < 0)
+    {
+        send_msg(conn, ERR_FILE_INCOMPLETE_MSG);
+        write_log(conn, conn->header, ERR_FILE_INCOMPLETE_MSG);
+        close_connection(conn);
+        return;
+    }
+    snprintf(msg, sizeof(msg), "%s, %d of %d chunks sent (%lu bytes)", OK_SUCCESS_MSG, conn->dedup->needed,
+             conn->dedup->count, conn->total_received);
+    printf("File '%s' stored as %d chunks, %d new\n", conn->filename, conn->dedup->count, conn->dedup->needed);
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+    dedup_free(conn->dedup);
+    conn->dedup = NULL;
+    conn->state = STATE_HEADER;
+}
+
+/**
+ * @brief Completes an upload whose header carried a digest: compares the hash of the
+ * received bytes with it and reports the computed digest in the reply. A file that
+ * does not match is deleted.
+ * @param conn The connection, with the whole body received.
+ */
+static void finish_hashed(Connection *conn)
+{
+    char msg[128];
+    uint64_t hash = xxh64_digest(&conn->hash);
+
+    if (hash == conn->expected_hash)
+    {
+        snprintf(msg, sizeof(msg), "%s xxh64:%016llx", OK_SUCCESS_MSG, (unsigned long long)hash);
+        printf("File '%s' uploaded successfully (%lu bytes) in '%s'\n", conn->filename, conn->filesize, conn->filepath);
+    }
+    else
+    {
+        snprintf(msg, sizeof(msg), "%s xxh64:%016llx", ERR_DIGEST_MSG, (unsigned long long)hash);
+        printf("File '%s' failed its checksum\n", conn->filename);
+        unlink(conn->filepath);
+    }
+    send_msg(conn, msg);
+    write_log(conn, conn->header, msg);
+    conn->state = STATE_HEADER;
+}
+
+/**
+ * @brief Releases the zlib stream of a deflate upload.
+ */
+void free_inflater(Connection *conn)
+{
+    if (conn->inflater == NULL)
+        return;
+    inflateEnd(conn->inflater);
+    free(conn->inflater);
+    conn->inflater = NULL;
+}
+
+/**
+ * @brief Streams a large upload through the page cache instead of letting it pile up
+ * there (-w). Write-back of each complete WRITEBACK_WINDOW of the body is started,
+ * and the window before it, which has had a window's time to reach the disk, is
+ * waited for and dropped with posix_fadvise(DONTNEED); the tail goes the same way
+ * once the body is complete. The write-back thread does both, so the select() loop
+ * never blocks on the disk. An upload keeps a few windows of cache while the disk
+ * keeps up, and the kernel never has gigabytes of dirty pages to write back at
+ * once. O_DIRECT is not used: splice() and recv() produce unaligned writes of any
+ * length.
+ * @param conn The connection.
+ * @param done 1 once the body is complete, to write back the tail.
+ */
+static void flush_windows(Connection *conn, int done)
+{
+    if (!stream_writeback || conn->file_fd < 0)
+        return;
+
+    while (conn->total_received - conn->flushed >= WRITEBACK_WINDOW)
+    {
+        off_t start = conn->range_offset + conn->flushed;
+        writeback_range(conn->file_fd, start, WRITEBACK_WINDOW, 0);
+        if (conn->flushed >= WRITEBACK_WINDOW)
+            writeback_range(conn->file_fd, start - WRITEBACK_WINDOW, WRITEBACK_WINDOW, 1);
+        conn->flushed += WRITEBACK_WINDOW;
+    }
+    if (done && conn->total_received > 0)
+    {
+        off_t start = conn->flushed >= WRITEBACK_WINDOW ? conn->flushed - WRITEBACK_WINDOW : 0;
+        writeback_range(conn->file_fd, conn->range_offset + start, conn->total_received - start, 1);
+    }
+}
+
+/**
+ * @brief Receives the body bytes available on a connection and writes them to the file.
+ * Replies and goes back to STATE_HEADER once the whole file has arrived.
+ * @param conn The connection, in STATE_BODY.
+ */
+void handle_body(Connection *conn)
+{
+    if (conn->dedup != NULL)
+    {
+        int status = receive_dedup(conn);
+        if (status == RECV_DONE)
+            finish_dedup(conn);
+        else if (status == RECV_CLOSED)
+            close_connection(conn);
+        return;
+    }
+
+    if (conn->resumable)
+    {
+        int status = receive_chunks(conn);
+        flush_windows(conn, status == RECV_DONE);
+        if (status == RECV_AGAIN)
+            return;
+        if (status == RECV_DONE)
+            finish_resumable(conn);
+        else
+        {
+            // the verified prefix stays in the partial file for the next RSUM
+            printf("Resumable upload of '%s' interrupted at %lu bytes\n", conn->filename, conn->verified);
+            write_log(conn, conn->header, ERR_FILE_INCOMPLETE_MSG);
+            close_connection(conn);
+        }
+        return;
+    }
+
+    // splice() keeps the bytes out of user space, where they cannot be hashed
+    int status;
+    if (conn->inflater != NULL)
+        status = receive_inflate(conn);
+    else
+        status = conn->use_splice && !conn->hashing ? receive_splice(conn) : receive_copy(conn);
+    if (status == RECV_UNSUPPORTED)
+    {
+        conn->use_splice = 0;
+        status = receive_copy(conn);
+    }
+    flush_windows(conn, status == RECV_DONE);
+    if (status == RECV_AGAIN)
+        return; // wait for the next readable event
+
+    if (conn->ranged != NULL)
+    {
+        finish_range(conn);
+        return;
+    }
+
+    close(conn->file_fd);
+    conn->file_fd = -1;
+    free_inflater(conn);
+
+    if (conn->total_received == conn->filesize && conn->hashing)
+    {
+        finish_hashed(conn);
+    }
+    else if (conn->total_received == conn->filesize)
+    {
+        send_msg(conn, OK_SUCCESS_MSG);
+        printf("File '%s' uploaded successfully (%lu bytes) in '%s'\n", conn->filename, conn->filesize, conn->filepath);
+        write_log(conn, conn->header, OK_SUCCESS_MSG);
+        conn->state = STATE_HEADER;
+    }
+    else
+    {
+        send_msg(conn, ERR_FILE_INCOMPLETE_MSG);
+        printf("%s\n", ERR_FILE_INCOMPLETE_MSG);
+        write_log(conn, conn->header, ERR_FILE_INCOMPLETE_MSG);
+        close_connection(conn);
+    }
+}
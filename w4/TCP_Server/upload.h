@@ -0,0 +1,11 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "connection.h"
+
+void handle_header(Connection *conn);
+void handle_body(Connection *conn);
+void send_reply(Connection *conn);
+void free_inflater(Connection *conn);
+
+#endif
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "writeback.h"
+
+/* Write-back is started and waited for by a thread of its own: even starting it
+ * blocks while the disk's queue is full, and waiting takes as long as the disk
+ * does, which would stall every connection of the select() loop. Jobs run in the
+ * order they are queued. Each holds a duplicate of the upload's descriptor, so the
+ * upload may finish and close its file meanwhile. */
+
+typedef struct WritebackJob
+{
+    int fd;
+    off_t offset;
+    off_t length;
+    int drop; // wait for the range and drop it from the page cache
+    struct WritebackJob *next;
+} WritebackJob;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static WritebackJob *head = NULL, *tail = NULL;
+static int started = 0;
+
+/**
+ * @brief Write-back thread: starts write-back of each range, or waits for it to
+ * reach the disk and drops it from the page cache.
+ */
+static void *writeback_thread(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&mutex);
+        while (head == NULL)
+            pthread_cond_wait(&queued, &mutex);
+        WritebackJob *job = head;
+        head = job->next;
+        if (head == NULL)
+            tail = NULL;
+        pthread_mutex_unlock(&mutex);
+
+        if (job->drop)
+        {
+            sync_file_range(job->fd, job->offset, job->length,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(job->fd, job->offset, job->length, POSIX_FADV_DONTNEED);
+        }
+        else
+        {
+            sync_file_range(job->fd, job->offset, job->length, SYNC_FILE_RANGE_WRITE);
+        }
+        close(job->fd);
+        free(job);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts the write-back thread.
+ * @return 0 on success, -1 on error.
+ */
+int writeback_start()
+{
+    pthread_t tid;
+
+    if (pthread_create(&tid, NULL, writeback_thread, NULL) != 0)
+    {
+        perror("pthread_create() error");
+        return -1;
+    }
+    pthread_detach(tid);
+    started = 1;
+    return 0;
+}
+
+/**
+ * @brief Has a range of a file written to disk, without waiting for it. When no job
+ * can be queued, write-back is only started and the range dropped as far as it is
+ * already clean.
+ * @param fd The file.
+ * @param offset Start of the range.
+ * @param length Length of the range.
+ * @param drop 1 to also drop the range from the page cache once it is on disk.
+ */
+void writeback_range(int fd, off_t offset, off_t length, int drop)
+{
+    WritebackJob *job = started ? malloc(sizeof(WritebackJob)) : NULL;
+    if (job != NULL && (job->fd = dup(fd)) < 0)
+    {
+        perror("dup() error");
+        free(job);
+        job = NULL;
+    }
+    if (job == NULL)
+    {
+        sync_file_range(fd, offset, length, SYNC_FILE_RANGE_WRITE);
+        if (drop)
+            posix_fadvise(fd, offset, length, POSIX_FADV_DONTNEED);
+        return;
+    }
+    job->offset = offset;
+    job->length = length;
+    job->drop = drop;
+    job->next = NULL;
+
+    pthread_mutex_lock(&mutex);
+    if (tail != NULL)
+        tail->next = job;
+    else
+        head = job;
+    tail = job;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&mutex);
+}
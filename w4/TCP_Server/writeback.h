@@ -0,0 +1,9 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <sys/types.h>
+
+int writeback_start();
+void writeback_range(int fd, off_t offset, off_t length, int drop);
+
+#endif
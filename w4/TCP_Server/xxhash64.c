@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include "xxhash64.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8); // xxHash is defined on little-endian words
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME1 + PRIME4;
+}
+
+/**
+ * @brief Mixes whole 32-byte stripes into the four lanes. The lanes are independent,
+ * so the compiler keeps them in registers and the CPU runs them in parallel.
+ * @return Number of bytes consumed (a multiple of 32).
+ */
+static size_t consume_stripes(Xxh64State *state, const uint8_t *p, size_t len)
+{
+    uint64_t v1 = state->v[0], v2 = state->v[1], v3 = state->v[2], v4 = state->v[3];
+    const uint8_t *start = p;
+
+    while (len >= 32)
+    {
+        v1 = round64(v1, read64(p));
+        v2 = round64(v2, read64(p + 8));
+        v3 = round64(v3, read64(p + 16));
+        v4 = round64(v4, read64(p + 24));
+        p += 32;
+        len -= 32;
+    }
+
+    state->v[0] = v1;
+    state->v[1] = v2;
+    state->v[2] = v3;
+    state->v[3] = v4;
+    return p - start;
+}
+
+/**
+ * @brief Starts a new XXH64 hash.
+ * @param state The hash state.
+ * @param seed The seed, 0 for the standard hash.
+ */
+void xxh64_reset(Xxh64State *state, uint64_t seed)
+{
+    memset(state, 0, sizeof(*state));
+    state->v[0] = seed + PRIME1 + PRIME2;
+    state->v[1] = seed + PRIME2;
+    state->v[2] = seed;
+    state->v[3] = seed - PRIME1;
+}
+
+/**
+ * @brief Feeds more bytes to the hash; the data can arrive in pieces of any size.
+ * @param state The hash state.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ */
+void xxh64_update(Xxh64State *state, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    state->total_len += len;
+
+    if (state->mem_len + len < 32)
+    {
+        memcpy(state->mem + state->mem_len, p, len);
+        state->mem_len += len;
+        return;
+    }
+
+    if (state->mem_len > 0)
+    {
+        size_t fill = 32 - state->mem_len;
+        memcpy(state->mem + state->mem_len, p, fill);
+        consume_stripes(state, state->mem, 32);
+        p += fill;
+        len -= fill;
+        state->mem_len = 0;
+    }
+
+    size_t used = consume_stripes(state, p, len);
+    memcpy(state->mem, p + used, len - used);
+    state->mem_len = len - used;
+}
+
+/**
+ * @brief Computes the hash of the bytes fed so far. The state is not modified.
+ * @param state The hash state.
+ * @return The 64-bit hash.
+ */
+uint64_t xxh64_digest(const Xxh64State *state)
+{
+    uint64_t h;
+    const uint8_t *p = state->mem;
+    size_t len = state->mem_len;
+
+    if (state->total_len >= 32)
+    {
+        h = rotl(state->v[0], 1) + rotl(state->v[1], 7) + rotl(state->v[2], 12) + rotl(state->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = merge_round(h, state->v[i]);
+    }
+    else
+    {
+        h = state->v[2] + PRIME5; // v[2] still holds the seed
+    }
+    h += state->total_len;
+
+    while (len >= 8)
+    {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+        p += 8;
+        len -= 8;
+    }
+    if (len >= 4)
+    {
+        h ^= (uint64_t)read32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0)
+    {
+        h ^= (*p++) * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+        len--;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,19 @@
+#ifndef XXHASH64_H
+#define XXHASH64_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct
+{
+    uint64_t total_len;
+    uint64_t v[4];    // the four lane accumulators
+    uint8_t mem[32];  // bytes not yet forming a whole 32-byte stripe
+    uint32_t mem_len;
+} Xxh64State;
+
+void xxh64_reset(Xxh64State *state, uint64_t seed);
+void xxh64_update(Xxh64State *state, const void *data, size_t len);
+uint64_t xxh64_digest(const Xxh64State *state);
+
+#endif
@@ -33,29 +33,29 @@ void load_accounts(const char *filename, Account accounts[])
 
 /**
  * @brief Check account and status, then authorize user.
- * @param log_in_username The username to authorize.
+ * @param log_in_username The username to authorize, not NUL-terminated.
+ * @param len Length of the username.
+ * @param account_index Set to the account's index in accounts[] on success.
  * @return 1 if success, 0 if account not found, -1 if account is banned.
  */
-int authorize_user(char *log_in_username)
+int authorize_user(const char *log_in_username, size_t len, int *account_index)
 {
   pthread_mutex_lock(&account_mutex);
 
-  bool found = false;
   for (int i = 0; i < account_number; i++)
   {
-    if (strcmp(log_in_username, accounts[i].username) == 0)
+    if (strlen(accounts[i].username) == len && memcmp(log_in_username, accounts[i].username, len) == 0)
     {
-      found = true;
-
       if (accounts[i].is_logged_in)
       {
-        printf("Account %s is already logged in elsewhere.\n", log_in_username);
+        printf("Account %s is already logged in elsewhere.\n", accounts[i].username);
         pthread_mutex_unlock(&account_mutex);
         return -2; // already logged in elsewhere
       }
       else if (accounts[i].status == 1)
       {
         accounts[i].is_logged_in = true;
+        *account_index = i;
         pthread_mutex_unlock(&account_mutex);
         return 1; // success
       }
@@ -67,28 +67,19 @@ int authorize_user(char *log_in_username)
     }
   }
 
-  if (!found)
-  {
-    pthread_mutex_unlock(&account_mutex);
-    return 0; // account not found
-  }
+  pthread_mutex_unlock(&account_mutex);
+  return 0; // account not found
 }
 
 /**
- * @brief Log out the current user if logged in.
+ * @brief Log out a logged-in account.
+ * @param account_index The account's index in accounts[], from authorize_user().
  */
-void log_out(char *username)
+void log_out(int account_index)
 {
   pthread_mutex_lock(&account_mutex);
-  for (int i = 0; i < account_number; i++)
-  {
-    if (strcmp(accounts[i].username, username) == 0)
-    {
-      accounts[i].is_logged_in = false;
-      printf("Set false: %s", username);
-      break;
-    }
-  }
+  accounts[account_index].is_logged_in = false;
+  printf("Set false: %s", accounts[account_index].username);
   pthread_mutex_unlock(&account_mutex);
 }
 
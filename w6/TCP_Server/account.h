@@ -24,8 +24,8 @@ extern Account accounts[MAX_ACCOUNTS];
 extern int account_number;
 
 void load_accounts(const char *filename, Account accounts[]);
-int authorize_user(char *log_in_username);
-void log_out(char *current_user);
+int authorize_user(const char *log_in_username, size_t len, int *account_index);
+void log_out(int account_index);
 void post_message();
 
 #endif // ACCOUNT_H
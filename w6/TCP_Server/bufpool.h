@@ -0,0 +1,13 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+#define POOL_MIN_SIZE 256   /* first buffer of a connection: holds any ordinary command */
+#define POOL_MAX_SIZE 65536 /* longest line a connection may send */
+
+char *pool_get(size_t size, size_t *capacity);
+char *pool_grow(char *buf, size_t used, size_t *capacity);
+void pool_put(char *buf, size_t capacity);
+
+#endif // BUFPOOL_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,13 +10,15 @@
 #include <netdb.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <ctype.h>
 #include <pthread.h>
 
 #include "account.h"
+#include "bufpool.h"
+#include "session.h"
 
 #define BACKLOG 20
-#define BUFF_SIZE 4096
-#define CHUNK_SIZE 65536
+#define THREAD_STACK_SIZE (128 * 1024) /* enough now that no request buffer lives on the stack */
 #define ACCOUNT_FILE "TCP_Server/account.txt"
 
 #define CONNECTED_MSG "100\r\n"
@@ -29,7 +32,7 @@
 #define POST_SUCCESS_MSG "120\r\n"
 #define UNKNOWN_REQUEST_MSG "300\r\n"
 
-int listen_sock, conn_sock, *connfd; /* file descriptors */
+int listen_sock, conn_sock; /* file descriptors */
 char *port;
 struct sockaddr_in server_addr; /* server's address information */
 struct sockaddr_in client_addr; /* client's address information */
@@ -54,41 +57,46 @@ void respond_to_client(int sockfd, char *msg)
 
 /**
  * @brief Handle client request based on the received message.
- * @param buff The received message buffer.
- * @param received_bytes The number of bytes received.
+ * @param session The client's session; its login state is updated.
+ * @param buff The received line, without its CRLF.
+ * @param len Length of the line.
  */
-bool handle_client_request(int sockfd, char *buff, int received_bytes, bool is_logged_in, char* current_user)
+void handle_client_request(Session *session, char *buff, size_t len)
 {
-    buff[strcspn(buff, "\r\n")] = '\0';
+    int sockfd = session->fd;
     printf("=> Received from client: %s\n", buff);
 
-    if (strncmp(buff, "USER", 4) == 0)
+    if (len >= 5 && strncmp(buff, "USER ", 5) == 0)
     {
-        if (is_logged_in)
+        if (session->is_logged_in)
         {
             respond_to_client(sockfd, ALREADY_LOGGED_IN_MSG);
-            return is_logged_in;
         }
         else
         {
-            char log_in_username[MAX_USERNAME_LENGTH];
-            sscanf(buff + 5, "%s", log_in_username);
-            int res = authorize_user(log_in_username);
+            // the username is the first word after USER, taken from the line only
+            const char *name = buff + 5, *end = buff + len;
+            while (name < end && isspace((unsigned char)*name))
+                name++;
+            size_t name_len = 0;
+            while (name + name_len < end && !isspace((unsigned char)name[name_len]))
+                name_len++;
+            int res = authorize_user(name, name_len, &session->account_index);
             switch (res)
             {
             case 1:
                 respond_to_client(sockfd, ACTIVE_ACCOUNT_MSG);
-                strcpy(current_user, log_in_username);
-                return true;
+                session->is_logged_in = true;
+                break;
             case 0:
                 respond_to_client(sockfd, UNKNOWN_ACCOUNT_MSG);
-                return is_logged_in;
+                break;
             case -1:
                 respond_to_client(sockfd, BANNED_ACCOUNT_MSG);
-                return is_logged_in;
+                break;
             case -2:
                 respond_to_client(sockfd, LOGGED_IN_ELSEWHERE_MSG);
-                return is_logged_in;
+                break;
             default:
                 break;
             }
@@ -96,89 +104,109 @@ bool handle_client_request(int sockfd, char *buff, int received_bytes, bool is_l
     }
     else if (strncmp(buff, "POST", 4) == 0)
     {
-        if (is_logged_in)
+        if (session->is_logged_in)
         {
             post_message();
             respond_to_client(sockfd, POST_SUCCESS_MSG);
-            return is_logged_in;
         }
         else
         {
             respond_to_client(sockfd, NOT_LOGGED_IN_MSG);
-            return is_logged_in;
         }
     }
     else if (strncmp(buff, "BYE", 3) == 0)
     {
-        if (is_logged_in)
+        if (session->is_logged_in)
         {
-            log_out(current_user);
-            strcpy(current_user, "");
+            log_out(session->account_index);
+            session->is_logged_in = false;
+            session->account_index = -1;
             respond_to_client(sockfd, LOGOUT_SUCCESS_MSG);
-            return false;
         }
         else
         {
             respond_to_client(sockfd, NOT_LOGGED_IN_MSG);
-            return is_logged_in;
         }
     }
     else
     {
         respond_to_client(sockfd, UNKNOWN_REQUEST_MSG);
-        return is_logged_in;
     }
 }
+
 /**
  * @brief Communicate with the client by receiving requests and sending responses.
- * @param sockfd The connected socket file descriptor.
+ * @param arg The client's Session.
  */
 void *communicate(void *arg)
 {
-    int sockfd;
-    sockfd = *((int *)arg);
-    free(arg);
+    Session *session = (Session *)arg;
+    int sockfd = session->fd;
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &session->peer.sin_addr, client_ip, sizeof(client_ip));
 
-    bool is_logged_in = false;
-    char current_user[1000] = "";
-
-    printf("Communicating with client %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+    printf("Communicating with client %s:%d\n", client_ip, ntohs(session->peer.sin_port));
     respond_to_client(sockfd, CONNECTED_MSG);
 
-    char recv_buf[BUFF_SIZE]; // bộ đệm tạm thời để nhận dữ liệu từ client
-    char mess[CHUNK_SIZE];
-
+    // the session's line buffer comes from the pool: small while the client sends
+    // short commands, grown only for a long line and handed back when the client leaves
     while (1)
     {
-        int disconnect = 0;
-        memset(recv_buf, 0, sizeof(recv_buf));
-        memset(mess, 0, sizeof(mess));
-        while (strstr(mess, "\r\n") == NULL)
+        char *end = memmem(session->buf, session->buf_len, "\r\n", 2);
+        if (end != NULL)
         {
-            ssize_t bytes = recv(sockfd, recv_buf, sizeof(recv_buf), 0);
-            if (bytes < 0)
+            size_t line_len = end - session->buf + 2;
+            *end = '\0';
+            if (session->discarding)
+                session->discarding = false; // the end of a line too long to handle
+            else
+                handle_client_request(session, session->buf, line_len - 2);
+            session->buf_len -= line_len;
+            memmove(session->buf, session->buf + line_len, session->buf_len);
+            if (session->buf_len == 0 && session->buf_cap > POOL_MIN_SIZE)
             {
-                perror("recv() error");
-                disconnect = 1;
-                break;
+                pool_put(session->buf, session->buf_cap); // a long line is over, go back to a small buffer
+                if ((session->buf = pool_get(POOL_MIN_SIZE, &session->buf_cap)) == NULL)
+                    break;
             }
-            else if (bytes == 0)
+            continue;
+        }
+
+        if (session->buf_len == session->buf_cap)
+        {
+            char *bigger = session->discarding ? NULL : pool_grow(session->buf, session->buf_len, &session->buf_cap);
+            if (bigger == NULL)
             {
-                printf("Connection closed: %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-                disconnect = 1;
-                break;
+                if (!session->discarding)
+                    respond_to_client(sockfd, UNKNOWN_REQUEST_MSG); // longer than POOL_MAX_SIZE
+                // the rest of the line is dropped up to its CRLF, never read as requests;
+                // a final CR is kept in case the LF comes next
+                session->discarding = true;
+                session->buf[0] = session->buf[session->buf_len - 1];
+                session->buf_len = session->buf[0] == '\r';
+                continue;
             }
-            strcat(mess, recv_buf);
+            session->buf = bigger;
         }
-        if (disconnect == 0)
-            is_logged_in = handle_client_request(sockfd, mess, strlen(mess), is_logged_in, current_user);
-        else
+
+        ssize_t bytes = recv(sockfd, session->buf + session->buf_len, session->buf_cap - session->buf_len, 0);
+        if (bytes < 0)
+        {
+            perror("recv() error");
             break;
+        }
+        else if (bytes == 0)
+        {
+            printf("Connection closed: %s:%d\n", client_ip, ntohs(session->peer.sin_port));
+            break;
+        }
+        session->buf_len += bytes;
     }
-    
-    strcpy(current_user, "");
-    log_out(current_user);
-    close(sockfd);
+
+    if (session->is_logged_in)
+        log_out(session->account_index);
+    session_close(session);
+    return NULL;
 }
 
 /**
@@ -234,13 +262,17 @@ int main(int argc, char *argv[])
 
     printf("Server started at port number %d!\n", atoi(port));
 
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
     while (1)
     {
-        connfd = (int *)malloc(sizeof(int));
-        if ((*connfd = accept(listen_sock, (struct sockaddr *)&client_addr, (socklen_t *)&sin_size)) == -1)
+        sin_size = sizeof(client_addr);
+        if ((conn_sock = accept(listen_sock, (struct sockaddr *)&client_addr, &sin_size)) == -1)
         {
             perror("accept() error");
-            free(connfd);
             continue;
         }
 
@@ -256,8 +288,20 @@ int main(int argc, char *argv[])
             printf("You got a connection from %s:%d\n", client_ip, client_port);
         }
 
+        Session *session = session_open(conn_sock, &client_addr);
+        if (session == NULL)
+        {
+            printf("Too many clients\n");
+            close(conn_sock);
+            continue;
+        }
+
         /* Spawn a new thread to handle the client */
-        pthread_create(&tid, NULL, &communicate, connfd);
+        if (pthread_create(&tid, &attr, &communicate, session) != 0)
+        {
+            perror("pthread_create() error");
+            session_close(session);
+        }
     }
 
     close(listen_sock);
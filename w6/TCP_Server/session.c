@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "session.h"
+#include "bufpool.h"
+
+static Session *slabs[MAX_SLABS];
+static int slab_count = 0;
+static int free_head = -1; /* most recently closed slot first: its memory is still in cache */
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Adds a slab of free sessions. This is the only allocation of session memory;
+ * slots are recycled through the free list afterwards.
+ * @return 0 on success, -1 if the session limit is reached or memory is exhausted.
+ */
+static int add_slab()
+{
+    if (slab_count == MAX_SLABS)
+        return -1;
+    Session *slab = malloc(SESSIONS_PER_SLAB * sizeof(Session));
+    if (slab == NULL)
+        return -1;
+
+    for (int i = SESSIONS_PER_SLAB - 1; i >= 0; i--)
+    {
+        slab[i].fd = -1;
+        slab[i].index = slab_count * SESSIONS_PER_SLAB + i;
+        slab[i].buf = NULL;
+        slab[i].next_free = free_head;
+        free_head = slab[i].index;
+    }
+    slabs[slab_count++] = slab;
+    return 0;
+}
+
+/**
+ * @brief Finds a session by its slot number.
+ * @param index The slot number, below session_slots().
+ * @return The session; its fd is -1 if the slot is free.
+ */
+Session *session_at(int index)
+{
+    return &slabs[index / SESSIONS_PER_SLAB][index % SESSIONS_PER_SLAB];
+}
+
+/**
+ * @brief Number of session slots allocated so far, for scanning every session.
+ */
+int session_slots()
+{
+    return slab_count * SESSIONS_PER_SLAB;
+}
+
+/**
+ * @brief Starts the session of an accepted connection.
+ * @param fd The connected socket.
+ * @param peer The client's address.
+ * @return The session, NULL if no slot or buffer is available.
+ */
+Session *session_open(int fd, const struct sockaddr_in *peer)
+{
+    pthread_mutex_lock(&session_mutex);
+    if (free_head < 0 && add_slab() < 0)
+    {
+        pthread_mutex_unlock(&session_mutex);
+        return NULL;
+    }
+    Session *session = session_at(free_head);
+    free_head = session->next_free;
+    pthread_mutex_unlock(&session_mutex);
+
+    session->buf = pool_get(POOL_MIN_SIZE, &session->buf_cap);
+    if (session->buf == NULL)
+    {
+        session_close(session);
+        return NULL;
+    }
+    session->fd = fd;
+    session->peer = *peer;
+    session->is_logged_in = false;
+    session->account_index = -1;
+    session->buf_len = 0;
+    session->discarding = false;
+    return session;
+}
+
+/**
+ * @brief Ends a session: closes its socket, returns its buffer to the pool and its
+ * slot to the free list.
+ * @param session The session.
+ */
+void session_close(Session *session)
+{
+    if (session->fd >= 0)
+        close(session->fd);
+    session->fd = -1;
+    pool_put(session->buf, session->buf_cap);
+    session->buf = NULL;
+
+    pthread_mutex_lock(&session_mutex);
+    session->next_free = free_head;
+    free_head = session->index;
+    pthread_mutex_unlock(&session_mutex);
+}
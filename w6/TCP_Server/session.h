@@ -0,0 +1,30 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+#define SESSIONS_PER_SLAB 256 /* sessions allocated together, contiguous in memory */
+#define MAX_SLABS 256         /* up to 65536 sessions */
+
+typedef struct
+{
+    int fd;                  // connected socket, -1 while the slot is free
+    int index;               // stable slot number
+    int next_free;           // next slot of the free list, -1 at its end
+    bool is_logged_in;
+    int account_index;       // logged-in account in accounts[], -1 otherwise
+    struct sockaddr_in peer; // client's address
+    char *buf;               // line buffer from the pool, NULL while the slot is free
+    size_t buf_cap;
+    size_t buf_len;          // bytes received but not yet handled
+    bool discarding;         // dropping the rest of a line too long for the pool
+} Session;
+
+Session *session_open(int fd, const struct sockaddr_in *peer);
+void session_close(Session *session);
+Session *session_at(int index);
+int session_slots();
+
+#endif // SESSION_H
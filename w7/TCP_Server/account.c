@@ -1,7 +1,6 @@
 #include "account.h"
 
 Account accounts[MAX_ACCOUNTS];
-char current_user[MAX_USERNAME_LENGTH] = "";
 int account_number = 0;
 
 /**
@@ -30,67 +29,35 @@ void load_accounts(const char *filename, Account accounts[])
 
 /**
  * @brief Check account and status, then authorize user.
- * @param log_in_username The username to authorize.
+ * @param log_in_username The username to authorize, not NUL-terminated.
+ * @param len Length of the username.
+ * @param account_index Set to the account's index in accounts[] on success.
  * @return 1 if success, 0 if account not found, -1 if account is banned.
  */
-int authorize_user(char *log_in_username)
+int authorize_user(const char *log_in_username, size_t len, int *account_index)
 {
-  bool found = false;
   for (int i = 0; i < account_number; i++)
   {
-    if (strcmp(log_in_username, accounts[i].username) == 0)
+    if (strlen(accounts[i].username) == len && memcmp(log_in_username, accounts[i].username, len) == 0)
     {
-      found = true;
       if (accounts[i].status == 1)
       {
-        strcpy(current_user, log_in_username);
+        *account_index = i;
         return 1; // success
       }
       else
       {
         return -1; // account is banned
       }
-      break;
     }
   }
-
-  if (!found)
-  {
-    return 0; // account not found
-  }
-}
-
-/**
- * @brief Check if a user is currently logged in.
- * @return true if a user is logged in, false otherwise.
- */
-bool logged_in_user()
-{
-  return strlen(current_user) > 0;
-}
-
-/**
- * @brief Log out the current user if logged in.
- */
-void log_out()
-{
-  if (logged_in_user())
-  {
-    strcpy(current_user, BLANK_STR);
-  }
+  return 0; // account not found
 }
 
 /**
- * @brief Get message input and handle posting process.
+ * @brief Handle posting process. The login is checked by the caller's session.
  */
 void post_message()
 {
-  if (logged_in_user())
-  {
-    printf("Successful post\n");
-  }
-  else
-  {
-    printf("You have not logged in\n");
-  }
+  printf("Successful post\n");
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,11 +9,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <ctype.h>
 #include "account.h"
+#include "bufpool.h"
+#include "session.h"
 
 #define BACKLOG 20
 #define BUFF_SIZE 4096
-#define MAX_MESS 65536
 #define ACCOUNT_FILE "TCP_Server/account.txt"
 
 #define CONNECTED_MSG "100\r\n"
@@ -25,231 +28,256 @@
 #define POST_SUCCESS_MSG "120\r\n"
 #define UNKNOWN_REQUEST_MSG "300\r\n"
 
-typedef struct
-{
-    int sockfd; // socket của client
-    // char username[MAX_USERNAME]; // nếu chưa login -> ""
-    bool logged_in; // true if logged in, false otherwise
-} ClientInfo;
-
-int i, maxi, maxfd, listenfd, connfd, sockfd;
+int i, maxfd, listenfd, connfd, sockfd;
 int nready;
-ClientInfo client[FD_SETSIZE];
 ssize_t ret;
 fd_set readfds, allset;
-char sendBuff[BUFF_SIZE], rcvBuff[BUFF_SIZE], mess[MAX_MESS];
+char sendBuff[BUFF_SIZE];
 char *port;
 struct sockaddr_in server_addr; /* server's address information */
 struct sockaddr_in client_addr; /* client's address information */
 socklen_t clilen;
 
-/**
- * @brief Receive message from client.
- * @param sockfd The connected socket file descriptor.
- * @return The length of the received message.
- */
-int receive_from_client(int sockfd)
-{
-    memset(rcvBuff, 0, sizeof(rcvBuff));
-    memset(mess, 0, sizeof(mess));
-    while (strstr(mess, "\r\n") == NULL)
-    {
-        ssize_t bytes = recv(sockfd, rcvBuff, sizeof(rcvBuff), 0);
-        if (bytes < 0)
-        {
-            perror("recv() error");
-            break;
-        }
-        else if (bytes == 0)
-        {
-            printf("Connection closed: %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-            break;
-        }
-        strcat(mess, rcvBuff);
-    }
-    return strlen(mess);
-};
-
 /**
  * @brief Send response message to client.
- * @param sockfd The connected socket file descriptor.
+ * @param session The client's session.
  * @param msg The message to send.
  */
-int respond_to_client(int sockfd, char *msg)
+int respond_to_client(Session *session, char *msg)
 {
     int len = strlen(msg);
-    int sent_bytes = send(sockfd, msg, len, 0);
-    printf("=> Sent to client %s:%d: %s\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), msg);
+    int sent_bytes = send(session->fd, msg, len, 0);
+    printf("=> Sent to client %s:%d: %s\n", inet_ntoa(session->peer.sin_addr), ntohs(session->peer.sin_port), msg);
     return sent_bytes;
 }
 
 /**
- * @brief Handle client request based on the received message.
- * @param buff The received message buffer.
+ * @brief Adds a reply to sendBuff, sending what is queued first if it is full.
+ * @param session The client's session.
+ * @param msg The reply.
  */
-void handle_client_request(ClientInfo *client, char *buff)
+void queue_reply(Session *session, char *msg)
 {
-    memset(sendBuff, 0, sizeof(sendBuff));
-    char *line = strtok(buff, "\r\n"); // tách từng dòng bằng CRLF
-    while (line != NULL)
+    if (strlen(sendBuff) + strlen(msg) >= sizeof(sendBuff))
     {
-        line[strcspn(line, "\r\n")] = '\0';
-        printf("=> Received from client: %s\n", line);
+        respond_to_client(session, sendBuff);
+        sendBuff[0] = '\0';
+    }
+    strcat(sendBuff, msg);
+}
+
+/**
+ * @brief Handle client request based on the received message.
+ * @param session The client's session; its login state is updated.
+ * @param line One request line, without its CRLF.
+ * @param len Length of the line.
+ */
+void handle_client_request(Session *session, char *line, size_t len)
+{
+    printf("=> Received from client: %s\n", line);
 
-        if (strncmp(line, "USER", 4) == 0)
+    if (len >= 5 && strncmp(line, "USER ", 5) == 0)
+    {
+        if (session->is_logged_in)
         {
-            if (client->logged_in)
-            {
-                strcat(sendBuff, ALREADY_LOGGED_IN_MSG);
-            }
-            else
-            {
-                char log_in_username[MAX_USERNAME_LENGTH];
-                sscanf(line + 5, "%s", log_in_username);
-                int res = authorize_user(log_in_username);
-                if (res == 1)
-                {
-                    strcat(sendBuff, ACTIVE_ACCOUNT_MSG);
-                    client->logged_in = true;
-                }
-                else if (res == 0)
-                {
-                    strcat(sendBuff, UNKNOWN_ACCOUNT_MSG);
-                }
-                else if (res == -1)
-                {
-                    strcat(sendBuff, BANNED_ACCOUNT_MSG);
-                }
-            }
+            queue_reply(session, ALREADY_LOGGED_IN_MSG);
         }
-        else if (strncmp(line, "POST", 4) == 0)
+        else
         {
-            if (client->logged_in)
+            // the username is the first word after USER, taken from the line only
+            const char *name = line + 5, *end = line + len;
+            while (name < end && isspace((unsigned char)*name))
+                name++;
+            size_t name_len = 0;
+            while (name + name_len < end && !isspace((unsigned char)name[name_len]))
+                name_len++;
+            int res = authorize_user(name, name_len, &session->account_index);
+            if (res == 1)
             {
-                post_message();
-                strcat(sendBuff, POST_SUCCESS_MSG);
+                queue_reply(session, ACTIVE_ACCOUNT_MSG);
+                session->is_logged_in = true;
             }
-            else
+            else if (res == 0)
             {
-                strcat(sendBuff, NOT_LOGGED_IN_MSG);
+                queue_reply(session, UNKNOWN_ACCOUNT_MSG);
             }
-        }
-        else if (strncmp(line, "BYE", 3) == 0)
-        {
-            if (client->logged_in)
+            else if (res == -1)
             {
-                log_out();
-                client->logged_in = false;
-                strcat(sendBuff, LOGOUT_SUCCESS_MSG);
-            }
-            else
-            {
-                strcat(sendBuff, NOT_LOGGED_IN_MSG);
+                queue_reply(session, BANNED_ACCOUNT_MSG);
             }
         }
+    }
+    else if (strncmp(line, "POST", 4) == 0)
+    {
+        if (session->is_logged_in)
+        {
+            post_message();
+            queue_reply(session, POST_SUCCESS_MSG);
+        }
+        else
+        {
+            queue_reply(session, NOT_LOGGED_IN_MSG);
+        }
+    }
+    else if (strncmp(line, "BYE", 3) == 0)
+    {
+        if (session->is_logged_in)
+        {
+            session->is_logged_in = false;
+            session->account_index = -1;
+            queue_reply(session, LOGOUT_SUCCESS_MSG);
+        }
         else
         {
-            strcat(sendBuff, UNKNOWN_REQUEST_MSG);
+            queue_reply(session, NOT_LOGGED_IN_MSG);
         }
-        line = strtok(NULL, "\r\n");
+    }
+    else
+    {
+        queue_reply(session, UNKNOWN_REQUEST_MSG);
     }
 }
 
 /**
- * @brief Communicate with the client by receiving requests and sending responses.
- * @param sockfd The connected socket file descriptor.
+ * @brief Receives what a client sent and handles every complete line in it, queuing
+ * the replies in sendBuff. A partial line stays in the session's buffer until the
+ * rest arrives, so a slow client never holds up the others.
+ * @param session The client's session.
+ * @return The number of bytes received, 0 if the client closed, -1 on error.
+ */
+int receive_from_client(Session *session)
+{
+    sendBuff[0] = '\0';
+    if (session->buf_len == session->buf_cap)
+    {
+        char *bigger = session->discarding ? NULL : pool_grow(session->buf, session->buf_len, &session->buf_cap);
+        if (bigger == NULL)
+        {
+            if (!session->discarding)
+                queue_reply(session, UNKNOWN_REQUEST_MSG); // longer than POOL_MAX_SIZE
+            // the rest of the line is dropped up to its CRLF, never read as requests;
+            // a final CR is kept in case the LF comes next
+            session->discarding = true;
+            session->buf[0] = session->buf[session->buf_len - 1];
+            session->buf_len = session->buf[0] == '\r';
+        }
+        else
+            session->buf = bigger;
+    }
+
+    ssize_t bytes = recv(session->fd, session->buf + session->buf_len, session->buf_cap - session->buf_len, 0);
+    if (bytes < 0)
+    {
+        perror("recv() error");
+        return -1;
+    }
+    else if (bytes == 0)
+    {
+        printf("Connection closed: %s:%d\n", inet_ntoa(session->peer.sin_addr), ntohs(session->peer.sin_port));
+        return 0;
+    }
+    session->buf_len += bytes;
+
+    char *end;
+    while ((end = memmem(session->buf, session->buf_len, "\r\n", 2)) != NULL)
+    {
+        size_t line_len = end - session->buf + 2;
+        *end = '\0';
+        if (session->discarding)
+            session->discarding = false; // the end of a line too long to handle
+        else
+            handle_client_request(session, session->buf, line_len - 2);
+        session->buf_len -= line_len;
+        memmove(session->buf, session->buf + line_len, session->buf_len);
+    }
+    if (session->buf_len == 0 && session->buf_cap > POOL_MIN_SIZE)
+    {
+        size_t capacity;
+        char *small = pool_get(POOL_MIN_SIZE, &capacity); // a long line is over
+        if (small != NULL)
+        {
+            pool_put(session->buf, session->buf_cap);
+            session->buf = small;
+            session->buf_cap = capacity;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Ends a client's session and stops watching its socket.
+ * @param session The session.
+ */
+void drop_client(Session *session)
+{
+    FD_CLR(session->fd, &allset);
+    session_close(session);
+}
+
+/**
+ * @brief Communicate with the clients by receiving requests and sending responses.
+ * Each client is a Session from the slab allocator, so accepting and closing a
+ * connection allocates nothing once the slabs are warm.
  */
 void communicate()
 {
+    maxfd = listenfd; /* initialize */
+    FD_ZERO(&allset);
+    FD_SET(listenfd, &allset);
+
+    // Step 4: Communicate with clients
     while (1)
     {
-        maxfd = listenfd; /* initialize */
-        maxi = -1;        /* index into client[] array */
-        for (i = 0; i < FD_SETSIZE; i++)
-            client[i].sockfd = -1; /* -1 indicates available entry */
-        FD_ZERO(&allset);
-        FD_SET(listenfd, &allset);
-
-        // Step 4: Communicate with clients
-        while (1)
+        readfds = allset; /* structure assignment */
+        nready = select(maxfd + 1, &readfds, NULL, NULL, NULL);
+        if (nready < 0)
         {
-            readfds = allset; /* structure assignment */
-            nready = select(maxfd + 1, &readfds, NULL, NULL, NULL);
-            if (nready < 0)
-            {
-                perror("select() error: ");
-                exit(EXIT_FAILURE);
-            }
+            perror("select() error: ");
+            exit(EXIT_FAILURE);
+        }
 
-            if (FD_ISSET(listenfd, &readfds))
-            { /* new client connection */
-                clilen = sizeof(client_addr);
-                if ((connfd = accept(listenfd, (struct sockaddr *)&client_addr, &clilen)) < 0)
-                    perror("\nError: ");
+        if (FD_ISSET(listenfd, &readfds))
+        { /* new client connection */
+            clilen = sizeof(client_addr);
+            if ((connfd = accept(listenfd, (struct sockaddr *)&client_addr, &clilen)) < 0)
+                perror("\nError: ");
+            else
+            {
+                printf("You got a connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port)); /* prints client's IP */
+                Session *session = connfd < FD_SETSIZE ? session_open(connfd, &client_addr) : NULL;
+                if (session == NULL)
+                {
+                    printf("\nToo many clients");
+                    close(connfd);
+                }
                 else
                 {
-                    printf("You got a connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port)); /* prints client's IP */
-                    for (i = 0; i < FD_SETSIZE; i++)
-                        if (client[i].sockfd < 0)
-                        {
-                            client[i].sockfd = connfd; /* save descriptor */
-                            break;
-                        }
-                    if (i == FD_SETSIZE)
-                    {
-                        printf("\nToo many clients");
-                        close(connfd);
-                    }
-                    else
-                    {
-                        FD_SET(connfd, &allset); /* add new descriptor to set */
-                        if (connfd > maxfd)
-                            maxfd = connfd; /* for select */
-                        if (i > maxi)
-                            maxi = i; /* max index in client[] array */
-
-                        client[i].logged_in = false; /* set logged_in to false */
-                        respond_to_client(connfd, CONNECTED_MSG);
-                    }
-
-                    if (--nready == 0)
-                        continue; /* no more readable descriptors */
+                    FD_SET(connfd, &allset); /* add new descriptor to set */
+                    if (connfd > maxfd)
+                        maxfd = connfd; /* for select */
+                    respond_to_client(session, CONNECTED_MSG);
                 }
             }
 
-            for (i = 0; i <= maxi; i++)
-            { /* check all clients for data */
-                if ((sockfd = client[i].sockfd) < 0)
-                    continue;
-                if (FD_ISSET(sockfd, &readfds))
-                {
-                    ret = receive_from_client(sockfd);
-                    if (ret <= 0)
-                    {
-                        FD_CLR(sockfd, &allset);
-                        close(sockfd);
-                        client[i].sockfd = -1;
-                    }
-                    else
-                    {
-                        handle_client_request(&client[i], rcvBuff);
-                        ret = respond_to_client(sockfd, sendBuff);
-                        if (ret < 0)
-                        {
-                            FD_CLR(sockfd, &allset);
-                            close(sockfd);
-                            client[i].sockfd = -1;
-                            client[i].logged_in = false;
-                        }
-                    }
+            if (--nready == 0)
+                continue; /* no more readable descriptors */
+        }
 
-                    if (--nready <= 0)
-                        break; /* no more readable descriptors */
-                }
-            }
+        for (i = 0; i < session_slots(); i++)
+        { /* check all clients for data */
+            Session *session = session_at(i);
+            if ((sockfd = session->fd) < 0 || !FD_ISSET(sockfd, &readfds))
+                continue;
+
+            ret = receive_from_client(session);
+            if (ret <= 0)
+                drop_client(session);
+            else if (sendBuff[0] != '\0' && respond_to_client(session, sendBuff) < 0)
+                drop_client(session);
+
+            if (--nready <= 0)
+                break; /* no more readable descriptors */
         }
-        return 0;
-        close(sockfd);
     }
 }
 
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "account.h"
+
+Account *accounts = NULL;
+int account_number = 0;
+
+static int *name_index = NULL;       // open-addressing table of account indices, -1 when empty
+static size_t index_mask = 0;
+static unsigned char *logged_in = NULL; // shared between the processes of the fork engines
+
+/**
+ * @brief FNV-1a hash of a username.
+ */
+static uint32_t hash_name(const char *name, size_t len)
+{
+  uint32_t h = 2166136261u;
+  while (len--)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+/**
+ * @brief Compares an account's username with a name that is not NUL-terminated.
+ */
+static bool same_name(const Account *account, const char *name, size_t len)
+{
+  return account->length == len && memcmp(account->username, name, len) == 0;
+}
+
+/**
+ * @brief Builds the username index over the loaded accounts. The first account of a
+ * duplicated name wins, as with the linear search the other servers use.
+ * @return 0 on success, -1 on error.
+ */
+static int build_index()
+{
+  size_t size = 16;
+  while (size < (size_t)account_number * 2)
+    size *= 2;
+  name_index = malloc(size * sizeof(int));
+  if (name_index == NULL)
+    return -1;
+  memset(name_index, 0xff, size * sizeof(int));
+  index_mask = size - 1;
+
+  for (int i = 0; i < account_number; i++)
+  {
+    size_t slot = hash_name(accounts[i].username, accounts[i].length) & index_mask;
+    while (name_index[slot] != -1 && !same_name(&accounts[name_index[slot]], accounts[i].username, accounts[i].length))
+      slot = (slot + 1) & index_mask;
+    if (name_index[slot] == -1)
+      name_index[slot] = i;
+  }
+  return 0;
+}
+
+/**
+ * @brief Loads account information from a file. The login flags are placed in shared
+ * memory, so they hold across the processes of the fork and pre-fork engines as well
+ * as across threads.
+ * @param filename The name of the file containing account information.
+ * @return 0 on success, -1 on error.
+ */
+int load_accounts(const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (!f)
+  {
+    printf("cant open file %s\n", filename);
+    return -1;
+  }
+
+  char username[MAX_USERNAME_LENGTH];
+  int status, capacity = 0;
+  while (account_number < MAX_ACCOUNTS && fscanf(f, "%999s %d", username, &status) == 2)
+  {
+    if (account_number == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 1024;
+      Account *bigger = realloc(accounts, capacity * sizeof(Account));
+      if (bigger == NULL)
+      {
+        perror("realloc() error");
+        fclose(f);
+        return -1;
+      }
+      accounts = bigger;
+    }
+    accounts[account_number].username = strdup(username);
+    accounts[account_number].length = strlen(username);
+    accounts[account_number].status = status;
+    account_number++;
+  }
+  fclose(f);
+
+  logged_in = mmap(NULL, account_number + 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (logged_in == MAP_FAILED)
+  {
+    perror("mmap() error");
+    return -1;
+  }
+  if (build_index() < 0)
+  {
+    perror("malloc() error");
+    return -1;
+  }
+  printf("Loaded %d accounts from %s\n", account_number, filename);
+  return 0;
+}
+
+/**
+ * @brief Looks up an account by username.
+ * @param name The username, not necessarily NUL-terminated.
+ * @param len Length of the username.
+ * @return The account's index in accounts[], -1 if there is none.
+ */
+int find_account(const char *name, size_t len)
+{
+  if (account_number == 0)
+    return -1;
+
+  size_t slot = hash_name(name, len) & index_mask;
+  while (name_index[slot] != -1 && !same_name(&accounts[name_index[slot]], name, len))
+    slot = (slot + 1) & index_mask;
+  return name_index[slot];
+}
+
+/**
+ * @brief Check account and status, then authorize user.
+ * @param log_in_username The username to authorize, not necessarily NUL-terminated.
+ * @param len Length of the username.
+ * @param account_index Set to the account's index in accounts[] on success.
+ * @return 1 if success, 0 if account not found, -1 if account is banned,
+ * -2 if the account is logged in elsewhere.
+ */
+int authorize_user(const char *log_in_username, size_t len, int *account_index)
+{
+  int i = find_account(log_in_username, len);
+  if (i == -1)
+    return 0; // account not found
+  if (accounts[i].status != 1)
+    return -1; // account is banned
+
+  unsigned char expected = 0;
+  if (!__atomic_compare_exchange_n(&logged_in[i], &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return -2; // already logged in elsewhere
+  *account_index = i;
+  return 1;
+}
+
+/**
+ * @brief Log out a logged-in account.
+ * @param account_index The account's index in accounts[], from authorize_user().
+ */
+void log_out(int account_index)
+{
+  __atomic_store_n(&logged_in[account_index], 0, __ATOMIC_RELEASE);
+}
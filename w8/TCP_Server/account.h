@@ -0,0 +1,26 @@
+#ifndef ACCOUNT_H
+#define ACCOUNT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define MAX_USERNAME_LENGTH 1000
+#define MAX_ACCOUNTS 1000000
+
+typedef struct
+{
+  char *username;
+  size_t length; // of username
+  int status; // 1: active, 0: banned
+} Account;
+
+extern Account *accounts;
+extern int account_number;
+
+int load_accounts(const char *filename);
+int find_account(const char *name, size_t len);
+int authorize_user(const char *log_in_username, size_t len, int *account_index);
+void log_out(int account_index);
+
+#endif // ACCOUNT_H
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bufpool.h"
+
+#define POOL_CLASSES 5     /* 256 B, 1 KB, 4 KB, 16 KB, 64 KB */
+#define POOL_MAX_FREE 1024 /* free buffers kept per class, the rest go back to malloc */
+
+typedef struct FreeBuffer
+{
+    struct FreeBuffer *next;
+} FreeBuffer;
+
+static FreeBuffer *free_list[POOL_CLASSES];
+static int free_count[POOL_CLASSES];
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Finds the smallest size class holding a number of bytes.
+ * @return The class index, -1 if the size is larger than POOL_MAX_SIZE.
+ */
+static int size_class(size_t size)
+{
+    size_t class_size = POOL_MIN_SIZE;
+    for (int i = 0; i < POOL_CLASSES; i++, class_size *= 4)
+    {
+        if (size <= class_size)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Takes a buffer of at least size bytes from the pool.
+ * @param size The number of bytes needed.
+ * @param capacity Set to the real size of the buffer, to give back to pool_put().
+ * @return The buffer, NULL if size is too large or memory is exhausted.
+ */
+char *pool_get(size_t size, size_t *capacity)
+{
+    int c = size_class(size);
+    if (c < 0)
+        return NULL;
+    *capacity = (size_t)POOL_MIN_SIZE << (2 * c);
+
+    pthread_mutex_lock(&pool_mutex);
+    FreeBuffer *buf = free_list[c];
+    if (buf != NULL)
+    {
+        free_list[c] = buf->next;
+        free_count[c]--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    return buf != NULL ? (char *)buf : malloc(*capacity);
+}
+
+/**
+ * @brief Moves the content of a buffer into one of the next size class.
+ * @param buf The buffer, given back to the pool on success.
+ * @param used Number of bytes of buf to keep.
+ * @param capacity Capacity of buf; set to the capacity of the new buffer.
+ * @return The new buffer, NULL if buf is already the largest size (buf is kept).
+ */
+char *pool_grow(char *buf, size_t used, size_t *capacity)
+{
+    size_t new_capacity;
+    char *bigger = pool_get(*capacity + 1, &new_capacity);
+    if (bigger == NULL)
+        return NULL;
+
+    memcpy(bigger, buf, used);
+    pool_put(buf, *capacity);
+    *capacity = new_capacity;
+    return bigger;
+}
+
+/**
+ * @brief Gives a buffer back to the pool.
+ * @param buf The buffer, from pool_get() or pool_grow().
+ * @param capacity Its capacity.
+ */
+void pool_put(char *buf, size_t capacity)
+{
+    int c = size_class(capacity);
+    if (buf == NULL)
+        return;
+
+    pthread_mutex_lock(&pool_mutex);
+    if (free_count[c] < POOL_MAX_FREE)
+    {
+        FreeBuffer *node = (FreeBuffer *)buf;
+        node->next = free_list[c];
+        free_list[c] = node;
+        free_count[c]++;
+        buf = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    free(buf);
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "command.h"
+
+/* Verbs are resolved with a perfect hash rebuilt whenever a module registers one:
+ * a verb is read as a 64-bit word, multiplied by a constant chosen so that no two
+ * registered verbs share a slot, and its top bits index the table. A lookup is one
+ * multiply and one compare however many verbs there are. */
+
+#define TABLE_BITS 7 /* 128 slots, twice MAX_COMMANDS */
+#define TABLE_SIZE (1 << TABLE_BITS)
+#define MAX_TRIES 100000
+
+typedef struct
+{
+    uint64_t key;
+    size_t len; // 0 for an empty slot
+    CommandHandler handler;
+} Entry;
+
+static Entry registered[MAX_COMMANDS];
+static int registered_count = 0;
+static Entry table[TABLE_SIZE];
+static uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+
+/**
+ * @brief Reads a verb of 1 to MAX_VERB_LENGTH bytes as a word, zero-padded. Two
+ * fixed-size loads that may overlap replace a variable-length copy; overlapping
+ * bytes land on the same bits, so OR-ing them is harmless.
+ */
+static inline uint64_t verb_key(const char *verb, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)verb;
+
+    if (len >= 4)
+    {
+        uint32_t head, tail;
+        memcpy(&head, p, 4);
+        memcpy(&tail, p + len - 4, 4);
+        return head | (uint64_t)tail << ((len - 4) * 8);
+    }
+    return p[0] | (uint64_t)p[len / 2] << (len / 2 * 8) | (uint64_t)p[len - 1] << ((len - 1) * 8);
+}
+
+/**
+ * @brief Slot of a key: the top bits of its product with the multiplier.
+ */
+static inline unsigned slot_of(uint64_t key, uint64_t mult)
+{
+    return (key * mult) >> (64 - TABLE_BITS);
+}
+
+/**
+ * @brief Looks for a multiplier that gives every registered verb its own slot.
+ * @return 0 on success, -1 if none was found.
+ */
+static int build_table()
+{
+    uint64_t mult = multiplier, state = 88172645463325252ull;
+
+    for (int tries = 0; tries < MAX_TRIES; tries++)
+    {
+        unsigned char used[TABLE_SIZE] = {0};
+        int i;
+        for (i = 0; i < registered_count; i++)
+        {
+            unsigned slot = slot_of(registered[i].key, mult);
+            if (used[slot])
+                break;
+            used[slot] = 1;
+        }
+        if (i == registered_count)
+        {
+            multiplier = mult;
+            memset(table, 0, sizeof(table));
+            for (i = 0; i < registered_count; i++)
+                table[slot_of(registered[i].key, mult)] = registered[i];
+            return 0;
+        }
+        // next odd candidate from an xorshift generator
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        mult = state | 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Registers the handler of a verb. Modules call it at startup, before the
+ * engine starts serving.
+ * @param verb The verb, at most MAX_VERB_LENGTH bytes.
+ * @param handler Called with each command using the verb.
+ * @return 0 on success, -1 if the verb is invalid, already registered or the table is full.
+ */
+int register_command(const char *verb, CommandHandler handler)
+{
+    size_t len = strlen(verb);
+
+    if (len == 0 || len > MAX_VERB_LENGTH || registered_count == MAX_COMMANDS)
+    {
+        fprintf(stderr, "Cannot register command %s\n", verb);
+        return -1;
+    }
+    uint64_t key = verb_key(verb, len);
+    for (int i = 0; i < registered_count; i++)
+    {
+        if (registered[i].key == key && registered[i].len == len)
+        {
+            fprintf(stderr, "Command %s is already registered\n", verb);
+            return -1;
+        }
+    }
+
+    registered[registered_count].key = key;
+    registered[registered_count].len = len;
+    registered[registered_count].handler = handler;
+    registered_count++;
+    if (build_table() < 0)
+    {
+        registered_count--;
+        build_table();
+        fprintf(stderr, "No perfect hash for command %s\n", verb);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the handler of a verb.
+ * @param verb The verb of a received command.
+ * @return The handler, NULL if the verb is unknown.
+ */
+CommandHandler find_command(const Slice *verb)
+{
+    if (verb->len == 0 || verb->len > MAX_VERB_LENGTH)
+        return NULL;
+    uint64_t key = verb_key(verb->ptr, verb->len);
+    const Entry *entry = &table[slot_of(key, multiplier)];
+    return entry->key == key && entry->len == verb->len ? entry->handler : NULL;
+}
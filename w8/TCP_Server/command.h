@@ -0,0 +1,15 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "protocol.h"
+#include "tokenizer.h"
+
+#define MAX_COMMANDS 64
+#define MAX_VERB_LENGTH 8 /* a verb is looked up as one 64-bit word */
+
+typedef void (*CommandHandler)(Client *client, const Command *cmd);
+
+int register_command(const char *verb, CommandHandler handler);
+CommandHandler find_command(const Slice *verb);
+
+#endif // COMMAND_H
@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78 /* Castagnoli polynomial, reflected */
+
+static uint32_t table[256];
+static int table_ready = 0;
+
+/**
+ * @brief Builds the byte-at-a-time lookup table used when the CPU has no CRC32 instruction.
+ */
+static void build_table()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        table[i] = c;
+    }
+    table_ready = 1;
+}
+
+/**
+ * @brief Portable CRC32C, one table lookup per byte.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    if (!table_ready)
+        build_table();
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief CRC32C with the SSE4.2 crc32 instruction, 8 bytes per instruction.
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#endif
+
+/**
+ * @brief Computes the CRC32C (Castagnoli) of a buffer, using the CPU's CRC32
+ * instruction when available.
+ * @param crc CRC of the preceding data, 0 for the first buffer.
+ * @param data The buffer.
+ * @param len Length of the buffer.
+ * @return The updated CRC.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_hw(crc, data, len);
+#endif
+    return ~crc32c_sw(crc, data, len);
+}
@@ -0,0 +1,22 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+/* A concurrency engine accepts connections on the listening socket and drives the
+ * protocol in protocol.c; it only returns on a fatal error. */
+
+typedef struct
+{
+    const char *name;
+    int (*run)(int listen_sock, int workers);
+    const char *description;
+} Engine;
+
+int run_fork(int listen_sock, int workers);
+int run_prefork(int listen_sock, int workers);
+int run_thread(int listen_sock, int workers);
+int run_pool(int listen_sock, int workers);
+int run_select(int listen_sock, int workers);
+int run_epoll(int listen_sock, int workers);
+int run_uring(int listen_sock, int workers);
+
+#endif // ENGINE_H
@@ -0,0 +1,342 @@
+/* Engines serving each connection with blocking calls: fork, pre-fork, thread per
+ * connection and thread pool. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "timerwheel.h"
+
+#define THREAD_STACK_SIZE (128 * 1024) /* no request buffer lives on the stack */
+#define QUEUE_SIZE 1024                /* accepted connections waiting for a pool thread */
+
+/**
+ * @brief Bounds how long the next recv() or send() blocks. A connection has its own
+ * thread here, so its deadline needs no wheel: the timeout is only lowered when the
+ * deadline comes closer, and set again after it fires early.
+ * @param fd The connected socket.
+ * @param option SO_RCVTIMEO or SO_SNDTIMEO.
+ * @param deadline The client's deadline, -1 if none.
+ * @param timeout The timeout in effect, -1 if none, INT64_MAX to set it again; updated.
+ * @return 0 to go on, -1 if the deadline has passed.
+ */
+static int set_deadline(int fd, int option, int64_t deadline, int64_t *timeout)
+{
+    int64_t left = deadline - clock_ms();
+
+    if (deadline >= 0 && left <= 0)
+        return -1;
+    if (deadline < 0 ? *timeout < 0 : *timeout >= 0 && left >= *timeout)
+        return 0;
+    *timeout = deadline < 0 ? -1 : left;
+    struct timeval tv = {left / 1000, left % 1000 * 1000};
+    if (deadline < 0)
+        tv.tv_sec = tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+    return 0;
+}
+
+/**
+ * @brief Sends every queued reply before the client's deadline, so a client that
+ * does not read holds its worker no longer than one that sends nothing.
+ * @param client The client.
+ * @param timeout The send timeout in effect, as for set_deadline(); updated.
+ * @return 0 on success, -1 if the connection failed or the deadline passed.
+ */
+static int send_replies(Client *client, int64_t *timeout)
+{
+    while (client_pending(client) > 0)
+    {
+        if (set_deadline(client->fd, SO_SNDTIMEO, client_deadline(client), timeout) < 0)
+            return -1;
+        struct iovec iov[MAX_OUT_IOV];
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = client_out_iov(client, iov, MAX_OUT_IOV)};
+        ssize_t bytes = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            *timeout = INT64_MAX; // fired: check the deadline and set the timeout again
+        if (bytes < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (bytes < 0)
+        {
+            perror("send() error");
+            return -1;
+        }
+        client_sent(client, bytes);
+    }
+    return 0;
+}
+
+/**
+ * @brief Serves one connection until the client leaves or its deadline passes,
+ * then closes it. A client past its deadline is sent what the socket takes of the
+ * reply telling it why, without blocking, unless its replies were what it left
+ * unread.
+ * @param fd The connected socket.
+ */
+static void serve_client(int fd)
+{
+    Client client;
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    int64_t timeout = -1;      // receive timeout in effect
+    int64_t send_timeout = -1;
+
+    if (getpeername(fd, (struct sockaddr *)&peer, &len) < 0)
+        memset(&peer, 0, sizeof(peer));
+    if (client_init(&client, fd, &peer) < 0)
+    {
+        close(fd);
+        return;
+    }
+
+    while (send_replies(&client, &send_timeout) == 0)
+    {
+        if (set_deadline(fd, SO_RCVTIMEO, client_deadline(&client), &timeout) < 0)
+        {
+            struct iovec iov[MAX_OUT_IOV];
+            client_expired(&client);
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = client_out_iov(&client, iov, MAX_OUT_IOV)};
+            sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            break;
+        }
+        size_t space;
+        char *buf = client_recv_space(&client, &space);
+        ssize_t bytes = recv(fd, buf, space, 0);
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            timeout = INT64_MAX; // fired: check the deadline and set the timeout again
+        if (bytes < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        if (bytes < 0)
+            perror("recv() error");
+        if (bytes <= 0)
+            break;
+        client_received(&client, bytes);
+    }
+    client_release(&client);
+}
+
+/**
+ * @brief Accepts a connection, retrying when a signal interrupts accept().
+ * @return The connected socket, -1 on error.
+ */
+static int accept_client(int listen_sock)
+{
+    while (1)
+    {
+        int fd = accept(listen_sock, NULL, NULL);
+        if (fd >= 0 || (errno != EINTR && errno != ECONNABORTED))
+            return fd;
+    }
+}
+
+/**
+ * @brief Reaps terminated children.
+ */
+static void sig_chld(int signo)
+{
+    int saved = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+    errno = saved;
+}
+
+/**
+ * @brief Forks a child process for each connection, as the w5 server does.
+ */
+int run_fork(int listen_sock, int workers)
+{
+    signal(SIGCHLD, sig_chld);
+
+    while (1)
+    {
+        int fd = accept_client(listen_sock);
+        if (fd < 0)
+        {
+            perror("accept() error");
+            return -1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(listen_sock);
+            serve_client(fd);
+            exit(EXIT_SUCCESS);
+        }
+        if (pid < 0)
+            perror("fork() error");
+        close(fd);
+    }
+}
+
+/**
+ * @brief Worker process of the pre-fork engine: accepts and serves one connection at a time.
+ */
+static void prefork_worker(int listen_sock)
+{
+    prctl(PR_SET_PDEATHSIG, SIGTERM); // stop accepting once the server is stopped
+    while (1)
+    {
+        int fd = accept_client(listen_sock);
+        if (fd < 0)
+        {
+            perror("accept() error");
+            exit(EXIT_FAILURE);
+        }
+        serve_client(fd);
+    }
+}
+
+/**
+ * @brief Forks a fixed set of worker processes that share the listening socket,
+ * and replaces any that dies. Serves at most workers connections at once.
+ */
+int run_prefork(int listen_sock, int workers)
+{
+    for (int i = 0; i < workers; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+            prefork_worker(listen_sock);
+        if (pid < 0)
+        {
+            perror("fork() error");
+            return -1;
+        }
+    }
+
+    while (1)
+    {
+        if (wait(NULL) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("wait() error");
+            return -1;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+            prefork_worker(listen_sock);
+        if (pid < 0)
+            perror("fork() error");
+    }
+}
+
+/**
+ * @brief Thread of the thread-per-connection engine.
+ * @param arg The connected socket, cast to a pointer.
+ */
+static void *connection_thread(void *arg)
+{
+    serve_client((int)(intptr_t)arg);
+    return NULL;
+}
+
+/**
+ * @brief Starts a detached thread for each connection, as the w6 server does.
+ */
+int run_thread(int listen_sock, int workers)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (1)
+    {
+        int fd = accept_client(listen_sock);
+        if (fd < 0)
+        {
+            perror("accept() error");
+            continue;
+        }
+
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, connection_thread, (void *)(intptr_t)fd) != 0)
+        {
+            perror("pthread_create() error");
+            close(fd);
+        }
+    }
+}
+
+static int queue[QUEUE_SIZE]; // accepted sockets, a ring buffer
+static int queue_head = 0, queue_count = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @brief Thread of the pool engine: takes accepted connections from the queue and
+ * serves them one at a time.
+ */
+static void *pool_thread(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_count == 0)
+            pthread_cond_wait(&queue_not_empty, &queue_mutex);
+        int fd = queue[queue_head];
+        queue_head = (queue_head + 1) % QUEUE_SIZE;
+        queue_count--;
+        pthread_cond_signal(&queue_not_full);
+        pthread_mutex_unlock(&queue_mutex);
+
+        serve_client(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts a fixed set of threads and hands them accepted connections through
+ * a bounded queue. Serves at most workers connections at once.
+ */
+int run_pool(int listen_sock, int workers)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    for (int i = 0; i < workers; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, pool_thread, NULL) != 0)
+        {
+            perror("pthread_create() error");
+            return -1;
+        }
+    }
+
+    while (1)
+    {
+        int fd = accept_client(listen_sock);
+        if (fd < 0)
+        {
+            perror("accept() error");
+            continue;
+        }
+
+        pthread_mutex_lock(&queue_mutex);
+        while (queue_count == QUEUE_SIZE)
+            pthread_cond_wait(&queue_not_full, &queue_mutex);
+        queue[(queue_head + queue_count) % QUEUE_SIZE] = fd;
+        queue_count++;
+        pthread_cond_signal(&queue_not_empty);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+}
@@ -0,0 +1,464 @@
+/* Engines multiplexing every connection in one thread with non-blocking sockets:
+ * select, as the w7 server does, and epoll. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "msglog.h"
+#include "timerwheel.h"
+
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64 /* connections accepted per wake-up, so clients are not starved */
+
+#define WANT_NONE 0 /* waiting for a stored POST to become durable */
+#define WANT_READ 1
+#define WANT_WRITE 2
+
+typedef struct
+{
+    Client client; // first, so a Client from client_next_committed() or client_next_woken() is its EventClient
+    int interest;  // WANT_READ while no reply is pending, WANT_WRITE until the replies are sent
+    Timer timer;   // armed no later than the client's deadline
+} EventClient;
+
+static TimerWheel wheel;
+
+/**
+ * @brief What to watch a client for next.
+ */
+static int next_interest(const Client *client)
+{
+    if (client_pending(client) > 0)
+        return WANT_WRITE;
+    return client_waiting(client) ? WANT_NONE : WANT_READ;
+}
+
+/**
+ * @brief Sends as much of the queued output as the socket takes.
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int flush_replies(Client *client)
+{
+    while (client_pending(client) > 0)
+    {
+        struct iovec iov[MAX_OUT_IOV];
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = client_out_iov(client, iov, MAX_OUT_IOV)};
+        ssize_t bytes = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+        if (bytes < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        client_sent(client, bytes);
+    }
+    return 0;
+}
+
+/**
+ * @brief Keeps a client's timer no later than its deadline. A deadline that moved
+ * later leaves the timer alone and is checked when the timer fires, so a busy client
+ * does not move its timer on every request.
+ */
+static void schedule(EventClient *ec)
+{
+    int64_t deadline = client_deadline(&ec->client);
+
+    if (deadline < 0)
+        timer_cancel(&wheel, &ec->timer);
+    else if (!timer_armed(&ec->timer) || deadline < ec->timer.when)
+        timer_arm(&wheel, &ec->timer, deadline);
+}
+
+/**
+ * @brief Returns a client whose deadline has passed, after sending what the socket
+ * takes of the reply telling it why. Clients whose timer fired before their
+ * deadline get it armed again.
+ * @param now The current time, from clock_ms().
+ * @return The client, to drop; NULL if there is none.
+ */
+static EventClient *next_expired(int64_t now)
+{
+    Timer *timer;
+
+    while ((timer = wheel_expire(&wheel, now)) != NULL)
+    {
+        EventClient *ec = (EventClient *)((char *)timer - offsetof(EventClient, timer));
+        int64_t deadline = client_deadline(&ec->client);
+        if (deadline >= 0 && deadline <= now)
+        {
+            client_expired(&ec->client);
+            flush_replies(&ec->client);
+            return ec;
+        }
+        if (deadline >= 0)
+            timer_arm(&wheel, timer, deadline);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Closes a client and frees it.
+ */
+static void drop_client(EventClient *ec)
+{
+    timer_cancel(&wheel, &ec->timer);
+    client_release(&ec->client);
+    free(ec);
+}
+
+/**
+ * @brief Accepts a pending connection as a non-blocking socket and sets up its client.
+ * @param listen_sock The non-blocking listening socket.
+ * @param ec Set to the new client.
+ * @return 1 if a client was accepted, 0 if none is pending, -1 on error.
+ */
+static int accept_client(int listen_sock, EventClient **ec)
+{
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+
+    int fd = accept4(listen_sock, (struct sockaddr *)&peer, &len, SOCK_NONBLOCK);
+    if (fd < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR)
+            return 0;
+        perror("accept() error");
+        return -1;
+    }
+
+    *ec = calloc(1, sizeof(EventClient));
+    if (*ec == NULL || client_init(&(*ec)->client, fd, &peer) < 0)
+    {
+        perror("malloc() error");
+        free(*ec);
+        close(fd);
+        return 0;
+    }
+    if (flush_replies(&(*ec)->client) < 0) // the greeting
+    {
+        drop_client(*ec);
+        return 0;
+    }
+    (*ec)->interest = next_interest(&(*ec)->client);
+    return 1;
+}
+
+/**
+ * @brief Handles readiness of a client: sends pending replies, or receives once and
+ * answers the complete lines. A client with unsent replies is not read from, so one
+ * that never reads cannot make the server queue without bound, nor is one waiting for
+ * a stored POST.
+ * @return The interest to watch next, -1 if the connection must be closed.
+ */
+static int serve_ready(EventClient *ec)
+{
+    Client *client = &ec->client;
+
+    if (client_pending(client) == 0 && !client_waiting(client))
+    {
+        size_t space;
+        char *buf = client_recv_space(client, &space);
+        ssize_t bytes = recv(client->fd, buf, space, 0);
+        if (bytes == 0)
+            return -1;
+        if (bytes < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? WANT_READ : -1;
+        client_received(client, bytes);
+    }
+    if (flush_replies(client) < 0)
+        return -1;
+    return next_interest(client);
+}
+
+/**
+ * @brief Makes POSTs to the message store wait without blocking the engine: a
+ * background thread syncs the log and signals an eventfd the engine watches.
+ * @param commit_fd Set to the eventfd, -1 when the store is off.
+ * @return 0 on success, -1 on error.
+ */
+static int start_commits(int *commit_fd)
+{
+    *commit_fd = -1;
+    if (!log_enabled())
+        return 0;
+    *commit_fd = eventfd(0, EFD_NONBLOCK);
+    if (*commit_fd < 0)
+    {
+        perror("eventfd() error");
+        return -1;
+    }
+    protocol_defer_commits();
+    return log_start_flusher(*commit_fd);
+}
+
+/**
+ * @brief Resets the eventfd after a sync, before collecting the clients it covered.
+ */
+static void drain_commits(int commit_fd)
+{
+    uint64_t count;
+    if (read(commit_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read() error");
+}
+
+/**
+ * @brief Makes the listening socket non-blocking, so accepting stops when no
+ * connection is pending.
+ * @return 0 on success, -1 on error.
+ */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("fcntl() error");
+        return -1;
+    }
+    return 0;
+}
+
+static EventClient *by_fd[FD_SETSIZE]; // select engine's clients, indexed by socket
+static fd_set read_set, write_set;     // descriptors the select engine watches
+
+/**
+ * @brief Updates what select() watches for a client.
+ */
+static void select_watch(EventClient *ec, int interest)
+{
+    int fd = ec->client.fd;
+    ec->interest = interest;
+    if (interest == WANT_READ)
+        FD_SET(fd, &read_set);
+    else
+        FD_CLR(fd, &read_set);
+    if (interest == WANT_WRITE)
+        FD_SET(fd, &write_set);
+    else
+        FD_CLR(fd, &write_set);
+}
+
+/**
+ * @brief Applies the outcome of serving a select client: drops it or updates what
+ * is watched.
+ */
+static void select_update(EventClient *ec, int interest)
+{
+    if (interest < 0)
+    {
+        int fd = ec->client.fd;
+        FD_CLR(fd, &read_set);
+        FD_CLR(fd, &write_set);
+        by_fd[fd] = NULL;
+        drop_client(ec);
+    }
+    else
+    {
+        if (interest != ec->interest)
+            select_watch(ec, interest);
+        schedule(ec);
+    }
+}
+
+/**
+ * @brief Serves every connection from one thread with select(), limited to FD_SETSIZE descriptors.
+ */
+int run_select(int listen_sock, int workers)
+{
+    int maxfd = listen_sock, commit_fd;
+    EventClient *expired;
+
+    if (set_nonblocking(listen_sock) < 0 || start_commits(&commit_fd) < 0 || protocol_enable_pubsub() < 0)
+        return -1;
+    wheel_init(&wheel, clock_ms());
+    FD_ZERO(&read_set);
+    FD_ZERO(&write_set);
+    FD_SET(listen_sock, &read_set);
+    if (commit_fd >= 0)
+    {
+        FD_SET(commit_fd, &read_set);
+        if (commit_fd > maxfd)
+            maxfd = commit_fd;
+    }
+
+    while (1)
+    {
+        fd_set readfds = read_set, writefds = write_set;
+        int timeout = wheel_timeout(&wheel, clock_ms());
+        struct timeval tv = {timeout / 1000, timeout % 1000 * 1000};
+        int nready = select(maxfd + 1, &readfds, &writefds, NULL, timeout < 0 ? NULL : &tv);
+        if (nready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("select() error");
+            return -1;
+        }
+
+        if (FD_ISSET(listen_sock, &readfds))
+        {
+            EventClient *ec;
+            for (int i = 0; i < ACCEPT_BATCH && accept_client(listen_sock, &ec) > 0; i++)
+            {
+                int fd = ec->client.fd;
+                if (fd >= FD_SETSIZE)
+                {
+                    printf("Too many clients\n");
+                    drop_client(ec);
+                    continue;
+                }
+                by_fd[fd] = ec;
+                select_watch(ec, ec->interest);
+                schedule(ec);
+                if (fd > maxfd)
+                    maxfd = fd;
+            }
+            nready--;
+        }
+
+        if (commit_fd >= 0 && FD_ISSET(commit_fd, &readfds))
+        {
+            Client *client;
+            drain_commits(commit_fd);
+            while ((client = client_next_committed()) != NULL)
+                select_update((EventClient *)client, flush_replies(client) < 0 ? -1 : next_interest(client));
+            nready--;
+        }
+
+        for (int fd = 0; fd <= maxfd && nready > 0; fd++)
+        {
+            EventClient *ec = by_fd[fd];
+            if (ec == NULL || !(FD_ISSET(fd, &readfds) || FD_ISSET(fd, &writefds)))
+                continue;
+            nready--;
+            select_update(ec, serve_ready(ec));
+        }
+
+        Client *client;
+        while ((client = client_next_woken()) != NULL)
+            select_update((EventClient *)client, flush_replies(client) < 0 ? -1 : next_interest(client));
+        while ((expired = next_expired(clock_ms())) != NULL)
+            select_update(expired, -1);
+    }
+}
+
+static EventClient commit_marker; // epoll data of the commit eventfd
+
+/**
+ * @brief Watches a client with epoll. A client with nothing to watch stays in the
+ * set as one-shot, so a hang-up is reported at most once while it waits.
+ * @return 0 on success, -1 on error.
+ */
+static int epoll_watch(int epfd, int op, EventClient *ec, int interest)
+{
+    struct epoll_event ev;
+
+    ec->interest = interest;
+    ev.events = interest == WANT_READ ? EPOLLIN : interest == WANT_WRITE ? EPOLLOUT : EPOLLONESHOT;
+    ev.data.ptr = ec;
+    if (epoll_ctl(epfd, op, ec->client.fd, &ev) < 0)
+    {
+        perror("epoll_ctl() error");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Applies the outcome of serving an epoll client: drops it or updates what
+ * is watched.
+ */
+static void epoll_update(int epfd, EventClient *ec, int interest)
+{
+    if (interest < 0)
+        drop_client(ec); // closing the socket removes it from the epoll set
+    else if (interest != ec->interest && epoll_watch(epfd, EPOLL_CTL_MOD, ec, interest) < 0)
+        drop_client(ec);
+    else
+        schedule(ec);
+}
+
+/**
+ * @brief Serves every connection from one thread with level-triggered epoll.
+ */
+int run_epoll(int listen_sock, int workers)
+{
+    struct epoll_event ev, events[MAX_EVENTS];
+    int commit_fd;
+    EventClient *expired;
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("epoll_create1() error");
+        return -1;
+    }
+    if (set_nonblocking(listen_sock) < 0 || start_commits(&commit_fd) < 0 || protocol_enable_pubsub() < 0)
+        return -1;
+    wheel_init(&wheel, clock_ms());
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listening socket
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listen_sock, &ev);
+    if (commit_fd >= 0)
+    {
+        ev.data.ptr = &commit_marker;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, commit_fd, &ev);
+    }
+
+    while (1)
+    {
+        bool committed = false;
+        int nready = epoll_wait(epfd, events, MAX_EVENTS, wheel_timeout(&wheel, clock_ms()));
+        if (nready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait() error");
+            return -1;
+        }
+
+        for (int i = 0; i < nready; i++)
+        {
+            EventClient *ec = events[i].data.ptr;
+            if (ec == NULL)
+            {
+                for (int k = 0; k < ACCEPT_BATCH && accept_client(listen_sock, &ec) > 0; k++)
+                {
+                    if (epoll_watch(epfd, EPOLL_CTL_ADD, ec, ec->interest) < 0)
+                        drop_client(ec);
+                    else
+                        schedule(ec);
+                }
+                continue;
+            }
+            if (ec == &commit_marker)
+            {
+                committed = true;
+                continue;
+            }
+
+            epoll_update(epfd, ec, serve_ready(ec));
+        }
+
+        // after the events, as answering may drop clients that still have one pending
+        Client *client;
+        if (committed)
+        {
+            drain_commits(commit_fd);
+            while ((client = client_next_committed()) != NULL)
+                epoll_update(epfd, (EventClient *)client, flush_replies(client) < 0 ? -1 : next_interest(client));
+        }
+        while ((client = client_next_woken()) != NULL)
+            epoll_update(epfd, (EventClient *)client, flush_replies(client) < 0 ? -1 : next_interest(client));
+        while ((expired = next_expired(clock_ms())) != NULL)
+            drop_client(expired);
+    }
+}
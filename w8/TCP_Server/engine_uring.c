@@ -0,0 +1,397 @@
+/* Engine driving every connection from one thread through io_uring. liburing is not
+ * a dependency: the rings are set up and used with the raw system calls. */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "msglog.h"
+#include "timerwheel.h"
+
+#define RING_ENTRIES 4096
+
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_COMMIT 3 /* read of the eventfd signalled after each sync of the message log */
+#define OP_MASK 3 /* the operation is kept in the low bits of user_data, next to the Client pointer */
+
+typedef struct
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit; // queued entries the kernel has not seen yet
+    bool timed_wait;    // the kernel takes a timeout when waiting for completions
+} Ring;
+
+typedef struct
+{
+    Client client;       // first, so the Client pointer in user_data is its UringClient
+    struct msghdr msg;   // of the send in flight
+    struct iovec iov[MAX_OUT_IOV];
+    bool receiving;      // a receive is in flight
+    bool sending;        // a send is in flight
+    bool closing;        // dropped; freed once nothing is in flight
+    Timer timer;         // armed no later than the client's deadline
+} UringClient;
+
+static Ring ring;
+static int listen_fd;
+static struct sockaddr_in accept_addr; // one accept is in flight at a time
+static socklen_t accept_len;
+static int commit_fd = -1;
+static uint64_t commit_count; // one read of commit_fd is in flight at a time
+static TimerWheel wheel;
+
+/**
+ * @brief Creates the ring and maps its submission and completion queues.
+ * @return 0 on success, -1 on error.
+ */
+static int ring_setup(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ring.fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring.fd < 0)
+    {
+        perror("io_uring_setup() error");
+        return -1;
+    }
+    ring.entries = p.sq_entries;
+    ring.timed_wait = p.features & IORING_FEAT_EXT_ARG;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    char *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring.sqes == MAP_FAILED)
+    {
+        perror("mmap() error");
+        return -1;
+    }
+
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+/**
+ * @brief Hands the queued entries to the kernel, optionally waiting for a completion.
+ * @param wait Completions to wait for.
+ * @param timeout Longest wait in ms, -1 for none. Kernels older than 5.11 wait
+ * without a timeout.
+ * @return 0 on success, -1 on error.
+ */
+static int ring_enter(unsigned wait, int timeout)
+{
+    struct __kernel_timespec ts = {timeout / 1000, timeout % 1000 * 1000000L};
+    struct io_uring_getevents_arg arg = {.ts = (uintptr_t)&ts};
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    if (wait && timeout >= 0 && ring.timed_wait)
+    {
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+    int ret = syscall(__NR_io_uring_enter, ring.fd, ring.to_submit, wait, flags, argp, argsz);
+    if (ret < 0)
+    {
+        if (errno == EINTR || errno == ETIME)
+            return 0;
+        perror("io_uring_enter() error");
+        return -1;
+    }
+    ring.to_submit -= ret;
+    return 0;
+}
+
+/**
+ * @brief Queues a submission entry, submitting what is queued first if the ring is full.
+ * @param op OP_ACCEPT, OP_RECV, OP_SEND or OP_COMMIT.
+ * @param client The client the operation is for, NULL for accept and commit.
+ * @param opcode The io_uring operation.
+ * @param fd The socket.
+ * @param buf The buffer, the address for accept or the message header for sendmsg.
+ * @param len The buffer length.
+ */
+static void ring_queue(int op, Client *client, int opcode, int fd, void *buf, unsigned len)
+{
+    unsigned tail = *ring.sq_tail;
+    while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.entries)
+    {
+        if (ring_enter(0, -1) < 0)
+            return;
+    }
+
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = (uintptr_t)client | op;
+    if (opcode == IORING_OP_ACCEPT)
+        sqe->addr2 = (uintptr_t)&accept_len;
+    else if (opcode == IORING_OP_SENDMSG)
+        sqe->msg_flags = MSG_NOSIGNAL;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.to_submit++;
+}
+
+/**
+ * @brief Queues the accept of the next connection.
+ */
+static void queue_accept()
+{
+    accept_len = sizeof(accept_addr);
+    ring_queue(OP_ACCEPT, NULL, IORING_OP_ACCEPT, listen_fd, &accept_addr, 0);
+}
+
+/**
+ * @brief Queues the wait for the next sync of the message log.
+ */
+static void queue_commit()
+{
+    ring_queue(OP_COMMIT, NULL, IORING_OP_READ, commit_fd, &commit_count, sizeof(commit_count));
+}
+
+/**
+ * @brief Keeps a client's timer no later than its deadline. A deadline that moved
+ * later leaves the timer alone and is checked when the timer fires.
+ */
+static void schedule(UringClient *uc)
+{
+    int64_t deadline = client_deadline(&uc->client);
+
+    if (deadline < 0)
+        timer_cancel(&wheel, &uc->timer);
+    else if (!timer_armed(&uc->timer) || deadline < uc->timer.when)
+        timer_arm(&wheel, &uc->timer, deadline);
+}
+
+/**
+ * @brief Queues the next operations of a client: sending its pending output, and
+ * receiving its next request once everything is sent. A client waiting for a
+ * stored POST is not received from; it is resumed by the next OP_COMMIT. A
+ * subscriber idle in a receive may also get a send queued for a broadcast.
+ */
+static void queue_next(Client *client)
+{
+    UringClient *uc = (UringClient *)client;
+
+    if (uc->closing)
+        return;
+    if (client_pending(client) > 0 && !uc->sending)
+    {
+        memset(&uc->msg, 0, sizeof(uc->msg));
+        uc->msg.msg_iov = uc->iov;
+        uc->msg.msg_iovlen = client_out_iov(client, uc->iov, MAX_OUT_IOV);
+        ring_queue(OP_SEND, client, IORING_OP_SENDMSG, client->fd, &uc->msg, 1);
+        uc->sending = true;
+        client->out_pinned = true;
+    }
+    else if (client_pending(client) == 0 && !client_waiting(client) && !uc->receiving)
+    {
+        size_t space;
+        char *buf = client_recv_space(client, &space);
+        ring_queue(OP_RECV, client, IORING_OP_RECV, client->fd, buf, space);
+        uc->receiving = true;
+    }
+    schedule(uc); // after client_recv_space(), which may make the client due at once
+}
+
+/**
+ * @brief Closes a client and frees it. With an operation still in flight, the
+ * socket is shut down so it completes, and the last completion frees the client.
+ */
+static void drop_client(Client *client)
+{
+    UringClient *uc = (UringClient *)client;
+
+    uc->closing = true;
+    timer_cancel(&wheel, &uc->timer);
+    if (uc->receiving || uc->sending)
+    {
+        shutdown(client->fd, SHUT_RDWR);
+        return;
+    }
+    client_release(client);
+    free(client);
+}
+
+/**
+ * @brief Drops the clients whose deadline has passed, after sending what the socket
+ * takes of the reply telling them why; not for one with a send in flight, whose
+ * output would be sent twice. Those whose timer fired before their deadline get it
+ * armed again.
+ */
+static void drop_expired()
+{
+    int64_t now = clock_ms();
+    Timer *timer;
+
+    while ((timer = wheel_expire(&wheel, now)) != NULL)
+    {
+        UringClient *uc = (UringClient *)((char *)timer - offsetof(UringClient, timer));
+        int64_t deadline = client_deadline(&uc->client);
+        if (deadline >= 0 && deadline <= now)
+        {
+            if (!uc->sending)
+            {
+                client_expired(&uc->client);
+                uc->msg.msg_iov = uc->iov;
+                uc->msg.msg_iovlen = client_out_iov(&uc->client, uc->iov, MAX_OUT_IOV);
+                sendmsg(uc->client.fd, &uc->msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+            drop_client(&uc->client);
+        }
+        else if (deadline >= 0)
+            timer_arm(&wheel, timer, deadline);
+    }
+}
+
+/**
+ * @brief Handles one completion.
+ */
+static void handle_completion(struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & OP_MASK;
+    Client *client = (Client *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+
+    switch (op)
+    {
+    case OP_ACCEPT:
+        if (cqe->res >= 0)
+        {
+            client = calloc(1, sizeof(UringClient));
+            if (client == NULL || client_init(client, cqe->res, &accept_addr) < 0)
+            {
+                perror("malloc() error");
+                free(client);
+                close(cqe->res);
+            }
+            else
+            {
+                queue_next(client); // the greeting
+            }
+        }
+        else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+        {
+            fprintf(stderr, "accept() error: %s\n", strerror(-cqe->res));
+        }
+        queue_accept();
+        break;
+
+    case OP_RECV:
+        ((UringClient *)client)->receiving = false;
+        if (cqe->res <= 0 || ((UringClient *)client)->closing)
+        {
+            drop_client(client);
+            break;
+        }
+        client_received(client, cqe->res);
+        queue_next(client);
+        break;
+
+    case OP_SEND:
+        ((UringClient *)client)->sending = false;
+        client->out_pinned = false;
+        if (cqe->res < 0 || ((UringClient *)client)->closing)
+        {
+            drop_client(client);
+            break;
+        }
+        client_sent(client, cqe->res);
+        queue_next(client);
+        break;
+
+    case OP_COMMIT:
+        while ((client = client_next_committed()) != NULL)
+            queue_next(client);
+        queue_commit();
+        break;
+    }
+}
+
+/**
+ * @brief Serves every connection from one thread with io_uring: each client has a
+ * receive or a send in flight, and a subscriber may have both.
+ */
+int run_uring(int listen_sock, int workers)
+{
+    listen_fd = listen_sock;
+    if (ring_setup(RING_ENTRIES) < 0)
+    {
+        fprintf(stderr, "io_uring is not available, choose another engine\n");
+        return -1;
+    }
+    if (log_enabled())
+    {
+        if ((commit_fd = eventfd(0, 0)) < 0)
+        {
+            perror("eventfd() error");
+            return -1;
+        }
+        protocol_defer_commits();
+        if (log_start_flusher(commit_fd) < 0)
+            return -1;
+        queue_commit();
+    }
+    if (protocol_enable_pubsub() < 0)
+        return -1;
+
+    wheel_init(&wheel, clock_ms());
+    queue_accept();
+    while (1)
+    {
+        if (ring_enter(1, wheel_timeout(&wheel, clock_ms())) < 0)
+            return -1;
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            handle_completion(&ring.cqes[head & *ring.cq_mask]);
+            head++;
+            // the entry is consumed, let the kernel reuse its slot while the rest are handled
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        Client *client;
+        while ((client = client_next_woken()) != NULL)
+            queue_next(client);
+        drop_expired();
+    }
+}
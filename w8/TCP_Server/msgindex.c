@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "msgindex.h"
+#include "account.h"
+
+/* Per-user index over the message log: the tickets of each account's records, in
+ * the order they were posted, which is also timestamp order. It is built from the
+ * log when the server starts and then grows as tickets are handed out, in shared
+ * memory like the location table, so the processes of the fork engines share one
+ * index instead of each scanning the log. A query is a binary search plus the
+ * records it returns.
+ *
+ * An account's tickets sit in chunks of MIN_TICKETS, then twice as many, and so on,
+ * carved from one shared arena and never moved, so readers need no lock: a ticket
+ * is stored before the count that covers it. Tickets are appended under the log's
+ * lock, but a ticket is only returned once its record is durable. */
+
+#define MIN_TICKETS 8
+#define MAX_CHUNKS 25 /* MIN_TICKETS << 25 - MIN_TICKETS tickets, more than MAX_RECORDS */
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t *chunks[MAX_CHUNKS]; // chunk k holds MIN_TICKETS << k tickets
+} UserIndex;
+
+typedef struct
+{
+    size_t arena_used; // tickets' worth of the arena handed out to chunks
+    UserIndex users[]; // by account index
+} IndexState;
+
+static IndexState *index_state = NULL;
+static uint64_t *arena = NULL;
+static size_t arena_size = 0; // in tickets
+
+/**
+ * @brief Finds the chunk of the i-th ticket of an account.
+ * @param i Position of the ticket.
+ * @param at Set to its position in the chunk.
+ * @return The chunk number.
+ */
+static inline int chunk_of(uint64_t i, uint64_t *at)
+{
+    int chunk = 63 - __builtin_clzll(i / MIN_TICKETS + 1);
+    *at = i - MIN_TICKETS * ((1ull << chunk) - 1);
+    return chunk;
+}
+
+/**
+ * @brief Returns the i-th ticket of an account, i below its count.
+ */
+static inline uint64_t ticket_at(const UserIndex *user, uint64_t i)
+{
+    uint64_t at;
+    int chunk = chunk_of(i, &at);
+    return user->chunks[chunk][at];
+}
+
+/**
+ * @brief Adds a ticket to an account's index. Called under the log's lock, in ticket
+ * order, so an account's tickets stay sorted.
+ * @param account_index The account's index in accounts[], -1 when it has none.
+ * @param ticket The ticket of the account's latest record.
+ */
+void index_add(int account_index, uint64_t ticket)
+{
+    if (index_state == NULL || account_index < 0 || account_index >= account_number)
+        return;
+    UserIndex *user = &index_state->users[account_index];
+    uint64_t at;
+    int chunk = chunk_of(user->count, &at);
+    if (chunk >= MAX_CHUNKS)
+        return; // more than MAX_RECORDS tickets, which the log never hands out
+    if (user->chunks[chunk] == NULL)
+    {
+        size_t size = (size_t)MIN_TICKETS << chunk;
+        if (index_state->arena_used + size > arena_size)
+        {
+            fprintf(stderr, "Message index full, ticket %lu is not indexed\n", (unsigned long)ticket);
+            return;
+        }
+        user->chunks[chunk] = arena + index_state->arena_used;
+        index_state->arena_used += size;
+    }
+    user->chunks[chunk][at] = ticket;
+    __atomic_store_n(&user->count, user->count + 1, __ATOMIC_RELEASE); // index_find() readers do not lock
+}
+
+/**
+ * @brief Sets up the index in shared memory and adds the records already in the log.
+ * Called after log_open(), before the engine starts serving.
+ * @return 0 on success, -1 on error.
+ */
+int index_open()
+{
+    size_t state_size = sizeof(IndexState) + account_number * sizeof(UserIndex);
+
+    index_state = mmap(NULL, state_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (index_state == MAP_FAILED)
+    {
+        perror("mmap() error");
+        index_state = NULL;
+        return -1;
+    }
+    // a chunk is at most twice the tickets it holds, plus the first chunk of each account
+    arena_size = 2 * MAX_RECORDS + (size_t)MIN_TICKETS * account_number;
+    arena = mmap(NULL, arena_size * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED)
+    {
+        perror("mmap() error");
+        munmap(index_state, state_size);
+        index_state = NULL;
+        arena = NULL;
+        return -1;
+    }
+
+    uint64_t durable = log_durable();
+    for (uint64_t ticket = 1; ticket <= durable; ticket++)
+    {
+        const RecordHeader *record = log_record(ticket);
+        if (record == NULL)
+            return -1;
+        index_add(find_account(RECORD_USER(record), record->user_len), ticket); // skipped if the account was removed since
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the oldest messages of an account posted after a timestamp.
+ * @param account_index The account's index in accounts[].
+ * @param since Timestamp in ns; only later messages are returned.
+ * @param records Filled with the records, oldest first. They stay mapped.
+ * @param max Size of records.
+ * @return Number of records found, -1 on error.
+ */
+int index_find(int account_index, int64_t since, const RecordHeader **records, int max)
+{
+    if (index_state == NULL)
+        return -1;
+    const UserIndex *user = &index_state->users[account_index];
+    uint64_t durable = log_durable();
+    uint64_t high = __atomic_load_n(&user->count, __ATOMIC_ACQUIRE);
+
+    // the tickets still being synced are the last ones
+    while (high > 0 && ticket_at(user, high - 1) > durable)
+        high--;
+    uint64_t low = 0, end = high;
+    while (low < high)
+    {
+        uint64_t mid = low + (high - low) / 2;
+        const RecordHeader *record = log_record(ticket_at(user, mid));
+        if (record != NULL && record->timestamp <= since)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    int count;
+    for (count = 0; count < max && low + count < end; count++)
+    {
+        if ((records[count] = log_record(ticket_at(user, low + count))) == NULL)
+            break;
+    }
+    return count;
+}
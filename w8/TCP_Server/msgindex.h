@@ -0,0 +1,12 @@
+#ifndef MSGINDEX_H
+#define MSGINDEX_H
+
+#include <stdint.h>
+
+#include "msglog.h"
+
+int index_open();
+void index_add(int account_index, uint64_t ticket);
+int index_find(int account_index, int64_t since, const RecordHeader **records, int max);
+
+#endif // MSGINDEX_H
@@ -0,0 +1,718 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "msglog.h"
+#include "crc32c.h"
+#include "msgindex.h"
+
+/* Append-only message log split into numbered segment files. Appenders reserve
+ * their bytes under a lock and write outside it, then take a ticket. Durability
+ * is group-committed: the first waiter whose ticket is not durable becomes the
+ * leader, syncs every segment written since the last sync and marks all tickets
+ * handed out before it started as durable; posters arriving meanwhile are covered
+ * by the next sync. The state lives in shared memory with process-shared locks, so
+ * the processes of the fork engines commit together just like threads.
+ *
+ * Readers find a record from its ticket through a shared table of locations, and
+ * see the segments through read-only mappings. The table is rebuilt from the
+ * segments when the log is opened.
+ *
+ * A record is written while its bytes are reserved, so one written and synced
+ * later never sits behind a hole that would end the scan. A streamed record only
+ * has its header and username written then, flagged RECORD_INCOMPLETE, and its
+ * body as it arrives; the flag is cleared once the last byte is in. A checksum
+ * lets the scan skip a record torn by a crash. A record larger than a segment
+ * gets a segment of its own.
+ *
+ * A failed sync is not retried: the kernel reports a writeback error once, so the
+ * next fdatasync() would succeed without the lost pages. Every ticket not durable
+ * by then fails, and the log takes no more records. */
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t synced;
+    pthread_cond_t appended; // wakes the flusher thread of the event engines
+    uint32_t segment;      // segment being appended to
+    uint64_t offset;       // its next free byte
+    uint64_t reserved;     // records with bytes reserved, written or not
+    int64_t last_timestamp;
+    uint32_t oldest_dirty; // first segment that may hold unsynced records
+    uint64_t requested;    // tickets handed out, one per written record
+    uint64_t durable;      // tickets whose records are synced
+    bool syncing;          // a leader is syncing
+    bool failed;           // a sync failed: no more records are taken or synced
+} LogState;
+
+#define MAX_OPEN_SEGMENTS 64 /* per process; a segment in use by an appender or a sync stays open */
+#define STREAM_WRITEBACK (8 * 1024 * 1024) /* streamed bytes after which their writeback is started */
+
+typedef struct
+{
+    const char *data; // NULL until mapped
+    size_t size;
+} Mapping;
+
+typedef struct
+{
+    uint32_t segment;
+    int fd;   // -1 when the slot is unused
+    int refs; // appenders and syncs using the descriptor
+} OpenSegment;
+
+static LogState *state = NULL;
+static char log_dir[512];
+static bool group_commit_enabled = true;
+static OpenSegment open_segments[MAX_OPEN_SEGMENTS];
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int notify = -1; // eventfd written after each sync, for the event engines
+static uint64_t *locations = NULL; // by ticket: segment << 32 | offset, shared
+static Mapping *mappings = NULL; // per process, by segment
+static size_t mapping_count = 0;
+static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Builds the path of a segment file.
+ */
+static void segment_path(uint32_t segment, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%08u.log", log_dir, segment);
+}
+
+/**
+ * @brief Returns a descriptor of a segment, opening (and creating) the file when this
+ * process has it closed. The descriptor stays open until segment_release().
+ * @return The descriptor, -1 on error.
+ */
+static int segment_acquire(uint32_t segment)
+{
+    char path[600];
+    int free_slot = -1;
+
+    pthread_mutex_lock(&open_mutex);
+    for (int i = 0; i < MAX_OPEN_SEGMENTS; i++)
+    {
+        OpenSegment *open_segment = &open_segments[i];
+        if (open_segment->fd >= 0 && open_segment->segment == segment)
+        {
+            open_segment->refs++;
+            pthread_mutex_unlock(&open_mutex);
+            return open_segment->fd;
+        }
+        // reuse an unused slot, else the oldest segment nobody is using
+        if (open_segment->fd < 0)
+        {
+            if (free_slot < 0 || open_segments[free_slot].fd >= 0)
+                free_slot = i;
+        }
+        else if (open_segment->refs == 0 && (free_slot < 0 || (open_segments[free_slot].fd >= 0 && open_segment->segment < open_segments[free_slot].segment)))
+        {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0)
+    {
+        fprintf(stderr, "Too many message log segments in use\n");
+        pthread_mutex_unlock(&open_mutex);
+        return -1;
+    }
+
+    segment_path(segment, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        perror("open() error");
+        pthread_mutex_unlock(&open_mutex);
+        return -1;
+    }
+    if (open_segments[free_slot].fd >= 0)
+        close(open_segments[free_slot].fd);
+    open_segments[free_slot].segment = segment;
+    open_segments[free_slot].fd = fd;
+    open_segments[free_slot].refs = 1;
+    pthread_mutex_unlock(&open_mutex);
+    return fd;
+}
+
+/**
+ * @brief Gives back a descriptor from segment_acquire().
+ */
+static void segment_release(uint32_t segment)
+{
+    pthread_mutex_lock(&open_mutex);
+    for (int i = 0; i < MAX_OPEN_SEGMENTS; i++)
+    {
+        if (open_segments[i].fd >= 0 && open_segments[i].segment == segment)
+        {
+            open_segments[i].refs--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&open_mutex);
+}
+
+/**
+ * @brief Returns a read-only mapping of a segment covering at least its first bytes,
+ * mapping it the first time. A segment is mapped SEGMENT_SIZE long, or longer when
+ * its only record is; a mapping found too short is replaced and the old one kept,
+ * as records in it may still be queued for sending. Bytes past the end of the file
+ * must not be touched.
+ * @param segment The segment.
+ * @param need Bytes from its start that must be mapped.
+ * @return The mapping, NULL if the segment does not exist or on error.
+ */
+static const char *segment_map(uint32_t segment, uint64_t need)
+{
+    char path[600];
+    const char *map = NULL;
+    struct stat st;
+
+    pthread_mutex_lock(&map_mutex);
+    if (segment < mapping_count && mappings[segment].data != NULL && mappings[segment].size >= need)
+    {
+        map = mappings[segment].data;
+        pthread_mutex_unlock(&map_mutex);
+        return map;
+    }
+    if (segment >= mapping_count)
+    {
+        size_t count = mapping_count ? mapping_count : 16;
+        while (count <= segment)
+            count *= 2;
+        Mapping *bigger = realloc(mappings, count * sizeof(Mapping));
+        if (bigger == NULL)
+        {
+            perror("realloc() error");
+            pthread_mutex_unlock(&map_mutex);
+            return NULL;
+        }
+        memset(bigger + mapping_count, 0, (count - mapping_count) * sizeof(Mapping));
+        mappings = bigger;
+        mapping_count = count;
+    }
+
+    segment_path(segment, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0 && fstat(fd, &st) == 0)
+    {
+        size_t size = st.st_size > SEGMENT_SIZE ? (size_t)st.st_size : SEGMENT_SIZE;
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("mmap() error");
+            map = NULL;
+        }
+        else
+        {
+            mappings[segment].data = map;
+            mappings[segment].size = size;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    pthread_mutex_unlock(&map_mutex);
+    return map;
+}
+
+/**
+ * @brief Completes the checksum of a record, once its username and body are summed,
+ * with the header fields before the checksum, the flags as they are once the
+ * record is complete.
+ */
+static uint32_t checksum_end(uint32_t checksum, const RecordHeader *header)
+{
+    RecordHeader fields = *header;
+    fields.flags = 0;
+    return crc32c(checksum, &fields, offsetof(RecordHeader, checksum));
+}
+
+/**
+ * @brief Walks the existing segments to rebuild the location table, so appending
+ * resumes after the last valid record. A record left incomplete or failing its
+ * checksum is skipped; a header that was never written, or a record running past
+ * the end of its file, ends the walk of its segment. The last segment is cut back
+ * to where appending resumes, so no stale bytes are left behind the new records.
+ */
+static void scan_log()
+{
+    char path[600];
+    struct stat st;
+    uint64_t ticket = 0;
+
+    state->segment = 0;
+    state->offset = 0;
+    for (uint32_t segment = 0;; segment++)
+    {
+        segment_path(segment, path, sizeof(path));
+        if (stat(path, &st) < 0)
+            break;
+        const char *map = segment_map(segment, st.st_size);
+        uint64_t offset = 0;
+        while (map != NULL && offset + sizeof(RecordHeader) <= (uint64_t)st.st_size && ticket < MAX_RECORDS)
+        {
+            const RecordHeader *header = (const RecordHeader *)(map + offset);
+            uint64_t size = sizeof(RecordHeader) + header->user_len + header->body_len;
+            if (header->user_len == 0 || offset + size > (uint64_t)st.st_size)
+                break;
+            uint32_t checksum = crc32c(crc32c(0, RECORD_USER(header), header->user_len), RECORD_BODY(header), header->body_len);
+            checksum = checksum_end(checksum, header);
+            if (!(header->flags & RECORD_INCOMPLETE) && checksum != header->checksum)
+                fprintf(stderr, "Skipping a damaged record in segment %u at %lu\n", segment, (unsigned long)offset);
+            else if (!(header->flags & RECORD_INCOMPLETE))
+            {
+                locations[++ticket] = (uint64_t)segment << 32 | offset;
+                if (header->timestamp > state->last_timestamp)
+                    state->last_timestamp = header->timestamp;
+            }
+            offset += size; // an incomplete record is a stream cut short, or a write that failed
+        }
+        state->segment = segment;
+        state->offset = offset;
+    }
+    state->reserved = state->requested = state->durable = ticket;
+
+    segment_path(state->segment, path, sizeof(path));
+    if (stat(path, &st) == 0 && (uint64_t)st.st_size > state->offset && truncate(path, state->offset) < 0)
+        perror("truncate() error");
+}
+
+/**
+ * @brief Opens the message log, creating its directory if needed.
+ * @param dir Directory of the segment files.
+ * @param group_commit true to share syncs between concurrent posters, false to sync
+ * every record on its own.
+ * @return 0 on success, -1 on error.
+ */
+int log_open(const char *dir, bool group_commit)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        perror("mkdir() error");
+        return -1;
+    }
+    snprintf(log_dir, sizeof(log_dir), "%s", dir);
+    group_commit_enabled = group_commit;
+    for (int i = 0; i < MAX_OPEN_SEGMENTS; i++)
+        open_segments[i].fd = -1;
+
+    state = mmap(NULL, sizeof(LogState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED)
+    {
+        perror("mmap() error");
+        state = NULL;
+        return -1;
+    }
+    locations = mmap(NULL, (MAX_RECORDS + 1) * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (locations == MAP_FAILED)
+    {
+        perror("mmap() error");
+        state = NULL;
+        return -1;
+    }
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&state->mutex, &mattr);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&state->synced, &cattr);
+    pthread_cond_init(&state->appended, &cattr);
+
+    scan_log();
+    state->oldest_dirty = state->segment;
+    printf("Message log %s: %lu records, appending to segment %u at %lu\n", dir, (unsigned long)state->durable,
+           state->segment, (unsigned long)state->offset);
+    return 0;
+}
+
+/**
+ * @brief Whether POSTs are stored.
+ */
+bool log_enabled()
+{
+    return state != NULL;
+}
+
+/**
+ * @brief Stops the log after a failed sync. Called with the mutex held.
+ */
+static void fail_log()
+{
+    if (!state->failed)
+        fprintf(stderr, "Message log %s: a sync failed, no more POSTs are stored\n", log_dir);
+    __atomic_store_n(&state->failed, true, __ATOMIC_RELEASE); // log_failed() readers do not lock
+}
+
+/**
+ * @brief Syncs every segment that may hold records of tickets handed out so far, as
+ * the leader of a group commit. Called and returns with the mutex held.
+ * @return 0 on success, -1 on error, after which the log is failed.
+ */
+static int sync_as_leader()
+{
+    uint64_t target = state->requested;
+    uint32_t from = state->oldest_dirty, to = state->segment;
+    int ret = 0;
+
+    state->syncing = true;
+    state->oldest_dirty = to;
+    pthread_mutex_unlock(&state->mutex);
+
+    for (uint32_t segment = from; segment <= to; segment++)
+    {
+        int fd = segment_acquire(segment);
+        if (fd < 0 || fdatasync(fd) < 0)
+        {
+            perror("fdatasync() error");
+            ret = -1;
+        }
+        if (fd >= 0)
+            segment_release(segment);
+    }
+
+    pthread_mutex_lock(&state->mutex);
+    state->syncing = false;
+    if (ret < 0)
+        fail_log();
+    else if (target > state->durable)
+        __atomic_store_n(&state->durable, target, __ATOMIC_RELEASE); // log_durable() readers do not lock
+    pthread_cond_broadcast(&state->synced);
+    return ret;
+}
+
+/**
+ * @brief Reserves the bytes of a record and writes it before the lock is released:
+ * whole when its body is given, else its header and username flagged
+ * RECORD_INCOMPLETE. A record reserved earlier is then always in the page cache
+ * ahead of a later one, so the sync that makes a record durable also covers every
+ * record before it. A record never spans two segments.
+ * @param header The header, with the lengths set; the rest is filled in.
+ * @param user The poster's username.
+ * @param body The message, NULL for a streamed record.
+ * @param checksum Checksum of the username and the body.
+ * @param segment Set to the record's segment.
+ * @param offset Set to the record's offset in it.
+ * @return A descriptor of the segment, to give back with segment_release(); -1 if
+ * the log is full or failed, or on error.
+ */
+static int reserve(RecordHeader *header, const char *user, const char *body, uint32_t checksum, uint32_t *segment,
+                   uint64_t *offset)
+{
+    struct timespec ts;
+    uint64_t size = sizeof(RecordHeader) + header->user_len + header->body_len;
+    struct iovec iov[3] = {{header, sizeof(RecordHeader)}, {(void *)user, header->user_len}, {(void *)body, header->body_len}};
+    int iov_count = body != NULL ? 3 : 2;
+    ssize_t length = body != NULL ? (ssize_t)size : (ssize_t)(sizeof(RecordHeader) + header->user_len);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    pthread_mutex_lock(&state->mutex);
+    if (state->reserved == MAX_RECORDS || state->failed)
+    {
+        pthread_mutex_unlock(&state->mutex);
+        return -1;
+    }
+    // timestamps are unique and increasing, so readers can resume after one
+    header->timestamp = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    if (header->timestamp <= state->last_timestamp)
+        header->timestamp = state->last_timestamp + 1;
+    header->flags = body != NULL ? 0 : RECORD_INCOMPLETE;
+    header->checksum = body != NULL ? checksum_end(checksum, header) : 0;
+    header->padding = 0;
+    *segment = state->segment;
+    *offset = state->offset;
+    if (*offset > 0 && *offset + size > SEGMENT_SIZE)
+    {
+        (*segment)++;
+        *offset = 0;
+    }
+
+    int fd = segment_acquire(*segment);
+    if (fd >= 0 && pwritev(fd, iov, iov_count, *offset) != length)
+    {
+        perror("pwritev() error");
+        segment_release(*segment);
+        fd = -1;
+    }
+    if (fd >= 0) // nothing is reserved when the record could not be written
+    {
+        state->reserved++;
+        state->last_timestamp = header->timestamp;
+        state->segment = *segment;
+        state->offset = *offset + size;
+    }
+    pthread_mutex_unlock(&state->mutex);
+    return fd;
+}
+
+/**
+ * @brief Hands out the ticket of a written record and adds it to the poster's index,
+ * under the lock so each account's tickets are indexed in order.
+ */
+static uint64_t take_ticket(uint32_t segment, uint64_t offset, int account)
+{
+    pthread_mutex_lock(&state->mutex);
+    uint64_t ticket = ++state->requested;
+    locations[ticket] = (uint64_t)segment << 32 | offset;
+    index_add(account, ticket);
+    if (segment < state->oldest_dirty)
+        state->oldest_dirty = segment; // written after a sync of its segment had started
+    if (!group_commit_enabled && ticket > state->durable)
+        __atomic_store_n(&state->durable, ticket, __ATOMIC_RELEASE); // synced above; tickets of unsynced records are not taken yet
+    pthread_cond_signal(&state->appended);
+    pthread_mutex_unlock(&state->mutex);
+    return ticket;
+}
+
+/**
+ * @brief Appends a message to the log. The record is written but not yet durable.
+ * @param account The poster's index in accounts[].
+ * @param user The poster's username.
+ * @param user_len Length of the username.
+ * @param body The message.
+ * @param body_len Length of the message.
+ * @return The record's ticket, to pass to log_wait(), 0 on error.
+ */
+uint64_t log_append(int account, const char *user, size_t user_len, const char *body, size_t body_len)
+{
+    RecordHeader header;
+    uint32_t segment;
+    uint64_t offset;
+
+    if (user_len == 0 || user_len > UINT16_MAX || body_len > UINT32_MAX)
+        return 0;
+    header.body_len = body_len;
+    header.user_len = user_len;
+    int fd = reserve(&header, user, body, crc32c(crc32c(0, user, user_len), body, body_len), &segment, &offset);
+    if (fd < 0)
+        return 0;
+    bool written = group_commit_enabled || fdatasync(fd) == 0;
+    if (!written)
+    {
+        perror("fdatasync() error");
+        pthread_mutex_lock(&state->mutex);
+        fail_log();
+        pthread_mutex_unlock(&state->mutex);
+    }
+    segment_release(segment);
+    return written ? take_ticket(segment, offset, account) : 0;
+}
+
+/**
+ * @brief Starts a record whose body is written as it arrives, with log_write().
+ * @param stream Filled in for the following calls.
+ * @param account The poster's index in accounts[].
+ * @param user The poster's username.
+ * @param user_len Length of the username.
+ * @param body_len Length the body will have.
+ * @return 0 on success, -1 on error.
+ */
+int log_begin(LogStream *stream, int account, const char *user, size_t user_len, uint64_t body_len)
+{
+    if (user_len == 0 || user_len > UINT16_MAX || body_len > UINT32_MAX)
+        return -1;
+    stream->header.body_len = body_len;
+    stream->header.user_len = user_len;
+    stream->written = 0;
+    stream->synced = 0;
+    stream->account = account;
+    stream->checksum = crc32c(0, user, user_len);
+    stream->fd = reserve(&stream->header, user, NULL, 0, &stream->segment, &stream->offset);
+    return stream->fd < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Writes the next bytes of a streamed body. Writeback of what is written is
+ * started every STREAM_WRITEBACK bytes, so the final sync has little left to do.
+ * @return 0 on success, -1 on error.
+ */
+int log_write(LogStream *stream, const char *data, size_t len)
+{
+    uint64_t body_start = stream->offset + sizeof(RecordHeader) + stream->header.user_len;
+
+    if (stream->written + len > stream->header.body_len)
+        return -1;
+    stream->checksum = crc32c(stream->checksum, data, len);
+    while (len > 0)
+    {
+        ssize_t bytes = pwrite(stream->fd, data, len, body_start + stream->written);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("pwrite() error");
+            return -1;
+        }
+        data += bytes;
+        len -= bytes;
+        stream->written += bytes;
+    }
+    if (stream->written - stream->synced >= STREAM_WRITEBACK)
+    {
+        sync_file_range(stream->fd, body_start + stream->synced, stream->written - stream->synced, SYNC_FILE_RANGE_WRITE);
+        stream->synced = stream->written;
+    }
+    return 0;
+}
+
+/**
+ * @brief Completes a streamed record once its whole body is written. Like
+ * log_append(), the record is written but not yet durable.
+ * @return The record's ticket, to pass to log_wait(), 0 on error.
+ */
+uint64_t log_finish(LogStream *stream)
+{
+    bool written = stream->written == stream->header.body_len;
+
+    stream->header.flags = 0;
+    stream->header.checksum = checksum_end(stream->checksum, &stream->header);
+    if (written && pwrite(stream->fd, &stream->header, sizeof(RecordHeader), stream->offset) != sizeof(RecordHeader))
+    {
+        perror("pwrite() error");
+        written = false;
+    }
+    if (written && !group_commit_enabled && fdatasync(stream->fd) < 0)
+    {
+        perror("fdatasync() error");
+        pthread_mutex_lock(&state->mutex);
+        fail_log();
+        pthread_mutex_unlock(&state->mutex);
+        written = false;
+    }
+    segment_release(stream->segment);
+    stream->fd = -1;
+    return written ? take_ticket(stream->segment, stream->offset, stream->account) : 0;
+}
+
+/**
+ * @brief Gives up a streamed record. It stays flagged incomplete and is skipped.
+ */
+void log_abort(LogStream *stream)
+{
+    if (stream->fd >= 0)
+        segment_release(stream->segment);
+    stream->fd = -1;
+}
+
+/**
+ * @brief Blocks until a record is durable, syncing as the leader when no other
+ * poster is already doing it.
+ * @param ticket The ticket from log_append().
+ * @return 0 once the record is durable, -1 if a sync failed before it was.
+ */
+int log_wait(uint64_t ticket)
+{
+    pthread_mutex_lock(&state->mutex);
+    while (state->durable < ticket && !state->failed)
+    {
+        if (state->syncing)
+            pthread_cond_wait(&state->synced, &state->mutex);
+        else
+            sync_as_leader();
+    }
+    int ret = state->durable < ticket ? -1 : 0;
+    pthread_mutex_unlock(&state->mutex);
+    return ret;
+}
+
+/**
+ * @brief Returns the last durable ticket.
+ */
+uint64_t log_durable()
+{
+    return __atomic_load_n(&state->durable, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Whether a record will never be durable, for the engines that do not wait
+ * in log_wait(): a sync failed before it was synced.
+ * @param ticket The ticket from log_append().
+ */
+bool log_failed(uint64_t ticket)
+{
+    return __atomic_load_n(&state->failed, __ATOMIC_ACQUIRE) && ticket > log_durable();
+}
+
+/**
+ * @brief Returns a durable record.
+ * @param ticket Its ticket, from 1 to log_durable().
+ * @return The record, which stays mapped while the process runs; NULL on error.
+ */
+const RecordHeader *log_record(uint64_t ticket)
+{
+    if (ticket == 0 || ticket > log_durable())
+        return NULL;
+    uint64_t location = locations[ticket];
+    uint64_t offset = location & 0xffffffff;
+    const char *map = segment_map(location >> 32, offset + sizeof(RecordHeader));
+    if (map == NULL)
+        return NULL;
+    const RecordHeader *header = (const RecordHeader *)(map + offset);
+    uint64_t end = offset + sizeof(RecordHeader) + header->user_len + header->body_len;
+    if (end > SEGMENT_SIZE) // a record larger than a segment
+    {
+        map = segment_map(location >> 32, end);
+        header = map != NULL ? (const RecordHeader *)(map + offset) : NULL;
+    }
+    return header;
+}
+
+/**
+ * @brief Syncing thread of the event engines: syncs whenever records are waiting,
+ * then wakes the engine's loop through its eventfd. It stops syncing once a sync
+ * failed; the waiting clients are then answered 500.
+ */
+static void *flusher(void *arg)
+{
+    pthread_mutex_lock(&state->mutex);
+    while (1)
+    {
+        if (state->durable < state->requested && !state->syncing && !state->failed)
+        {
+            sync_as_leader();
+            uint64_t one = 1;
+            if (write(notify, &one, sizeof(one)) < 0 && errno != EAGAIN)
+                perror("write() error");
+            continue;
+        }
+        pthread_cond_wait(&state->appended, &state->mutex);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts syncing in the background, for engines whose thread must not block
+ * in log_wait(). The eventfd is written after each sync; the engine then picks up
+ * the clients whose records are durable.
+ * @param notify_fd An eventfd.
+ * @return 0 on success, -1 on error.
+ */
+int log_start_flusher(int notify_fd)
+{
+    pthread_t tid;
+
+    notify = notify_fd;
+    if (!group_commit_enabled)
+        return 0; // every append is synced before it returns
+    if (pthread_create(&tid, NULL, flusher, NULL) != 0)
+    {
+        perror("pthread_create() error");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
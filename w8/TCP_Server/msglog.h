@@ -0,0 +1,54 @@
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEGMENT_SIZE (64L * 1024 * 1024) /* a segment is closed once the next record does not fit */
+#define MAX_RECORDS (1L << 27) /* the location table is reserved up front, 8 bytes a record */
+
+/* A record is a RecordHeader, the poster's username, then the message.
+ * RECORD_USER() and RECORD_BODY() point at them. */
+typedef struct
+{
+    uint32_t body_len;
+    uint16_t user_len; // 0 marks the end of the valid records of a segment
+    uint16_t flags;    // RECORD_INCOMPLETE until the whole record is written
+    int64_t timestamp; // ns since the epoch
+    uint32_t checksum; // CRC32C of the username, the body, then the fields above with flags 0
+    uint32_t padding;  // 0
+} RecordHeader;
+
+#define RECORD_INCOMPLETE 1
+
+/* A record being streamed, from log_begin() to log_finish() or log_abort(). */
+typedef struct
+{
+    RecordHeader header;
+    uint32_t segment;
+    uint64_t offset;   // of the record
+    uint64_t written;  // body bytes written
+    uint64_t synced;   // body bytes whose writeback was started
+    uint32_t checksum; // of the username and the body written so far
+    int account;       // the poster's index in accounts[], for the per-user index
+    int fd;
+} LogStream;
+
+#define RECORD_USER(header) ((const char *)((header) + 1))
+#define RECORD_BODY(header) (RECORD_USER(header) + (header)->user_len)
+
+int log_open(const char *dir, bool group_commit);
+bool log_enabled();
+uint64_t log_append(int account, const char *user, size_t user_len, const char *body, size_t body_len);
+int log_begin(LogStream *stream, int account, const char *user, size_t user_len, uint64_t body_len);
+int log_write(LogStream *stream, const char *data, size_t len);
+uint64_t log_finish(LogStream *stream);
+void log_abort(LogStream *stream);
+int log_wait(uint64_t ticket);
+bool log_failed(uint64_t ticket);
+uint64_t log_durable();
+const RecordHeader *log_record(uint64_t ticket);
+int log_start_flusher(int notify_fd);
+
+#endif // MSGLOG_H
@@ -0,0 +1,1041 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "protocol.h"
+#include "account.h"
+#include "bufpool.h"
+#include "tokenizer.h"
+#include "command.h"
+#include "msglog.h"
+#include "msgindex.h"
+#include "timerwheel.h"
+
+#define CONNECTED_MSG "100\r\n"
+#define ACTIVE_ACCOUNT_MSG "110\r\n"
+#define BANNED_ACCOUNT_MSG "211\r\n"
+#define UNKNOWN_ACCOUNT_MSG "212\r\n"
+#define ALREADY_LOGGED_IN_MSG "213\r\n"
+#define LOGGED_IN_ELSEWHERE_MSG "214\r\n"
+#define LOGOUT_SUCCESS_MSG "130\r\n"
+#define NOT_LOGGED_IN_MSG "221\r\n"
+#define POST_SUCCESS_MSG "120\r\n"
+#define POST_HASH_FMT "120 %016llx\r\n"
+#define READ_SUCCESS_FMT "140 %d\r\n"
+#define READ_MESSAGE_FMT "%lld %u\r\n"
+#define SUB_SUCCESS_MSG "150\r\n"
+#define UNSUB_SUCCESS_MSG "151\r\n"
+#define BROADCAST_FMT "170 %.*s %zu\r\n"
+#define DROPPED_FMT "171 %zu\r\n"
+#define UNKNOWN_REQUEST_MSG "300\r\n"
+#define TOO_LONG_MSG "301\r\n"
+#define TOO_SLOW_MSG "302\r\n"
+#define TIMEOUT_MSG "303\r\n"
+#define STORE_ERROR_MSG "500\r\n"
+
+#define OUT_MIN_SIZE 64
+#define MIN_CHUNKS 8
+#define READ_LIMIT 100 /* messages per READ reply; the client asks again after the last one */
+#define SUB_BACKLOG_LIMIT (256 * 1024) /* unsent bytes past which a subscriber misses broadcasts */
+#define MAX_POST_LENGTH (1024L * 1024 * 1024) /* longest streamed body */
+#define IDLE_TIMEOUT_MS (300 * 1000) /* default time a logged-in client may stay silent */
+#define LOGIN_TIMEOUT_MS (30 * 1000) /* from connecting to logging in */
+#define REQUEST_TIMEOUT_MS (10 * 1000) /* from the first byte of a request to its end */
+#define MIN_RECEIVE_RATE 1 /* bytes per ms a streamed body must average past REQUEST_TIMEOUT_MS */
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+bool verbose = false; // log every request and reply, off while benchmarking
+static int64_t idle_timeout = IDLE_TIMEOUT_MS; // 0 when clients never time out
+
+/* With deferred commits a stored POST does not block: the client joins a queue in
+ * ticket order and the engine calls client_next_committed() once a sync is done. */
+static bool defer_commits = false;
+static Client *waiting_head = NULL;
+static Client *waiting_tail = NULL;
+
+/* A POST is encoded once into a SharedBuf and every subscriber queues a reference
+ * to it. Only the single-threaded engines enable SUB, so the count needs no atomics. */
+typedef struct SharedBuf
+{
+    int refs;
+    size_t len;
+    char data[];
+} SharedBuf;
+
+static Client **subscribers = NULL;
+static int subscriber_count = 0;
+static int subscriber_cap = 0;
+static Client *woken_head = NULL; // subscribers given output while another client was served
+
+/**
+ * @brief Appends a chunk to the output queue.
+ * @return 0 on success, -1 if memory is exhausted.
+ */
+static int push_chunk(Client *client, const char *data, size_t offset, size_t len)
+{
+    if (client->chunk_count == client->chunk_cap)
+    {
+        size_t cap = client->chunk_cap ? client->chunk_cap * 2 : MIN_CHUNKS;
+        OutChunk *bigger = realloc(client->chunks, cap * sizeof(OutChunk));
+        if (bigger == NULL)
+        {
+            perror("realloc() error");
+            return -1;
+        }
+        client->chunks = bigger;
+        client->chunk_cap = cap;
+    }
+    client->chunks[client->chunk_count].data = data;
+    client->chunks[client->chunk_count].offset = offset;
+    client->chunks[client->chunk_count].len = len;
+    client->chunks[client->chunk_count].shared = NULL;
+    client->chunk_count++;
+    client->out_pending += len;
+    return 0;
+}
+
+/**
+ * @brief Queues bytes that stay valid until they are sent, without copying them.
+ */
+static void queue_external(Client *client, const char *data, size_t len)
+{
+    if (len > 0)
+        push_chunk(client, data, 0, len);
+}
+
+/**
+ * @brief Drops a reference to a shared buffer, freeing it with the last one.
+ */
+static void shared_put(SharedBuf *buf)
+{
+    if (--buf->refs == 0)
+        free(buf);
+}
+
+/**
+ * @brief Queues a reference to a shared buffer.
+ */
+static void queue_shared(Client *client, SharedBuf *buf)
+{
+    if (push_chunk(client, buf->data, 0, buf->len) == 0)
+    {
+        client->chunks[client->chunk_count - 1].shared = buf;
+        buf->refs++;
+    }
+}
+
+/**
+ * @brief Copies reply bytes to a buffer of their own and queues it, for when the
+ * out buffer is full but pinned by a send in flight.
+ */
+static void queue_copy(Client *client, const char *msg, size_t len)
+{
+    SharedBuf *buf = malloc(sizeof(SharedBuf) + len);
+    if (buf == NULL)
+    {
+        perror("malloc() error");
+        return;
+    }
+    buf->refs = 1;
+    buf->len = len;
+    memcpy(buf->data, msg, len);
+    queue_shared(client, buf);
+    shared_put(buf);
+}
+
+/**
+ * @brief Copies reply bytes to the out buffer and queues them, extending the last
+ * chunk when it ends where they start.
+ */
+static void queue_bytes(Client *client, const char *msg, size_t len)
+{
+    if (client->out_len + len > client->out_cap)
+    {
+        if (client->out_pinned)
+        {
+            queue_copy(client, msg, len);
+            return;
+        }
+        size_t cap = client->out_cap ? client->out_cap : OUT_MIN_SIZE;
+        while (cap < client->out_len + len)
+            cap *= 2;
+        char *bigger = realloc(client->out, cap);
+        if (bigger == NULL)
+        {
+            perror("realloc() error");
+            return;
+        }
+        client->out = bigger;
+        client->out_cap = cap;
+    }
+    memcpy(client->out + client->out_len, msg, len);
+
+    OutChunk *last = client->chunk_count > 0 ? &client->chunks[client->chunk_count - 1] : NULL;
+    if (last != NULL && last->data == NULL && last->offset + last->len == client->out_len)
+    {
+        last->len += len;
+        client->out_pending += len;
+    }
+    else if (push_chunk(client, NULL, client->out_len, len) < 0)
+    {
+        return;
+    }
+    client->out_len += len;
+}
+
+/**
+ * @brief Queues a reply behind those not yet sent.
+ * @param client The client.
+ * @param msg The reply.
+ */
+static void queue_reply(Client *client, const char *msg)
+{
+    queue_bytes(client, msg, strlen(msg));
+    if (verbose)
+        printf("=> Sent to client %s:%d: %s", inet_ntoa(client->peer.sin_addr), ntohs(client->peer.sin_port), msg);
+}
+
+/**
+ * @brief USER <username>: logs the client in.
+ */
+static void handle_user(Client *client, const Command *cmd)
+{
+    if (client->is_logged_in)
+    {
+        queue_reply(client, ALREADY_LOGGED_IN_MSG);
+        return;
+    }
+
+    switch (authorize_user(cmd->argument.ptr, cmd->argument.len, &client->account_index))
+    {
+    case 1:
+        queue_reply(client, ACTIVE_ACCOUNT_MSG);
+        client->is_logged_in = true;
+        break;
+    case 0:
+        queue_reply(client, UNKNOWN_ACCOUNT_MSG);
+        break;
+    case -1:
+        queue_reply(client, BANNED_ACCOUNT_MSG);
+        break;
+    case -2:
+        queue_reply(client, LOGGED_IN_ELSEWHERE_MSG);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Puts a subscriber in the queue of clients the engine must send to.
+ */
+static void wake(Client *client)
+{
+    if (client->woken)
+        return;
+    client->woken = true;
+    client->wake_prev = NULL;
+    client->wake_next = woken_head;
+    if (woken_head != NULL)
+        woken_head->wake_prev = client;
+    woken_head = client;
+}
+
+/**
+ * @brief Takes a client out of the queue of woken clients.
+ */
+static void unlink_woken(Client *client)
+{
+    if (client->wake_prev != NULL)
+        client->wake_prev->wake_next = client->wake_next;
+    else
+        woken_head = client->wake_next;
+    if (client->wake_next != NULL)
+        client->wake_next->wake_prev = client->wake_prev;
+    client->woken = false;
+}
+
+/**
+ * @brief Encodes the broadcast of a POST: "170 <user> <length>" and the message on
+ * its own line.
+ * @return The buffer with one reference, NULL if nobody is subscribed or memory is
+ * exhausted.
+ */
+static SharedBuf *encode_broadcast(const Client *client, const Command *cmd)
+{
+    const Account *account = &accounts[client->account_index];
+    char header[MAX_USERNAME_LENGTH + 32];
+
+    if (subscriber_count == 0)
+        return NULL;
+    int len = snprintf(header, sizeof(header), BROADCAST_FMT, (int)account->length, account->username, cmd->argument.len);
+    SharedBuf *buf = malloc(sizeof(SharedBuf) + len + cmd->argument.len + 2);
+    if (buf == NULL)
+    {
+        perror("malloc() error");
+        return NULL;
+    }
+    buf->refs = 1;
+    buf->len = len + cmd->argument.len + 2;
+    memcpy(buf->data, header, len);
+    memcpy(buf->data + len, cmd->argument.ptr, cmd->argument.len);
+    memcpy(buf->data + len + cmd->argument.len, "\r\n", 2);
+    return buf;
+}
+
+/**
+ * @brief Queues a broadcast to every subscriber but its poster, then drops the
+ * caller's reference. A subscriber whose unsent output is over SUB_BACKLOG_LIMIT
+ * misses it; once it catches up it is told how many it missed with a 171 reply.
+ */
+static void publish(const Client *poster, SharedBuf *buf)
+{
+    char line[32];
+
+    if (buf == NULL)
+        return;
+    for (int i = 0; i < subscriber_count; i++)
+    {
+        Client *sub = subscribers[i];
+        if (sub == poster)
+            continue;
+        if (client_pending(sub) >= SUB_BACKLOG_LIMIT)
+        {
+            sub->dropped++;
+            continue;
+        }
+        if (sub->dropped > 0)
+        {
+            snprintf(line, sizeof(line), DROPPED_FMT, sub->dropped);
+            queue_reply(sub, line);
+            sub->dropped = 0;
+        }
+        queue_shared(sub, buf);
+        wake(sub);
+    }
+    shared_put(buf);
+}
+
+/**
+ * @brief Takes a client out of the subscribers.
+ */
+static void unsubscribe(Client *client)
+{
+    if (client->sub_index < 0)
+        return;
+    Client *last = subscribers[--subscriber_count];
+    subscribers[client->sub_index] = last;
+    last->sub_index = client->sub_index;
+    client->sub_index = -1;
+    client->dropped = 0;
+}
+
+/**
+ * @brief Puts a client whose stored POST is not durable yet at the end of the
+ * queue of waiting clients.
+ */
+static void wait_for_commit(Client *client, uint64_t ticket)
+{
+    client->wait_ticket = ticket;
+    client->prev = waiting_tail;
+    client->next = NULL;
+    if (waiting_tail != NULL)
+        waiting_tail->next = client;
+    else
+        waiting_head = client;
+    waiting_tail = client;
+}
+
+/**
+ * @brief Parses a decimal argument.
+ * @return 0 on success, -1 if it is not a number or does not fit.
+ */
+static int parse_number(const Slice *arg, int64_t *value)
+{
+    *value = 0;
+    for (size_t i = 0; i < arg->len; i++)
+    {
+        if (arg->ptr[i] < '0' || arg->ptr[i] > '9' || *value > (INT64_MAX - 9) / 10)
+            return -1;
+        *value = *value * 10 + (arg->ptr[i] - '0');
+    }
+    return 0;
+}
+
+/**
+ * @brief Queues the reply to a streamed POST: 120 with the hash of its body, or the
+ * error met on the way.
+ */
+static void reply_streamed(Client *client)
+{
+    char line[32];
+
+    if (client->body_error != NULL)
+    {
+        queue_reply(client, client->body_error);
+        return;
+    }
+    snprintf(line, sizeof(line), POST_HASH_FMT, (unsigned long long)client->body_hash);
+    queue_reply(client, line);
+}
+
+/**
+ * @brief Ends a streamed body: completes its record and answers once it is durable.
+ */
+static void finish_body(Client *client)
+{
+    if (client->storing)
+    {
+        client->storing = false;
+        if (client->body_error != NULL)
+        {
+            log_abort(&client->stream);
+        }
+        else
+        {
+            uint64_t ticket = log_finish(&client->stream);
+            if (ticket == 0 || log_failed(ticket))
+            {
+                client->body_error = STORE_ERROR_MSG;
+            }
+            else if (defer_commits && log_durable() < ticket)
+            {
+                client->streamed = true;
+                wait_for_commit(client, ticket);
+                return;
+            }
+            else if (!defer_commits && log_wait(ticket) < 0)
+            {
+                client->body_error = STORE_ERROR_MSG;
+            }
+        }
+    }
+    reply_streamed(client);
+}
+
+/**
+ * @brief Starts receiving a streamed body. Its bytes are hashed and, when the store
+ * is on, written to a record as they arrive. A body from a client that is not
+ * logged in is still received and discarded, so the next request is found after
+ * it; one over MAX_POST_LENGTH gets the client disconnected.
+ */
+static void start_body(Client *client, int64_t len)
+{
+    if (len > MAX_POST_LENGTH)
+    {
+        client->hangup_msg = TOO_LONG_MSG;
+        return;
+    }
+    client->body_len = client->body_left = len;
+    client->body_hash = FNV_OFFSET;
+    client->body_error = NULL;
+    client->request_at = client->active_at;
+    if (!client->is_logged_in)
+    {
+        client->body_error = NOT_LOGGED_IN_MSG;
+    }
+    else if (log_enabled())
+    {
+        const Account *account = &accounts[client->account_index];
+        if (log_begin(&client->stream, client->account_index, account->username, account->length, len) < 0)
+            client->body_error = STORE_ERROR_MSG;
+        else
+            client->storing = true;
+    }
+    if (len == 0)
+        finish_body(client);
+}
+
+/**
+ * @brief Takes the next bytes of a streamed body, straight from the receive buffer.
+ */
+static void stream_body(Client *client, const char *data, size_t len)
+{
+    uint64_t hash = client->body_hash;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= FNV_PRIME;
+    }
+    client->body_hash = hash;
+    if (client->storing && client->body_error == NULL && log_write(&client->stream, data, len) < 0)
+        client->body_error = STORE_ERROR_MSG;
+    client->body_left -= len;
+    if (client->body_left == 0)
+        finish_body(client);
+}
+
+/**
+ * @brief POST <message>: posts a message. When the message store is on, 120 is only
+ * sent once the message is durable. Subscribers get it once it is accepted.
+ *
+ * POST {<length>}: the message is the next length bytes, which may hold anything
+ * and are never buffered whole. The reply is "120 <hash>", the FNV-1a hash of the
+ * bytes in hex; such messages are not sent to subscribers.
+ */
+static void handle_post(Client *client, const Command *cmd)
+{
+    const Slice *arg = &cmd->argument;
+
+    if (arg->len > 2 && arg->ptr[0] == '{' && arg->ptr[arg->len - 1] == '}')
+    {
+        Slice digits = {arg->ptr + 1, arg->len - 2};
+        int64_t len;
+        if (parse_number(&digits, &len) == 0)
+        {
+            start_body(client, len);
+            return;
+        }
+    }
+    if (!client->is_logged_in)
+    {
+        queue_reply(client, NOT_LOGGED_IN_MSG);
+        return;
+    }
+    if (!log_enabled())
+    {
+        queue_reply(client, POST_SUCCESS_MSG);
+        publish(client, encode_broadcast(client, cmd));
+        return;
+    }
+
+    const Account *account = &accounts[client->account_index];
+    uint64_t ticket = log_append(client->account_index, account->username, account->length, cmd->argument.ptr, cmd->argument.len);
+    if (ticket == 0 || log_failed(ticket))
+    {
+        queue_reply(client, STORE_ERROR_MSG);
+    }
+    else if (defer_commits && log_durable() < ticket)
+    {
+        client->unpublished = encode_broadcast(client, cmd);
+        wait_for_commit(client, ticket);
+    }
+    else if (defer_commits || log_wait(ticket) == 0)
+    {
+        queue_reply(client, POST_SUCCESS_MSG);
+        publish(client, encode_broadcast(client, cmd));
+    }
+    else
+    {
+        queue_reply(client, STORE_ERROR_MSG);
+    }
+}
+
+/**
+ * @brief Takes a client out of the queue of waiting clients.
+ */
+static void unlink_waiting(Client *client)
+{
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        waiting_head = client->next;
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+    else
+        waiting_tail = client->prev;
+    client->prev = client->next = NULL;
+    client->wait_ticket = 0;
+}
+
+/**
+ * @brief READ <user> [since]: sends the user's stored messages posted after since,
+ * a timestamp in ns, oldest first and at most READ_LIMIT of them. The reply is
+ * "140 <count>", then "<timestamp> <length>" and the message on its own line for
+ * each one; the messages are sent straight from the mapped log.
+ */
+static void handle_read(Client *client, const Command *cmd)
+{
+    const RecordHeader *records[READ_LIMIT];
+    Command args;
+    int64_t since;
+    char line[64];
+
+    if (!client->is_logged_in)
+    {
+        queue_reply(client, NOT_LOGGED_IN_MSG);
+        return;
+    }
+    split_command(cmd->argument.ptr, cmd->argument.len, &args);
+    if (args.verb.len == 0 || parse_number(&args.argument, &since) < 0)
+    {
+        queue_reply(client, UNKNOWN_REQUEST_MSG);
+        return;
+    }
+    int account = find_account(args.verb.ptr, args.verb.len);
+    if (account < 0)
+    {
+        queue_reply(client, UNKNOWN_ACCOUNT_MSG);
+        return;
+    }
+
+    int count = index_find(account, since, records, READ_LIMIT);
+    if (count < 0)
+    {
+        queue_reply(client, STORE_ERROR_MSG);
+        return;
+    }
+    snprintf(line, sizeof(line), READ_SUCCESS_FMT, count);
+    queue_reply(client, line);
+    for (int i = 0; i < count; i++)
+    {
+        int len = snprintf(line, sizeof(line), READ_MESSAGE_FMT, (long long)records[i]->timestamp, records[i]->body_len);
+        queue_bytes(client, line, len);
+        queue_external(client, RECORD_BODY(records[i]), records[i]->body_len);
+        queue_bytes(client, "\r\n", 2);
+    }
+}
+
+/**
+ * @brief BYE: logs the client out.
+ */
+static void handle_bye(Client *client, const Command *cmd)
+{
+    if (client->is_logged_in)
+    {
+        log_out(client->account_index);
+        unsubscribe(client);
+        client->is_logged_in = false;
+        client->account_index = -1;
+        client->logged_out_at = clock_ms();
+        queue_reply(client, LOGOUT_SUCCESS_MSG);
+    }
+    else
+    {
+        queue_reply(client, NOT_LOGGED_IN_MSG);
+    }
+}
+
+/**
+ * @brief SUB: receives every POST of the other clients until UNSUB or BYE.
+ */
+static void handle_sub(Client *client, const Command *cmd)
+{
+    if (!client->is_logged_in)
+    {
+        queue_reply(client, NOT_LOGGED_IN_MSG);
+        return;
+    }
+    if (client->sub_index < 0)
+    {
+        if (subscriber_count == subscriber_cap)
+        {
+            int cap = subscriber_cap ? subscriber_cap * 2 : 64;
+            Client **bigger = realloc(subscribers, cap * sizeof(Client *));
+            if (bigger == NULL)
+            {
+                perror("realloc() error");
+                queue_reply(client, STORE_ERROR_MSG);
+                return;
+            }
+            subscribers = bigger;
+            subscriber_cap = cap;
+        }
+        client->sub_index = subscriber_count;
+        subscribers[subscriber_count++] = client;
+    }
+    queue_reply(client, SUB_SUCCESS_MSG);
+}
+
+/**
+ * @brief UNSUB: stops receiving POSTs.
+ */
+static void handle_unsub(Client *client, const Command *cmd)
+{
+    if (!client->is_logged_in)
+    {
+        queue_reply(client, NOT_LOGGED_IN_MSG);
+        return;
+    }
+    unsubscribe(client);
+    queue_reply(client, UNSUB_SUCCESS_MSG);
+}
+
+/**
+ * @brief Handle client request based on the received message.
+ * @param client The client; its login state is updated.
+ * @param line One request line, without its CRLF; it points into the receive buffer.
+ * @param len Length of the line.
+ */
+static void handle_client_request(Client *client, const char *line, size_t len)
+{
+    Command cmd;
+
+    if (verbose)
+        printf("=> Received from client: %.*s\n", (int)len, line);
+
+    split_command(line, len, &cmd);
+    CommandHandler handler = find_command(&cmd.verb);
+    if (handler != NULL)
+        handler(client, &cmd);
+    else
+        queue_reply(client, UNKNOWN_REQUEST_MSG);
+}
+
+/**
+ * @brief Registers the commands of the login protocol, and READ with its index when the message
+ * store is on. Called after log_open().
+ * @return 0 on success, -1 on error.
+ */
+int protocol_init()
+{
+    if (register_command("USER", handle_user) < 0 ||
+        register_command("POST", handle_post) < 0 ||
+        register_command("BYE", handle_bye) < 0)
+        return -1;
+    if (log_enabled() && (index_open() < 0 || register_command("READ", handle_read) < 0))
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Sets up a new client and queues the greeting.
+ * @param client The client to fill in.
+ * @param fd The connected socket.
+ * @param peer The client's address.
+ * @return 0 on success, -1 if memory is exhausted.
+ */
+int client_init(Client *client, int fd, const struct sockaddr_in *peer)
+{
+    memset(client, 0, sizeof(Client));
+    client->fd = fd;
+    if (peer != NULL)
+        client->peer = *peer;
+    client->account_index = -1;
+    client->sub_index = -1;
+    client->logged_out_at = client->active_at = clock_ms();
+    if ((client->in = pool_get(POOL_MIN_SIZE, &client->in_cap)) == NULL)
+        return -1;
+    if (verbose)
+        printf("You got a connection from %s:%d\n", inet_ntoa(client->peer.sin_addr), ntohs(client->peer.sin_port));
+    queue_reply(client, CONNECTED_MSG);
+    return 0;
+}
+
+/**
+ * @brief Logs the client out, frees its buffers and closes its socket.
+ * @param client The client.
+ */
+void client_release(Client *client)
+{
+    if (verbose)
+        printf("Connection closed: %s:%d\n", inet_ntoa(client->peer.sin_addr), ntohs(client->peer.sin_port));
+    if (client->is_logged_in)
+        log_out(client->account_index);
+    if (client_waiting(client))
+        unlink_waiting(client);
+    if (client->unpublished != NULL)
+        shared_put(client->unpublished);
+    if (client->storing)
+        log_abort(&client->stream);
+    unsubscribe(client);
+    if (client->woken)
+        unlink_woken(client);
+    for (size_t i = client->chunk_sent; i < client->chunk_count; i++)
+    {
+        if (client->chunks[i].shared != NULL)
+            shared_put(client->chunks[i].shared);
+    }
+    if (client->in != NULL)
+        pool_put(client->in, client->in_cap);
+    free(client->out);
+    free(client->chunks);
+    close(client->fd);
+    client->in = NULL;
+    client->out = NULL;
+}
+
+/**
+ * @brief Returns where the engine should receive the client's next bytes. A line
+ * longer than POOL_MAX_SIZE is dropped and gets the client disconnected. A streamed
+ * body is received into a buffer of POOL_MAX_SIZE, whatever its length.
+ * @param client The client.
+ * @param space Set to the number of bytes that fit.
+ * @return The free end of the input buffer.
+ */
+char *client_recv_space(Client *client, size_t *space)
+{
+    if (client->body_left > 0 && client->in_len == 0 && client->in_cap < POOL_MAX_SIZE)
+    {
+        size_t cap;
+        char *big = pool_get(POOL_MAX_SIZE, &cap);
+        if (big != NULL)
+        {
+            pool_put(client->in, client->in_cap);
+            client->in = big;
+            client->in_cap = cap;
+        }
+    }
+    if (client->in_len == client->in_cap)
+    {
+        char *bigger = pool_grow(client->in, client->in_len, &client->in_cap);
+        if (bigger == NULL)
+        {
+            client->hangup_msg = TOO_LONG_MSG;
+            client->in_len = 0;
+            client->in_searched = 0;
+        }
+        else
+        {
+            client->in = bigger;
+        }
+    }
+    *space = client->in_cap - client->in_len;
+    return client->in + client->in_len;
+}
+
+/**
+ * @brief Handles the bytes an engine received into client_recv_space(): every
+ * complete line is answered, a partial line waits for the rest. Only the new bytes
+ * are searched for a CRLF, so a long line arriving in many pieces is not rescanned.
+ * The bytes of a streamed body are consumed as they come. Nothing more is handled
+ * once the client broke a limit.
+ * @param client The client.
+ * @param bytes Number of bytes received.
+ */
+void client_received(Client *client, size_t bytes)
+{
+    char *start = client->in;
+    const char *end;
+
+    if (bytes > 0)
+    {
+        client->active_at = clock_ms();
+        if (client->in_len == 0 && client->body_left == 0)
+            client->request_at = client->active_at;
+    }
+    client->in_len += bytes;
+    while (!client_waiting(client) && client->hangup_msg == NULL)
+    {
+        size_t avail = client->in_len - (start - client->in);
+        if (client->body_left > 0)
+        {
+            if (avail == 0)
+                break;
+            size_t len = avail < client->body_left ? avail : client->body_left;
+            stream_body(client, start, len);
+            start += len;
+            client->in_searched = 0;
+            continue;
+        }
+        if ((end = find_line_end(start, client->in_searched, avail)) == NULL)
+            break;
+        handle_client_request(client, start, end - start);
+        start = (char *)end + 2;
+        client->in_searched = 0;
+    }
+
+    if (client->hangup_msg != NULL)
+        start = client->in + client->in_len;
+    else if (start != client->in && client->body_left == 0)
+        client->request_at = client->active_at; // what is left began in the last bytes
+    client->in_len -= start - client->in;
+    if (!client_waiting(client))
+        client->in_searched = client->in_len;
+    if (start != client->in)
+        memmove(client->in, start, client->in_len);
+    if (client->in_len == 0 && client->in_cap > POOL_MIN_SIZE && client->body_left == 0)
+    {
+        size_t cap;
+        char *small = pool_get(POOL_MIN_SIZE, &cap); // a long line is over, go back to a small buffer
+        if (small != NULL)
+        {
+            pool_put(client->in, client->in_cap);
+            client->in = small;
+            client->in_cap = cap;
+        }
+    }
+}
+
+/**
+ * @brief Makes stored POSTs return at once instead of blocking until they are
+ * durable, for the engines serving every client from one thread. Such an engine
+ * runs log_start_flusher() and collects the clients with client_next_committed().
+ */
+void protocol_defer_commits()
+{
+    defer_commits = true;
+}
+
+/**
+ * @brief Answers the oldest waiting client if its POST is durable, or 500 if it
+ * never will be, and handles the requests it sent meanwhile.
+ * @return The client, whose replies the engine should send; NULL if none is ready.
+ */
+Client *client_next_committed()
+{
+    Client *client = waiting_head;
+
+    if (client == NULL || (client->wait_ticket > log_durable() && !log_failed(client->wait_ticket)))
+        return NULL;
+    bool failed = log_failed(client->wait_ticket);
+    unlink_waiting(client);
+    if (client->streamed)
+    {
+        if (failed)
+            client->body_error = STORE_ERROR_MSG;
+        reply_streamed(client);
+        client->streamed = false;
+    }
+    else if (failed)
+    {
+        queue_reply(client, STORE_ERROR_MSG);
+        if (client->unpublished != NULL)
+            shared_put(client->unpublished);
+        client->unpublished = NULL;
+    }
+    else
+    {
+        queue_reply(client, POST_SUCCESS_MSG);
+        publish(client, client->unpublished);
+        client->unpublished = NULL;
+    }
+    client_received(client, 0);
+    return client;
+}
+
+/**
+ * @brief Registers SUB and UNSUB, for the engines serving every client from one
+ * thread: a POST is queued straight to the other clients' output. Such an engine
+ * sends to the clients from client_next_woken() after serving others.
+ * @return 0 on success, -1 on error.
+ */
+int protocol_enable_pubsub()
+{
+    if (register_command("SUB", handle_sub) < 0 ||
+        register_command("UNSUB", handle_unsub) < 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Returns a client that was given output while others were served, such as
+ * a broadcast, so the engine sends it and updates what it watches.
+ * @return The client, NULL if there is none.
+ */
+Client *client_next_woken()
+{
+    Client *client = woken_head;
+
+    if (client != NULL)
+        unlink_woken(client);
+    return client;
+}
+
+/**
+ * @brief Describes the output not yet sent, for sendmsg().
+ * @param client The client.
+ * @param iov Filled with the unsent chunks, in order.
+ * @param max Size of iov.
+ * @return Number of entries filled in.
+ */
+int client_out_iov(const Client *client, struct iovec *iov, int max)
+{
+    int n = 0;
+
+    for (size_t i = client->chunk_sent; i < client->chunk_count && n < max; i++, n++)
+    {
+        const OutChunk *chunk = &client->chunks[i];
+        const char *data = chunk->data != NULL ? chunk->data : client->out + chunk->offset;
+        size_t skip = i == client->chunk_sent ? client->out_sent : 0;
+        iov[n].iov_base = (char *)data + skip;
+        iov[n].iov_len = chunk->len - skip;
+    }
+    return n;
+}
+
+/**
+ * @brief Records that an engine sent part of the queued output.
+ * @param client The client.
+ * @param bytes Number of bytes sent.
+ */
+void client_sent(Client *client, size_t bytes)
+{
+    client->out_pending -= bytes;
+    bytes += client->out_sent;
+    while (client->chunk_sent < client->chunk_count && bytes >= client->chunks[client->chunk_sent].len)
+    {
+        OutChunk *chunk = &client->chunks[client->chunk_sent];
+        bytes -= chunk->len;
+        if (chunk->shared != NULL)
+            shared_put(chunk->shared);
+        client->chunk_sent++;
+    }
+    client->out_sent = bytes;
+    if (client->out_pending == 0)
+    {
+        client->out_len = 0;
+        client->chunk_count = 0;
+        client->chunk_sent = 0;
+        client->out_sent = 0;
+    }
+}
+
+/**
+ * @brief Sets how long a logged-in client may stay silent before it is disconnected.
+ * The login and request deadlines are never longer.
+ * @param ms The timeout, 0 for clients to never time out.
+ */
+void protocol_set_idle_timeout(int64_t ms)
+{
+    idle_timeout = ms;
+}
+
+/**
+ * @brief When the client is to be disconnected unless it sends what is due:
+ * - a request, line or streamed body, within REQUEST_TIMEOUT_MS of its first byte;
+ *   a body may take longer as long as it averages MIN_RECEIVE_RATE, so one sent a
+ *   byte at a time is cut off as surely as a line;
+ * - its next request within the idle timeout of its last bytes;
+ * - USER within LOGIN_TIMEOUT_MS of connecting or logging out.
+ * Subscribers only listen, so they have no idle deadline, and a client waiting for
+ * a stored POST has none until it is answered. A client that broke a limit is due
+ * at once.
+ * @param client The client.
+ * @return The deadline in ms of clock_ms(), -1 if there is none.
+ */
+int64_t client_deadline(const Client *client)
+{
+    int64_t request_timeout = REQUEST_TIMEOUT_MS < idle_timeout ? REQUEST_TIMEOUT_MS : idle_timeout;
+    int64_t deadline = -1;
+
+    if (client->hangup_msg != NULL)
+        return 0;
+    if (idle_timeout == 0 || client_waiting(client))
+        return -1;
+    if (client->body_left > 0)
+        deadline = client->request_at + request_timeout + (client->body_len - client->body_left) / MIN_RECEIVE_RATE;
+    else if (client->in_len > 0)
+        deadline = client->request_at + request_timeout;
+    else if (client->sub_index < 0)
+        deadline = client->active_at + idle_timeout;
+    if (!client->is_logged_in)
+    {
+        int64_t login = client->logged_out_at + (LOGIN_TIMEOUT_MS < idle_timeout ? LOGIN_TIMEOUT_MS : idle_timeout);
+        if (deadline < 0 || login < deadline)
+            deadline = login;
+    }
+    return deadline;
+}
+
+/**
+ * @brief Queues the reply telling a client why it is disconnected, once its deadline
+ * passed: 301 for a line or body over the limits, 302 for a request received too
+ * slowly, 303 for an idle client. The engine then sends what it can without
+ * blocking and closes the connection.
+ * @param client The client.
+ */
+void client_expired(Client *client)
+{
+    if (client->hangup_msg != NULL)
+        queue_reply(client, client->hangup_msg);
+    else if (client->in_len > 0 || client->body_left > 0)
+        queue_reply(client, TOO_SLOW_MSG);
+    else
+        queue_reply(client, TIMEOUT_MSG);
+}
@@ -0,0 +1,107 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "msglog.h"
+
+/* The USER/POST/BYE protocol, shared by every engine. An engine reads into the
+ * client's input buffer, hands the bytes to client_received() and sends whatever
+ * replies it queued; the protocol code never touches the socket. */
+
+#define MAX_OUT_IOV 64 /* chunks handed to one sendmsg() */
+
+struct SharedBuf;
+
+/* A piece of queued output: reply bytes in the client's out buffer, or bytes that
+ * live elsewhere for as long as they are queued, such as stored messages and
+ * broadcasts shared by every subscriber. */
+typedef struct
+{
+    const char *data;        // NULL when the bytes are in out, at offset
+    size_t offset;
+    size_t len;
+    struct SharedBuf *shared; // reference released once sent, NULL if none
+} OutChunk;
+
+typedef struct Client
+{
+    int fd;                  // connected socket
+    struct sockaddr_in peer; // client's address
+    bool is_logged_in;
+    int account_index;       // logged-in account in accounts[], -1 otherwise
+    char *in;                // line buffer from the pool
+    size_t in_cap;
+    size_t in_len;           // bytes received but not yet handled
+    size_t in_searched;      // bytes of the pending line already searched for its CRLF
+    char *out;               // reply bytes, sent through the chunks
+    size_t out_cap;
+    size_t out_len;
+    bool out_pinned;         // an asynchronous send reads out, so it must not move
+    OutChunk *chunks;        // output in sending order
+    size_t chunk_cap;
+    size_t chunk_count;
+    size_t chunk_sent;       // chunks already sent
+    size_t out_sent;         // bytes of chunks[chunk_sent] already sent
+    size_t out_pending;      // bytes not yet sent
+    uint64_t wait_ticket;    // stored POST waiting to be durable, 0 if none
+    struct Client *prev;     // neighbours in the queue of waiting clients
+    struct Client *next;
+    struct SharedBuf *unpublished; // broadcast of the waiting POST, sent once durable
+    uint64_t body_len;       // length of the streamed POST body being received
+    uint64_t body_left;      // bytes of it still to be received
+    uint64_t body_hash;      // FNV-1a of the body bytes received so far
+    const char *body_error;  // reply replacing 120 once the body is over, NULL if none
+    bool storing;            // the body is written to stream
+    bool streamed;           // the waiting POST was streamed, so 120 carries its hash
+    LogStream stream;
+    int64_t logged_out_at;   // when the client connected or logged out, in ms of clock_ms()
+    int64_t active_at;       // when bytes were last received
+    int64_t request_at;      // when the first bytes of the pending request were received
+    const char *hangup_msg;  // reply to a broken limit, sent before disconnecting; NULL if none
+    int sub_index;           // position in the subscribers, -1 if not subscribed
+    size_t dropped;          // broadcasts skipped while the client was too slow
+    bool woken;              // in the queue of clients given output by others
+    struct Client *wake_prev;
+    struct Client *wake_next;
+} Client;
+
+extern bool verbose;
+
+int protocol_init();
+int client_init(Client *client, int fd, const struct sockaddr_in *peer);
+void client_release(Client *client);
+char *client_recv_space(Client *client, size_t *space);
+void client_received(Client *client, size_t bytes);
+int client_out_iov(const Client *client, struct iovec *iov, int max);
+void client_sent(Client *client, size_t bytes);
+void protocol_defer_commits();
+Client *client_next_committed();
+int protocol_enable_pubsub();
+Client *client_next_woken();
+void protocol_set_idle_timeout(int64_t ms);
+int64_t client_deadline(const Client *client);
+void client_expired(Client *client);
+
+/**
+ * @brief Number of reply bytes waiting to be sent.
+ */
+static inline size_t client_pending(const Client *client)
+{
+    return client->out_pending;
+}
+
+/**
+ * @brief Whether the client waits for a stored POST to become durable; its next
+ * requests are not handled until then.
+ */
+static inline bool client_waiting(const Client *client)
+{
+    return client->wait_ticket != 0;
+}
+
+#endif // PROTOCOL_H
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "account.h"
+#include "engine.h"
+#include "protocol.h"
+#include "msglog.h"
+
+#define BACKLOG 1024 /* load tests open connections in bursts */
+#define ACCOUNT_FILE "TCP_Server/account.txt"
+#define DEFAULT_ENGINE "epoll"
+#define DEFAULT_WORKERS 64
+#define DEFAULT_IDLE_TIMEOUT 300
+
+static const Engine engines[] = {
+    {"fork", run_fork, "one process per connection (w5)"},
+    {"prefork", run_prefork, "fixed set of processes, one connection each at a time"},
+    {"thread", run_thread, "one thread per connection (w6)"},
+    {"pool", run_pool, "fixed set of threads, one connection each at a time"},
+    {"select", run_select, "one thread, select() (w7)"},
+    {"epoll", run_epoll, "one thread, epoll"},
+    {"uring", run_uring, "one thread, io_uring"},
+};
+
+int listen_sock; /* file descriptor */
+char *port;
+struct sockaddr_in server_addr; /* server's address information */
+
+/**
+ * @brief Sets up the server socket to listen for incoming connections.
+ */
+void setup_socket()
+{
+    // Step 1: Construct a TCP socket to listen connection request
+    if ((listen_sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    {
+        perror("socket() error");
+        exit(EXIT_FAILURE);
+    }
+    int one = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)); // benchmarks restart the server often
+    // inherited by accepted sockets: replies are complete when sent, and a long one
+    // going out in several sendmsg() calls must not wait for the client's delayed ACK
+    setsockopt(listen_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Step 2: Bind address to socket
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(port));
+    server_addr.sin_addr.s_addr = htonl(INADDR_ANY); /* INADDR_ANY puts your IP address automatically */
+
+    if (bind(listen_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+    {
+        perror("bind() error");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Prints the command line usage and the available engines.
+ * @param prog Program name.
+ */
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-e engine] [-w workers] [-m dir [-n]] [-t seconds] [-v] <server_port>\n", prog);
+    fprintf(stderr, "  -e engine   concurrency model (default %s):\n", DEFAULT_ENGINE);
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+        fprintf(stderr, "      %-8s %s\n", engines[i].name, engines[i].description);
+    fprintf(stderr, "  -w workers  processes or threads of prefork and pool (default %d)\n", DEFAULT_WORKERS);
+    fprintf(stderr, "  -m dir      store POSTs in an append-only log in dir, answering once durable, and serve READ\n");
+    fprintf(stderr, "  -n          sync every stored POST on its own instead of group commits\n");
+    fprintf(stderr, "  -t seconds  disconnect logged-in clients silent for that long, 0 for never (default %d);\n", DEFAULT_IDLE_TIMEOUT);
+    fprintf(stderr, "              logging in gets at most 30 seconds and a request 10 from its first byte,\n");
+    fprintf(stderr, "              a long POST body more as long as it arrives at 1 KB/s\n");
+    fprintf(stderr, "  -v          log every request and reply\n");
+}
+
+/**
+ * @brief Main function to start the TCP server.
+ * @param argc Argument count.
+ * @param argv Argument vector.
+ * @return Exit status.
+ */
+int main(int argc, char *argv[])
+{
+    const char *engine_name = DEFAULT_ENGINE;
+    const Engine *engine = NULL;
+    int workers = DEFAULT_WORKERS;
+    const char *log_dir = NULL;
+    bool group_commit = true;
+    int idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:w:m:nt:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'e':
+            engine_name = optarg;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'm':
+            log_dir = optarg;
+            break;
+        case 'n':
+            group_commit = false;
+            break;
+        case 't':
+            idle_timeout = atoi(optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1 || workers <= 0 || idle_timeout < 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+        if (strcmp(engines[i].name, engine_name) == 0)
+            engine = &engines[i];
+    if (engine == NULL)
+    {
+        fprintf(stderr, "Unknown engine %s\n", engine_name);
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    port = argv[optind];
+    setup_socket();
+    if (load_accounts(ACCOUNT_FILE) < 0)
+        exit(EXIT_FAILURE);
+    if (log_dir != NULL && log_open(log_dir, group_commit) < 0)
+        exit(EXIT_FAILURE);
+    if (protocol_init() < 0)
+        exit(EXIT_FAILURE);
+    protocol_set_idle_timeout(idle_timeout * 1000LL);
+
+    // Step 3: Listen request from client
+    if (listen(listen_sock, BACKLOG) == -1)
+    {
+        perror("listen() error");
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGPIPE, SIG_IGN); // a client that leaves mid-reply is seen as a send() error
+
+    printf("Server started at port number %d with the %s engine!\n", atoi(port), engine->name);
+    fflush(stdout);
+
+    engine->run(listen_sock, workers);
+
+    close(listen_sock);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,206 @@
+#include <limits.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+#define EXPIRED (WHEEL_LEVELS * WHEEL_SLOTS) /* slot listing the expired timers */
+#define LATER (EXPIRED + 1)                   /* slot of the timers past the top level's turn */
+#define TURN_BITS(level) (WHEEL_BITS * ((level) + 1)) /* ticks in a turn of a level, as a power of 2 */
+#define TOP_BITS TURN_BITS(WHEEL_LEVELS - 1)
+
+/**
+ * @brief Sets up an empty wheel.
+ * @param wheel The wheel.
+ * @param now The current time, from clock_ms().
+ */
+void wheel_init(TimerWheel *wheel, int64_t now)
+{
+    memset(wheel, 0, sizeof(TimerWheel));
+    wheel->start = now;
+}
+
+/**
+ * @brief Tick at which a deadline is reached, rounded up so no timer fires early.
+ */
+static uint64_t to_tick(const TimerWheel *wheel, int64_t when)
+{
+    return when <= wheel->start ? 0 : (when - wheel->start + TICK_MS - 1) / TICK_MS;
+}
+
+/**
+ * @brief Adds a timer to the front of a slot's list.
+ */
+static void link_timer(TimerWheel *wheel, Timer *timer, int slot)
+{
+    timer->slot = slot;
+    timer->next = wheel->slots[slot];
+    if (timer->next != NULL)
+        timer->next->pprev = &timer->next;
+    wheel->slots[slot] = timer;
+    timer->pprev = &wheel->slots[slot];
+    if (slot < EXPIRED)
+        wheel->occupied[slot / WHEEL_SLOTS] |= 1ull << (slot % WHEEL_SLOTS);
+}
+
+/**
+ * @brief Puts an unlinked timer in the slot for its deadline: the lowest level whose
+ * current turn holds it, the expired list once it is due, or the later list when
+ * it is past the top level's turn; those are placed again when the next turn starts.
+ */
+static void place(TimerWheel *wheel, Timer *timer)
+{
+    uint64_t expires = to_tick(wheel, timer->when);
+    int level = 0;
+
+    if (expires <= wheel->now)
+    {
+        link_timer(wheel, timer, EXPIRED);
+        return;
+    }
+    if (expires >> TOP_BITS != wheel->now >> TOP_BITS)
+    {
+        link_timer(wheel, timer, LATER);
+        return;
+    }
+    while ((expires >> TURN_BITS(level)) != (wheel->now >> TURN_BITS(level)))
+        level++;
+    link_timer(wheel, timer, level * WHEEL_SLOTS + ((expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+}
+
+/**
+ * @brief Arms a timer, or moves it if it is already armed.
+ * @param wheel The wheel.
+ * @param timer The timer.
+ * @param when Its deadline, in ms of clock_ms().
+ */
+void timer_arm(TimerWheel *wheel, Timer *timer, int64_t when)
+{
+    timer_cancel(wheel, timer);
+    timer->when = when;
+    place(wheel, timer);
+}
+
+/**
+ * @brief Disarms a timer; nothing happens if it is not armed.
+ */
+void timer_cancel(TimerWheel *wheel, Timer *timer)
+{
+    if (timer->pprev == NULL)
+        return;
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    if (timer->slot < EXPIRED && wheel->slots[timer->slot] == NULL)
+        wheel->occupied[timer->slot / WHEEL_SLOTS] &= ~(1ull << (timer->slot % WHEEL_SLOTS));
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * @brief Next tick with work to do: the soonest non-empty slot of level 0, or of a
+ * higher level the tick its timers move down, or the start of the next turn.
+ * @return The tick, UINT64_MAX if no timer is armed.
+ */
+static uint64_t next_tick(const TimerWheel *wheel)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+    {
+        int shift = WHEEL_BITS * level;
+        unsigned index = (wheel->now >> shift) & (WHEEL_SLOTS - 1);
+        uint64_t later = index == WHEEL_SLOTS - 1 ? 0 : wheel->occupied[level] & (~0ull << (index + 1));
+        if (later != 0)
+        {
+            uint64_t tick = (wheel->now >> TURN_BITS(level) << TURN_BITS(level)) | (uint64_t)__builtin_ctzll(later) << shift;
+            if (tick < next)
+                next = tick;
+        }
+    }
+    if (wheel->slots[LATER] != NULL && next == UINT64_MAX)
+        next = ((wheel->now >> TOP_BITS) + 1) << TOP_BITS;
+    return next;
+}
+
+/**
+ * @brief Handles the tick just reached: the timers of the higher slots it starts
+ * move down, then those of its level-0 slot expire.
+ */
+static void run_tick(TimerWheel *wheel)
+{
+    if ((wheel->now & ((1ull << TOP_BITS) - 1)) == 0)
+    {
+        Timer *timer = wheel->slots[LATER];
+        wheel->slots[LATER] = NULL;
+        while (timer != NULL)
+        {
+            Timer *next = timer->next;
+            place(wheel, timer);
+            timer = next;
+        }
+    }
+    for (int level = WHEEL_LEVELS - 1; level >= 0; level--)
+    {
+        int shift = WHEEL_BITS * level;
+        if (level > 0 && (wheel->now & ((1ull << shift) - 1)) != 0)
+            continue;
+        int slot = level * WHEEL_SLOTS + ((wheel->now >> shift) & (WHEEL_SLOTS - 1));
+        Timer *timer = wheel->slots[slot];
+        wheel->slots[slot] = NULL;
+        wheel->occupied[level] &= ~(1ull << (slot % WHEEL_SLOTS));
+        while (timer != NULL)
+        {
+            Timer *next = timer->next;
+            if (level == 0)
+                link_timer(wheel, timer, EXPIRED);
+            else
+                place(wheel, timer);
+            timer = next;
+        }
+    }
+}
+
+/**
+ * @brief Milliseconds until the wheel has work, for a poll timeout. It may be a
+ * little early, when timers only move down a level.
+ * @return The timeout, -1 if no timer is armed.
+ */
+int wheel_timeout(const TimerWheel *wheel, int64_t now)
+{
+    if (wheel->slots[EXPIRED] != NULL)
+        return 0;
+    uint64_t tick = next_tick(wheel);
+    if (tick == UINT64_MAX)
+        return -1;
+    int64_t at = wheel->start + (int64_t)tick * TICK_MS;
+    return at <= now ? 0 : at - now > INT_MAX ? INT_MAX : (int)(at - now);
+}
+
+/**
+ * @brief Takes out the next timer whose deadline has passed. Empty stretches of
+ * time are skipped without visiting their ticks.
+ * @param wheel The wheel.
+ * @param now The current time, from clock_ms().
+ * @return The timer, now disarmed; NULL if none has expired.
+ */
+Timer *wheel_expire(TimerWheel *wheel, int64_t now)
+{
+    uint64_t target = now <= wheel->start ? 0 : (now - wheel->start) / TICK_MS;
+
+    while (wheel->slots[EXPIRED] == NULL && wheel->now < target)
+    {
+        uint64_t tick = next_tick(wheel);
+        if (tick > target)
+        {
+            wheel->now = target;
+            break;
+        }
+        wheel->now = tick;
+        run_tick(wheel);
+    }
+
+    Timer *timer = wheel->slots[EXPIRED];
+    if (timer != NULL)
+        timer_cancel(wheel, timer);
+    return timer;
+}
@@ -0,0 +1,60 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Connection deadlines in a hierarchical timing wheel: WHEEL_LEVELS wheels of
+ * WHEEL_SLOTS slots, a slot of one level spanning a whole turn of the level below.
+ * A timer sits in the lowest level whose current turn holds its deadline and moves
+ * down as the time comes near, so arming and cancelling are O(1) and timers that
+ * are not due cost nothing. */
+
+#define TICK_MS 10 /* resolution of the deadlines */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4 /* a turn of the top level is 2^24 ticks, 46 hours */
+
+typedef struct Timer
+{
+    struct Timer *next;
+    struct Timer **pprev; // link pointing at this timer, NULL when not armed
+    int64_t when;         // deadline, in ms of clock_ms()
+    int slot;             // list holding the timer
+} Timer;
+
+typedef struct
+{
+    Timer *slots[WHEEL_LEVELS * WHEEL_SLOTS + 2]; // then the expired timers and those of a later turn
+    uint64_t occupied[WHEEL_LEVELS];              // non-empty slots of each level
+    uint64_t now;                                 // ticks handled
+    int64_t start;                                // ms of tick 0
+} TimerWheel;
+
+/**
+ * @brief Monotonic time in ms. The coarse clock is read without a system call and
+ * its few ms of resolution are well below that of the deadlines.
+ */
+static inline int64_t clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Whether the timer waits in a wheel.
+ */
+static inline bool timer_armed(const Timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+void wheel_init(TimerWheel *wheel, int64_t now);
+void timer_arm(TimerWheel *wheel, Timer *timer, int64_t when);
+void timer_cancel(TimerWheel *wheel, Timer *timer);
+int wheel_timeout(const TimerWheel *wheel, int64_t now);
+Timer *wheel_expire(TimerWheel *wheel, int64_t now);
+
+#endif // TIMERWHEEL_H
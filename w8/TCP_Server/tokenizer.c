@@ -0,0 +1,74 @@
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "tokenizer.h"
+
+/**
+ * @brief Finds the next LF. Commands are short, so the first 16 bytes are compared
+ * at once with SSE2 inline; past them glibc's memchr(), itself vectorized with the
+ * widest instructions the CPU has, beats a hand-written loop.
+ * @param buf Bytes to search.
+ * @param len Number of bytes.
+ * @return The LF, NULL if there is none.
+ */
+static const char *find_lf(const char *buf, size_t len)
+{
+#if defined(__SSE2__)
+    if (len >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)buf);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+        if (mask != 0)
+            return buf + __builtin_ctz(mask);
+        return memchr(buf + 16, '\n', len - 16);
+    }
+#endif
+    return memchr(buf, '\n', len);
+}
+
+/**
+ * @brief Finds the end of a CRLF-terminated line, searching only the bytes not
+ * searched before. A LF not preceded by CR belongs to the line, as it does for the
+ * other servers.
+ * @param line Start of the line.
+ * @param searched Bytes of the line already searched without finding its end.
+ * @param len Bytes of the line received so far.
+ * @return The CR of the CRLF, NULL if the line has not ended yet.
+ */
+const char *find_line_end(const char *line, size_t searched, size_t len)
+{
+    const char *from = line + searched, *end = line + len, *lf;
+
+    while ((lf = find_lf(from, end - from)) != NULL)
+    {
+        if (lf > line && lf[-1] == '\r')
+            return lf - 1;
+        from = lf + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Splits a line into its verb and argument.
+ * @param line The line, without its CRLF.
+ * @param len Length of the line.
+ * @param cmd Set to slices of line.
+ */
+void split_command(const char *line, size_t len, Command *cmd)
+{
+    const char *space = memchr(line, ' ', len);
+    const char *end = line + len;
+
+    cmd->verb.ptr = line;
+    cmd->verb.len = space != NULL ? (size_t)(space - line) : len;
+
+    const char *arg = line + cmd->verb.len;
+    while (arg < end && *arg == ' ')
+        arg++;
+    while (end > arg && end[-1] == ' ')
+        end--;
+    cmd->argument.ptr = arg;
+    cmd->argument.len = end - arg;
+}
@@ -0,0 +1,24 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stddef.h>
+
+/* Line framing and command splitting without copies: a command's verb and argument
+ * point into the receive buffer and are not NUL-terminated. */
+
+typedef struct
+{
+    const char *ptr;
+    size_t len;
+} Slice;
+
+typedef struct
+{
+    Slice verb;     // up to the first space
+    Slice argument; // the rest, without the separating and trailing spaces
+} Command;
+
+const char *find_line_end(const char *line, size_t searched, size_t len);
+void split_command(const char *line, size_t len, Command *cmd);
+
+#endif // TOKENIZER_H